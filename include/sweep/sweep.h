@@ -31,6 +31,7 @@
 #include <sweep/sweep_sounddata.h>
 #include <sweep/sweep_selection.h>
 #include <sweep/sweep_filter.h>
+#include <sweep/sweep_fft.h>
 
 #endif  /* __SWEEP_H__ */
 
@@ -0,0 +1,85 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SWEEP_FFT_H__
+#define __SWEEP_FFT_H__
+
+#include <glib.h>
+
+/*
+ * Fast Fourier transforms over split (separate real and imaginary)
+ * float arrays, for any length: factors of 2, 3 and 5 take the fast
+ * kernels, other prime factors fall back to a direct one.
+ *
+ * Plans are built once per type and length, cached for the life of the
+ * program and never modified, so one plan may be used by any number of
+ * threads at once. Each concurrent caller needs its own work buffer of
+ * sw_fft_work_size () floats; pass NULL to have one allocated per call.
+ *
+ * Transforms are unnormalised: an inverse of a forward transform returns
+ * the input scaled by the length.
+ */
+
+typedef struct _sw_fft_plan sw_fft_plan;
+
+typedef enum {
+  SW_FFT_COMPLEX,
+  SW_FFT_REAL  /* length must be even */
+} sw_fft_type;
+
+#define SW_FFT_FORWARD (-1)
+#define SW_FFT_INVERSE (1)
+
+/*
+ * Return the shared plan for transforms of length n, or NULL if no such
+ * plan can be made.
+ */
+sw_fft_plan *
+sw_fft_plan_get (sw_fft_type type, gint n);
+
+gint
+sw_fft_length (sw_fft_plan * plan);
+
+gint
+sw_fft_work_size (sw_fft_plan * plan);
+
+/*
+ * Complex transform of length n, in the direction given by sign. The
+ * output may be the same arrays as the input.
+ */
+void
+sw_fft_complex (sw_fft_plan * plan, gint sign,
+		const gfloat * in_re, const gfloat * in_im,
+		gfloat * out_re, gfloat * out_im, gfloat * work);
+
+/*
+ * Real transform of length n, to and from the n/2+1 non-negative
+ * frequency bins.
+ */
+void
+sw_fft_real_forward (sw_fft_plan * plan, const gfloat * in,
+		     gfloat * out_re, gfloat * out_im, gfloat * work);
+
+void
+sw_fft_real_inverse (sw_fft_plan * plan,
+		     const gfloat * in_re, const gfloat * in_im,
+		     gfloat * out, gfloat * work);
+
+#endif /* __SWEEP_FFT_H__ */
@@ -34,5 +34,21 @@ sw_op_instance *
 perform_filter_op (sw_sample * sample, char * desc, SweepFilter func,
 		   sw_param_set pset, gpointer custom_data);
 
+/*
+ * As perform_filter_op (), calling destroy on custom_data once the
+ * operation is finished with it, whether or not it ever ran.
+ */
+sw_op_instance *
+perform_filter_op_full (sw_sample * sample, char * desc, SweepFilter func,
+			sw_param_set pset, gpointer custom_data,
+			SweepFunction destroy);
+
+/*
+ * Run processor over the selection of sample, as an undoable operation.
+ */
+sw_op_instance *
+perform_process_op (sw_sample * sample, char * desc,
+		    sw_processor * processor, sw_param_set pset,
+		    gpointer custom_data);
 
 #endif /* __SWEEP_FILTER_H__ */
@@ -33,6 +33,18 @@ sample_new_copy(sw_sample * s);
 void
 sample_destroy (sw_sample * s);
 
+/*
+ * Samples are reference counted. A new sample starts with one reference,
+ * which is normally handed to the sample bank; sample_bank_remove ()
+ * drops it. The sample is destroyed when the last reference goes, which
+ * must be on the main thread.
+ */
+sw_sample *
+sample_ref (sw_sample * s);
+
+void
+sample_unref (sw_sample * s);
+
 sw_sounddata *
 sample_get_sounddata (sw_sample * s);
 
@@ -60,6 +72,16 @@ sample_bank_remove (sw_sample * s);
 void
 sample_refresh_views (sw_sample * s);
 
+/*
+ * Any thread: frames [start, end) of s have been rewritten in place (end
+ * is G_MAXINT64 if the edit moved everything after start). Discards the
+ * staged playback frames and the spectrogram tiles over that range, so
+ * call it once the new data is in place.
+ */
+void
+sample_data_changed (sw_sample * s, sw_framecount_t start,
+		     sw_framecount_t end);
+
 void
 sample_start_marching_ants (sw_sample * s);
 
@@ -22,7 +22,8 @@
 #define __SWEEP_SOUNDDATA_H__
 
 sw_sounddata *
-sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length);
+sounddata_new_empty(gint nr_channels, gint sample_rate,
+		    sw_framecount_t sample_length);
 
 void
 sounddata_destroy (sw_sounddata * sounddata);
@@ -60,14 +61,15 @@ sounddata_set_selection_1 (sw_sounddata * sounddata,
 guint
 sounddata_selection_nr_regions (sw_sounddata * sounddata);
 
-gint
+sw_framecount_t
 sounddata_selection_nr_frames (sw_sounddata * sounddata);
 
-gint
+sw_framecount_t
 sounddata_selection_width (sw_sounddata * sounddata);
 
 void
-sounddata_selection_translate (sw_sounddata * sounddata, gint delta);
+sounddata_selection_translate (sw_sounddata * sounddata,
+			       sw_framecount_t delta);
 
 void
 sounddata_selection_scale (sw_sounddata * sounddata, gfloat scale);
@@ -25,13 +25,13 @@
  * Determine the number of samples occupied by a number of frames
  * in a given format.
  */
-glong
+gint64
 frames_to_samples (sw_format * format, sw_framecount_t nr_frames);
 
 /*
  * Determine the size in bytes of a number of frames of a given format.
  */
-glong
+gint64
 frames_to_bytes (sw_format * format, sw_framecount_t nr_frames);
 
 /*
@@ -45,7 +45,7 @@ typedef gfloat sw_time_t;
 
 /* Frame Counts */
 typedef int64_t sw_framecount_t;
-#define FRAMECOUNT_MAX INT_MAX
+#define FRAMECOUNT_MAX G_MAXINT64
 
 
 /*
@@ -164,6 +164,7 @@ typedef void (*SweepCallback) (sw_sample * sample, gpointer data);
 
 typedef struct _sw_operation sw_operation;
 typedef struct _sw_op_instance sw_op_instance;
+typedef struct _sw_op_stats sw_op_stats;
 
 struct _sw_operation {
   sw_edit_mode edit_mode;
@@ -175,6 +176,18 @@ struct _sw_operation {
   SweepFunction purge_redo;
 };
 
+/*
+ * Performance telemetry recorded by the host for each operation.
+ * nr_frames and undo_bytes are taken from the undo data the operation
+ * registers, so META operations (selection changes etc.) report zero.
+ */
+struct _sw_op_stats {
+  gint64 wall_usec; /* elapsed time */
+  gint64 cpu_usec; /* CPU time of the ops thread, -1 if unknown */
+  sw_framecount_t nr_frames; /* frames covered by the undo data */
+  gsize undo_bytes; /* bytes of undo/redo data retained */
+};
+
 struct _sw_op_instance {
   sw_sample * sample;
   char * description;
@@ -182,6 +195,7 @@ struct _sw_op_instance {
   gpointer do_data;
   gpointer undo_data;
   gpointer redo_data;
+  sw_op_stats stats;
 };
 
 /*
@@ -391,8 +405,54 @@ struct _sw_param_spec {
  */
 
 typedef struct _sw_procedure sw_procedure;
+typedef struct _sw_processor sw_processor;
 typedef struct _sw_plugin sw_plugin;
 
+/*
+ * sw_processor: block processing interface for procedures (plugin API v2).
+ *
+ * Rather than being handed a whole sample, a processor is driven by the
+ * host: the host takes care of selections, locking, cancellation, progress
+ * and undo, and may run the same processor for realtime preview.
+ *
+ * Audio is passed planar: channels[c] points to nr_frames floats of
+ * channel c. Every channel buffer is aligned to SW_PROCESS_ALIGN bytes,
+ * and nr_frames is never more than SW_PROCESS_BLOCK_FRAMES. Processing is
+ * in place.
+ */
+#define SW_PROCESS_BLOCK_FRAMES 1024
+#define SW_PROCESS_ALIGN 16
+
+struct _sw_processor {
+  /* init creates the processor state for a run over audio of the given
+   * format with parameters pset, or returns NULL on failure.
+   * pset is NULL if the procedure has no parameters.
+   */
+  gpointer (*init) (sw_format * format, sw_param_set pset,
+		    gpointer custom_data);
+
+  /* process processes one block of audio in place */
+  void (*process) (gpointer state, gfloat ** channels, gint nr_channels,
+		   gint nr_frames);
+
+  /* flush discards any history held in state, so that the next block
+   * processed is treated as the start of a new stream. The host calls
+   * this between discontiguous regions, and when seeking.
+   * May be NULL if the processor keeps no history.
+   */
+  void (*flush) (gpointer state);
+
+  /* latency returns the number of frames by which output lags input.
+   * The host feeds that many frames of silence after each region, and
+   * discards that many frames from the start of its output.
+   * May be NULL if the processor has no latency.
+   */
+  gint (*latency) (gpointer state);
+
+  /* cleanup frees state */
+  void (*cleanup) (gpointer state);
+};
+
 struct _sw_procedure {
   gchar * name;
   gchar * description;
@@ -430,6 +490,12 @@ struct _sw_procedure {
 
   /* custom data to pass to the suggest and apply functions */
   gpointer custom_data;
+
+  /* Procedures may give a processor instead of an apply function, which
+   * the host then runs over the selection itself.
+   * If apply is not NULL then this is not used.
+   */
+  sw_processor * processor;
 };
 
 struct _sw_plugin {
@@ -40,6 +40,9 @@ register_operation (sw_sample * s, sw_op_instance * inst);
 void
 trim_registered_ops (sw_sample * s, int length);
 
+gdouble
+op_stats_frames_per_second (sw_op_stats * stats);
+
 void
 undo_current (sw_sample * s);
 
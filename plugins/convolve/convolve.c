@@ -0,0 +1,758 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <gdk/gdkkeysyms.h>
+#include <sndfile.h>
+
+#include <sweep/sweep.h>
+
+#include "../src/sweep_app.h" /* XXX */
+#include "../src/scheduler.h"
+
+#define NR_PARAMS 3
+
+/* Longest impulse that will be loaded */
+#define CV_MAX_IMPULSE_SECONDS 60
+
+/*
+ * Partition size when applying to a selection. The work per frame goes
+ * as the impulse length over the partition size, so offline rendering
+ * uses long partitions; previews use SW_PROCESS_BLOCK_FRAMES to keep
+ * the latency down.
+ */
+#define CV_OFFLINE_PARTITION 8192
+
+#ifndef __GNUC__
+#error GCCisms used here. Please report this error to \
+sweep-devel@lists.sourceforge.net stating your versions of sweep \
+and your operating system and compiler.
+#endif
+
+
+static sw_param_range mix_range = {
+  SW_RANGE_ALL_VALID,
+  lower: {f: 0.0},
+  upper: {f: 1.0},
+  step: {f: 0.01}
+};
+
+static sw_param_spec param_specs[] = {
+  {
+    N_("Impulse"),
+    N_("Sound file holding the impulse response to convolve with"),
+    SWEEP_TYPE_STRING,
+    SW_PARAM_CONSTRAINED_NOT,
+    {NULL},
+    SW_PARAM_HINT_FILENAME
+  },
+  {
+    N_("Wet"),
+    N_("Gain of the convolved signal"),
+    SWEEP_TYPE_FLOAT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &mix_range},
+    SW_PARAM_HINT_DEFAULT
+  },
+  {
+    N_("Dry"),
+    N_("Gain of the original signal"),
+    SWEEP_TYPE_FLOAT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &mix_range},
+    SW_PARAM_HINT_DEFAULT
+  },
+};
+
+/* The impulse last applied, suggested next time */
+static gchar * last_impulse = NULL;
+
+static void
+convolve_suggest (sw_sample * sample, sw_param_set pset, gpointer custom_data)
+{
+  pset[0].s = last_impulse ? last_impulse : "";
+  pset[1].f = 1.0;
+  pset[2].f = 0.0;
+}
+
+/* y += x * h, over n complex bins */
+static void
+cv_cmac (gfloat * __restrict__ yr, gfloat * __restrict__ yi,
+	 const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	 const gfloat * __restrict__ hr, const gfloat * __restrict__ hi,
+	 gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    yr[i] += xr[i] * hr[i] - xi[i] * hi[i];
+    yi[i] += xr[i] * hi[i] + xi[i] * hr[i];
+  }
+}
+
+/*
+ * Uniformly partitioned convolution (overlap-save).
+ *
+ * The impulse is cut into partitions of B frames, each zero padded to
+ * 2B and transformed once. Input is taken B frames at a time: the last
+ * 2B frames of input are transformed into a frequency domain delay line
+ * holding one spectrum per partition, and the output spectrum is the
+ * sum of each delayed input spectrum times its impulse partition. The
+ * second half of its inverse transform is the next B frames of output,
+ * so output lags input by B frames.
+ */
+typedef struct {
+  gint nr_parts;
+  gfloat * re, * im; /* nr_parts spectra of nr_bins */
+} cv_impulse;
+
+typedef struct {
+  sw_fft_plan * fft; /* shared */
+  cv_impulse * ir;   /* shared */
+  gint size;         /* B */
+  gint nr_bins;
+  gfloat wet, dry;
+
+  gfloat * fdl_re, * fdl_im; /* nr_parts spectra of input */
+  gint fdl_head;
+  gfloat * acc_re, * acc_im;
+  gfloat * time;     /* last 2B frames of input */
+  gfloat * y;        /* 2B frames of inverse transform */
+  gfloat * work;     /* FFT scratch */
+  gfloat * out;      /* B frames of output waiting to go */
+  gint fill;         /* frames of the current partition taken in */
+} cv_channel;
+
+/*
+ * The transformed channels of an impulse file, for one rate and
+ * partition size. These are shared, and the last loaded is cached, so
+ * that changing the mix while previewing does not reload the file.
+ */
+typedef struct {
+  gint refcount;
+  gchar * path;
+  time_t mtime;
+  gint rate;
+  gint size;
+  gint nr_impulses;
+  cv_impulse ** impulses;
+} cv_impulses;
+
+typedef struct {
+  gint nr_channels;
+  gint size;
+  sw_fft_plan * fft;
+  cv_impulses * irs; /* shared */
+  cv_channel ** channels;
+} cv_state;
+
+static GMutex cv_cache_mutex;
+static cv_impulses * cv_cache = NULL;
+
+static cv_impulse *
+cv_impulse_new (sw_fft_plan * fft, gint size, const gfloat * data,
+		sw_framecount_t nr_frames)
+{
+  cv_impulse * ir;
+  gint nr_bins = size + 1, p, i;
+  sw_framecount_t offset, n;
+  gfloat * time, * work, scale;
+
+  ir = g_malloc (sizeof (cv_impulse));
+  ir->nr_parts = MAX (1, (nr_frames + size - 1) / size);
+  ir->re = g_malloc (ir->nr_parts * nr_bins * sizeof (gfloat));
+  ir->im = g_malloc (ir->nr_parts * nr_bins * sizeof (gfloat));
+
+  time = g_malloc0 (2 * size * sizeof (gfloat));
+  work = g_malloc (sw_fft_work_size (fft) * sizeof (gfloat));
+
+  /* The inverse transform is unnormalised, so fold its 1/2B in here */
+  scale = 1.0 / (2 * size);
+
+  for (p = 0; p < ir->nr_parts; p++) {
+    offset = (sw_framecount_t)p * size;
+    n = CLAMP (nr_frames - offset, 0, size);
+
+    memset (time, 0, 2 * size * sizeof (gfloat));
+    for (i = 0; i < n; i++)
+      time[i] = data[offset + i] * scale;
+
+    sw_fft_real_forward (fft, time, ir->re + p * nr_bins,
+			 ir->im + p * nr_bins, work);
+  }
+
+  g_free (work);
+  g_free (time);
+
+  return ir;
+}
+
+static void
+cv_impulse_free (cv_impulse * ir)
+{
+  g_free (ir->im);
+  g_free (ir->re);
+  g_free (ir);
+}
+
+static void
+cv_channel_reset (cv_channel * ch)
+{
+  gint len = ch->ir->nr_parts * ch->nr_bins;
+
+  memset (ch->fdl_re, 0, len * sizeof (gfloat));
+  memset (ch->fdl_im, 0, len * sizeof (gfloat));
+  memset (ch->time, 0, 2 * ch->size * sizeof (gfloat));
+  memset (ch->out, 0, ch->size * sizeof (gfloat));
+  ch->fdl_head = 0;
+  ch->fill = 0;
+}
+
+static cv_channel *
+cv_channel_new (sw_fft_plan * fft, cv_impulse * ir, gint size,
+		gfloat wet, gfloat dry)
+{
+  cv_channel * ch;
+  gint len;
+
+  ch = g_malloc0 (sizeof (cv_channel));
+  ch->fft = fft;
+  ch->ir = ir;
+  ch->size = size;
+  ch->nr_bins = size + 1;
+  ch->wet = wet;
+  ch->dry = dry;
+
+  len = ir->nr_parts * ch->nr_bins;
+  ch->fdl_re = g_malloc (len * sizeof (gfloat));
+  ch->fdl_im = g_malloc (len * sizeof (gfloat));
+  ch->acc_re = g_malloc (ch->nr_bins * sizeof (gfloat));
+  ch->acc_im = g_malloc (ch->nr_bins * sizeof (gfloat));
+  ch->time = g_malloc (2 * size * sizeof (gfloat));
+  ch->y = g_malloc (2 * size * sizeof (gfloat));
+  ch->work = g_malloc (sw_fft_work_size (fft) * sizeof (gfloat));
+  ch->out = g_malloc (size * sizeof (gfloat));
+
+  cv_channel_reset (ch);
+
+  return ch;
+}
+
+static void
+cv_channel_free (cv_channel * ch)
+{
+  g_free (ch->out);
+  g_free (ch->work);
+  g_free (ch->y);
+  g_free (ch->time);
+  g_free (ch->acc_im);
+  g_free (ch->acc_re);
+  g_free (ch->fdl_im);
+  g_free (ch->fdl_re);
+  g_free (ch);
+}
+
+/* Convolve the partition of input now complete in the second half of time */
+static void
+cv_channel_partition (cv_channel * ch)
+{
+  cv_impulse * ir = ch->ir;
+  gint size = ch->size, nr_bins = ch->nr_bins, nr_parts = ir->nr_parts;
+  gint p, slot, i;
+  gfloat * in = ch->time + size;
+
+  sw_fft_real_forward (ch->fft, ch->time,
+		       ch->fdl_re + ch->fdl_head * nr_bins,
+		       ch->fdl_im + ch->fdl_head * nr_bins, ch->work);
+
+  memset (ch->acc_re, 0, nr_bins * sizeof (gfloat));
+  memset (ch->acc_im, 0, nr_bins * sizeof (gfloat));
+
+  for (p = 0; p < nr_parts; p++) {
+    slot = (ch->fdl_head - p + nr_parts) % nr_parts;
+    cv_cmac (ch->acc_re, ch->acc_im,
+	     ch->fdl_re + slot * nr_bins, ch->fdl_im + slot * nr_bins,
+	     ir->re + p * nr_bins, ir->im + p * nr_bins, nr_bins);
+  }
+
+  sw_fft_real_inverse (ch->fft, ch->acc_re, ch->acc_im, ch->y, ch->work);
+
+  for (i = 0; i < size; i++) {
+    ch->out[i] = ch->wet * ch->y[size + i] + ch->dry * in[i];
+  }
+
+  /* This partition of input becomes the first half of the next */
+  memcpy (ch->time, in, size * sizeof (gfloat));
+
+  ch->fdl_head = (ch->fdl_head + 1) % nr_parts;
+}
+
+/* Stream n frames of buf through the convolver, in place */
+static void
+cv_channel_run (cv_channel * ch, gfloat * buf, sw_framecount_t n)
+{
+  gint size = ch->size;
+  sw_framecount_t m;
+
+  while (n > 0) {
+    m = MIN (n, size - ch->fill);
+
+    memcpy (ch->time + size + ch->fill, buf, m * sizeof (gfloat));
+    memcpy (buf, ch->out + ch->fill, m * sizeof (gfloat));
+
+    ch->fill += m;
+    buf += m;
+    n -= m;
+
+    if (ch->fill == size) {
+      cv_channel_partition (ch);
+      ch->fill = 0;
+    }
+  }
+}
+
+/*
+ * Load the channels of an impulse file, resampled to rate if need be.
+ * Returns NULL if it cannot be read.
+ */
+static gfloat **
+cv_load_impulse (const gchar * path, gint rate, gint * nr_channels,
+		 sw_framecount_t * nr_frames)
+{
+  SNDFILE * sndfile;
+  SF_INFO info;
+  sw_framecount_t n, len, i, j;
+  gfloat * buf, ** chans;
+  gdouble pos, frac;
+  gint c;
+
+  memset (&info, 0, sizeof (info));
+
+  if ((sndfile = sf_open (path, SFM_READ, &info)) == NULL) {
+    fprintf (stderr, "sweep: Convolve: %s: %s\n", path, sf_strerror (NULL));
+    return NULL;
+  }
+
+  n = MIN (info.frames, (sw_framecount_t)info.samplerate *
+	   CV_MAX_IMPULSE_SECONDS);
+
+  buf = g_malloc (n * info.channels * sizeof (gfloat));
+  n = sf_readf_float (sndfile, buf, n);
+  sf_close (sndfile);
+
+  if (n <= 0) {
+    g_free (buf);
+    return NULL;
+  }
+
+  len = (sw_framecount_t)((gdouble)n * rate / info.samplerate);
+  if (len < 1) len = 1;
+
+  chans = g_malloc (info.channels * sizeof (gfloat *));
+
+  for (c = 0; c < info.channels; c++) {
+    chans[c] = g_malloc (len * sizeof (gfloat));
+
+    for (i = 0; i < len; i++) {
+      if (info.samplerate == rate) {
+	chans[c][i] = buf[i * info.channels + c];
+      } else {
+	/* linear interpolation is plenty for a reverb tail */
+	pos = (gdouble)i * info.samplerate / rate;
+	j = (sw_framecount_t)pos;
+	frac = pos - j;
+	chans[c][i] = buf[j * info.channels + c] * (1.0 - frac);
+	if (j + 1 < n)
+	  chans[c][i] += buf[(j + 1) * info.channels + c] * frac;
+      }
+    }
+  }
+
+  g_free (buf);
+
+  *nr_channels = info.channels;
+  *nr_frames = len;
+
+  return chans;
+}
+
+static void
+cv_impulses_unref (cv_impulses * irs)
+{
+  gint i;
+
+  if (!g_atomic_int_dec_and_test (&irs->refcount)) return;
+
+  for (i = 0; i < irs->nr_impulses; i++) {
+    cv_impulse_free (irs->impulses[i]);
+  }
+
+  g_free (irs->impulses);
+  g_free (irs->path);
+  g_free (irs);
+}
+
+/*
+ * Return a reference to the impulses of path, transformed for partitions
+ * of size frames at rate, loading them unless they are those cached.
+ * Returns NULL if the file cannot be read.
+ */
+static cv_impulses *
+cv_impulses_get (const gchar * path, gint rate, gint size)
+{
+  cv_impulses * irs, * old;
+  struct stat st;
+  time_t mtime;
+  gfloat ** data;
+  sw_framecount_t nr_frames;
+  sw_fft_plan * fft;
+  gint i;
+
+  mtime = (stat (path, &st) == 0) ? st.st_mtime : 0;
+
+  g_mutex_lock (&cv_cache_mutex);
+  irs = cv_cache;
+  if (irs && irs->rate == rate && irs->size == size &&
+      irs->mtime == mtime && !strcmp (irs->path, path)) {
+    g_atomic_int_inc (&irs->refcount);
+    g_mutex_unlock (&cv_cache_mutex);
+    return irs;
+  }
+  g_mutex_unlock (&cv_cache_mutex);
+
+  data = cv_load_impulse (path, rate, &i, &nr_frames);
+  if (data == NULL) return NULL;
+
+  fft = sw_fft_plan_get (SW_FFT_REAL, 2 * size);
+
+  irs = g_malloc0 (sizeof (cv_impulses));
+  irs->refcount = 1;
+  irs->path = g_strdup (path);
+  irs->mtime = mtime;
+  irs->rate = rate;
+  irs->size = size;
+  irs->nr_impulses = i;
+
+  irs->impulses = g_malloc0 (irs->nr_impulses * sizeof (cv_impulse *));
+  for (i = 0; i < irs->nr_impulses; i++) {
+    irs->impulses[i] = cv_impulse_new (fft, size, data[i], nr_frames);
+    g_free (data[i]);
+  }
+  g_free (data);
+
+  /* The cache holds a reference of its own */
+  g_atomic_int_inc (&irs->refcount);
+
+  g_mutex_lock (&cv_cache_mutex);
+  old = cv_cache;
+  cv_cache = irs;
+  g_mutex_unlock (&cv_cache_mutex);
+
+  if (old) cv_impulses_unref (old);
+
+  return irs;
+}
+
+static void
+cv_state_free (cv_state * cs)
+{
+  gint i;
+
+  for (i = 0; i < cs->nr_channels; i++) {
+    if (cs->channels[i]) cv_channel_free (cs->channels[i]);
+  }
+
+  cv_impulses_unref (cs->irs);
+
+  g_free (cs->channels);
+  g_free (cs);
+}
+
+/*
+ * Set up convolution of format->channels channels with partitions of
+ * size frames. Channel c of the sample uses channel c of the impulse,
+ * wrapping round if the impulse has fewer channels.
+ */
+static cv_state *
+cv_state_new (sw_format * format, sw_param_set pset, gint size)
+{
+  cv_state * cs;
+  cv_impulses * irs;
+  gint i;
+
+  if (pset[0].s == NULL || pset[0].s[0] == '\0') return NULL;
+
+  irs = cv_impulses_get (pset[0].s, format->rate, size);
+  if (irs == NULL) return NULL;
+
+  cs = g_malloc0 (sizeof (cv_state));
+  cs->nr_channels = format->channels;
+  cs->size = size;
+  cs->fft = sw_fft_plan_get (SW_FFT_REAL, 2 * size);
+  cs->irs = irs;
+
+  cs->channels = g_malloc0 (cs->nr_channels * sizeof (cv_channel *));
+  for (i = 0; i < cs->nr_channels; i++) {
+    cs->channels[i] =
+      cv_channel_new (cs->fft, irs->impulses[i % irs->nr_impulses], size,
+		      pset[1].f, pset[2].f);
+  }
+
+  return cs;
+}
+
+/*
+ * Applying to a selection: each channel is convolved over a whole
+ * region by one thread, through scheduler_parallel ().
+ */
+typedef struct {
+  sw_sample * sample;
+  cv_state * cs;
+  gfloat * data;               /* start of the region, interleaved */
+  sw_framecount_t nr_frames;
+  sw_framecount_t run_total;   /* frames done in earlier regions */
+  sw_framecount_t op_total;
+} cv_job;
+
+static void
+cv_region_channel (gpointer data, gint c)
+{
+  cv_job * job = (cv_job *)data;
+  sw_sample * sample = job->sample;
+  cv_channel * ch = job->cs->channels[c];
+  gint nr_channels = job->cs->nr_channels;
+  sw_framecount_t size = ch->size, len = job->nr_frames;
+  sw_framecount_t in_pos, out_pos, n, m, skip, i;
+  gfloat * buf, * d;
+
+  buf = g_malloc (size * sizeof (gfloat));
+
+  /* Run latency (size) frames past the end, and write output size
+   * frames behind input, as for any processor */
+  for (in_pos = 0; in_pos < len + size; in_pos += n) {
+    n = MIN (size, len + size - in_pos);
+
+    g_mutex_lock (&sample->ops_mutex);
+
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      g_mutex_unlock (&sample->ops_mutex);
+      break;
+    }
+
+    m = CLAMP (len - in_pos, 0, n);
+    d = job->data + in_pos * nr_channels + c;
+    for (i = 0; i < m; i++) {
+      buf[i] = *d;
+      d += nr_channels;
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+
+    memset (buf + m, 0, (n - m) * sizeof (gfloat));
+
+    /* The transforms run unlocked, so that channels overlap */
+    cv_channel_run (ch, buf, n);
+
+    g_mutex_lock (&sample->ops_mutex);
+
+    out_pos = in_pos - size;
+    skip = MAX (-out_pos, 0);
+    m = MIN (n, len - out_pos);
+    d = job->data + (out_pos + skip) * nr_channels + c;
+    for (i = skip; i < m; i++) {
+      *d = buf[i];
+      d += nr_channels;
+    }
+
+    if (c == 0)
+      sample_set_progress_percent (sample, (job->run_total + in_pos) /
+				   job->op_total);
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  g_free (buf);
+}
+
+static sw_sample *
+convolve_apply_filter (sw_sample * sample, sw_param_set pset,
+		       gpointer custom_data)
+{
+  sw_sounddata * sounddata = sample_get_sounddata (sample);
+  sw_format * format = sounddata->format;
+  cv_state * cs;
+  cv_job job;
+  GList * gl;
+  sw_sel * sel;
+  gboolean cancelled;
+  gint c;
+
+  cs = cv_state_new (format, pset, CV_OFFLINE_PARTITION);
+  if (cs == NULL) {
+    sample_set_tmp_message (sample, _("Could not load impulse %s"),
+			    pset[0].s);
+    return NULL;
+  }
+
+  job.sample = sample;
+  job.cs = cs;
+  job.run_total = 0;
+  job.op_total = (sounddata_selection_nr_frames (sounddata) +
+		  g_list_length (sounddata->sels) * CV_OFFLINE_PARTITION) / 100;
+  if (job.op_total == 0) job.op_total = 1;
+
+  for (gl = sounddata->sels; gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+
+    g_mutex_lock (&sample->ops_mutex);
+    cancelled = (sample->edit_state == SWEEP_EDIT_STATE_CANCEL);
+    g_mutex_unlock (&sample->ops_mutex);
+
+    if (cancelled) break;
+
+    if (gl != sounddata->sels) {
+      for (c = 0; c < cs->nr_channels; c++)
+	cv_channel_reset (cs->channels[c]);
+    }
+
+    job.data = (gfloat *)sounddata->data + sel->sel_start * format->channels;
+    job.nr_frames = sel->sel_end - sel->sel_start;
+
+    scheduler_parallel (cv_region_channel, &job, cs->nr_channels);
+
+    job.run_total += job.nr_frames + CV_OFFLINE_PARTITION;
+  }
+
+  cv_state_free (cs);
+
+  return sample;
+}
+
+static sw_op_instance *
+convolve_apply (sw_sample * sample, sw_param_set pset, gpointer custom_data)
+{
+  if (pset[0].s != last_impulse) {
+    g_free (last_impulse);
+    last_impulse = g_strdup (pset[0].s);
+  }
+
+  return
+    perform_filter_op (sample, _("Convolve"),
+		       (SweepFilter)convolve_apply_filter, pset, NULL);
+}
+
+/*
+ * Processor, for realtime preview
+ */
+
+static gpointer
+convolve_init (sw_format * format, sw_param_set pset, gpointer custom_data)
+{
+  return cv_state_new (format, pset, SW_PROCESS_BLOCK_FRAMES);
+}
+
+static void
+convolve_process (gpointer state, gfloat ** channels, gint nr_channels,
+		  gint nr_frames)
+{
+  cv_state * cs = (cv_state *)state;
+  gint c;
+
+  for (c = 0; c < nr_channels; c++) {
+    cv_channel_run (cs->channels[c], channels[c], nr_frames);
+  }
+}
+
+static void
+convolve_flush (gpointer state)
+{
+  cv_state * cs = (cv_state *)state;
+  gint c;
+
+  for (c = 0; c < cs->nr_channels; c++) {
+    cv_channel_reset (cs->channels[c]);
+  }
+}
+
+static gint
+convolve_latency (gpointer state)
+{
+  return ((cv_state *)state)->size;
+}
+
+static void
+convolve_cleanup (gpointer state)
+{
+  cv_state_free ((cv_state *)state);
+}
+
+static sw_processor convolve_processor = {
+  convolve_init,
+  convolve_process,
+  convolve_flush,
+  convolve_latency,
+  convolve_cleanup,
+};
+
+
+static sw_procedure proc_convolve = {
+  N_("Convolve"),
+  N_("Convolve selected regions of a sample with an impulse response"),
+  "Conrad Parker",
+  "Copyright (C) 2000",
+  "http://sweep.sourceforge.net/plugins/convolve",
+  "Filters/Convolve", /* identifier */
+  0, /* accel_key */
+  0, /* accel_mods */
+  NR_PARAMS, /* nr_params */
+  param_specs, /* param_specs */
+  convolve_suggest, /* suggests() */
+  convolve_apply,
+  NULL, /* custom_data */
+  &convolve_processor, /* processor, for previews */
+};
+
+static GList *
+convolve_plugin_init (void)
+{
+  return g_list_append ((GList *)NULL, &proc_convolve);
+}
+
+static void
+convolve_plugin_cleanup (void)
+{
+  g_free (last_impulse);
+  last_impulse = NULL;
+
+  if (cv_cache) {
+    cv_impulses_unref (cv_cache);
+    cv_cache = NULL;
+  }
+}
+
+
+sw_plugin plugin = {
+  convolve_plugin_init, /* plugin_init */
+  convolve_plugin_cleanup, /* plugin_cleanup */
+};
@@ -25,7 +25,13 @@
 #include <sweep/sweep.h>
 
 
-#define NR_PARAMS 2
+#define NR_PARAMS 4
+
+/* Most taps an echo can have */
+#define MAX_TAPS 8
+
+/* Longest delay between taps, in seconds */
+#define MAX_DELAY 10.0
 
 #ifndef __GNUC__
 #error GCCisms used here. Please report this error to \
@@ -35,8 +41,9 @@ and your operating system and compiler.
 
 
 static sw_param_range delay_range = {
-  SW_RANGE_LOWER_BOUND_VALID|SW_RANGE_STEP_VALID,
+  SW_RANGE_ALL_VALID,
   lower: {f: 0.0},
+  upper: {f: MAX_DELAY},
   step:  {f: 0.001}
 };
 
@@ -47,6 +54,20 @@ static sw_param_range gain_range = {
   step: {f: 0.01}
 };
 
+static sw_param_range taps_range = {
+  SW_RANGE_ALL_VALID,
+  lower: {i: 1},
+  upper: {i: MAX_TAPS},
+  step: {i: 1}
+};
+
+static sw_param_range feedback_range = {
+  SW_RANGE_ALL_VALID,
+  lower: {f: 0.0},
+  upper: {f: 0.95},
+  step: {f: 0.01}
+};
+
 
 static sw_param_spec param_specs[] = {
   {
@@ -65,6 +86,24 @@ static sw_param_spec param_specs[] = {
     {range: &gain_range},
     SW_PARAM_HINT_DEFAULT
   },
+  {
+    N_("Taps"),
+    N_("Number of echoes, each one delay after the last and quieter "
+       "by the gain"),
+    SWEEP_TYPE_INT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &taps_range},
+    SW_PARAM_HINT_DEFAULT
+  },
+  {
+    N_("Feedback"),
+    N_("Gain with which the echoes are fed back to repeat after the "
+       "last tap"),
+    SWEEP_TYPE_FLOAT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &feedback_range},
+    SW_PARAM_HINT_DEFAULT
+  },
 };
 
 static void
@@ -72,42 +111,196 @@ echo_suggest (sw_sample * sample, sw_param_set pset, gpointer custom_data)
 {
   pset[0].f = 0.0;
   pset[1].f = 0.0;
+  pset[2].i = 1;
+  pset[3].f = 0.0;
+}
+
+/*
+ * The echo keeps a delay line per channel, a ring buffer which persists
+ * from one block to the next, holding
+ *
+ *   w[n] = x[n] + feedback * w[n - taps * delay]
+ *
+ * and outputs
+ *
+ *   y[n] = x[n] + sum over k = 1 .. taps of gain^k * w[n - k * delay]
+ *
+ * So with one tap and no feedback this is a single echo, and delays of
+ * any length are correct across block boundaries. Blocks are worked in
+ * pieces of at most one delay, so that every frame read from the delay
+ * line was written by an earlier piece; each piece is then a handful of
+ * plain loops over contiguous runs of the ring, which the compiler can
+ * vectorize.
+ */
+typedef struct {
+  gint nr_channels;
+  sw_framecount_t delay; /* frames between taps */
+  sw_framecount_t length; /* frames from input to last tap */
+  gint nr_taps;
+  gfloat tap_gains[MAX_TAPS];
+  gfloat feedback;
+
+  gfloat ** rings; /* per channel, mask+1 frames */
+  sw_framecount_t mask;
+  sw_framecount_t pos; /* where the next frame of w is written */
+
+  gfloat scratch[SW_PROCESS_BLOCK_FRAMES];
+} echo_state;
+
+static void
+echo_mix (gfloat * __restrict__ out, const gfloat * __restrict__ in,
+	  gint n, gfloat gain)
+{
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    out[i] += gain * in[i];
+  }
+}
+
+/* out[0..n) += gain * ring[start..start+n), wrapping around the ring */
+static void
+echo_ring_mix (gfloat * out, const gfloat * ring, sw_framecount_t mask,
+	       sw_framecount_t start, gint n, gfloat gain)
+{
+  gint first;
+
+  start &= mask;
+  first = (gint)MIN ((sw_framecount_t)n, mask + 1 - start);
+
+  echo_mix (out, ring + start, first, gain);
+  echo_mix (out + first, ring, n - first, gain);
 }
 
+/* ring[start..start+n) = in[0..n), wrapping around the ring */
 static void
-region_echo (gpointer data, sw_format * format, sw_framecount_t nr_frames,
-	     sw_param_set pset, gpointer custom_data)
+echo_ring_write (gfloat * ring, sw_framecount_t mask, sw_framecount_t start,
+		 const gfloat * in, gint n)
 {
-  gfloat delay = pset[0].f;
-  gfloat gain = pset[1].f;
+  gint first;
 
-  sw_framecount_t i, delay_f, dlen_s;
-  float * d, * e;
-  gpointer ep;
+  start &= mask;
+  first = (gint)MIN ((sw_framecount_t)n, mask + 1 - start);
 
-  delay_f = time_to_frames (format, delay);
+  memcpy (ring + start, in, first * sizeof (gfloat));
+  memcpy (ring, in + first, (n - first) * sizeof (gfloat));
+}
 
-  d = (float *)data;
-  ep = data + frames_to_bytes (format, delay_f);
-  e = (float *)ep;
+static void
+echo_cleanup (gpointer data)
+{
+  echo_state * es = (echo_state *)data;
+  gint c;
 
-  if (delay > nr_frames) return;
+  if (es->rings) {
+    for (c = 0; c < es->nr_channels; c++) {
+      g_free (es->rings[c]);
+    }
+  }
 
-  dlen_s = frames_to_samples (format, nr_frames - delay_f);
+  g_free (es->rings);
+  g_free (es);
+}
 
-  for (i = 0; i < dlen_s; i++) {
-    e[i] += (float)((gfloat)(d[i]) * gain);
+static void
+echo_flush (gpointer data)
+{
+  echo_state * es = (echo_state *)data;
+  gint c;
+
+  for (c = 0; c < es->nr_channels; c++) {
+    memset (es->rings[c], 0, (es->mask + 1) * sizeof (gfloat));
   }
+
+  es->pos = 0;
 }
 
-static sw_op_instance *
-echo_apply (sw_sample * sample, sw_param_set pset, gpointer custom_data)
+static gpointer
+echo_init (sw_format * format, sw_param_set pset, gpointer custom_data)
 {
-  return
-    perform_filter_region_op (sample, _("Echo"),
-			      (SweepFilterRegion)region_echo, pset, NULL);
+  echo_state * es;
+  sw_framecount_t size;
+  gfloat g;
+  gint c, k;
+
+  es = g_malloc0 (sizeof (echo_state));
+
+  es->nr_channels = format->channels;
+  es->delay = time_to_frames (format, CLAMP (pset[0].f, 0.0, MAX_DELAY));
+  es->nr_taps = CLAMP (pset[2].i, 1, MAX_TAPS);
+  es->length = es->delay * es->nr_taps;
+  es->feedback = pset[3].f;
+
+  g = 1.0;
+  for (k = 0; k < es->nr_taps; k++) {
+    g *= pset[1].f;
+    es->tap_gains[k] = g;
+  }
+
+  /* Room for the whole delay plus the piece being written */
+  for (size = 1; size < es->length + SW_PROCESS_BLOCK_FRAMES; size <<= 1);
+  es->mask = size - 1;
+
+  /* Long delays at high rates need a lot of memory; fail rather than abort */
+  es->rings = g_try_malloc0 (es->nr_channels * sizeof (gfloat *));
+  if (es->rings == NULL) goto fail;
+
+  for (c = 0; c < es->nr_channels; c++) {
+    es->rings[c] = g_try_malloc0 (size * sizeof (gfloat));
+    if (es->rings[c] == NULL) goto fail;
+  }
+
+  return es;
+
+ fail:
+  echo_cleanup (es);
+  return NULL;
+}
+
+static void
+echo_process (gpointer data, gfloat ** channels, gint nr_channels,
+	      gint nr_frames)
+{
+  echo_state * es = (echo_state *)data;
+  gfloat * x, * ring;
+  gint c, k, offset, n;
+
+  if (es->delay <= 0) return;
+
+  for (offset = 0; offset < nr_frames; offset += n) {
+    n = (gint)MIN ((sw_framecount_t)(nr_frames - offset), es->delay);
+
+    for (c = 0; c < nr_channels; c++) {
+      x = channels[c] + offset;
+      ring = es->rings[c];
+
+      /* w = x + feedback * w delayed by the last tap */
+      memcpy (es->scratch, x, n * sizeof (gfloat));
+      if (es->feedback != 0.0)
+	echo_ring_mix (es->scratch, ring, es->mask, es->pos - es->length, n,
+		       es->feedback);
+
+      /* y = x + each tap of w */
+      for (k = 0; k < es->nr_taps; k++) {
+	echo_ring_mix (x, ring, es->mask, es->pos - (k + 1) * es->delay, n,
+		       es->tap_gains[k]);
+      }
+
+      echo_ring_write (ring, es->mask, es->pos, es->scratch, n);
+    }
+
+    es->pos = (es->pos + n) & es->mask;
+  }
 }
 
+static sw_processor echo_processor = {
+  echo_init,
+  echo_process,
+  echo_flush,
+  NULL, /* latency */
+  echo_cleanup,
+};
+
 
 static sw_procedure proc_echo = {
   N_("Echo"),
@@ -121,18 +314,19 @@ static sw_procedure proc_echo = {
   NR_PARAMS, /* nr_params */
   param_specs, /* param_specs */
   echo_suggest, /* suggests() */
-  echo_apply,
+  NULL, /* apply: use processor */
   NULL, /* custom_data */
+  &echo_processor, /* processor */
 };
 
 static GList *
-echo_init (void)
+echo_plugin_init (void)
 {
   return g_list_append ((GList *)NULL, &proc_echo);
 }
 
 
 sw_plugin plugin = {
-  echo_init, /* plugin_init */
+  echo_plugin_init, /* plugin_init */
   NULL, /* plugin_cleanup */
 };
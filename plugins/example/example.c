@@ -141,10 +141,97 @@ static sw_procedure proc_example_filter_region = {
   NULL, /* custom_data */
 };
 
+/*
+ * Example processor: rather than providing an apply function, the
+ * procedure gives a processor, and sweep runs it over the selection
+ * in blocks, one channel buffer per channel.
+ */
+
+static sw_param_range example_gain_range = {
+  SW_RANGE_ALL_VALID,
+  lower: {f: 0.0},
+  upper: {f: 2.0},
+  step: {f: 0.01}
+};
+
+static sw_param_spec example_processor_param_specs[] = {
+  {
+    N_("Gain"),
+    N_("Gain to apply"),
+    SWEEP_TYPE_FLOAT,
+    SW_PARAM_CONSTRAINED_RANGE,
+    {range: &example_gain_range},
+    SW_PARAM_HINT_DEFAULT
+  }
+};
+
+static void
+example_processor_suggest (sw_sample * sample, sw_param_set pset,
+			   gpointer custom_data)
+{
+  pset[0].f = 1.0;
+}
+
+static gpointer
+example_processor_init (sw_format * format, sw_param_set pset,
+			gpointer custom_data)
+{
+  gfloat * gain = g_malloc (sizeof (gfloat));
+
+  /* Set up any state needed across blocks */
+  *gain = (gfloat)pset[0].f;
+
+  return gain;
+}
+
+static void
+example_processor_process (gpointer state, gfloat ** channels,
+			   gint nr_channels, gint nr_frames)
+{
+  gfloat gain = *(gfloat *)state;
+  gint c, i;
+
+  for (c = 0; c < nr_channels; c++) {
+    for (i = 0; i < nr_frames; i++) {
+      channels[c][i] *= gain;
+    }
+  }
+}
+
+static sw_processor example_processor = {
+  example_processor_init,
+  example_processor_process,
+  NULL, /* flush: no history to discard */
+  NULL, /* latency: none */
+  g_free, /* cleanup */
+};
+
+static sw_procedure proc_example_processor = {
+  N_("Example Processor"),
+  N_("An example block processor plugin"),
+  "Conrad Parker",
+  "Copyright (C) 2000",
+  "http://sweep.sourceforge.net/plugins/example",
+  "Example", /* identifier */
+  0, /* accel_key */
+  0, /* accel_mods */
+  1, /* nr_params */
+  example_processor_param_specs, /* param_specs */
+  example_processor_suggest, /* suggests() */
+  NULL, /* apply: use processor */
+  NULL, /* custom_data */
+  &example_processor, /* processor */
+};
+
 static GList *
 example_init (void)
 {
-  return g_list_append ((GList *)NULL, &proc_example_filter_region);
+  GList * gl = NULL;
+
+  gl = g_list_append (gl, &proc_example_filter_region);
+  gl = g_list_append (gl, &proc_example_processor);
+
+  return gl;
 }
 
 
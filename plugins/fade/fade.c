@@ -71,7 +71,7 @@ fade (sw_sample * sample, gfloat start, gfloat end)
 	for (i = 0; i < n; i++)
 	{
 		factor = start + (end - start) *
-                  (gfloat)run_total++ / (gfloat)frames_total;
+                  (gdouble)run_total++ / (gdouble)frames_total;
 
 		for (j = 0; j < f->channels; j++)
 		{
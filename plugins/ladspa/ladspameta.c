@@ -27,7 +27,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <string.h>
 #include <math.h> /* for ceil() */
 
@@ -39,6 +42,8 @@
 
 #include <sweep/sweep.h>
 #include "../src/sweep_app.h"
+#include "../src/scheduler.h"
+#include "../src/tdb/tdb.h"
 
 #include "ladspa.h"
 
@@ -164,25 +169,119 @@ convert_constraint ( /* sw_format * format, */
 
 typedef struct _lm_custom lm_custom;
 
+/*
+ * d describes the plugin's ports and names. It is either the plugin's
+ * own descriptor, or a copy rebuilt from the discovery cache (see below)
+ * whose function pointers are all NULL; in that case the library is
+ * only opened, and run_d filled in, when the plugin is first applied.
+ */
 struct _lm_custom {
   const LADSPA_Descriptor * d;
+  const LADSPA_Descriptor * run_d; /* loaded descriptor, or NULL */
+  gboolean cached;                 /* d is ours, rebuilt from the cache */
+  gboolean stale;                  /* the library no longer matches d */
+  gchar * path;                    /* library, and index within it */
+  gulong index;
+  gint nr_params;
   sw_param_spec * param_specs;
+  sw_param_set last_pset; /* as last applied, or NULL */
 };
 
 static lm_custom *
-lm_custom_new (const LADSPA_Descriptor * d, sw_param_spec * param_specs)
+lm_custom_new (const LADSPA_Descriptor * d, gint nr_params,
+	       sw_param_spec * param_specs)
 {
   lm_custom * lmc;
 
-  lmc = g_malloc (sizeof (*lmc));
+  lmc = g_malloc0 (sizeof (*lmc));
   if (lmc) {
     lmc->d = d;
+    lmc->nr_params = nr_params;
     lmc->param_specs = param_specs;
+    lmc->last_pset = NULL;
   }
 
   return lmc;
 }
 
+static void
+lm_descriptor_free (LADSPA_Descriptor * d)
+{
+  gulong i;
+
+  for (i = 0; i < d->PortCount; i++)
+    g_free ((gchar *)d->PortNames[i]);
+
+  g_free ((gpointer)d->PortDescriptors);
+  g_free ((gpointer)d->PortNames);
+  g_free ((gpointer)d->PortRangeHints);
+  g_free ((gchar *)d->Name);
+  g_free ((gchar *)d->Maker);
+  g_free ((gchar *)d->Copyright);
+  g_free (d);
+}
+
+static void
+lm_custom_free (lm_custom * lmc)
+{
+  if (lmc->cached)
+    lm_descriptor_free ((LADSPA_Descriptor *)lmc->d);
+
+  g_free (lmc->path);
+  g_free (lmc->last_pset);
+  g_free (lmc);
+}
+
+/*
+ * ladspa_meta_resolve (lm, sample)
+ *
+ * Return the loaded descriptor for lm, opening its library if that has
+ * not been done yet. Returns NULL if the library can no longer provide
+ * the plugin that was cached for it; the library is then closed again,
+ * not retried, and the failure shown on sample if it is not NULL.
+ */
+static const LADSPA_Descriptor *
+ladspa_meta_resolve (lm_custom * lm, sw_sample * sample)
+{
+  void * module;
+  LADSPA_Descriptor_Function desc_func;
+  const LADSPA_Descriptor * d;
+
+  if (lm->run_d != NULL) return lm->run_d;
+
+  if (!lm->stale) {
+    module = dlopen (lm->path, RTLD_NOW);
+    if (!module) {
+      fprintf (stderr, "sweep: Error opening LADSPA plugin %s: %s\n",
+	       lm->path, dlerror ());
+      if (sample != NULL)
+	sample_set_tmp_message (sample, _("Could not open LADSPA plugin %s"),
+				lm->d->Name);
+      return NULL;
+    }
+
+    if ((desc_func = dlsym (module, "ladspa_descriptor")) != NULL &&
+	(d = desc_func (lm->index)) != NULL &&
+	d->UniqueID == lm->d->UniqueID && is_usable (d)) {
+      modules_list = g_list_append (modules_list, module);
+      lm->run_d = d;
+      return d;
+    }
+
+    dlclose (module);
+    lm->stale = TRUE;
+
+    fprintf (stderr, "sweep: LADSPA plugin %s has changed in %s, "
+	     "please restart sweep\n", lm->d->Name, lm->path);
+  }
+
+  if (sample != NULL)
+    sample_set_tmp_message (sample, _("LADSPA plugin %s has changed, "
+				      "please restart Sweep"), lm->d->Name);
+
+  return NULL;
+}
+
 static sw_param
 convert_default (sw_format * format, const LADSPA_PortRangeHint * prh)
 {
@@ -266,6 +365,11 @@ ladspa_meta_suggest (sw_sample * sample, sw_param_set pset,
   LADSPA_PortDescriptor pd;
   int i, pset_i = 0;
 
+  if (lm->last_pset != NULL) {
+    memcpy (pset, lm->last_pset, lm->nr_params * sizeof (sw_param));
+    return;
+  }
+
   sounddata = sample_get_sounddata (sample);
 
   for (i=0; i < d->PortCount; i++) {
@@ -281,69 +385,86 @@ ladspa_meta_suggest (sw_sample * sample, sw_param_set pset,
 
 #define BLOCK_SIZE 1024
 
-static sw_sample *
-ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
-			  gpointer custom_data)
-{
-  lm_custom * lm = (lm_custom *)custom_data;
-  const LADSPA_Descriptor * d = lm->d;
-  sw_param_spec * param_specs = lm->param_specs;
-
-  sw_sounddata * sounddata;
-  sw_format * format;
-  sw_framecount_t op_total, run_total;
-  sw_framecount_t offset, remaining, n;
-
-  GList * gl;
-  sw_sel * sel;
-
-  gpointer pcmdata;
+/*
+ * Frames rendered per step with the sample's ops_mutex held. Within a
+ * span each handle runs its plugin BLOCK_SIZE frames at a time; the
+ * handles of a stage run concurrently through scheduler_parallel (),
+ * and a span is long enough to keep that hand-off cheap next to the
+ * plugins' own work.
+ */
+#define SPAN_SIZE (BLOCK_SIZE * 8)
 
-  /* The number of times the plugin will be run; ie. if the number of
-   * channels in the input pcmdata is greater than the number of
-   * audio ports on the ladspa plugin, the plugin will be run
-   * multiple times until enough output channels have been calculated.
-   */
+/*
+ * An lm_stage is one LADSPA plugin set up to process a sample. If the
+ * plugin has fewer audio ports than the sample has channels it is
+ * instantiated several times, one handle per group of channels; the
+ * handles are independent, so they may run concurrently.
+ *
+ * Stages read and write planar channel buffers shared by all the
+ * stages of a render, so a chain of them makes one pass over the
+ * sample data (see lm_render).
+ */
+typedef struct {
+  const LADSPA_Descriptor * d;
+  gint nr_ai, nr_ao;
+  gulong * ai_ports, * ao_ports; /* port numbers of the audio ports */
   gint nr_handles;
-
-  LADSPA_Handle ** handles;
-  LADSPA_Data ** input_buffers, ** output_buffers;
-  LADSPA_Data * mono_input_buffers[1], * mono_output_buffers[1];
-  LADSPA_Data * p;
+  LADSPA_Handle * handles;
+  gboolean activated;
   LADSPA_Data * control_inputs;
-  LADSPA_Data dummy_control_output;
-  LADSPA_PortDescriptor pd;
-  glong length_b;
-  gulong port_i; /* counter for iterating over ports */
-  gint h, i, j, c;
+  LADSPA_Data * control_outputs; /* one sink per handle */
+  LADSPA_Data * zeros;           /* input for ports past the last channel */
+  LADSPA_Data ** scratch;        /* per handle, nr_ao blocks of output */
+} lm_stage;
+
+typedef struct {
+  lm_stage * stage;
+  LADSPA_Data ** chan_bufs;
+  gint nr_channels;
+  sw_framecount_t nr_frames;
+} lm_pass;
 
-  /* Enumerate the numbers of each type of port on the ladspa plugin */
-  gint
-    nr_ci=0, /* control inputs */
-    nr_ai=0, /* audio inputs */
-    nr_co=0, /* control outputs */
-    nr_ao=0; /* audio outputs */
+static void
+lm_stage_free (lm_stage * st)
+{
+  const LADSPA_Descriptor * d = st->d;
+  gint h;
 
-  /* The number of audio channels to be processed */
-  gint nr_channels;
+  for (h = 0; h < st->nr_handles; h++) {
+    if (st->handles[h] == NULL) continue;
 
-  /* The number of input and output buffers to use */
-  gint nr_i=0, nr_o=0;
+    /* deactivate the ladspa plugin */
+    if (st->activated && d->deactivate)
+      d->deactivate (st->handles[h]);
 
-  /* Counters for allocating input and output buffers */
-  gint ibi=0, obi=0;
+    /* let the ladspa plugin clean up after itself */
+    if (d->cleanup)
+      d->cleanup (st->handles[h]);
 
-  gboolean active = TRUE;
+    g_free (st->scratch[h]);
+  }
 
-  g_return_val_if_fail (d != NULL, NULL);
+  g_free (st->scratch);
+  g_free (st->zeros);
+  g_free (st->control_outputs);
+  g_free (st->control_inputs);
+  g_free (st->handles);
+  g_free (st->ao_ports);
+  g_free (st->ai_ports);
+  g_free (st);
+}
 
-  sounddata = sample_get_sounddata (sample);
-  format = sounddata->format;
-  nr_channels = format->channels;
+static lm_stage *
+lm_stage_new (const LADSPA_Descriptor * d, sw_param_spec * param_specs,
+	      sw_param_set pset, gint nr_channels, glong rate)
+{
+  lm_stage * st;
+  LADSPA_PortDescriptor pd;
+  gulong port_i; /* counter for iterating over ports */
+  gint h, i, o, j, nr_ci = 0;
 
-  op_total = sounddata_selection_nr_frames (sounddata) / 100;
-  if (op_total == 0) op_total = 1;
-  run_total = 0;
+  st = g_malloc0 (sizeof (*st));
+  st->d = d;
 
   /* Cache how many of each type of port this ladspa plugin has */
   for (port_i=0; port_i < d->PortCount; port_i++) {
@@ -351,97 +472,56 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
     if (LADSPA_IS_CONTROL_INPUT(pd))
       nr_ci++;
     if (LADSPA_IS_AUDIO_INPUT(pd))
-      nr_ai++;
-    if (LADSPA_IS_CONTROL_OUTPUT(pd))
-      nr_co++;
+      st->nr_ai++;
     if (LADSPA_IS_AUDIO_OUTPUT(pd))
-      nr_ao++;
+      st->nr_ao++;
   }
 
-  /* Basic assumption of this meta plugin, which was
-   * checked above in is_usable(); nb. for future expansion
-   * much of this routine is written to accomodate this
-   * assumption being incorrect.
-   */
-  g_assert (nr_ai == nr_ao);
-
-  /* Basic assumption that this plugin has audio output.
+  /* Basic assumptions of this meta plugin, checked in is_usable().
    * Also important as we are about to divide by nr_ao.
    */
-  g_assert (nr_ao > 0);
+  g_assert (st->nr_ai == st->nr_ao);
+  g_assert (st->nr_ao > 0);
 
-  nr_handles = (gint) ceil(((double)nr_channels) / ((double)nr_ao));
-
-  /* Numbers of input and output buffers: ensure
-   * nr_i >= nr_channels && nr_o >= nr_channels
-   */
-  nr_i = nr_handles * nr_ai;
-  nr_o = nr_handles * nr_ao;
+  st->ai_ports = g_malloc (st->nr_ai * sizeof (gulong));
+  st->ao_ports = g_malloc (st->nr_ao * sizeof (gulong));
 
-  /* Create all input and output buffers */
-
-  if ((nr_channels == 1) && (nr_ai == 1) && (nr_ao >= 1)) {
-    /*
-     * Processing a mono sample with a mono filter.
-     * Attempt to do this in place.
-     */
+  i = 0; o = 0;
+  for (port_i=0; port_i < d->PortCount; port_i++) {
+    pd = d->PortDescriptors[(int)port_i];
+    if (LADSPA_IS_AUDIO_INPUT(pd))
+      st->ai_ports[i++] = port_i;
+    if (LADSPA_IS_AUDIO_OUTPUT(pd))
+      st->ao_ports[o++] = port_i;
+  }
 
-    /* Create an input buffer if this ladspa plugin cannot work inplace */
-    if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-      length_b = frames_to_bytes (format, BLOCK_SIZE);
-      mono_input_buffers[0] = g_malloc (length_b);
-    } else {
-      /* Input directly from sample data; mark as NULL */
-      mono_input_buffers[0] = NULL;
-    }
-    input_buffers = mono_input_buffers;
+  /* The number of times the plugin will be run; ie. if the number of
+   * channels in the input pcmdata is greater than the number of
+   * audio ports on the ladspa plugin, the plugin will be run
+   * multiple times until enough output channels have been calculated.
+   */
+  st->nr_handles = (nr_channels + st->nr_ao - 1) / st->nr_ao;
 
-    /* Always output directly into the sample data; mark as NULL */
-    mono_output_buffers[0] = NULL;
-    output_buffers = mono_output_buffers;
+  st->handles = g_malloc0 (st->nr_handles * sizeof (LADSPA_Handle));
+  st->scratch = g_malloc0 (st->nr_handles * sizeof (LADSPA_Data *));
+  st->control_inputs = g_malloc (MAX (nr_ci, 1) * sizeof (LADSPA_Data));
+  st->control_outputs = g_malloc0 (st->nr_handles * sizeof (LADSPA_Data));
+  st->zeros = g_malloc0 (LADSPA_frames_to_bytes (BLOCK_SIZE));
 
-  } else {
-    length_b = LADSPA_frames_to_bytes (BLOCK_SIZE);
-
-    /* Allocate zeroed input buffers; these will remain zeroed
-     * if there aren't enough channels in the input pcmdata
-     * to use them.
-     */
-    input_buffers = g_malloc (sizeof(LADSPA_Data *) * nr_i);
-    for (i=0; i < nr_i; i++) {
-      input_buffers[i] = g_malloc0 (length_b);
+  /* instantiate the ladspa plugin */
+  for (h = 0; h < st->nr_handles; h++) {
+    st->handles[h] = d->instantiate (d, rate);
+    if (st->handles[h] == NULL) {
+      fprintf (stderr, "sweep: LADSPA plugin %s could not be "
+	       "instantiated\n", d->Name);
+      lm_stage_free (st);
+      return NULL;
     }
 
-    output_buffers = g_malloc(sizeof(LADSPA_Data *) * nr_o);
-
-    /* Create separate output buffers if this ladspa plugin cannot
-     * work inplace */
-    if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-      for (i=0; i < nr_o; i++) {
-	output_buffers[i] = g_malloc (length_b);
-      }
-    } else {
-      /* Re-use the input buffers, directly mapping them to
-       * corresponding output buffers
-       */
-      for (i=0; i < MIN(nr_i, nr_o); i++) {
-	output_buffers[i] = input_buffers[i];
-      }
-      /* Create some extra output buffers if nr_o > nr_i */
-      for (; i < nr_o; i++) {
-	output_buffers[i] = g_malloc (length_b);
-      }
-    }
-  }
-
-  /* instantiate the ladspa plugin */
-  handles = g_malloc (sizeof (LADSPA_Handle *) * nr_handles);
-  for (h = 0; h < nr_handles; h++) {
-    handles[h] = d->instantiate (d, (long)format->rate);
+    st->scratch[h] = g_malloc (st->nr_ao * LADSPA_frames_to_bytes (BLOCK_SIZE));
   }
 
   /* connect control ports */
-  control_inputs = g_malloc (nr_ci * sizeof(LADSPA_Data));
   j=0;
   for (port_i=0; port_i < d->PortCount; port_i++) {
     pd = d->PortDescriptors[(int)port_i];
@@ -454,13 +534,13 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
 	 * `off' or `false,'
 	 * and data above zero should be considered `on' or `true.'
 	 */
-	control_inputs[j] = pset[j].b ? 1.0 : 0.0;
+	st->control_inputs[j] = pset[j].b ? 1.0 : 0.0;
 	break;
       case SWEEP_TYPE_INT:
-	control_inputs[j] = (LADSPA_Data)pset[j].i;
+	st->control_inputs[j] = (LADSPA_Data)pset[j].i;
 	break;
       case SWEEP_TYPE_FLOAT:
-	control_inputs[j] = pset[j].f;
+	st->control_inputs[j] = pset[j].f;
 	break;
       default:
 	/* This plugin should produce no other types */
@@ -468,27 +548,128 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
 	break;
       }
 
-      for (h = 0; h < nr_handles; h++) {
-	d->connect_port (handles[h], port_i, &control_inputs[j]);
+      for (h = 0; h < st->nr_handles; h++) {
+	d->connect_port (st->handles[h], port_i, &st->control_inputs[j]);
       }
 
       j++;
     }
     if (LADSPA_IS_CONTROL_OUTPUT(pd)) {
-      for (h = 0; h < nr_handles; h++) {
-	d->connect_port (handles[h], port_i, &dummy_control_output);
+      /* each handle gets its own sink, as handles may run concurrently */
+      for (h = 0; h < st->nr_handles; h++) {
+	d->connect_port (st->handles[h], port_i, &st->control_outputs[h]);
       }
     }
   }
 
   /* activate the ladspa plugin */
   if (d->activate) {
-    for (h = 0; h < nr_handles; h++) {
-      d->activate (handles[h]);
+    for (h = 0; h < st->nr_handles; h++) {
+      d->activate (st->handles[h]);
+    }
+  }
+  st->activated = TRUE;
+
+  return st;
+}
+
+/*
+ * Run handle h of a stage over the current span of planar channel
+ * buffers, one BLOCK_SIZE at a time. Handles touch disjoint channels
+ * and buffers, so any number of these can run at once.
+ */
+static void
+lm_stage_run_handle (gpointer data, gint h)
+{
+  lm_pass * pass = (lm_pass *)data;
+  lm_stage * st = pass->stage;
+  const LADSPA_Descriptor * d = st->d;
+  gboolean inplace = !LADSPA_META_IS_INPLACE_BROKEN(d->Properties);
+  LADSPA_Data * buf;
+  sw_framecount_t offset, n;
+  gint k, c;
+
+  for (offset = 0; offset < pass->nr_frames; offset += n) {
+    n = MIN(pass->nr_frames - offset, BLOCK_SIZE);
+
+    /* connect input and output audio buffers to the
+     * audio ports of the ladspa plugin */
+    for (k = 0; k < st->nr_ai; k++) {
+      c = h * st->nr_ai + k;
+      buf = (c < pass->nr_channels) ? pass->chan_bufs[c] + offset : st->zeros;
+      d->connect_port (st->handles[h], st->ai_ports[k], buf);
     }
+
+    for (k = 0; k < st->nr_ao; k++) {
+      c = h * st->nr_ao + k;
+      if (inplace && c < pass->nr_channels)
+	buf = pass->chan_bufs[c] + offset;
+      else
+	buf = st->scratch[h] + k * BLOCK_SIZE;
+      d->connect_port (st->handles[h], st->ao_ports[k], buf);
+    }
+
+    /* run the ladspa plugin */
+    d->run (st->handles[h], n);
+
+    if (!inplace) {
+      for (k = 0; k < st->nr_ao; k++) {
+	c = h * st->nr_ao + k;
+	if (c < pass->nr_channels)
+	  memcpy (pass->chan_bufs[c] + offset, st->scratch[h] + k * BLOCK_SIZE,
+		  LADSPA_frames_to_bytes (n));
+      }
+    }
+  }
+}
+
+/*
+ * lm_render (sample, stages, nr_stages)
+ *
+ * Run a series of stages over the selection of sample. Each span of
+ * frames is de-interleaved once into planar buffers, passed through
+ * every stage in turn, and re-interleaved once; mono data is already
+ * planar, so it is processed where it lies.
+ */
+static sw_sample *
+lm_render (sw_sample * sample, lm_stage ** stages, gint nr_stages)
+{
+  sw_sounddata * sounddata;
+  sw_format * format;
+  sw_framecount_t op_total, run_total;
+  sw_framecount_t offset, remaining, n, i;
+
+  GList * gl;
+  sw_sel * sel;
+
+  LADSPA_Data ** chan_bufs;
+  LADSPA_Data * planar = NULL;
+  LADSPA_Data * p;
+  lm_pass pass;
+  gint nr_channels, c, s;
+
+  gboolean active = TRUE;
+
+  sounddata = sample_get_sounddata (sample);
+  format = sounddata->format;
+  nr_channels = format->channels;
+
+  op_total = sounddata_selection_nr_frames (sounddata) / 100;
+  if (op_total == 0) op_total = 1;
+  run_total = 0;
+
+  chan_bufs = g_malloc (nr_channels * sizeof (LADSPA_Data *));
+
+  if (nr_channels > 1) {
+    planar = g_malloc (nr_channels * LADSPA_frames_to_bytes (SPAN_SIZE));
+    for (c = 0; c < nr_channels; c++)
+      chan_bufs[c] = planar + c * SPAN_SIZE;
   }
 
-  /* run the plugin on selection regions */
+  pass.chan_bufs = chan_bufs;
+  pass.nr_channels = nr_channels;
+
+  /* run the plugins on selection regions */
   for (gl = sounddata->sels; active && gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
 
@@ -501,68 +682,35 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
       if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
 	active = FALSE;
       } else { /* cancel */
-	pcmdata = sounddata->data +
-	  frames_to_bytes (format, sel->sel_start + offset);
+	p = (LADSPA_Data *)(sounddata->data +
+			    frames_to_bytes (format, sel->sel_start + offset));
 
-	n = MIN(remaining, BLOCK_SIZE);
+	n = MIN(remaining, SPAN_SIZE);
 
-	/* Copy data into input buffers */
+	/* de-interleave multichannel data */
 	if (nr_channels == 1) {
-	  if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-	    length_b = frames_to_bytes (format, n);
-	    memcpy (input_buffers[0], pcmdata, length_b);
-	  } else {
-	    /* we're processing in-place, so we haven't needed to set
-	     * up a separate input buffer; input_buffers[0] actually
-	     * points to pcmdata hence we don't do any copying here.
-	     */
-	    input_buffers[0] = (LADSPA_Data *)pcmdata;
-	  }
-
-	  output_buffers[0] = (LADSPA_Data *)pcmdata;
-
+	  chan_bufs[0] = p;
 	} else {
-	  /* de-interleave multichannel data */
-
-	  p = (LADSPA_Data *)pcmdata;
-
 	  for (i=0; i < n; i++) {
 	    for (c=0; c < nr_channels; c++) {
-	      input_buffers[c][i] = *p++;
-	    }
-	  }
-	}
-
-	g_assert (input_buffers[0] != NULL);
-	g_assert (output_buffers[0] != NULL);
-
-	/* connect input and output audio buffers to the
-	 * audio ports of the ladspa plugin */
-	ibi = 0; obi = 0;
-	for (h = 0; h < nr_handles; h++) {
-	  for (port_i=0; port_i < d->PortCount; port_i++) {
-	    pd = d->PortDescriptors[(int)port_i];
-	    if (LADSPA_IS_AUDIO_INPUT(pd)) {
-	      d->connect_port (handles[h], port_i, input_buffers[ibi++]);
-	    }
-	    if (LADSPA_IS_AUDIO_OUTPUT(pd)) {
-	      d->connect_port (handles[h], port_i, output_buffers[obi++]);
+	      chan_bufs[c][i] = p[i * nr_channels + c];
 	    }
 	  }
 	}
 
-	/* run the ladspa plugin */
-	for (h = 0; h < nr_handles; h++) {
-	  d->run (handles[h], n);
+	/* run each stage in turn, its handles concurrently */
+	pass.nr_frames = n;
+	for (s = 0; s < nr_stages; s++) {
+	  pass.stage = stages[s];
+	  scheduler_parallel (lm_stage_run_handle, &pass,
+			      stages[s]->nr_handles);
 	}
 
 	/* re-interleave data */
 	if (nr_channels > 1) {
-	  p = (LADSPA_Data *)pcmdata;
-
 	  for (i=0; i < n; i++) {
 	    for (c=0; c < nr_channels; c++) {
-	      *p++ = output_buffers[c][i];
+	      p[i * nr_channels + c] = chan_bufs[c][i];
 	    }
 	  }
 	}
@@ -578,53 +726,31 @@ ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
     }
   }
 
-  /* deactivate the ladspa plugin */
-  if (d->deactivate) {
-    for (h = 0; h < nr_handles; h++) {
-      d->deactivate (handles[h]);
-    }
-  }
+  g_free (planar);
+  g_free (chan_bufs);
 
-  /* let the ladspa plugin clean up after itself */
-  if (d->cleanup) {
-    for (h = 0; h < nr_handles; h++) {
-      d->cleanup (handles[h]);
-    }
-  }
+  return sample;
+}
 
-  /* free the array of handles */
-  g_free (handles);
+static sw_sample *
+ladspa_meta_apply_filter (sw_sample * sample, sw_param_set pset,
+			  gpointer custom_data)
+{
+  lm_custom * lm = (lm_custom *)custom_data;
+  sw_format * format;
+  lm_stage * stage;
 
-  /* free the input and output buffers */
-  if (control_inputs) g_free (control_inputs);
+  g_return_val_if_fail (lm->run_d != NULL, NULL);
 
-  if ((nr_channels == 1) && (nr_ai == 1) && (nr_ao >= 1)) {
-    if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-      g_free (mono_input_buffers[0]);
-    }
-  } else {
+  format = sample_get_sounddata (sample)->format;
 
-    /* free the output buffers */
-    for (i=0; i < nr_o; i++) {
-      g_free (output_buffers[i]);
-    }
-    g_free (output_buffers);
+  stage = lm_stage_new (lm->run_d, lm->param_specs, pset,
+			format->channels, (glong)format->rate);
+  if (stage == NULL) return NULL;
 
-    /* free the input buffers, if we created some */
-    if (LADSPA_META_IS_INPLACE_BROKEN(d->Properties)) {
-      for (i=0; i < nr_i; i++) {
-	g_free (input_buffers[i]);
-      }
-    } else {
-      /* inplace worked, but if (nr_i > nr_o), then
-       * we still need to free the last input buffers
-       **/
-      for (i=nr_o; i < nr_i; i++) {
-	g_free (input_buffers[i]);
-      }
-    }
-    g_free (input_buffers);
-  }
+  sample = lm_render (sample, &stage, 1);
+
+  lm_stage_free (stage);
 
   return sample;
 }
@@ -634,7 +760,14 @@ ladspa_meta_apply (sw_sample * sample,
 		   sw_param_set pset, gpointer custom_data)
 {
   lm_custom * lm = (lm_custom *)custom_data;
-  const LADSPA_Descriptor * d = lm->d;
+  const LADSPA_Descriptor * d;
+
+  /* Load the library now if it was only known from the cache */
+  if ((d = ladspa_meta_resolve (lm, sample)) == NULL) return NULL;
+
+  /* Remember these settings for next time, and for chains */
+  g_free (lm->last_pset);
+  lm->last_pset = g_memdup (pset, lm->nr_params * sizeof (sw_param));
 
   return
     perform_filter_op (sample, (char *)d->Name,
@@ -643,26 +776,630 @@ ladspa_meta_apply (sw_sample * sample,
 }
 
 /*
- * ladspa_meta_add_procs (dir, name, gl)
+ * Processor, for running a LADSPA plugin as a realtime insert. The host
+ * sets inserts up on the main thread, so init may load the library.
+ * The handles of the stage run one after another here, as the mixer
+ * thread should not wait on the parallel helpers.
+ */
+
+static gpointer
+ladspa_meta_processor_init (sw_format * format, sw_param_set pset,
+			    gpointer custom_data)
+{
+  lm_custom * lm = (lm_custom *)custom_data;
+  const LADSPA_Descriptor * d;
+
+  if ((d = ladspa_meta_resolve (lm, NULL)) == NULL) return NULL;
+
+  return lm_stage_new (d, lm->param_specs, pset, format->channels,
+		       (glong)format->rate);
+}
+
+static void
+ladspa_meta_processor_process (gpointer state, gfloat ** channels,
+			       gint nr_channels, gint nr_frames)
+{
+  lm_pass pass;
+  gint h;
+
+  pass.stage = (lm_stage *)state;
+  pass.chan_bufs = channels;
+  pass.nr_channels = nr_channels;
+  pass.nr_frames = nr_frames;
+
+  for (h = 0; h < pass.stage->nr_handles; h++) {
+    lm_stage_run_handle (&pass, h);
+  }
+}
+
+static void
+ladspa_meta_processor_flush (gpointer state)
+{
+  lm_stage * st = (lm_stage *)state;
+  const LADSPA_Descriptor * d = st->d;
+  gint h;
+
+  /* Re-activating a plugin resets its internal state */
+  for (h = 0; h < st->nr_handles; h++) {
+    if (d->deactivate) d->deactivate (st->handles[h]);
+    if (d->activate) d->activate (st->handles[h]);
+  }
+}
+
+static void
+ladspa_meta_processor_cleanup (gpointer state)
+{
+  lm_stage_free ((lm_stage *)state);
+}
+
+static sw_processor ladspa_meta_processor = {
+  ladspa_meta_processor_init,
+  ladspa_meta_processor_process,
+  ladspa_meta_processor_flush,
+  NULL, /* latency */
+  ladspa_meta_processor_cleanup,
+};
+
+/*
+ * LADSPA Chain
+ *
+ * Runs up to LADSPA_CHAIN_STAGES LADSPA plugins, in order, as a single
+ * operation: the selection is rendered in one pass with one undo step.
+ * Each stage uses the settings last applied with that plugin's own
+ * dialog, or its defaults.
+ */
+
+#define LADSPA_CHAIN_STAGES 4
+
+typedef struct {
+  gint nr_stages;
+  lm_custom * lms[LADSPA_CHAIN_STAGES];
+  sw_param_set psets[LADSPA_CHAIN_STAGES];
+} lm_chain;
+
+static sw_procedure * chain_proc = NULL;
+static sw_param * chain_choices = NULL; /* constraint list of plugin names */
+static sw_param chain_last[LADSPA_CHAIN_STAGES];
+
+static gchar * chain_none = N_("(None)");
+
+static lm_custom *
+ladspa_chain_find (sw_string name)
+{
+  GList * gl;
+  sw_procedure * proc;
+
+  if (name == NULL || name == chain_none) return NULL;
+
+  for (gl = proc_list; gl; gl = gl->next) {
+    proc = (sw_procedure *)gl->data;
+    if (proc != chain_proc && !strcmp (proc->name, name))
+      return (lm_custom *)proc->custom_data;
+  }
+
+  return NULL;
+}
+
+static void
+ladspa_chain_suggest (sw_sample * sample, sw_param_set pset,
+		      gpointer custom_data)
+{
+  gint i;
+
+  for (i = 0; i < LADSPA_CHAIN_STAGES; i++) {
+    pset[i].s = chain_last[i].s ? chain_last[i].s : chain_none;
+  }
+}
+
+static void
+ladspa_chain_free (lm_chain * chain)
+{
+  gint i;
+
+  for (i = 0; i < chain->nr_stages; i++)
+    g_free (chain->psets[i]);
+  g_free (chain);
+}
+
+static sw_sample *
+ladspa_chain_apply_filter (sw_sample * sample, sw_param_set pset,
+			   gpointer custom_data)
+{
+  lm_chain * chain = (lm_chain *)custom_data;
+  lm_stage * stages[LADSPA_CHAIN_STAGES];
+  sw_format * format;
+  gint i, nr_stages = 0;
+
+  format = sample_get_sounddata (sample)->format;
+
+  for (i = 0; i < chain->nr_stages; i++) {
+    stages[nr_stages] = lm_stage_new (chain->lms[i]->run_d,
+				      chain->lms[i]->param_specs,
+				      chain->psets[i], format->channels,
+				      (glong)format->rate);
+    if (stages[nr_stages] != NULL) nr_stages++;
+  }
+
+  if (nr_stages > 0)
+    sample = lm_render (sample, stages, nr_stages);
+
+  for (i = 0; i < nr_stages; i++)
+    lm_stage_free (stages[i]);
+
+  return sample;
+}
+
+static sw_op_instance *
+ladspa_chain_apply (sw_sample * sample,
+		    sw_param_set pset, gpointer custom_data)
+{
+  lm_chain * chain;
+  lm_custom * lm;
+  GString * desc;
+  sw_op_instance * inst = NULL;
+  gint i;
+
+  chain = g_malloc0 (sizeof (*chain));
+  desc = g_string_new (_("LADSPA Chain"));
+
+  for (i = 0; i < LADSPA_CHAIN_STAGES; i++) {
+    chain_last[i] = pset[i];
+
+    if ((lm = ladspa_chain_find (pset[i].s)) == NULL) continue;
+    if (ladspa_meta_resolve (lm, sample) == NULL) continue;
+
+    chain->lms[chain->nr_stages] = lm;
+    chain->psets[chain->nr_stages] =
+      g_malloc (MAX (lm->nr_params, 1) * sizeof (sw_param));
+    ladspa_meta_suggest (sample, chain->psets[chain->nr_stages], lm);
+
+    g_string_append (desc, chain->nr_stages == 0 ? ": " : ", ");
+    g_string_append (desc, lm->d->Name);
+
+    chain->nr_stages++;
+  }
+
+  /* The op frees chain once it is done with it, even if cancelled */
+  if (chain->nr_stages > 0) {
+    inst = perform_filter_op_full (sample, desc->str,
+				   (SweepFilter)ladspa_chain_apply_filter,
+				   pset, chain,
+				   (SweepFunction)ladspa_chain_free);
+  } else {
+    ladspa_chain_free (chain);
+  }
+
+  g_string_free (desc, TRUE);
+
+  return inst;
+}
+
+static void
+ladspa_chain_add_proc (void)
+{
+  GList * gl;
+  sw_procedure * proc;
+  sw_param_spec * ps;
+  gint i, nr_choices = 0;
+
+  if (proc_list == NULL) return;
+
+  chain_choices = g_malloc0 ((g_list_length (proc_list) + 2) *
+			     sizeof (sw_param));
+
+  chain_choices[1].s = chain_none;
+  nr_choices = 1;
+  for (gl = proc_list; gl; gl = gl->next) {
+    proc = (sw_procedure *)gl->data;
+    chain_choices[++nr_choices].s = proc->name;
+  }
+  chain_choices[0].i = nr_choices;
+
+  ps = g_malloc0 (LADSPA_CHAIN_STAGES * sizeof (sw_param_spec));
+  for (i = 0; i < LADSPA_CHAIN_STAGES; i++) {
+    ps[i].name = g_strdup_printf (_("Stage %d"), i + 1);
+    ps[i].desc = _("LADSPA plugin to run at this point in the chain");
+    ps[i].type = SWEEP_TYPE_STRING;
+    ps[i].constraint_type = SW_PARAM_CONSTRAINED_LIST;
+    ps[i].constraint.list = chain_choices;
+    ps[i].hints = SW_PARAM_HINT_DEFAULT;
+  }
+
+  chain_proc = g_malloc0 (sizeof (*chain_proc));
+  chain_proc->name = N_("LADSPA Chain");
+  chain_proc->description =
+    N_("Run several LADSPA plugins over the selection in a single pass, "
+       "as one undoable step. Each plugin uses the settings it was last "
+       "applied with, or its defaults.");
+  chain_proc->author = "The Sweep developers";
+  chain_proc->copyright = "Copyright (C) 2026";
+  chain_proc->nr_params = LADSPA_CHAIN_STAGES;
+  chain_proc->param_specs = ps;
+  chain_proc->suggest = ladspa_chain_suggest;
+  chain_proc->apply = ladspa_chain_apply;
+  chain_proc->custom_data = NULL;
+
+  proc_list = g_list_append (proc_list, chain_proc);
+}
+
+/*
+ * ladspa_meta_add_proc (d, lm)
+ *
+ * form a sweep proc to describe the ladspa plugin function d,
+ * and add it to proc_list. Only the metadata in d is used, so d may
+ * have been rebuilt from the discovery cache.
+ */
+static void
+ladspa_meta_add_proc (const LADSPA_Descriptor * d, lm_custom * lm)
+{
+  LADSPA_PortDescriptor pd;
+  gint j, k, nr_params;
+  int valid_mask;
+  sw_procedure * proc;
+
+  proc = g_malloc0 (sizeof (*proc));
+  proc->name = (gchar *)d->Name;
+  proc->author = (gchar *)d->Maker;
+  proc->copyright = (gchar *)d->Copyright;
+
+  nr_params=0;
+  for (j=0; j < d->PortCount; j++) {
+    pd = d->PortDescriptors[j];
+    if (LADSPA_IS_CONTROL_INPUT(pd)) {
+      nr_params++;
+    }
+  }
+
+  proc->nr_params = nr_params;
+  proc->param_specs =
+    (sw_param_spec *)g_malloc0 (nr_params * sizeof (sw_param_spec));
+
+  k=0;
+  for (j=0; j < d->PortCount; j++) {
+    pd = d->PortDescriptors[j];
+    if (LADSPA_IS_CONTROL_INPUT(pd)) {
+      proc->param_specs[k].name = (gchar *)d->PortNames[j];
+      proc->param_specs[k].desc = (gchar *)d->PortNames[j];
+      proc->param_specs[k].type =
+	convert_type (d->PortRangeHints[j].HintDescriptor);
+      valid_mask = get_valid_mask (d->PortRangeHints[j].HintDescriptor);
+      if (valid_mask == 0) {
+	proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_NOT;
+      } else {
+	proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_RANGE;
+	proc->param_specs[k].constraint.range =
+	  convert_constraint (&d->PortRangeHints[j]);
+      }
+      k++;
+    }
+  }
+
+  proc->suggest = ladspa_meta_suggest;
+
+  proc->apply = ladspa_meta_apply;
+  proc->processor = &ladspa_meta_processor;
+
+  lm->nr_params = nr_params;
+  lm->param_specs = proc->param_specs;
+  proc->custom_data = lm;
+
+  proc_list = g_list_append (proc_list, proc);
+}
+
+/*
+ * Discovery cache
+ *
+ * Opening every library on LADSPA_PATH at startup is slow with a large
+ * plugin collection, so the metadata of the usable descriptors in each
+ * library is kept in ~/.sweep/ladspa-cache.tdb, keyed by the library's
+ * path and checked against its mtime and size. Libraries whose entry is
+ * current are not opened until one of their plugins is applied.
+ *
+ * An entry is packed in host byte order as:
+ *
+ *   "LMC1", mtime (gint64), size (gint64), nr_descriptors (guint32),
+ *   then for each descriptor:
+ *     index (guint32), UniqueID (guint32), Properties (gint32),
+ *     Name, Maker, Copyright (strings), PortCount (guint32),
+ *     then for each port:
+ *       descriptor (gint32), name (string),
+ *       hint descriptor (gint32), lower bound, upper bound (gfloat)
+ *
+ * with strings stored as a guint32 length followed by the bytes.
+ */
+
+#define LM_CACHE_MAGIC "LMC1"
+
+static TDB_CONTEXT * lm_cache = NULL;
+static GHashTable * lm_cache_seen = NULL; /* paths present this session */
+
+typedef struct {
+  const guchar * p, * end;
+  gboolean ok;
+} lm_reader;
+
+static void
+lm_cache_open (void)
+{
+  gchar * path;
+
+  path = g_strconcat (g_get_home_dir (), "/.sweep/ladspa-cache.tdb", NULL);
+  lm_cache = tdb_open (path, 0, 0, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  g_free (path);
+
+  lm_cache_seen = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, NULL);
+}
+
+static int
+lm_cache_prune_one (TDB_CONTEXT * tdb, TDB_DATA key, TDB_DATA data,
+		    void * unused)
+{
+  gchar * path = g_strndup ((gchar *)key.dptr, key.dsize);
+
+  if (g_hash_table_lookup (lm_cache_seen, path) == NULL)
+    tdb_delete (tdb, key);
+
+  g_free (path);
+
+  return 0;
+}
+
+/* Drop entries for libraries that were not found, and close the cache */
+static void
+lm_cache_close (void)
+{
+  if (lm_cache != NULL) {
+    tdb_traverse (lm_cache, lm_cache_prune_one, NULL);
+    tdb_close (lm_cache);
+    lm_cache = NULL;
+  }
+
+  if (lm_cache_seen != NULL) {
+    g_hash_table_destroy (lm_cache_seen);
+    lm_cache_seen = NULL;
+  }
+}
+
+static void
+lm_pack (GString * buf, gconstpointer data, gsize len)
+{
+  g_string_append_len (buf, (const gchar *)data, len);
+}
+
+static void
+lm_pack_u32 (GString * buf, guint32 v)
+{
+  lm_pack (buf, &v, sizeof (v));
+}
+
+static void
+lm_pack_string (GString * buf, const char * str)
+{
+  guint32 len = str ? strlen (str) : 0;
+
+  lm_pack_u32 (buf, len);
+  lm_pack (buf, str, len);
+}
+
+static gboolean
+lm_unpack (lm_reader * r, gpointer data, gsize len)
+{
+  if (!r->ok || (gsize)(r->end - r->p) < len) {
+    r->ok = FALSE;
+    memset (data, 0, len);
+    return FALSE;
+  }
+
+  memcpy (data, r->p, len);
+  r->p += len;
+
+  return TRUE;
+}
+
+static guint32
+lm_unpack_u32 (lm_reader * r)
+{
+  guint32 v;
+
+  lm_unpack (r, &v, sizeof (v));
+
+  return v;
+}
+
+static gchar *
+lm_unpack_string (lm_reader * r)
+{
+  guint32 len = lm_unpack_u32 (r);
+  gchar * str;
+
+  if (!r->ok || (gsize)(r->end - r->p) < len) {
+    r->ok = FALSE;
+    return NULL;
+  }
+
+  str = g_strndup ((const gchar *)r->p, len);
+  r->p += len;
+
+  return str;
+}
+
+static void
+lm_cache_store (const gchar * path, struct stat * st, GList * descs)
+{
+  GString * buf;
+  GList * gl;
+  lm_custom * lm;
+  const LADSPA_Descriptor * d;
+  TDB_DATA key, data;
+  gint64 v;
+  gulong i;
+
+  if (lm_cache == NULL) return;
+
+  buf = g_string_new (LM_CACHE_MAGIC);
+
+  v = st->st_mtime; lm_pack (buf, &v, sizeof (v));
+  v = st->st_size; lm_pack (buf, &v, sizeof (v));
+  lm_pack_u32 (buf, g_list_length (descs));
+
+  for (gl = descs; gl; gl = gl->next) {
+    lm = (lm_custom *)gl->data;
+    d = lm->d;
+
+    lm_pack_u32 (buf, lm->index);
+    lm_pack_u32 (buf, d->UniqueID);
+    lm_pack_u32 (buf, d->Properties);
+    lm_pack_string (buf, d->Name);
+    lm_pack_string (buf, d->Maker);
+    lm_pack_string (buf, d->Copyright);
+    lm_pack_u32 (buf, d->PortCount);
+
+    for (i = 0; i < d->PortCount; i++) {
+      lm_pack_u32 (buf, d->PortDescriptors[i]);
+      lm_pack_string (buf, d->PortNames[i]);
+      lm_pack_u32 (buf, d->PortRangeHints[i].HintDescriptor);
+      lm_pack (buf, &d->PortRangeHints[i].LowerBound, sizeof (LADSPA_Data));
+      lm_pack (buf, &d->PortRangeHints[i].UpperBound, sizeof (LADSPA_Data));
+    }
+  }
+
+  key.dptr = (char *)path;
+  key.dsize = strlen (path);
+  data.dptr = buf->str;
+  data.dsize = buf->len;
+
+  tdb_store (lm_cache, key, data, TDB_REPLACE);
+
+  g_string_free (buf, TRUE);
+}
+
+/*
+ * Add procs for path from its cache entry, if that is current.
+ * Returns FALSE if the library must be opened and scanned instead.
+ */
+static gboolean
+lm_cache_load (const gchar * path, struct stat * st)
+{
+  TDB_DATA key, data;
+  lm_reader r;
+  GList * loaded = NULL, * gl;
+  LADSPA_Descriptor * d;
+  LADSPA_PortDescriptor * pds;
+  const char ** names;
+  LADSPA_PortRangeHint * hints;
+  lm_custom * lm;
+  gint64 mtime, size;
+  guint32 i, j, nr;
+  gchar magic[4];
+
+  if (lm_cache == NULL) return FALSE;
+
+  key.dptr = (char *)path;
+  key.dsize = strlen (path);
+
+  data = tdb_fetch (lm_cache, key);
+  if (data.dptr == NULL) return FALSE;
+
+  r.p = (const guchar *)data.dptr;
+  r.end = r.p + data.dsize;
+  r.ok = TRUE;
+
+  lm_unpack (&r, magic, sizeof (magic));
+  lm_unpack (&r, &mtime, sizeof (mtime));
+  lm_unpack (&r, &size, sizeof (size));
+
+  if (!r.ok || memcmp (magic, LM_CACHE_MAGIC, sizeof (magic)) ||
+      mtime != st->st_mtime || size != st->st_size) {
+    free (data.dptr);
+    return FALSE;
+  }
+
+  nr = lm_unpack_u32 (&r);
+
+  for (i = 0; r.ok && i < nr; i++) {
+    d = g_malloc0 (sizeof (*d));
+    lm = lm_custom_new (d, 0, NULL);
+    lm->cached = TRUE;
+    lm->path = g_strdup (path);
+    loaded = g_list_append (loaded, lm);
+
+    lm->index = lm_unpack_u32 (&r);
+    d->UniqueID = lm_unpack_u32 (&r);
+    d->Properties = lm_unpack_u32 (&r);
+    d->Name = lm_unpack_string (&r);
+    d->Maker = lm_unpack_string (&r);
+    d->Copyright = lm_unpack_string (&r);
+    d->PortCount = lm_unpack_u32 (&r);
+
+    /* Guard against a corrupt count before allocating for it */
+    if ((gsize)(r.end - r.p) < d->PortCount * 4 * sizeof (guint32)) {
+      r.ok = FALSE;
+      d->PortCount = 0;
+    }
+
+    d->PortDescriptors = pds =
+      g_malloc0 (d->PortCount * sizeof (LADSPA_PortDescriptor));
+    d->PortNames = names = g_malloc0 (d->PortCount * sizeof (char *));
+    d->PortRangeHints = hints =
+      g_malloc0 (d->PortCount * sizeof (LADSPA_PortRangeHint));
+
+    for (j = 0; j < d->PortCount; j++) {
+      pds[j] = lm_unpack_u32 (&r);
+      names[j] = lm_unpack_string (&r);
+      hints[j].HintDescriptor = lm_unpack_u32 (&r);
+      lm_unpack (&r, &hints[j].LowerBound, sizeof (LADSPA_Data));
+      lm_unpack (&r, &hints[j].UpperBound, sizeof (LADSPA_Data));
+    }
+  }
+
+  free (data.dptr);
+
+  if (!r.ok) {
+    for (gl = loaded; gl; gl = gl->next)
+      lm_custom_free ((lm_custom *)gl->data);
+    g_list_free (loaded);
+    return FALSE;
+  }
+
+  for (gl = loaded; gl; gl = gl->next) {
+    lm = (lm_custom *)gl->data;
+    ladspa_meta_add_proc (lm->d, lm);
+  }
+  g_list_free (loaded);
+
+  return TRUE;
+}
+
+/*
+ * ladspa_meta_add_procs (dir, name)
  *
  * form sweep procs to describe the ladspa plugin functions that
- * are in the shared library file "dir/name",
- * and add these procs to the GList * (*gl)
+ * are in the shared library file "dir/name", and add these procs
+ * to proc_list; from the discovery cache if possible, otherwise by
+ * opening the library and caching what it contains.
  */
 static void
 ladspa_meta_add_procs (gchar * dir, gchar * name)
 {
   gchar path[256];
+  struct stat st;
   void * module;
   LADSPA_Descriptor_Function desc_func;
   const LADSPA_Descriptor * d;
-  LADSPA_PortDescriptor pd;
-  gint i, j, k, nr_params;
-  int valid_mask;
-  sw_procedure * proc;
+  GList * descs = NULL;
+  lm_custom * lm;
+  gulong i;
 
   snprintf (path, sizeof (path), "%s/%s", dir, name);
 
+  if (stat (path, &st) == -1 || !S_ISREG (st.st_mode)) return;
+
+  if (lm_cache_seen != NULL)
+    g_hash_table_insert (lm_cache_seen, g_strdup (path), GINT_TO_POINTER (1));
+
+  if (lm_cache_load (path, &st)) return;
+
   module = dlopen (path, RTLD_NOW);
   if (!module) return;
 
@@ -674,52 +1411,22 @@ ladspa_meta_add_procs (gchar * dir, gchar * name)
       if (!is_usable(d))
 	continue;
 
-      proc = g_malloc0 (sizeof (*proc));
-      proc->name = (gchar *)d->Name;
-      proc->author = (gchar *)d->Maker;
-      proc->copyright = (gchar *)d->Copyright;
+      lm = lm_custom_new (d, 0, NULL);
+      lm->run_d = d;
+      lm->path = g_strdup (path);
+      lm->index = i;
 
-      nr_params=0;
-      for (j=0; j < d->PortCount; j++) {
-	pd = d->PortDescriptors[j];
-	if (LADSPA_IS_CONTROL_INPUT(pd)) {
-	  nr_params++;
-	}
-      }
+      ladspa_meta_add_proc (d, lm);
 
-      proc->nr_params = nr_params;
-      proc->param_specs =
-	(sw_param_spec *)g_malloc0 (nr_params * sizeof (sw_param_spec));
-
-      k=0;
-      for (j=0; j < d->PortCount; j++) {
-	pd = d->PortDescriptors[j];
-	if (LADSPA_IS_CONTROL_INPUT(pd)) {
-	  proc->param_specs[k].name = (gchar *)d->PortNames[j];
-	  proc->param_specs[k].desc = (gchar *)d->PortNames[j];
-	  proc->param_specs[k].type =
-	    convert_type (d->PortRangeHints[j].HintDescriptor);
-	  valid_mask = get_valid_mask (d->PortRangeHints[j].HintDescriptor);
-	  if (valid_mask == 0) {
-	    proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_NOT;
-	  } else {
-	    proc->param_specs[k].constraint_type = SW_PARAM_CONSTRAINED_RANGE;
-	    proc->param_specs[k].constraint.range =
-	      convert_constraint (&d->PortRangeHints[j]);
-	  }
-	  k++;
-	}
-      }
-
-      proc->suggest = ladspa_meta_suggest;
-
-      proc->apply = ladspa_meta_apply;
-
-      proc->custom_data = lm_custom_new (d, proc->param_specs);
-
-      proc_list = g_list_append (proc_list, proc);
+      descs = g_list_append (descs, lm);
     }
   }
+
+  /* Cache even an empty list, so that helper libraries sharing the
+   * directory are not opened again either */
+  lm_cache_store (path, &st, descs);
+
+  g_list_free (descs);
 }
 
 /*
@@ -768,6 +1475,8 @@ ladspa_meta_init (void)
   if (!ladspa_path)
     ladspa_path = saved_lp = strdup(default_ladspa_path);
 
+  lm_cache_open ();
+
   do {
     next_sep = strchr (ladspa_path, ':');
     if (next_sep != NULL) *next_sep = '\0';
@@ -778,6 +1487,10 @@ ladspa_meta_init (void)
 
   } while ((next_sep != NULL) && (*next_sep != '\0'));
 
+  lm_cache_close ();
+
+  ladspa_chain_add_proc ();
+
   ladspa_meta_initialised = TRUE;
 
   /* free string if dup'd for ladspa_path */
@@ -793,12 +1506,26 @@ ladspa_meta_cleanup (void)
 
   if (!ladspa_meta_initialised) return;
 
+  /* chain_proc itself is freed with the rest of proc_list below */
+  if (chain_proc != NULL) {
+    int j;
+
+    for (j=0; j < LADSPA_CHAIN_STAGES; j++) {
+      g_free (chain_proc->param_specs[j].name);
+      chain_last[j].s = NULL;
+    }
+    g_free (chain_proc->param_specs);
+    chain_proc = NULL;
+  }
+  g_free (chain_choices);
+  chain_choices = NULL;
+
   for (gl = proc_list; gl; gl = gl->next) {
     sw_procedure * p = (sw_procedure *) gl->data;
     if (p && p->custom_data) {
       int j;
 
-      g_free (p->custom_data);
+      lm_custom_free ((lm_custom *)p->custom_data);
       p->custom_data =  NULL;
 
       for (j=0; j < p->nr_params; j++) {
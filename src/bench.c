@@ -0,0 +1,1262 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * sweep-bench: times the editing, filtering, file and playback paths of
+ * Sweep on synthetic sounddata, without opening any windows.
+ *
+ * Built and run by "make bench"; it is not installed. Each result is
+ * printed as one line of JSON (or CSV with --format=csv) so that runs from
+ * different builds can be compared mechanically.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <glib.h>
+#include <gmodule.h>
+
+#include <sndfile.h>
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_undo.h>
+#include <sweep/sweep_sample.h>
+#include <sweep/sweep_sounddata.h>
+#include <sweep/sweep_selection.h>
+#include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_fft.h>
+
+#include "sweep_app.h"
+#include "edit.h"
+#include "head.h"
+#include "interp.h"
+#include "mixbus.h"
+#include "sample-display.h"
+#include "file_sndfile.h"
+#include "scheduler.h"
+#include "plugin.h"
+
+#ifdef HAVE_OGGVORBIS
+extern sw_sample * vorbis_sample_reload (sw_sample * sample);
+#endif
+#ifdef HAVE_SPEEX
+extern sw_sample * speex_sample_reload (sw_sample * sample);
+#endif
+#ifdef HAVE_MAD
+extern sw_sample * mad_sample_reload (sw_sample * sample);
+#endif
+
+/* How often to poll a scheduled operation for completion */
+#define BENCH_POLL_USEC 100
+
+/* Frames per head_read() call; the same block size as the player thread */
+#define BENCH_BLOCK 64
+
+/* Width in pixels of the simulated waveform redraw */
+#define BENCH_RENDER_WIDTH 1024
+
+#define BENCH_MAX_HEADS 256
+
+/* Blocks timed by the naive DFT, which is too slow for the whole sample */
+#define BENCH_DFT_BLOCKS 16
+
+/* Bins of each FFT size checked against the naive DFT */
+#define BENCH_FFT_CHECK_BINS 64
+
+/* Frames of the sparse sample used by --large, and the region edited */
+#define BENCH_LARGE_FRAMES ((G_GINT64_CONSTANT(1) << 31) + (1 << 20))
+#define BENCH_LARGE_START ((G_GINT64_CONSTANT(1) << 31) + 4096)
+#define BENCH_LARGE_WIDTH 1024
+#define BENCH_LARGE_MARK (BENCH_LARGE_START + 8192)
+
+static struct {
+  gdouble seconds;
+  gint channels;
+  gint rate;
+  gint repeat;
+  gchar * heads;
+  gchar * plugin_dir;
+  gchar * tmpdir;
+  gchar * only;
+  gboolean csv;
+  gchar * vorbis_file;
+  gchar * speex_file;
+  gchar * mp3_file;
+  gint interp;
+  gdouble pitch;
+  gint out_channels;
+  gboolean large;
+} opts = {
+  60.0, 2, 44100, 3, "2,8,32", NULL, NULL, NULL, FALSE, NULL, NULL, NULL,
+  INTERP_LINEAR, 1.0, 0, FALSE
+};
+
+static sw_sample * master = NULL;
+
+/* Set by a benchmark whose frame count is only known once it has run */
+static sw_framecount_t bench_frames = -1;
+
+static GList * bench_procs = NULL;
+
+/* Set when a correctness check fails, for the exit status */
+static gboolean bench_failed = FALSE;
+
+/*
+ * Output
+ */
+
+static void
+bench_report_header (void)
+{
+  if (opts.csv) {
+    printf ("bench,version,channels,rate,frames,heads,runs,best_s,mean_s,"
+	    "frames_per_sec,x_realtime\n");
+  }
+}
+
+static void
+bench_report (const char * name, sw_framecount_t nr_frames, gint heads,
+	      gint runs, gdouble best, gdouble mean)
+{
+  gdouble fps = (best > 0.0) ? nr_frames / best : 0.0;
+  gdouble xrt = fps / opts.rate;
+
+  if (opts.csv) {
+    printf ("%s,%s,%d,%d,%" G_GINT64_FORMAT ",%d,%d,%.6f,%.6f,%.1f,%.2f\n",
+	    name, VERSION, opts.channels, opts.rate, (gint64)nr_frames, heads,
+	    runs, best, mean, fps, xrt);
+  } else {
+    printf ("{\"bench\": \"%s\", \"version\": \"%s\", \"channels\": %d, "
+	    "\"rate\": %d, \"frames\": %" G_GINT64_FORMAT ", \"heads\": %d, "
+	    "\"runs\": %d, \"best_s\": %.6f, \"mean_s\": %.6f, "
+	    "\"frames_per_sec\": %.1f, \"x_realtime\": %.2f}\n",
+	    name, VERSION, opts.channels, opts.rate, (gint64)nr_frames, heads,
+	    runs, best, mean, fps, xrt);
+  }
+
+  fflush (stdout);
+}
+
+/*
+ * Synthetic data: a different sine per channel plus a little noise, so
+ * that nothing is silent and normalise has real work to do.
+ */
+static sw_sample *
+bench_make_master (void)
+{
+  sw_sample * s;
+  sw_framecount_t i, nr_frames;
+  float * d;
+  gint c;
+  gdouble freq;
+
+  nr_frames = (sw_framecount_t)(opts.seconds * opts.rate);
+
+  s = sample_new_empty ("bench-master.wav", opts.channels, opts.rate,
+			nr_frames);
+  if (s == NULL) {
+    fprintf (stderr, "sweep-bench: unable to allocate %" G_GINT64_FORMAT
+	     " frames\n", (gint64)nr_frames);
+    exit (1);
+  }
+
+  d = (float *)s->sounddata->data;
+
+  for (c = 0; c < opts.channels; c++) {
+    freq = 110.0 * (c + 1) * 2.0 * M_PI / opts.rate;
+    for (i = 0; i < nr_frames; i++) {
+      d[i*opts.channels + c] =
+	0.5 * sin (freq * i) + 0.01 * ((random () % 2001) - 1000) / 1000.0;
+    }
+  }
+
+  return s;
+}
+
+static sw_sample *
+bench_sample_new (void)
+{
+  sw_sample * s;
+
+  s = sample_new_copy (master);
+  s->edit_ignore_mtime = TRUE;
+
+  return s;
+}
+
+static void
+bench_sample_free (sw_sample * s)
+{
+  trim_registered_ops (s, 0);
+  sample_destroy (s);
+}
+
+/*
+ * Drive a scheduled operation to completion without a GTK main loop,
+ * standing in for the update_edit_progress() timeout.
+ */
+static void
+bench_wait (sw_sample * s)
+{
+  gint tag = s->op_progress_tag;
+
+  while (update_edit_progress (s))
+    g_usleep (BENCH_POLL_USEC);
+
+  if (tag != -1) g_source_remove (tag);
+}
+
+static void
+bench_select (sw_sample * s, gdouble start, gdouble end)
+{
+  sw_framecount_t nr_frames = s->sounddata->nr_frames;
+
+  sample_set_selection_1 (s, (sw_framecount_t)(start * nr_frames),
+			  (sw_framecount_t)(end * nr_frames));
+}
+
+/* Put the middle tenth of s on the clipboard */
+static void
+bench_fill_clipboard (sw_sample * s)
+{
+  bench_select (s, 0.45, 0.55);
+  do_copy (s);
+  bench_wait (s);
+}
+
+/*
+ * Edit benchmarks. Each returns the elapsed time of the timed part in
+ * seconds, or a negative value if it could not run.
+ */
+
+typedef gdouble (*BenchFunc) (gpointer data);
+
+static gdouble
+bench_splice_out (gpointer data)
+{
+  sw_sample * s = bench_sample_new ();
+  gint64 t0;
+
+  bench_select (s, 0.25, 0.75);
+
+  t0 = g_get_monotonic_time ();
+  do_delete (s);
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+
+  return t0 / 1e6;
+}
+
+static gdouble
+bench_splice_in (gpointer data)
+{
+  sw_sample * s = bench_sample_new ();
+  gint64 t0;
+
+  bench_fill_clipboard (s);
+  s->user_offset = s->sounddata->nr_frames / 3;
+
+  t0 = g_get_monotonic_time ();
+  do_paste_insert (s);
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+
+  return t0 / 1e6;
+}
+
+static gdouble
+bench_paste_mix (gpointer data)
+{
+  sw_sample * s = bench_sample_new ();
+  gint64 t0;
+
+  bench_fill_clipboard (s);
+  s->user_offset = s->sounddata->nr_frames / 3;
+
+  t0 = g_get_monotonic_time ();
+  do_paste_mix (s, 0.5, 0.5);
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+
+  return t0 / 1e6;
+}
+
+static gdouble
+bench_paste_xfade (gpointer data)
+{
+  sw_sample * s = bench_sample_new ();
+  gint64 t0;
+
+  bench_fill_clipboard (s);
+  s->user_offset = s->sounddata->nr_frames / 3;
+
+  t0 = g_get_monotonic_time ();
+  do_paste_xfade (s, 0.0, 1.0, 1.0, 0.0);
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+
+  return t0 / 1e6;
+}
+
+/*
+ * Filter plugins, applied to the whole sample
+ */
+
+static void
+bench_load_plugin (const char * name)
+{
+  GModule * module;
+  gchar * dir, * path;
+  gpointer ptr;
+  sw_plugin * plugin;
+  GList * gl;
+
+  if (opts.plugin_dir != NULL) {
+    dir = g_strconcat (opts.plugin_dir, "/", name, "/.libs", NULL);
+  } else {
+    dir = g_strdup (PACKAGE_PLUGIN_DIR);
+  }
+
+  path = g_module_build_path (dir, name);
+  module = g_module_open (path, G_MODULE_BIND_LAZY);
+
+  if (module == NULL) {
+    fprintf (stderr, "sweep-bench: %s\n", g_module_error ());
+  } else if (g_module_symbol (module, "plugin", &ptr)) {
+    plugin = (sw_plugin *)ptr;
+    for (gl = plugin->plugin_init (); gl; gl = gl->next)
+      bench_procs = g_list_append (bench_procs, gl->data);
+  }
+
+  g_free (path);
+  g_free (dir);
+}
+
+static sw_procedure *
+bench_find_proc (const char * name)
+{
+  GList * gl;
+  sw_procedure * proc;
+
+  for (gl = bench_procs; gl; gl = gl->next) {
+    proc = (sw_procedure *)gl->data;
+    if (!strcmp (proc->name, name)) return proc;
+  }
+
+  return NULL;
+}
+
+static gdouble
+bench_filter (gpointer data)
+{
+  sw_procedure * proc = (sw_procedure *)data;
+  sw_param_set pset = NULL;
+  sw_sample * s = bench_sample_new ();
+  gint64 t0;
+
+  if (proc->nr_params > 0) {
+    pset = g_malloc0 (proc->nr_params * sizeof (sw_param));
+    if (proc->suggest)
+      proc->suggest (s, pset, proc->custom_data);
+  }
+
+  /* Echo suggests a zero delay and gain; give it something to do */
+  if (!strcmp (proc->name, "Echo")) {
+    pset[0].f = 0.25;
+    pset[1].f = 0.5;
+  }
+
+  bench_select (s, 0.0, 1.0);
+
+  t0 = g_get_monotonic_time ();
+  procedure_apply (proc, s, pset);
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+  g_free (pset);
+
+  return t0 / 1e6;
+}
+
+/*
+ * File save and load through libsndfile
+ */
+
+static gchar *
+bench_tmp_path (const char * ext)
+{
+  const char * dir = opts.tmpdir ? opts.tmpdir : g_get_tmp_dir ();
+
+  return g_strdup_printf ("%s/sweep-bench-%d.%s", dir, (int)getpid (), ext);
+}
+
+static gdouble
+bench_sndfile_save_as (int sf_format, const char * path)
+{
+  sw_sample * s = bench_sample_new ();
+  SF_INFO * sfinfo;
+  gint64 t0;
+
+  sfinfo = g_malloc0 (sizeof (SF_INFO));
+  sfinfo->format = sf_format;
+  sfinfo->channels = opts.channels;
+  s->file_info = sfinfo;
+  s->file_method = SWEEP_FILE_METHOD_LIBSNDFILE;
+
+  t0 = g_get_monotonic_time ();
+  sndfile_sample_save (s, g_strdup (path));
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_sample_free (s);
+
+  return t0 / 1e6;
+}
+
+static gdouble
+bench_sndfile_save (gpointer data)
+{
+  int sf_format = GPOINTER_TO_INT (data);
+  gchar * path = bench_tmp_path ("wav");
+  gdouble t;
+
+  t = bench_sndfile_save_as (sf_format, path);
+
+  unlink (path);
+  g_free (path);
+
+  return t;
+}
+
+typedef sw_sample * (*BenchReloadFunc) (sw_sample * sample);
+
+static sw_sample *
+bench_sndfile_reload (sw_sample * s)
+{
+  return sndfile_sample_reload (s, FALSE);
+}
+
+static gdouble
+bench_reload (BenchReloadFunc reload, const char * path)
+{
+  sw_sample * s;
+  gint64 t0;
+
+  s = sample_new_empty ((gchar *)path, opts.channels, opts.rate, 0);
+
+  t0 = g_get_monotonic_time ();
+  if (reload (s) == NULL) {
+    sample_destroy (s);
+    return -1.0;
+  }
+  bench_wait (s);
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_frames = s->sounddata->nr_frames;
+
+  /* The master sample stays in the bank, so this never empties it */
+  sample_bank_remove (s);
+
+  return t0 / 1e6;
+}
+
+static gdouble
+bench_sndfile_load (gpointer data)
+{
+  int sf_format = GPOINTER_TO_INT (data);
+  gchar * path = bench_tmp_path ("wav");
+  gdouble t;
+
+  if (bench_sndfile_save_as (sf_format, path) < 0.0) {
+    t = -1.0;
+  } else {
+    t = bench_reload (bench_sndfile_reload, path);
+  }
+
+  unlink (path);
+  g_free (path);
+
+  return t;
+}
+
+#if defined (HAVE_OGGVORBIS) || defined (HAVE_SPEEX) || defined (HAVE_MAD)
+typedef struct {
+  BenchReloadFunc reload;
+  const char * path;
+} bench_load_data;
+
+static gdouble
+bench_codec_load (gpointer data)
+{
+  bench_load_data * ld = (bench_load_data *)data;
+
+  return bench_reload (ld->reload, ld->path);
+}
+#endif
+
+/*
+ * Waveform rendering: the per-column data pass of a full redraw of the
+ * whole sample at BENCH_RENDER_WIDTH pixels, as sample-display does it.
+ */
+static gdouble
+bench_render (gpointer data)
+{
+  sw_sounddata * sounddata = master->sounddata;
+  sw_framecount_t nr_frames = sounddata->nr_frames;
+  sw_framecount_t step, start, end;
+  sw_column_peaks peaks;
+  gdouble per_pixel;
+  gint x, c;
+  gint64 t0;
+
+  per_pixel = (gdouble)nr_frames / BENCH_RENDER_WIDTH;
+  step = MAX (1, (sw_framecount_t)per_pixel / SAMPLE_DISPLAY_STEP_MAX);
+
+  t0 = g_get_monotonic_time ();
+
+  for (c = 0; c < opts.channels; c++) {
+    for (x = 0; x < BENCH_RENDER_WIDTH; x++) {
+      start = (sw_framecount_t)(x * per_pixel);
+      end = MIN (nr_frames, (sw_framecount_t)((x+1) * per_pixel));
+      sample_display_scan_column ((float *)sounddata->data, opts.channels,
+				  c, start, end, step, &peaks);
+    }
+  }
+
+  t0 = g_get_monotonic_time () - t0;
+
+  return t0 / 1e6;
+}
+
+/*
+ * Playback mixing: N looping heads over the master sample, each read in
+ * player-sized blocks and mixed into one device buffer. The reported frame
+ * count is per head, so x_realtime is how many times faster than realtime
+ * N simultaneous heads can be mixed.
+ */
+static gdouble
+bench_heads (gpointer data)
+{
+  gint nr_heads = GPOINTER_TO_INT (data);
+  sw_head * heads[BENCH_MAX_HEADS];
+  sw_framecount_t nr_frames, done;
+  float * buf, * mix;
+  gint h, nr_samples = BENCH_BLOCK * opts.out_channels;
+  gint64 t0;
+
+  nr_frames = master->sounddata->nr_frames;
+
+  buf = g_malloc (BENCH_BLOCK * opts.channels * sizeof (float));
+  mix = g_malloc (nr_samples * sizeof (float));
+
+  for (h = 0; h < nr_heads; h++) {
+    heads[h] = head_new (master, SWEEP_HEAD_PLAY);
+    heads[h]->looping = TRUE;
+    heads[h]->offset = (nr_frames / nr_heads) * h;
+    heads[h]->rate = opts.pitch;
+    heads[h]->delta = opts.pitch;
+    heads[h]->going = TRUE;
+
+    if (opts.interp != INTERP_LINEAR)
+      heads[h]->interp = interp_new (opts.channels, opts.interp);
+  }
+
+  t0 = g_get_monotonic_time ();
+
+  for (done = 0; done < nr_frames; done += BENCH_BLOCK) {
+    memset (mix, 0, nr_samples * sizeof (float));
+    for (h = 0; h < nr_heads; h++) {
+      head_read (heads[h], buf, BENCH_BLOCK, opts.rate);
+      mixbus_add (mix, opts.out_channels, buf, opts.channels, NULL,
+		  heads[h]->gain, heads[h]->gain, BENCH_BLOCK);
+    }
+  }
+
+  t0 = g_get_monotonic_time () - t0;
+
+  for (h = 0; h < nr_heads; h++) {
+    interp_free (heads[h]->interp);
+    g_mutex_clear (&heads[h]->head_mutex);
+    g_mutex_clear (&heads[h]->insert_mutex);
+    g_free (heads[h]);
+  }
+
+  g_free (mix);
+  g_free (buf);
+
+  return t0 / 1e6;
+}
+
+/*
+ * The mix bus alone: N pre-rendered head blocks mixed into a device
+ * buffer, every other head with a gain ramp, so that the cost of mixing
+ * can be seen apart from reading and interpolation.
+ */
+static gdouble
+bench_mixbus (gpointer data)
+{
+  gint nr_heads = GPOINTER_TO_INT (data);
+  sw_framecount_t nr_frames, done;
+  float * bufs, * mix;
+  gint h, in_samples = BENCH_BLOCK * opts.channels;
+  gint out_samples = BENCH_BLOCK * opts.out_channels;
+  gfloat from, to;
+  gint64 t0;
+
+  nr_frames = master->sounddata->nr_frames;
+
+  bufs = g_malloc (nr_heads * in_samples * sizeof (float));
+  mix = g_malloc (out_samples * sizeof (float));
+
+  for (h = 0; h < nr_heads; h++) {
+    memcpy (bufs + h * in_samples,
+	    (float *)master->sounddata->data + h * in_samples,
+	    in_samples * sizeof (float));
+  }
+
+  t0 = g_get_monotonic_time ();
+
+  for (done = 0; done < nr_frames; done += BENCH_BLOCK) {
+    memset (mix, 0, out_samples * sizeof (float));
+    for (h = 0; h < nr_heads; h++) {
+      from = 0.5;
+      to = (h & 1) ? 0.6 : 0.5;
+      mixbus_add (mix, opts.out_channels, bufs + h * in_samples,
+		  opts.channels, NULL, from, to, BENCH_BLOCK);
+    }
+  }
+
+  t0 = g_get_monotonic_time () - t0;
+
+  g_free (mix);
+  g_free (bufs);
+
+  return t0 / 1e6;
+}
+
+/*
+ * FFT: sw_fft over consecutive blocks of the first channel (and the
+ * second as the imaginary part, for complex transforms), after checking
+ * a spread of its bins against a naive DFT in double precision and the
+ * inverse transform against the input. The naive DFT is also timed by
+ * itself over a few blocks, for comparison.
+ */
+typedef struct {
+  sw_fft_type type;
+  gint n;
+} bench_fft_data;
+
+static float *
+bench_channel (gint c)
+{
+  float * d = (float *)master->sounddata->data;
+  sw_framecount_t i, nr_frames = master->sounddata->nr_frames;
+  float * buf;
+
+  c %= opts.channels;
+  buf = g_malloc (nr_frames * sizeof (float));
+  for (i = 0; i < nr_frames; i++)
+    buf[i] = d[i*opts.channels + c];
+
+  return buf;
+}
+
+/* Bin k of the DFT of n points of re, im (im may be NULL) */
+static void
+bench_dft_bin (const float * re, const float * im, gint n, gint k,
+	       gdouble * out_re, gdouble * out_im)
+{
+  gdouble sr = 0.0, si = 0.0, a, c, s;
+  gint t;
+
+  for (t = 0; t < n; t++) {
+    a = -2.0 * M_PI * (gdouble)(((gint64)k * t) % n) / n;
+    c = cos (a); s = sin (a);
+    sr += re[t] * c - (im ? im[t] * s : 0.0);
+    si += re[t] * s + (im ? im[t] * c : 0.0);
+  }
+
+  *out_re = sr;
+  *out_im = si;
+}
+
+static gboolean
+bench_fft_check (bench_fft_data * fd, sw_fft_plan * plan,
+		 const float * re, const float * im)
+{
+  gint n = fd->n, nr_bins, i, k;
+  float * out_re, * out_im, * back_re, * back_im;
+  gdouble energy = 0.0, err = 0.0, rt_err = 0.0, dr, di;
+
+  nr_bins = (fd->type == SW_FFT_REAL) ? n/2 + 1 : n;
+  out_re = g_malloc (nr_bins * sizeof (float));
+  out_im = g_malloc (nr_bins * sizeof (float));
+
+  if (fd->type == SW_FFT_REAL) {
+    sw_fft_real_forward (plan, re, out_re, out_im, NULL);
+  } else {
+    sw_fft_complex (plan, SW_FFT_FORWARD, re, im, out_re, out_im, NULL);
+  }
+
+  for (i = 0; i < n; i++) {
+    energy += re[i] * re[i];
+    if (fd->type == SW_FFT_COMPLEX) energy += im[i] * im[i];
+  }
+
+  for (i = 0; i < BENCH_FFT_CHECK_BINS; i++) {
+    k = (gint)(((gint64)i * nr_bins) / BENCH_FFT_CHECK_BINS);
+    bench_dft_bin (re, fd->type == SW_FFT_REAL ? NULL : im, n, k, &dr, &di);
+    err = MAX (err, fabs (dr - out_re[k]) + fabs (di - out_im[k]));
+  }
+
+  /* Transform back, which should give the input scaled by n */
+  back_re = g_malloc (n * sizeof (float));
+  back_im = g_malloc (n * sizeof (float));
+
+  if (fd->type == SW_FFT_REAL) {
+    sw_fft_real_inverse (plan, out_re, out_im, back_re, NULL);
+  } else {
+    sw_fft_complex (plan, SW_FFT_INVERSE, out_re, out_im, back_re, back_im,
+		    NULL);
+  }
+
+  for (i = 0; i < n; i++) {
+    dr = back_re[i] - (gdouble)n * re[i];
+    rt_err += dr * dr;
+    if (fd->type == SW_FFT_COMPLEX) {
+      di = back_im[i] - (gdouble)n * im[i];
+      rt_err += di * di;
+    }
+  }
+  rt_err = sqrt (rt_err);
+
+  g_free (back_im);
+  g_free (back_re);
+  g_free (out_im);
+  g_free (out_re);
+
+  /*
+   * Float rounding error grows with log n, relative to the norm of the
+   * input; a real fault in a kernel is of the order of the norm itself.
+   */
+  if (err > 1e-4 * sqrt (energy)) {
+    fprintf (stderr, "sweep-bench: FFT of %d points is off by %g\n", n, err);
+    bench_failed = TRUE;
+    return FALSE;
+  }
+
+  if (rt_err > 1e-4 * n * sqrt (energy)) {
+    fprintf (stderr, "sweep-bench: inverse FFT of %d points is off by %g\n",
+	     n, rt_err / n);
+    bench_failed = TRUE;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gdouble
+bench_fft (gpointer data)
+{
+  bench_fft_data * fd = (bench_fft_data *)data;
+  sw_framecount_t nr_frames = master->sounddata->nr_frames, offset;
+  sw_fft_plan * plan;
+  float * re, * im, * out_re, * out_im, * work;
+  gdouble secs = -1.0;
+  gint64 t0;
+
+  if (nr_frames < fd->n) return -1.0;
+
+  if ((plan = sw_fft_plan_get (fd->type, fd->n)) == NULL) return -1.0;
+
+  re = bench_channel (0);
+  im = bench_channel (1);
+  out_re = g_malloc (fd->n * sizeof (float));
+  out_im = g_malloc (fd->n * sizeof (float));
+  work = g_malloc (sw_fft_work_size (plan) * sizeof (float));
+
+  if (!bench_fft_check (fd, plan, re, im))
+    goto out;
+
+  t0 = g_get_monotonic_time ();
+
+  for (offset = 0; offset + fd->n <= nr_frames; offset += fd->n) {
+    if (fd->type == SW_FFT_REAL) {
+      sw_fft_real_forward (plan, re + offset, out_re, out_im, work);
+    } else {
+      sw_fft_complex (plan, SW_FFT_FORWARD, re + offset, im + offset,
+		      out_re, out_im, work);
+    }
+  }
+
+  secs = (g_get_monotonic_time () - t0) / 1e6;
+
+  bench_frames = offset;
+
+ out:
+  g_free (work);
+  g_free (out_im);
+  g_free (out_re);
+  g_free (im);
+  g_free (re);
+
+  return secs;
+}
+
+/* The textbook real DFT, with the twiddles from a table */
+static gdouble
+bench_dft_naive (gpointer data)
+{
+  bench_fft_data * fd = (bench_fft_data *)data;
+  gint n = fd->n, b, k, t, j;
+  float * re, * cos_n, * sin_n, * x;
+  gfloat sr, si;
+  volatile gfloat sink = 0.0;
+  gint64 t0;
+
+  if (master->sounddata->nr_frames < (sw_framecount_t)n * BENCH_DFT_BLOCKS)
+    return -1.0;
+
+  re = bench_channel (0);
+  cos_n = g_malloc (n * sizeof (float));
+  sin_n = g_malloc (n * sizeof (float));
+  for (t = 0; t < n; t++) {
+    cos_n[t] = cos (-2.0 * M_PI * t / n);
+    sin_n[t] = sin (-2.0 * M_PI * t / n);
+  }
+
+  t0 = g_get_monotonic_time ();
+
+  for (b = 0; b < BENCH_DFT_BLOCKS; b++) {
+    x = re + b * n;
+    for (k = 0; k <= n/2; k++) {
+      sr = si = 0.0;
+      for (t = 0, j = 0; t < n; t++) {
+	sr += x[t] * cos_n[j];
+	si += x[t] * sin_n[j];
+	if ((j += k) >= n) j -= n;
+      }
+      sink += sr + si;
+    }
+  }
+
+  t0 = g_get_monotonic_time () - t0;
+
+  bench_frames = (sw_framecount_t)n * BENCH_DFT_BLOCKS;
+
+  g_free (sin_n);
+  g_free (cos_n);
+  g_free (re);
+
+  return t0 / 1e6;
+}
+
+/*
+ * Large offsets: a mono sample of more than 2^31 frames (8 GB of floats),
+ * left zero-filled by sounddata_new_empty() so that only the pages near
+ * the edited region are ever touched. A ramp past 2^31 is selected,
+ * reversed, cut and pasted back in place, and the selection, the sample
+ * length and the data around it are checked at each step.
+ */
+
+static gboolean
+bench_large_expect (const char * what, gint64 got, gint64 want)
+{
+  if (got == want) return TRUE;
+
+  fprintf (stderr, "sweep-bench: large: %s is %" G_GINT64_FORMAT
+	   ", expected %" G_GINT64_FORMAT "\n", what, got, want);
+  bench_failed = TRUE;
+
+  return FALSE;
+}
+
+/* Check that the ramp is at start, reversed or not, with silence around */
+static gboolean
+bench_large_check_ramp (sw_sample * s, const char * what,
+			sw_framecount_t start, gboolean reversed)
+{
+  float * d = (float *)s->sounddata->data;
+  gint k, want;
+
+  for (k = -1; k <= BENCH_LARGE_WIDTH; k++) {
+    if (k < 0 || k == BENCH_LARGE_WIDTH)
+      want = 0;
+    else
+      want = reversed ? BENCH_LARGE_WIDTH - k : k + 1;
+
+    if (d[start + k] * BENCH_LARGE_WIDTH != want) {
+      fprintf (stderr, "sweep-bench: large: after %s, frame %" G_GINT64_FORMAT
+	       " is %g, expected %g\n", what, (gint64)(start + k),
+	       d[start + k], (gdouble)want / BENCH_LARGE_WIDTH);
+      bench_failed = TRUE;
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static gdouble
+bench_large (gpointer data)
+{
+  sw_sample * s;
+  sw_sounddata * sounddata;
+  sw_sel * sel;
+  sw_procedure * proc;
+  float * d;
+  gint k;
+  gdouble secs = -1.0;
+  gint64 t0;
+
+  s = sample_new_empty ("bench-large.wav", 1, opts.rate, BENCH_LARGE_FRAMES);
+  if (s == NULL || s->sounddata == NULL) {
+    fprintf (stderr, "sweep-bench: large: unable to allocate %"
+	     G_GINT64_FORMAT " frames\n", (gint64)BENCH_LARGE_FRAMES);
+    return -1.0;
+  }
+  s->edit_ignore_mtime = TRUE;
+  sounddata = s->sounddata;
+
+  d = (float *)sounddata->data;
+  for (k = 0; k < BENCH_LARGE_WIDTH; k++)
+    d[BENCH_LARGE_START + k] = (gfloat)(k + 1) / BENCH_LARGE_WIDTH;
+  d[BENCH_LARGE_MARK] = 0.75;
+
+  t0 = g_get_monotonic_time ();
+
+  /* Selection offsets */
+  sample_set_selection_1 (s, BENCH_LARGE_START,
+			  BENCH_LARGE_START + BENCH_LARGE_WIDTH);
+  sel = (sw_sel *)sounddata->sels->data;
+  if (!bench_large_expect ("selection start", sel->sel_start,
+			   BENCH_LARGE_START) ||
+      !bench_large_expect ("selected frames",
+			   sounddata_selection_nr_frames (sounddata),
+			   BENCH_LARGE_WIDTH) ||
+      !bench_large_expect ("selection width",
+			   sounddata_selection_width (sounddata),
+			   BENCH_LARGE_WIDTH))
+    goto out;
+
+  sounddata_selection_translate (sounddata, BENCH_LARGE_WIDTH / 2);
+  sel = (sw_sel *)sounddata->sels->data;
+  if (!bench_large_expect ("translated selection start", sel->sel_start,
+			   BENCH_LARGE_START + BENCH_LARGE_WIDTH / 2))
+    goto out;
+  sounddata_selection_translate (sounddata, -BENCH_LARGE_WIDTH / 2);
+
+  /* Filter */
+  if ((proc = bench_find_proc ("Reverse")) == NULL) {
+    fprintf (stderr, "sweep-bench: large: no plugin for Reverse, "
+	     "not checking filters\n");
+    bench_large_check_ramp (s, "setup", BENCH_LARGE_START, FALSE);
+  } else {
+    procedure_apply (proc, s, NULL);
+    bench_wait (s);
+  }
+  if (!bench_large_check_ramp (s, "Reverse", BENCH_LARGE_START,
+			       proc != NULL))
+    goto out;
+
+  /* Splice out, and back in at the same offset */
+  do_cut (s);
+  bench_wait (s);
+  sounddata = s->sounddata;
+  d = (float *)sounddata->data;
+  if (!bench_large_expect ("length after cut", sounddata->nr_frames,
+			   BENCH_LARGE_FRAMES - BENCH_LARGE_WIDTH) ||
+      !bench_large_expect ("marker after cut",
+			   (gint64)(d[BENCH_LARGE_MARK - BENCH_LARGE_WIDTH]
+				    * 4), 3))
+    goto out;
+
+  s->user_offset = BENCH_LARGE_START;
+  do_paste_insert (s);
+  bench_wait (s);
+  sounddata = s->sounddata;
+  d = (float *)sounddata->data;
+  if (!bench_large_expect ("length after paste", sounddata->nr_frames,
+			   BENCH_LARGE_FRAMES) ||
+      !bench_large_expect ("marker after paste",
+			   (gint64)(d[BENCH_LARGE_MARK] * 4), 3) ||
+      !bench_large_check_ramp (s, "paste", BENCH_LARGE_START, proc != NULL))
+    goto out;
+
+  sel = (sw_sel *)sounddata->sels->data;
+  if (!bench_large_expect ("pasted selection start", sel->sel_start,
+			   BENCH_LARGE_START) ||
+      !bench_large_expect ("pasted selection end", sel->sel_end,
+			   BENCH_LARGE_START + BENCH_LARGE_WIDTH))
+    goto out;
+
+  secs = (g_get_monotonic_time () - t0) / 1e6;
+
+ out:
+  bench_sample_free (s);
+
+  return secs;
+}
+
+/*
+ * Driver
+ */
+
+static void
+bench_run (const char * name, BenchFunc func, gpointer data,
+	   sw_framecount_t nr_frames, gint heads)
+{
+  gint i, runs = 0;
+  gdouble t, best = -1.0, total = 0.0;
+
+  if (opts.only != NULL && strstr (name, opts.only) == NULL)
+    return;
+
+  bench_frames = -1;
+
+  for (i = 0; i < opts.repeat; i++) {
+    t = func (data);
+    if (t < 0.0) {
+      fprintf (stderr, "sweep-bench: %s failed, skipping\n", name);
+      return;
+    }
+    if (best < 0.0 || t < best) best = t;
+    total += t;
+    runs++;
+  }
+
+  if (bench_frames >= 0) nr_frames = bench_frames;
+
+  bench_report (name, nr_frames, heads, runs, best, total / runs);
+}
+
+static void
+usage (const char * progname)
+{
+  printf ("Usage: %s [option ...]\n", progname);
+  printf ("Valid options are:\n");
+  printf ("  --seconds=N       Length of synthetic data (60 to 14400, default 60)\n");
+  printf ("  --channels=N      Number of channels (1 to 16, default 2)\n");
+  printf ("  --rate=N          Sample rate (default 44100)\n");
+  printf ("  --repeat=N        Runs per benchmark; best and mean are reported\n");
+  printf ("  --heads=LIST      Comma-separated playback head counts (default 2,8,32)\n");
+  printf ("  --out-channels=N  Device channels heads are mixed to (default --channels)\n");
+  printf ("  --plugin-dir=DIR  Build tree plugins directory\n");
+  printf ("  --tmpdir=DIR      Directory for temporary sound files\n");
+  printf ("  --only=NAME       Only run benchmarks whose name contains NAME\n");
+  printf ("  --format=json|csv Output format (default json, one line per result)\n");
+  printf ("  --vorbis=FILE     Also time loading this Ogg Vorbis file\n");
+  printf ("  --speex=FILE      Also time loading this Ogg Speex file\n");
+  printf ("  --mp3=FILE        Also time loading this MPEG audio file\n");
+  printf ("  --interp=N        Head interpolation quality, 0 (linear) to 3 (best)\n");
+  printf ("  --pitch=X         Head playback rate (default 1.0)\n");
+  printf ("  --large           Also check editing offsets past 2^31 frames, on a\n"
+	  "                    sparse 8 GB sample\n");
+}
+
+static gboolean
+parse_option (const char * arg, const char * name, const char ** value)
+{
+  size_t len = strlen (name);
+
+  if (strncmp (arg, name, len) != 0 || arg[len] != '=') return FALSE;
+
+  *value = arg + len + 1;
+  return TRUE;
+}
+
+int
+main (int argc, char * argv[])
+{
+  const char * v;
+  gchar ** counts, ** c;
+  sw_framecount_t nr_frames;
+  sw_procedure * proc;
+  gint i, n;
+  static const char * filters[] = {
+    "Normalise", "Reverse", "Fade in", "Echo", NULL
+  };
+  static const char * filter_plugins[] = {
+    "normalise", "reverse", "fade", "echo", NULL
+  };
+  static bench_fft_data ffts[] = {
+    { SW_FFT_REAL, 1024 },
+    { SW_FFT_REAL, 4096 },
+    { SW_FFT_REAL, 44100 },
+    { SW_FFT_REAL, 1250 },
+    { SW_FFT_REAL, 2002 },
+    { SW_FFT_COMPLEX, 4096 },
+    { SW_FFT_COMPLEX, 3000 },
+    { SW_FFT_COMPLEX, 2187 },
+    { SW_FFT_COMPLEX, 251 },
+  };
+
+  for (i = 1; i < argc; i++) {
+    if (parse_option (argv[i], "--seconds", &v)) {
+      opts.seconds = CLAMP (atof (v), 60.0, 14400.0);
+    } else if (parse_option (argv[i], "--channels", &v)) {
+      opts.channels = CLAMP (atoi (v), 1, 16);
+    } else if (parse_option (argv[i], "--rate", &v)) {
+      opts.rate = MAX (atoi (v), 1);
+    } else if (parse_option (argv[i], "--repeat", &v)) {
+      opts.repeat = MAX (atoi (v), 1);
+    } else if (parse_option (argv[i], "--heads", &v)) {
+      opts.heads = (gchar *)v;
+    } else if (parse_option (argv[i], "--out-channels", &v)) {
+      opts.out_channels = CLAMP (atoi (v), 1, 16);
+    } else if (parse_option (argv[i], "--plugin-dir", &v)) {
+      opts.plugin_dir = (gchar *)v;
+    } else if (parse_option (argv[i], "--tmpdir", &v)) {
+      opts.tmpdir = (gchar *)v;
+    } else if (parse_option (argv[i], "--only", &v)) {
+      opts.only = (gchar *)v;
+    } else if (parse_option (argv[i], "--format", &v)) {
+      opts.csv = !strcmp (v, "csv");
+    } else if (parse_option (argv[i], "--vorbis", &v)) {
+      opts.vorbis_file = (gchar *)v;
+    } else if (parse_option (argv[i], "--speex", &v)) {
+      opts.speex_file = (gchar *)v;
+    } else if (parse_option (argv[i], "--mp3", &v)) {
+      opts.mp3_file = (gchar *)v;
+    } else if (parse_option (argv[i], "--interp", &v)) {
+      opts.interp = CLAMP (atoi (v), INTERP_LINEAR, INTERP_MAX - 1);
+    } else if (parse_option (argv[i], "--pitch", &v)) {
+      opts.pitch = CLAMP (atof (v), 0.01, 16.0);
+    } else if (!strcmp (argv[i], "--large")) {
+      opts.large = TRUE;
+    } else {
+      usage (argv[0]);
+      exit (strcmp (argv[i], "--help") ? 1 : 0);
+    }
+  }
+
+  if (opts.out_channels == 0)
+    opts.out_channels = opts.channels;
+
+  srandom (1);
+
+  init_scheduler ();
+
+  for (i = 0; filter_plugins[i]; i++)
+    bench_load_plugin (filter_plugins[i]);
+
+  master = bench_make_master ();
+  sample_bank_add (master);
+  nr_frames = master->sounddata->nr_frames;
+
+  bench_report_header ();
+
+  bench_run ("splice_out", bench_splice_out, NULL, nr_frames / 2, 0);
+  bench_run ("splice_in", bench_splice_in, NULL, nr_frames / 10, 0);
+  bench_run ("paste_mix", bench_paste_mix, NULL, nr_frames / 10, 0);
+  bench_run ("paste_xfade", bench_paste_xfade, NULL, nr_frames / 10, 0);
+
+  for (i = 0; filters[i]; i++) {
+    gchar * name;
+
+    if ((proc = bench_find_proc (filters[i])) == NULL) {
+      fprintf (stderr, "sweep-bench: no plugin for %s, skipping\n",
+	       filters[i]);
+      continue;
+    }
+
+    name = g_ascii_strdown (filters[i], -1);
+    g_strdelimit (name, " ", '_');
+    bench_run (name, bench_filter, proc, nr_frames, 0);
+    g_free (name);
+  }
+
+  bench_run ("sndfile_save_wav_float", bench_sndfile_save,
+	     GINT_TO_POINTER (SF_FORMAT_WAV | SF_FORMAT_FLOAT), nr_frames, 0);
+  bench_run ("sndfile_save_wav_pcm16", bench_sndfile_save,
+	     GINT_TO_POINTER (SF_FORMAT_WAV | SF_FORMAT_PCM_16), nr_frames, 0);
+  bench_run ("sndfile_load_wav_float", bench_sndfile_load,
+	     GINT_TO_POINTER (SF_FORMAT_WAV | SF_FORMAT_FLOAT), 0, 0);
+  bench_run ("sndfile_load_wav_pcm16", bench_sndfile_load,
+	     GINT_TO_POINTER (SF_FORMAT_WAV | SF_FORMAT_PCM_16), 0, 0);
+
+#ifdef HAVE_OGGVORBIS
+  if (opts.vorbis_file) {
+    bench_load_data ld = { vorbis_sample_reload, opts.vorbis_file };
+    bench_run ("vorbis_load", bench_codec_load, &ld, 0, 0);
+  }
+#endif
+#ifdef HAVE_SPEEX
+  if (opts.speex_file) {
+    bench_load_data ld = { speex_sample_reload, opts.speex_file };
+    bench_run ("speex_load", bench_codec_load, &ld, 0, 0);
+  }
+#endif
+#ifdef HAVE_MAD
+  if (opts.mp3_file) {
+    bench_load_data ld = { mad_sample_reload, opts.mp3_file };
+    bench_run ("mad_load", bench_codec_load, &ld, 0, 0);
+  }
+#endif
+
+  bench_run ("render", bench_render, NULL, nr_frames, 0);
+
+  for (i = 0; i < G_N_ELEMENTS (ffts); i++) {
+    gchar name[32];
+
+    g_snprintf (name, sizeof (name), "fft_%s_%d",
+		ffts[i].type == SW_FFT_REAL ? "real" : "complex", ffts[i].n);
+    bench_run (name, bench_fft, &ffts[i], nr_frames, 0);
+
+    if (ffts[i].type == SW_FFT_REAL && ffts[i].n <= 4096) {
+      g_snprintf (name, sizeof (name), "dft_naive_%d", ffts[i].n);
+      bench_run (name, bench_dft_naive, &ffts[i], nr_frames, 0);
+    }
+  }
+
+  counts = g_strsplit (opts.heads, ",", 0);
+  for (c = counts; *c; c++) {
+    gchar name[32];
+
+    n = CLAMP (atoi (*c), 1, BENCH_MAX_HEADS);
+    g_snprintf (name, sizeof (name), "head_read_%d", n);
+    bench_run (name, bench_heads, GINT_TO_POINTER (n), nr_frames, n);
+
+    g_snprintf (name, sizeof (name), "mixbus_%d", n);
+    bench_run (name, bench_mixbus, GINT_TO_POINTER (n), nr_frames, n);
+  }
+  g_strfreev (counts);
+
+  if (opts.large)
+    bench_run ("large_offsets", bench_large, NULL, BENCH_LARGE_FRAMES, 0);
+
+  exit (bench_failed ? 1 : 0);
+}
@@ -372,6 +372,13 @@ sample_set_color_cb (GtkWidget * widget, gpointer data)
   sample_set_color (view->sample, color);
 }
 
+void
+spectrogram_toggle_cb (GtkWidget * widget, gpointer data)
+{
+  sw_view * view = (sw_view *)data;
+  view_set_spectrogram (view, !view->spectrogram);
+}
+
 /* Playback */
 
 void
@@ -92,6 +92,9 @@ zoom_combo_changed_cb (GtkWidget * widget, gpointer data);
 void
 sample_set_color_cb (GtkWidget * widget, gpointer data);
 
+void
+spectrogram_toggle_cb (GtkWidget * widget, gpointer data);
+
 void
 device_config_cb (GtkWidget * widget, gpointer data);
 
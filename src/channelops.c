@@ -492,6 +492,8 @@ do_stereo_swap (sw_sample * sample, gpointer data)
 
     g_mutex_unlock (&sample->ops_mutex);
   }
+
+  sample_data_changed (sample, 0, run_total);
 }
 
 static void
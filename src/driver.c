@@ -43,6 +43,8 @@
 #include "driver.h"
 #include "preferences.h"
 #include "pcmio.h"
+#include "play.h"
+#include "interp.h"
 
 #define ARRAY_LEN(x) ((int) (sizeof (x)) / (sizeof (x [0])))
 
@@ -50,6 +52,8 @@ extern sw_driver * driver_alsa;
 extern sw_driver * driver_oss;
 extern sw_driver * driver_pulseaudio;
 extern sw_driver * driver_solaris;
+extern sw_driver * driver_null;
+extern sw_driver * driver_file;
 
 static sw_driver * driver_table [10];
 
@@ -194,6 +198,18 @@ config_dev_dsp_dialog_ok_cb (GtkWidget * widget, gpointer data)
     prefs_set_int (USE_MONITOR_KEY, 0);
   }
 
+  prefs_set_int (INTERP_QUALITY_KEY, gtk_combo_box_get_active
+		 (GTK_COMBO_BOX(g_object_get_data (G_OBJECT(dialog),
+						   "interp_combo"))));
+
+  play_set_realtime (gtk_toggle_button_get_active
+		     (GTK_TOGGLE_BUTTON(g_object_get_data (G_OBJECT(dialog),
+							   "realtime_chb"))));
+
+  prefs_set_int (ALSA_MMAP_KEY, gtk_toggle_button_get_active
+		 (GTK_TOGGLE_BUTTON(g_object_get_data (G_OBJECT(dialog),
+						       "mmap_chb"))));
+
   gtk_widget_hide (dialog);
 }
 
@@ -378,6 +394,66 @@ pcmio_buffering_default_cb (GtkWidget * widget, gpointer data)
   set_buff_adj (dialog, DEFAULT_LOG_FRAGS);
 }
 
+static gboolean
+realtime_stats_update (gpointer data)
+{
+  GtkWidget * label = GTK_WIDGET (data);
+  gint late, worst_usec, period_usec;
+  gint dev_xruns, dev_worst_usec, limits;
+  sw_interp_quality ceiling;
+  gchar buf[192];
+  gchar * text;
+
+  play_get_stats (&late, &worst_usec, &period_usec);
+  device_get_xruns (&dev_xruns, &dev_worst_usec);
+  interp_get_limits (&limits, &ceiling);
+
+  if (period_usec > 0) {
+    g_snprintf (buf, sizeof (buf),
+		_("Late periods: %d    Worst period: %.2f ms of %.2f ms"),
+		late, worst_usec / 1000.0, period_usec / 1000.0);
+  } else {
+    g_snprintf (buf, sizeof (buf), _("Late periods: %d"), late);
+  }
+
+  if (limits > 0 && ceiling < INTERP_MAX - 1) {
+    text = g_strdup (buf);
+    g_snprintf (buf, sizeof (buf), _("%s\nInterpolation limited to %s"),
+		text, interp_quality_name (ceiling));
+    g_free (text);
+  }
+
+  if (dev_xruns > 0) {
+    text = g_strdup_printf (_("%s\nDevice xruns: %d    Longest: %.2f ms"),
+			    buf, dev_xruns, dev_worst_usec / 1000.0);
+    gtk_label_set_text (GTK_LABEL(label), text);
+    g_free (text);
+  } else {
+    gtk_label_set_text (GTK_LABEL(label), buf);
+  }
+
+  return TRUE;
+}
+
+static guint realtime_stats_tag = 0;
+
+static void
+realtime_stats_destroy_cb (GtkWidget * widget, gpointer data)
+{
+  if (realtime_stats_tag != 0) {
+    g_source_remove (realtime_stats_tag);
+    realtime_stats_tag = 0;
+  }
+}
+
+static void
+realtime_stats_reset_cb (GtkWidget * widget, gpointer data)
+{
+  play_reset_stats ();
+  device_reset_xruns ();
+  realtime_stats_update (data);
+}
+
 static GtkWidget *
 create_drivers_combo (void)
 {
@@ -426,6 +502,8 @@ device_config (void)
   GtkWidget * hscale;
   GtkWidget * ok_button;
   GtkWidget * button;
+  GtkWidget * combo;
+  gint i;
 
   GtkTooltips * tooltips;
 
@@ -713,6 +791,117 @@ device_config (void)
     gtk_tooltips_set_tip (tooltips, button,
 			  _("Set to default device buffering."),
 			  NULL);
+
+
+    /* Realtime */
+
+    label = gtk_label_new (_("Realtime"));
+    vbox = gtk_vbox_new (FALSE, 0);
+    gtk_notebook_append_page (GTK_NOTEBOOK (notebook), vbox, label);
+    gtk_container_set_border_width (GTK_CONTAINER(vbox), 4);
+    gtk_widget_show (vbox);
+
+    checkbutton =
+      gtk_check_button_new_with_label (_("Use realtime scheduling for playback"));
+    gtk_box_pack_start (GTK_BOX(vbox), checkbutton, FALSE, FALSE, 8);
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(checkbutton),
+				  play_get_realtime ());
+    gtk_widget_show (checkbutton);
+
+    g_object_set_data (G_OBJECT(dialog), "realtime_chb", checkbutton);
+
+    label = gtk_label_new (_("Runs the playback mixer at realtime priority "
+			     "and locks the sound being played into memory, "
+			     "so that other activity is less likely to cause "
+			     "dropouts. This requires permission to use "
+			     "realtime scheduling and to lock memory; if "
+			     "either is refused, playback continues "
+			     "normally.\n\nTakes effect the next time "
+			     "playback starts."));
+    gtk_label_set_line_wrap (GTK_LABEL(label), TRUE);
+    gtk_box_pack_start (GTK_BOX(vbox), label, FALSE, FALSE, 8);
+    gtk_widget_show (label);
+
+    checkbutton =
+      gtk_check_button_new_with_label (_("Render directly into the device "
+					 "buffer (ALSA mmap)"));
+    gtk_box_pack_start (GTK_BOX(vbox), checkbutton, FALSE, FALSE, 4);
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(checkbutton),
+				  prefs_get_int (ALSA_MMAP_KEY,
+						 DEFAULT_ALSA_MMAP) != 0);
+    gtk_widget_show (checkbutton);
+
+    g_object_set_data (G_OBJECT(dialog), "mmap_chb", checkbutton);
+
+    tooltips = gtk_tooltips_new ();
+    gtk_tooltips_set_tip (tooltips, checkbutton,
+			  _("Mixes playback straight into the sound card's "
+			    "memory-mapped buffer instead of copying it "
+			    "there, waking once per period. Devices that "
+			    "cannot be memory-mapped fall back to normal "
+			    "writes. Takes effect the next time playback "
+			    "starts."),
+			  NULL);
+
+    separator = gtk_hseparator_new ();
+    gtk_box_pack_start (GTK_BOX (vbox), separator, FALSE, FALSE, 8);
+    gtk_widget_show (separator);
+
+    hbox = gtk_hbox_new (FALSE, 4);
+    gtk_box_pack_start (GTK_BOX(vbox), hbox, FALSE, FALSE, 4);
+    gtk_widget_show (hbox);
+
+    label = gtk_label_new (_("Interpolation:"));
+    gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 4);
+    gtk_widget_show (label);
+
+    combo = gtk_combo_box_new_text ();
+    for (i = 0; i < INTERP_MAX; i++)
+      gtk_combo_box_append_text (GTK_COMBO_BOX(combo),
+				 _(interp_quality_name (i)));
+    gtk_combo_box_set_active (GTK_COMBO_BOX(combo),
+			      CLAMP (prefs_get_int (INTERP_QUALITY_KEY,
+						    DEFAULT_INTERP_QUALITY),
+				     INTERP_LINEAR, INTERP_MAX - 1));
+    gtk_box_pack_start (GTK_BOX(hbox), combo, FALSE, FALSE, 4);
+    gtk_widget_show (combo);
+
+    g_object_set_data (G_OBJECT(dialog), "interp_combo", combo);
+
+    tooltips = gtk_tooltips_new ();
+    gtk_tooltips_set_tip (tooltips, combo,
+			  _("How playback is resampled when its rate or "
+			    "pitch is changed, when scrubbing, and when "
+			    "the device runs at a different sampling rate. "
+			    "Higher qualities use more CPU; if playback "
+			    "falls behind, quality is reduced "
+			    "automatically."),
+			  NULL);
+
+    hbox = gtk_hbox_new (FALSE, 4);
+    gtk_box_pack_start (GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+    gtk_container_set_border_width (GTK_CONTAINER(hbox), 12);
+    gtk_widget_show (hbox);
+
+    label = gtk_label_new ("");
+    gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 0);
+    gtk_widget_show (label);
+
+    realtime_stats_update (label);
+    realtime_stats_tag = g_timeout_add (500, realtime_stats_update, label);
+    g_signal_connect (G_OBJECT(label), "destroy",
+		      G_CALLBACK(realtime_stats_destroy_cb), NULL);
+
+    button = gtk_button_new_with_label (_("Reset"));
+    gtk_box_pack_end (GTK_BOX (hbox), button, FALSE, TRUE, 4);
+    g_signal_connect (G_OBJECT(button), "clicked",
+			G_CALLBACK(realtime_stats_reset_cb), label);
+    gtk_widget_show (button);
+
+    tooltips = gtk_tooltips_new ();
+    gtk_tooltips_set_tip (tooltips, button,
+			  _("Reset the late period and xrun counts and the worst period time."),
+			  NULL);
   }
 
   update_pcmio_settings ();
@@ -773,6 +962,40 @@ device_write (sw_handle * handle, const float * buf, size_t count)
     return -1;
 }
 
+float *
+device_begin (sw_handle * handle, sw_framecount_t frames)
+{
+  if (current_driver->begin)
+    return current_driver->begin (handle, frames);
+  else
+    return NULL;
+}
+
+void
+device_commit (sw_handle * handle, sw_framecount_t frames)
+{
+  if (current_driver->commit)
+    current_driver->commit (handle, frames);
+}
+
+void
+device_get_xruns (gint * xruns, gint * worst_usec)
+{
+  if (current_driver->get_xruns) {
+    current_driver->get_xruns (xruns, worst_usec);
+  } else {
+    if (xruns) *xruns = 0;
+    if (worst_usec) *worst_usec = 0;
+  }
+}
+
+void
+device_reset_xruns (void)
+{
+  if (current_driver->reset_xruns)
+    current_driver->reset_xruns ();
+}
+
 sw_framecount_t
 device_offset (sw_handle * handle)
 {
@@ -830,6 +1053,11 @@ init_devices (void)
   if (driver_solaris->name != NULL)
     driver_table [k++] = driver_solaris;
 
+  /* The offline drivers are always available, but never the default
+   * unless there is no sound device driver at all. */
+  driver_table [k++] = driver_null;
+  driver_table [k++] = driver_file;
+
   prefs_get_string (prefs_driver_key, driver, sizeof (driver), "");
 
   /* Set a default in case preferences driver doesn't exist. */
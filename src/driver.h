@@ -27,6 +27,10 @@
 
 #define PBUF_SIZE 256
 
+/* Preferences key for ALSA mmap (direct) playback transfers */
+#define ALSA_MMAP_KEY "alsa_mmap"
+#define DEFAULT_ALSA_MMAP 0
+
 typedef struct _sw_handle sw_handle;
 typedef struct _sw_driver sw_driver;
 
@@ -55,6 +59,14 @@ struct _sw_driver {
   char * primary_device_key;
   char * monitor_device_key;
   char * log_frags_key;
+
+  /* Optional: direct rendering into the device's own buffer */
+  float * (*begin) (sw_handle * handle, sw_framecount_t frames);
+  void (*commit) (sw_handle * handle, sw_framecount_t frames);
+
+  /* Optional: xruns reported by the device itself */
+  void (*get_xruns) (gint * xruns, gint * worst_usec);
+  void (*reset_xruns) (void);
 };
 
 void
@@ -78,6 +90,31 @@ device_read (sw_handle * handle, float * buf, size_t count);
 ssize_t
 device_write (sw_handle * handle, const float * buf, size_t count);
 
+/*
+ * Direct transfers, for drivers that can map the device's ring buffer.
+ * device_begin () returns where to render the next frames frames,
+ * interleaved at handle->driver_channels, or NULL if the driver cannot
+ * provide that many contiguous frames right now; the caller should
+ * then render into its own buffer and use device_write () instead.
+ * Every non-NULL device_begin () must be followed by device_commit ()
+ * with the number of frames actually rendered.
+ */
+float *
+device_begin (sw_handle * handle, sw_framecount_t frames);
+
+void
+device_commit (sw_handle * handle, sw_framecount_t frames);
+
+/*
+ * Xruns seen by the device driver, and the longest of them. Drivers that
+ * cannot tell report none. Safe to call from any thread.
+ */
+void
+device_get_xruns (gint * xruns, gint * worst_usec);
+
+void
+device_reset_xruns (void);
+
 /* As far as I'm aware the method
  * used to monitor latency in OSS and Solaris etc. is different to that which
  * ALSA uses, and different again from JACK and PortAudio.
@@ -38,6 +38,7 @@
 #include <fcntl.h>
 #include <math.h>
 #include <sys/ioctl.h>
+#include <errno.h>
 #include <pthread.h>
 
 #include <sweep/sweep_types.h>
@@ -45,6 +46,7 @@
 
 #include "driver.h"
 #include "pcmio.h"
+#include "preferences.h"
 #include "question_dialogs.h"
 
 #ifdef DRIVER_ALSA
@@ -64,10 +66,46 @@ do { \
 } while (0)
 #endif
 
-static sw_handle alsa_handle = {
- 0, -1, 0, 0, NULL
+/* Separate handles for the main and monitor devices */
+static sw_handle alsa_handles[2] = {
+  { 0, -1, 0, 0, NULL },
+  { 0, -1, 0, 0, NULL }
 };
 
+/*
+ * Playback can optionally use SND_PCM_ACCESS_MMAP_INTERLEAVED, so that
+ * the mixer renders each block straight into the device's ring buffer
+ * (alsa_device_begin/commit) rather than into its own buffer followed
+ * by a copy in snd_pcm_writei. The stream is started explicitly once
+ * the ring has been filled, and the mixer is woken by snd_pcm_wait
+ * whenever another block's worth of room is available.
+ *
+ * This works with any PCM that can be mapped, including the userspace
+ * "null" plugin and the "file" plugin, eg. with
+ *
+ *   pcm.sweepfile { type file; slave.pcm null; file "/tmp/sweep.raw" }
+ *
+ * in ~/.asoundrc and SWEEP_ALSA_PCM=sweepfile.
+ */
+typedef struct {
+  gboolean want_mmap;         /* from prefs, read when the device opens */
+  gboolean mmap;              /* mmap access was granted by setup */
+  snd_pcm_uframes_t buffer_size;
+  snd_pcm_uframes_t block;    /* frames the mixer renders per begin () */
+  snd_pcm_uframes_t offset;   /* of the area handed out by begin () */
+} alsa_state;
+
+static alsa_state alsa_states[2];
+
+#define ALSA_STATE(h) (&alsa_states[(h) - alsa_handles])
+
+/*
+ * Xruns are counted on the audio thread, which must not print or block,
+ * so they are kept here and read by the GUI through device_get_xruns ().
+ */
+static volatile gint alsa_xruns = 0;
+static volatile gint alsa_xrun_worst_usec = 0;
+
 
 void print_pcm_state (snd_pcm_t * pcm)
 {
@@ -101,6 +139,62 @@ void print_pcm_state (snd_pcm_t * pcm)
   }
 }
 
+static void
+alsa_get_xruns (gint * xruns, gint * worst_usec)
+{
+  if (xruns) *xruns = g_atomic_int_get (&alsa_xruns);
+  if (worst_usec) *worst_usec = g_atomic_int_get (&alsa_xrun_worst_usec);
+}
+
+static void
+alsa_reset_xruns (void)
+{
+  g_atomic_int_set (&alsa_xruns, 0);
+  g_atomic_int_set (&alsa_xrun_worst_usec, 0);
+}
+
+/*
+ * Recover from an error returned by a transfer on the audio thread:
+ * count xruns, and re-prepare (or resume) the stream. Returns 0 if the
+ * stream can be used again, or a negative error code.
+ */
+static int
+alsa_recover (snd_pcm_t * pcm_handle, int err)
+{
+  snd_pcm_status_t * status;
+  struct timeval now, diff, tstamp;
+  gint usec, worst;
+
+  if (err == -EPIPE) {
+    snd_pcm_status_alloca (&status);
+    if (snd_pcm_status (pcm_handle, status) == 0 &&
+	snd_pcm_status_get_state (status) == SND_PCM_STATE_XRUN) {
+      gettimeofday (&now, 0);
+      snd_pcm_status_get_trigger_tstamp (status, &tstamp);
+      timersub (&now, &tstamp, &diff);
+      usec = diff.tv_sec * 1000000 + diff.tv_usec;
+
+      do {
+	worst = g_atomic_int_get (&alsa_xrun_worst_usec);
+      } while (usec > worst &&
+	       !g_atomic_int_compare_and_exchange (&alsa_xrun_worst_usec,
+						   worst, usec));
+    }
+
+    g_atomic_int_inc (&alsa_xruns);
+
+    return snd_pcm_prepare (pcm_handle);
+  } else if (err == -ESTRPIPE) {
+    while ((err = snd_pcm_resume (pcm_handle)) == -EAGAIN)
+      g_usleep (1000);
+
+    if (err < 0)
+      err = snd_pcm_prepare (pcm_handle);
+  }
+
+  return err;
+}
+
 static GList *
 alsa_get_names (void)
 {
@@ -128,7 +222,7 @@ alsa_device_open (int monitoring, int flags)
   int err;
   const char * alsa_pcm_name;
   snd_pcm_t * pcm_handle;
-  sw_handle * handle = &alsa_handle;
+  sw_handle * handle = &alsa_handles[monitoring ? 1 : 0];
   snd_pcm_stream_t stream;
 
   if (monitoring) {
@@ -158,6 +252,11 @@ alsa_device_open (int monitoring, int flags)
   handle->driver_flags = flags;
   handle->custom_data = pcm_handle;
 
+  ALSA_STATE(handle)->want_mmap = (stream == SND_PCM_STREAM_PLAYBACK &&
+				   prefs_get_int (ALSA_MMAP_KEY,
+						  DEFAULT_ALSA_MMAP) != 0);
+  ALSA_STATE(handle)->mmap = FALSE;
+
   return handle;
 }
 
@@ -168,16 +267,20 @@ alsa_device_setup (sw_handle * handle, sw_format * format)
 {
   int err;
   snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  alsa_state * state = ALSA_STATE(handle);
   snd_pcm_hw_params_t * hwparams;
+  snd_pcm_sw_params_t * swparams;
   unsigned int rate = format->rate;
   unsigned int channels = format->channels;
   unsigned int periods;
   snd_pcm_uframes_t period_size = PBUF_SIZE/format->channels;
 
-  if (handle->driver_flags != O_RDONLY && handle->driver_flags == O_WRONLY) {
+  if (handle->driver_flags != O_RDONLY && handle->driver_flags != O_WRONLY) {
     return;
   }
 
+  state->mmap = FALSE;
+
   snd_pcm_hw_params_alloca (&hwparams);
 
   if ((err = snd_pcm_hw_params_any (pcm_handle, hwparams)) < 0) {
@@ -187,7 +290,19 @@ alsa_device_setup (sw_handle * handle, sw_format * format)
     return;
   }
 
-  if ((err = snd_pcm_hw_params_set_access
+  if (state->want_mmap) {
+    if ((err = snd_pcm_hw_params_set_access
+	 (pcm_handle, hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+      fprintf (stderr,
+	       "sweep: alsa_setup: can't set mmap access (%s), "
+	       "using normal writes\n", snd_strerror (err));
+    } else {
+      state->mmap = TRUE;
+    }
+  }
+
+  if (!state->mmap &&
+      (err = snd_pcm_hw_params_set_access
        (pcm_handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
     fprintf(stderr,
 	    "sweep: alsa_setup: can't set interleaved access (%s)\n",
@@ -254,8 +369,28 @@ alsa_device_setup (sw_handle * handle, sw_format * format)
     fprintf (stderr,
 	     "sweep: alsa_setup: audio interface could not be configured "
 	     "with specified parameters\n");
+    state->mmap = FALSE;
     return;
   }
+
+  if (state->mmap) {
+    snd_pcm_hw_params_get_period_size (hwparams, &period_size, 0);
+    snd_pcm_hw_params_get_buffer_size (hwparams, &state->buffer_size);
+    state->block = period_size;
+
+    /* Start explicitly once the ring is full (see alsa_device_commit) */
+    snd_pcm_sw_params_alloca (&swparams);
+    if ((err = snd_pcm_sw_params_current (pcm_handle, swparams)) < 0 ||
+	(err = snd_pcm_sw_params_set_start_threshold
+	 (pcm_handle, swparams, state->buffer_size)) < 0 ||
+	(err = snd_pcm_sw_params_set_avail_min
+	 (pcm_handle, swparams, period_size)) < 0 ||
+	(err = snd_pcm_sw_params (pcm_handle, swparams)) < 0) {
+      fprintf (stderr,
+	       "sweep: alsa_setup: can't set PCM sw params (%s)\n",
+	       snd_strerror (err));
+    }
+  }
   //printf ("sweep: alsa_setup 9\n");
 
   {
@@ -297,12 +432,36 @@ static int
 alsa_device_wait (sw_handle * handle)
 {
   snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  alsa_state * state = ALSA_STATE(handle);
+  snd_pcm_sframes_t avail;
+  int err;
 
-  if (snd_pcm_wait (pcm_handle, 1000) < 0) {
-    fprintf (stderr, "poll failed (%s)\n", strerror (errno));
+  if (!state->mmap) {
+    if ((err = snd_pcm_wait (pcm_handle, 1000)) < 0)
+      alsa_recover (pcm_handle, err);
+    return 0;
   }
 
-  return 0;
+  /* Wait until there is room for the mixer's next block */
+  for (;;) {
+    avail = snd_pcm_avail_update (pcm_handle);
+
+    if (avail < 0) {
+      if (alsa_recover (pcm_handle, avail) < 0) return -1;
+      continue;
+    }
+
+    if ((snd_pcm_uframes_t)avail >= state->block) return 0;
+
+    /* Not yet started, so no room will be made; let commit start it */
+    if (snd_pcm_state (pcm_handle) == SND_PCM_STATE_PREPARED) return 0;
+
+    if ((err = snd_pcm_wait (pcm_handle, 1000)) < 0) {
+      if (alsa_recover (pcm_handle, err) < 0) return -1;
+    } else if (err == 0) {
+      return -1; /* timed out; the device has stalled */
+    }
+  }
 }
 
 #define PLAYBACK_SCALE (32768 / SW_AUDIO_MAX)
@@ -325,48 +484,98 @@ static ssize_t
 alsa_device_write (sw_handle * handle, const float * buf, size_t count)
 {
   snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  alsa_state * state = ALSA_STATE(handle);
   snd_pcm_uframes_t uframes;
-  snd_pcm_status_t * status;
-  int err;
-
-  /*printf ("sweep: alsa_write \n");*/
+  snd_pcm_sframes_t err;
 
   uframes = handle->driver_channels > 0 ? count / handle->driver_channels : 0;
-  //printf ("sweep: alsa_write 1\n");
 
-  // this basicaly ripped straight out of alsaplayer alsa-final driver:
-  err = snd_pcm_writei(pcm_handle, buf, uframes);
+  /*
+   * In mmap mode this is only used when the ring could not hand out a
+   * contiguous block (see alsa_device_begin).
+   */
+  if (state->mmap)
+    err = snd_pcm_mmap_writei (pcm_handle, buf, uframes);
+  else
+    err = snd_pcm_writei (pcm_handle, buf, uframes);
 
-  if (err == -EPIPE) {
-    snd_pcm_status_alloca(&status);
-    if ((err = snd_pcm_status(pcm_handle, status))<0) {
-      fprintf(stderr, "sweep: alsa_write: xrun. can't determine length\n");
-    } else {
-      if (snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN) {
-        struct timeval now, diff, tstamp;
-        gettimeofday(&now, 0);
-        snd_pcm_status_get_trigger_tstamp(status, &tstamp);
-        timersub(&now, &tstamp, &diff);
-        fprintf(stderr, "sweep: alsa_write: xrun of at least %.3f msecs. "
-	    "resetting stream\n", diff.tv_sec * 1000 + diff.tv_usec / 1000.0);
-      } else {
-        fprintf(stderr, "sweep: alsa_write: xrun. can't determine length\n");
-      }
-    }
-    snd_pcm_prepare(pcm_handle);
-    err = snd_pcm_writei(pcm_handle, buf, uframes);
-    if (err != uframes) {
-      fprintf(stderr, "sweep: alsa_write: %s\n", snd_strerror(err));
-      return 0;
-    } else if (err < 0) {
-      fprintf(stderr, "sweep: alsa_write: %s\n", snd_strerror(err));
-      return 0;
-    }
+  if (err < 0) {
+    if (alsa_recover (pcm_handle, err) < 0) return 0;
+
+    if (state->mmap)
+      err = snd_pcm_mmap_writei (pcm_handle, buf, uframes);
+    else
+      err = snd_pcm_writei (pcm_handle, buf, uframes);
+
+    if (err != (snd_pcm_sframes_t)uframes) return 0;
   }
 
   return 1;
 }
 
+static float *
+alsa_device_begin (sw_handle * handle, sw_framecount_t frames)
+{
+  snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  alsa_state * state = ALSA_STATE(handle);
+  const snd_pcm_channel_area_t * areas;
+  snd_pcm_uframes_t offset, n;
+  snd_pcm_sframes_t avail;
+  int err;
+
+  if (!state->mmap || frames <= 0) return NULL;
+
+  state->block = frames;
+
+  avail = snd_pcm_avail_update (pcm_handle);
+  if (avail < 0) {
+    alsa_recover (pcm_handle, avail);
+    return NULL;
+  }
+
+  if ((snd_pcm_uframes_t)avail < (snd_pcm_uframes_t)frames) return NULL;
+
+  n = frames;
+  if ((err = snd_pcm_mmap_begin (pcm_handle, &areas, &offset, &n)) < 0) {
+    alsa_recover (pcm_handle, err);
+    return NULL;
+  }
+
+  /* Split by the end of the ring, or not plainly interleaved float */
+  if (n < (snd_pcm_uframes_t)frames || areas[0].first % 8 != 0 ||
+      areas[0].step != handle->driver_channels * 8 * sizeof (float)) {
+    snd_pcm_mmap_commit (pcm_handle, offset, 0);
+    return NULL;
+  }
+
+  state->offset = offset;
+
+  return (float *)((char *)areas[0].addr + areas[0].first / 8 +
+		   offset * areas[0].step / 8);
+}
+
+static void
+alsa_device_commit (sw_handle * handle, sw_framecount_t frames)
+{
+  snd_pcm_t * pcm_handle = (snd_pcm_t *)handle->custom_data;
+  alsa_state * state = ALSA_STATE(handle);
+  snd_pcm_sframes_t err;
+
+  err = snd_pcm_mmap_commit (pcm_handle, state->offset, frames);
+
+  if (err < 0) {
+    alsa_recover (pcm_handle, err);
+    return;
+  }
+
+  /* Start once the ring can't take another block */
+  if (snd_pcm_state (pcm_handle) == SND_PCM_STATE_PREPARED &&
+      snd_pcm_avail_update (pcm_handle) < (snd_pcm_sframes_t)state->block) {
+    if ((err = snd_pcm_start (pcm_handle)) < 0)
+      alsa_recover (pcm_handle, err);
+  }
+}
+
 sw_framecount_t
 alsa_device_offset (sw_handle * handle)
 {
@@ -413,6 +622,7 @@ alsa_device_close (sw_handle * handle)
 
   snd_pcm_close (pcm_handle);
   handle->custom_data = NULL;
+  ALSA_STATE(handle)->mmap = FALSE;
 }
 
 static sw_driver _driver_alsa = {
@@ -430,7 +640,11 @@ static sw_driver _driver_alsa = {
   alsa_device_close,
   "alsa_primary_device",
   "alsa_monitor_device",
-  "alsa_log_frags"
+  "alsa_log_frags",
+  alsa_device_begin,
+  alsa_device_commit,
+  alsa_get_xruns,
+  alsa_reset_xruns
 };
 
 #else
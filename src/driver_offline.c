@@ -0,0 +1,378 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Offline drivers: "Null" discards everything written to it and records
+ * silence, "File" writes the mix to a soundfile through libsndfile.
+ *
+ * Neither is tied to a device clock. By default they run as fast as the
+ * player thread can mix; setting the DriverSpeed preference (or the
+ * SWEEP_DRIVER_SPEED environment variable) to a positive value throttles
+ * them to that multiple of realtime instead. When the handle is closed
+ * the number of frames mixed per second is reported on stderr.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <sndfile.h>
+
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_sample.h>
+
+#include "driver.h"
+#include "preferences.h"
+#include "pcmio.h"
+
+/*#define DEBUG*/
+
+#define DRIVER_SPEED_KEY "DriverSpeed"
+#define DRIVER_SPEED_ENV "SWEEP_DRIVER_SPEED"
+
+/* Unthrottled */
+#define DEFAULT_DRIVER_SPEED 0.0
+
+#define DEFAULT_FILE_DEV "sweep-output.wav"
+
+typedef struct _sw_offline sw_offline;
+
+struct _sw_offline {
+  const char * driver_name;
+  SNDFILE * sndfile;
+  gchar * filename;
+  gdouble speed;
+  sw_framecount_t nr_frames;
+  gint64 start_usec;
+};
+
+/* One handle each for the main and monitor devices */
+static sw_handle null_handles[2] = {
+  { 0, -1, 0, 0, NULL },
+  { 0, -1, 0, 0, NULL }
+};
+
+static sw_handle file_handles[2] = {
+  { 0, -1, 0, 0, NULL },
+  { 0, -1, 0, 0, NULL }
+};
+
+static gdouble
+offline_get_speed (void)
+{
+  const char * env;
+  gdouble speed;
+
+  if ((env = getenv (DRIVER_SPEED_ENV)) != NULL && env[0] != '\0')
+    speed = g_ascii_strtod (env, NULL);
+  else
+    speed = prefs_get_float (DRIVER_SPEED_KEY, DEFAULT_DRIVER_SPEED);
+
+  return MAX (speed, 0.0);
+}
+
+static sw_handle *
+offline_open (sw_handle * handles, const char * driver_name, int monitoring,
+	      int flags)
+{
+  sw_handle * handle;
+  sw_offline * offline;
+
+  if (monitoring && !pcmio_get_use_monitor ())
+    return NULL;
+
+  handle = &handles[monitoring ? 1 : 0];
+
+  offline = g_malloc0 (sizeof (sw_offline));
+  offline->driver_name = driver_name;
+  offline->speed = offline_get_speed ();
+
+  handle->driver_flags = flags & (O_RDONLY|O_WRONLY|O_RDWR);
+  handle->custom_data = offline;
+
+  return handle;
+}
+
+static void
+offline_setup (sw_handle * handle, sw_format * format)
+{
+  sw_offline * offline = (sw_offline *)handle->custom_data;
+
+  handle->driver_rate = format->rate;
+  handle->driver_channels = format->channels;
+
+  if (offline == NULL) return;
+
+  offline->nr_frames = 0;
+  offline->start_usec = g_get_monotonic_time ();
+}
+
+/*
+ * Account for count samples having passed through the handle, and
+ * sleep if that puts us ahead of the configured multiple of realtime.
+ */
+static void
+offline_advance (sw_handle * handle, size_t count)
+{
+  sw_offline * offline = (sw_offline *)handle->custom_data;
+  gint64 due, now;
+
+  if (handle->driver_channels <= 0) return;
+
+  offline->nr_frames += count / handle->driver_channels;
+
+  if (offline->speed <= 0.0 || handle->driver_rate <= 0) return;
+
+  due = offline->start_usec + (gint64)
+    ((gdouble)offline->nr_frames * G_USEC_PER_SEC /
+     (handle->driver_rate * offline->speed));
+  now = g_get_monotonic_time ();
+
+  if (due > now)
+    g_usleep (due - now);
+}
+
+static sw_framecount_t
+offline_offset (sw_handle * handle)
+{
+  return -1;
+}
+
+static void
+offline_report (sw_offline * offline, int rate)
+{
+  gdouble secs, fps;
+
+  if (offline->nr_frames == 0) return;
+
+  secs = (g_get_monotonic_time () - offline->start_usec) /
+    (gdouble)G_USEC_PER_SEC;
+  fps = (secs > 0.0) ? offline->nr_frames / secs : 0.0;
+
+  fprintf (stderr, "sweep: %s driver: %" G_GINT64_FORMAT
+	   " frames in %.3f s, %.0f frames/s (%.1fx realtime)\n",
+	   offline->driver_name, (gint64)offline->nr_frames, secs, fps,
+	   rate > 0 ? fps / rate : 0.0);
+}
+
+static void
+offline_close (sw_handle * handle)
+{
+  sw_offline * offline = (sw_offline *)handle->custom_data;
+
+  if (offline == NULL) return;
+
+  offline_report (offline, handle->driver_rate);
+
+  if (offline->sndfile != NULL)
+    sf_close (offline->sndfile);
+
+  g_free (offline->filename);
+  g_free (offline);
+  handle->custom_data = NULL;
+}
+
+/*
+ * Null driver
+ */
+
+static GList *
+null_get_names (void)
+{
+  GList * names = NULL;
+
+  names = g_list_append (names, "null");
+
+  return names;
+}
+
+static sw_handle *
+null_open (int monitoring, int flags)
+{
+  return offline_open (null_handles, "Null", monitoring, flags);
+}
+
+static ssize_t
+null_read (sw_handle * handle, float * buf, size_t count)
+{
+  memset (buf, 0, count * sizeof (float));
+  offline_advance (handle, count);
+
+  return count;
+}
+
+static ssize_t
+null_write (sw_handle * handle, const float * buf, size_t count)
+{
+  offline_advance (handle, count);
+
+  return count;
+}
+
+static sw_driver _driver_null = {
+  "Null",
+  null_get_names,
+  null_open,
+  offline_setup,
+  NULL, /* wait */
+  null_read,
+  null_write,
+  offline_offset,
+  NULL, /* reset */
+  NULL, /* flush */
+  NULL, /* drain */
+  offline_close,
+  "null_primary_device",
+  "null_monitor_device",
+  "null_log_frags"
+};
+
+sw_driver * driver_null = &_driver_null;
+
+/*
+ * File driver. The "device name" is the path of the soundfile to write;
+ * its extension selects the container.
+ */
+
+static GList *
+file_get_names (void)
+{
+  GList * names = NULL;
+
+  names = g_list_append (names, DEFAULT_FILE_DEV);
+  names = g_list_append (names, "sweep-monitor.wav");
+
+  return names;
+}
+
+static int
+file_guess_format (const char * filename)
+{
+  const char * ext;
+
+  if ((ext = strrchr (filename, '.')) != NULL) {
+    ext++;
+    if (!strcasecmp (ext, "w64"))
+      return SF_FORMAT_W64 | SF_FORMAT_FLOAT;
+    if (!strcasecmp (ext, "aif") || !strcasecmp (ext, "aiff"))
+      return SF_FORMAT_AIFF | SF_FORMAT_FLOAT;
+    if (!strcasecmp (ext, "au") || !strcasecmp (ext, "snd"))
+      return SF_FORMAT_AU | SF_FORMAT_FLOAT;
+    if (!strcasecmp (ext, "flac"))
+      return SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+  }
+
+  return SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+}
+
+static sw_handle *
+file_open (int monitoring, int flags)
+{
+  sw_handle * handle;
+  sw_offline * offline;
+  const char * dev_name;
+
+  if ((flags & (O_RDONLY|O_WRONLY|O_RDWR)) != O_WRONLY) {
+    fprintf (stderr, "sweep: File driver can only be used for playback\n");
+    return NULL;
+  }
+
+  if ((handle = offline_open (file_handles, "File", monitoring, flags)) == NULL)
+    return NULL;
+
+  dev_name = monitoring ? pcmio_get_monitor_dev () : pcmio_get_main_dev ();
+  if (dev_name == NULL || dev_name[0] == '\0' || !strcmp (dev_name, "Default"))
+    dev_name = DEFAULT_FILE_DEV;
+
+  offline = (sw_offline *)handle->custom_data;
+  offline->filename = g_strdup (dev_name);
+
+  return handle;
+}
+
+static void
+file_setup (sw_handle * handle, sw_format * format)
+{
+  sw_offline * offline = (sw_offline *)handle->custom_data;
+  SF_INFO sfinfo;
+
+  offline_setup (handle, format);
+
+  if (offline == NULL || offline->sndfile != NULL) return;
+
+  memset (&sfinfo, 0, sizeof (sfinfo));
+  sfinfo.samplerate = format->rate;
+  sfinfo.channels = format->channels;
+  sfinfo.format = file_guess_format (offline->filename);
+
+  if ((offline->sndfile = sf_open (offline->filename, SFM_WRITE, &sfinfo))
+      == NULL) {
+    fprintf (stderr, "sweep: File driver: unable to open %s: %s\n",
+	     offline->filename, sf_strerror (NULL));
+  }
+
+#ifdef DEBUG
+  fprintf (stderr, "file_setup: writing %s\n", offline->filename);
+#endif
+}
+
+static ssize_t
+file_write (sw_handle * handle, const float * buf, size_t count)
+{
+  sw_offline * offline = (sw_offline *)handle->custom_data;
+
+  if (offline == NULL || offline->sndfile == NULL) return -1;
+
+  if (sf_write_float (offline->sndfile, buf, count) != (sf_count_t)count)
+    return -1;
+
+  offline_advance (handle, count);
+
+  return count;
+}
+
+static sw_driver _driver_file = {
+  "File",
+  file_get_names,
+  file_open,
+  file_setup,
+  NULL, /* wait */
+  NULL, /* read */
+  file_write,
+  offline_offset,
+  NULL, /* reset */
+  NULL, /* flush */
+  NULL, /* drain */
+  offline_close,
+  "file_primary_device",
+  "file_monitor_device",
+  "file_log_frags"
+};
+
+sw_driver * driver_file = &_driver_file;
@@ -76,8 +76,10 @@ static int oindex;
 static int current_frame;
 static int frame;
 
-static sw_handle oss_handle = {
- 0, -1, 0, 0, NULL
+/* Separate handles for the main and monitor devices */
+static sw_handle oss_handles[2] = {
+  { 0, -1, 0, 0, NULL },
+  { 0, -1, 0, 0, NULL }
 };
 
 /* driver functions */
@@ -99,7 +101,7 @@ oss_open (int monitoring, int flags)
 {
   const char * dev_name;
   int dev_dsp;
-  sw_handle * handle = &oss_handle;
+  sw_handle * handle = &oss_handles[monitoring ? 1 : 0];
   int i;
 
   if (monitoring) {
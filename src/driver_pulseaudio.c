@@ -54,6 +54,10 @@ static sw_handle handle_wo = {
  0, -1, 0, 0, NULL
 };
 
+static sw_handle handle_wo_monitor = {
+ 0, -1, 0, 0, NULL
+};
+
 static sw_handle handle_rw = {
  0, -1, 0, 0, NULL
 };
@@ -76,7 +80,7 @@ pulse_open (int monitoring, int flags)
   if (flags == O_RDONLY) {
     handle = &handle_ro;
   } else if (flags == O_WRONLY) {
-    handle = &handle_wo;
+    handle = monitoring ? &handle_wo_monitor : &handle_wo;
   }
 
   handle->driver_flags = flags;
@@ -160,13 +160,11 @@ static sw_edit_region *
 edit_region_new0 (sw_format * format, sw_framecount_t start,
 		  sw_framecount_t end, gpointer data0)
 {
-  sw_framecount_t offset;
-  int o2;
+  gint64 offset;
 
   offset = frames_to_bytes (format, start);
-  o2 = (int)offset; /* XXX */
 
-  return edit_region_new (format, start, end, data0+o2);
+  return edit_region_new (format, start, end, (gchar *)data0 + offset);
 }
 
 static sw_edit_region *
@@ -264,7 +262,7 @@ ebuf_clear (void)
   ebuf = NULL;
 }
 
-static sw_framecount_t
+sw_framecount_t
 edit_buffer_length (sw_edit_buffer * eb)
 {
   GList * gl;
@@ -414,6 +412,18 @@ sample_from_edit_buffer (sw_edit_buffer * eb)
   return s;
 }
 
+/*
+ * Percentage of total done, without the intermediate truncation (and
+ * division by zero for totals under 100 frames) of done / (total/100).
+ */
+static gint
+edit_progress_percent (sw_framecount_t done, sw_framecount_t total)
+{
+  if (total <= 0) return 100;
+
+  return (gint) MIN (100, done * 100 / total);
+}
+
 static void
 head_dec_if_within (sw_head * head, sw_framecount_t lower,
 		    sw_framecount_t upper, sw_framecount_t amount)
@@ -464,19 +474,55 @@ head_set_if_within (sw_head * head, sw_framecount_t lower,
   g_mutex_unlock (&head->head_mutex);
 }
 
+/* Note that the data under eb's regions, moved by delta, has changed */
+static void
+edit_invalidate_eb (sw_sample * sample, sw_edit_buffer * eb,
+		    sw_framecount_t delta)
+{
+  GList * gl;
+  sw_edit_region * er;
+
+  for (gl = eb->regions; gl; gl = gl->next) {
+    er = (sw_edit_region *)gl->data;
+    sample_data_changed (sample, er->start + delta, er->end + delta);
+  }
+}
+
+/*
+ * Resize the data of sounddata to length frames, first shortening
+ * nr_frames if it is shrinking. This holds data_mutex, so that the
+ * prefetch thread never copies from a block that is being moved or
+ * freed; the caller updates nr_frames itself once the data is in place.
+ */
+static gpointer
+edit_resize_data (sw_sounddata * sounddata, sw_framecount_t length)
+{
+  g_mutex_lock (&sounddata->data_mutex);
+
+  if (sounddata->nr_frames > length)
+    sounddata->nr_frames = length;
+
+  sounddata->data = g_realloc (sounddata->data,
+			       frames_to_bytes (sounddata->format, length));
+
+  g_mutex_unlock (&sounddata->data_mutex);
+
+  return sounddata->data;
+}
+
 /* modifies sounddata */
 sw_sample *
 splice_out_sel (sw_sample * sample)
 {
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  gint length;
+  sw_framecount_t length;
   GList * gl;
   sw_sel * osel, * sel;
   /*sw_sounddata * out;*/
   gpointer d;
   sw_framecount_t offset, len, sel_length = 0;
-  sw_framecount_t move_length, run_length;
+  sw_framecount_t move_length, run_length, changed_start;
 
   if (!sounddata->sels) {
     printf ("Nothing to splice out.\n");
@@ -486,8 +532,11 @@ splice_out_sel (sw_sample * sample)
   length = sounddata->nr_frames - sounddata_selection_nr_frames (sounddata);
   run_length = 0;
 
+  changed_start = ((sw_sel *)sounddata->sels->data)->sel_start;
+
 #ifdef DEBUG
-  printf("Splice out: remaining length %d\n", length);
+  printf("Splice out: remaining length %" G_GINT64_FORMAT "\n",
+	 (gint64)length);
 #endif
 
   d = sounddata->data;
@@ -523,7 +572,8 @@ splice_out_sel (sw_sample * sample)
     d += len;
 
     run_length += move_length;
-    sample_set_progress_percent (sample, run_length / (length/100));
+    sample_set_progress_percent (sample,
+				 edit_progress_percent (run_length, length));
   }
   for (gl = gl->next; gl; gl = gl->next) {
     sel = (sw_sel *)gl->data;
@@ -559,7 +609,8 @@ splice_out_sel (sw_sample * sample)
     d += len;
 
     run_length += move_length;
-    sample_set_progress_percent (sample, run_length / (length/100));
+    sample_set_progress_percent (sample,
+				 edit_progress_percent (run_length, length));
 
     osel = sel;
   }
@@ -584,11 +635,11 @@ splice_out_sel (sw_sample * sample)
     g_memmove (d, (gpointer)(sounddata->data + offset), len);
 
     run_length += move_length;
-    sample_set_progress_percent (sample, run_length / (length/100));
+    sample_set_progress_percent (sample,
+				 edit_progress_percent (run_length, length));
   }
 
-  d = g_realloc (sounddata->data, frames_to_bytes(f, length));
-  sounddata->data = d;
+  d = edit_resize_data (sounddata, length);
   sounddata->nr_frames = length;
 
   sounddata_clear_selection (sounddata);
@@ -597,6 +648,8 @@ splice_out_sel (sw_sample * sample)
 
   g_mutex_unlock (&sample->ops_mutex);
 
+  sample_data_changed (sample, changed_start, G_MAXINT64);
+
   return sample;
 }
 
@@ -626,7 +679,7 @@ splice_in_eb_data (sw_sample * sample, sw_edit_buffer * eb)
 {
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  gint length;
+  sw_framecount_t length;
   GList * gl;
   sw_edit_region * er;
   sw_framecount_t prev_start = 0;
@@ -644,8 +697,7 @@ splice_in_eb_data (sw_sample * sample, sw_edit_buffer * eb)
 
   length = sounddata->nr_frames + edit_buffer_length (eb);
 
-  d = g_realloc (sounddata->data, frames_to_bytes (f, length));
-  sounddata->data = d;
+  d = edit_resize_data (sounddata, length);
 
   /* set di to point to the end of the original data */
   di = d + frames_to_bytes (f, sounddata->nr_frames);
@@ -701,6 +753,9 @@ splice_in_eb_data (sw_sample * sample, sw_edit_buffer * eb)
 
   g_mutex_unlock (&sample->ops_mutex);
 
+  er = (sw_edit_region *)eb->regions->data;
+  sample_data_changed (sample, er->start, G_MAXINT64);
+
   return sample;
 }
 
@@ -719,7 +774,7 @@ static sw_sounddata *
 crop_in_eb_data (sw_sounddata * sounddata, sw_edit_buffer * eb)
 {
   sw_format * f = sounddata->format;
-  sw_framecount_t length, byte_length, o_byte_length;
+  sw_framecount_t length, o_byte_length;
   GList * gl;
   sw_edit_region * er1, * er2, * er;
   sw_framecount_t len1 = 0, len2 = 0;
@@ -748,10 +803,8 @@ crop_in_eb_data (sw_sounddata * sounddata, sw_edit_buffer * eb)
 
   if (len1 + len2 > 0) {
     length = sounddata->nr_frames + len1 + len2;
-    byte_length = frames_to_bytes (f, length);
 
-    d = g_realloc (sounddata->data, byte_length);
-    sounddata->data = d;
+    d = edit_resize_data (sounddata, length);
     sounddata->nr_frames = length;
 
     if (len1 > 0) {
@@ -806,9 +859,14 @@ crop_in (sw_sample * sample, sw_edit_buffer * eb)
   sw_edit_region * er;
   sw_framecount_t delta;
 
+  g_mutex_lock (&sample->ops_mutex);
   crop_in_eb_data (sample->sounddata, eb);
+  g_mutex_unlock (&sample->ops_mutex);
+
   sounddata = sample->sounddata;
 
+  sample_data_changed (sample, 0, G_MAXINT64);
+
   gl = eb->regions;
   er = (sw_edit_region *)gl->data;
   if (er->start == 0) {
@@ -867,6 +925,7 @@ edit_clear_sel (sw_sample * sample)
       len = frames_to_bytes (f, sel->sel_end - sel->sel_start);
 
       memset ((gpointer)(sounddata->data + offset), 0, (size_t)len);
+      sample_data_changed (sample, sel->sel_start, sel->sel_end);
 
       run_total += sel->sel_end - sel->sel_start;
       sample_set_progress_percent (sample, run_total / sel_total);
@@ -896,7 +955,8 @@ crop_out (sw_sample * sample)
 
 
 #ifdef DEBUG
-  printf("Splice out: remaining length %d\n", length);
+  printf("Splice out: remaining length %" G_GINT64_FORMAT "\n",
+	 (gint64)length);
 #endif
 
 
@@ -936,8 +996,7 @@ crop_out (sw_sample * sample)
   sample_set_progress_percent (sample, 37);
 
   /* Need to shorten */
-  d = g_realloc (sounddata->data, byte_length);
-  sounddata->data = d;
+  d = edit_resize_data (sounddata, length);
   sounddata->nr_frames = length;
 
   /* Fix offsets */
@@ -992,6 +1051,8 @@ crop_out (sw_sample * sample)
 
   g_mutex_unlock (&sample->ops_mutex);
 
+  sample_data_changed (sample, 0, G_MAXINT64);
+
   return sample;
 }
 
@@ -1013,8 +1074,9 @@ paste_insert (sw_sample * sample, sw_edit_buffer * eb,
   paste_length = edit_buffer_length (eb);
   length = MAX(sounddata->nr_frames, paste_offset) + paste_length;
 
-  d = g_realloc (sounddata->data, frames_to_bytes (f, length));
-  sounddata->data = d;
+  g_mutex_lock (&sample->ops_mutex);
+
+  edit_resize_data (sounddata, length);
 
   d = (gpointer)(sounddata->data + frames_to_bytes(f, length));
 
@@ -1069,6 +1131,10 @@ paste_insert (sw_sample * sample, sw_edit_buffer * eb,
 
   sounddata->nr_frames = length;
 
+  g_mutex_unlock (&sample->ops_mutex);
+
+  sample_data_changed (sample, paste_offset, G_MAXINT64);
+
   return sample;
 }
 
@@ -1096,6 +1162,8 @@ paste_over (sw_sample * sample, sw_edit_buffer * eb)
     memcpy ((gpointer)(sample->sounddata->data + offset), er->data, len);
   }
 
+  edit_invalidate_eb (sample, eb, 0);
+
   return sample;
 }
 
@@ -1160,11 +1228,12 @@ paste_mix (sw_sample * sample, sw_edit_buffer * eb,
 	e += n * f->channels;
 
 	run_total += n;
-	percent = run_total / (eb_total/100);
+	percent = edit_progress_percent (run_total, eb_total);
 	sample_set_progress_percent (sample, percent);
 
 #ifdef DEBUG
-	g_print ("completed %d / %d frames, %d%%\n", run_total, eb_total,
+	g_print ("completed %" G_GINT64_FORMAT " / %" G_GINT64_FORMAT
+		 " frames, %d%%\n", (gint64)run_total, (gint64)eb_total,
 		 percent);
 #endif
       }
@@ -1174,6 +1243,8 @@ paste_mix (sw_sample * sample, sw_edit_buffer * eb,
 
   }
 
+  edit_invalidate_eb (sample, eb, paste_offset - eb_delta);
+
   return sample;
 }
 
@@ -1256,11 +1327,12 @@ paste_xfade (sw_sample * sample, sw_edit_buffer * eb,
 	e += n * f->channels;
 
 	run_total += n;
-	percent = run_total / (eb_total/100);
+	percent = edit_progress_percent (run_total, eb_total);
 	sample_set_progress_percent (sample, percent);
 
 #ifdef DEBUG
-	g_print ("completed %d / %d frames, %d%%\n", run_total, eb_total,
+	g_print ("completed %" G_GINT64_FORMAT " / %" G_GINT64_FORMAT
+		 " frames, %d%%\n", (gint64)run_total, (gint64)eb_total,
 		 percent);
 #endif
       }
@@ -1270,6 +1342,8 @@ paste_xfade (sw_sample * sample, sw_edit_buffer * eb,
 
   }
 
+  edit_invalidate_eb (sample, eb, paste_offset - eb_delta);
+
   return sample;
 }
 
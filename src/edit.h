@@ -39,6 +39,9 @@ edit_buffer_ref (sw_edit_buffer * eb);
 sw_edit_buffer *
 edit_buffer_from_sample (sw_sample * sample);
 
+sw_framecount_t
+edit_buffer_length (sw_edit_buffer * eb);
+
 void
 edit_buffer_destroy (sw_edit_buffer * eb);
 
@@ -153,6 +153,16 @@ extern GtkStyle * style_bw;
 
 #define READ_SIZE 200
 
+/* Read size for decoding; large enough to hold several Ogg pages */
+#define SPEEX_READ_SIZE (64 * 1024)
+
+/* Tail of the file to scan for the final granule position. An Ogg page
+ * is at most 65307 bytes, so this always contains one complete page. */
+#define SPEEX_TAIL_SIZE (2 * 65536)
+
+/* Minimum growth of the decode buffer when the final length is unknown */
+#define SPEEX_GROW_FRAMES (1 << 18)
+
 /*
  * file_is_ogg_speex (pathname)
  *
@@ -328,6 +338,77 @@ process_header(ogg_packet *op, int enh_enabled, int * frame_size, int * rate,
   return st;
 }
 
+/*
+ * speex_last_granulepos (fd, file_length)
+ *
+ * Scan the last page of the file for its granule position, which is
+ * the length in frames of the decoded stream. Returns -1 if none found.
+ * The file offset of fd is restored to the start of the file.
+ */
+static sw_framecount_t
+speex_last_granulepos (int fd, off_t file_length)
+{
+  ogg_sync_state oy;
+  ogg_page og;
+  char * ogg_data;
+  off_t tail;
+  ssize_t nread;
+  sw_framecount_t granulepos = -1;
+  int ret;
+
+  tail = MIN (file_length, (off_t)SPEEX_TAIL_SIZE);
+
+  if (lseek (fd, file_length - tail, SEEK_SET) == -1) goto out;
+
+  ogg_sync_init (&oy);
+
+  ogg_data = ogg_sync_buffer (&oy, tail);
+  if (ogg_data != NULL && (nread = read (fd, ogg_data, tail)) > 0) {
+    ogg_sync_wrote (&oy, nread);
+
+    /* pageout returns -1 while resyncing from mid-page; skip those */
+    while ((ret = ogg_sync_pageout (&oy, &og)) != 0) {
+      if (ret > 0 && ogg_page_granulepos (&og) >= 0)
+	granulepos = (sw_framecount_t)ogg_page_granulepos (&og);
+    }
+  }
+
+  ogg_sync_clear (&oy);
+
+ out:
+  lseek (fd, 0, SEEK_SET);
+
+  return granulepos;
+}
+
+/*
+ * Make room for at least nr_frames frames of decoded data. The buffer
+ * grows by at least SPEEX_GROW_FRAMES (or doubles) at a time rather
+ * than being reallocated for every packet.
+ */
+static gboolean
+speex_ensure_frames (sw_sounddata * sounddata, sw_framecount_t nr_frames,
+		     sw_framecount_t * allocated)
+{
+  sw_format * f = sounddata->format;
+  sw_framecount_t want;
+  gpointer data;
+
+  if (nr_frames <= *allocated) return TRUE;
+
+  want = MAX (nr_frames, *allocated + MAX (*allocated, SPEEX_GROW_FRAMES));
+
+  g_mutex_lock (&sounddata->data_mutex);
+  data = g_try_realloc (sounddata->data, frames_to_bytes (f, want));
+  if (data != NULL) {
+    sounddata->data = data;
+    *allocated = want;
+  }
+  g_mutex_unlock (&sounddata->data_mutex);
+
+  return (data != NULL);
+}
+
 static sw_sample *
 sample_load_speex_data (sw_op_instance * inst)
 {
@@ -360,8 +441,9 @@ sample_load_speex_data (sw_op_instance * inst)
 
   int i, j;
   float * d = NULL;
-  sw_framecount_t frames_total = 0, frames_decoded = 0;
-  size_t file_length, remaining, n;
+  sw_framecount_t frames_expected, frames_allocated = 0, frames_decoded = 0;
+  off_t file_length, remaining;
+  size_t n;
   ssize_t nread;
   gint percent;
 
@@ -375,11 +457,14 @@ sample_load_speex_data (sw_op_instance * inst)
 
   if (fstat (fd, &statbuf) == -1) {
     sweep_perror (errno, "failed stat in sample_load_speex_data");
+    close (fd);
     return NULL;
   }
 
   file_length = remaining = statbuf.st_size;
 
+  frames_expected = speex_last_granulepos (fd, file_length);
+
   /* Init Ogg sync */
   ogg_sync_init (&oy);
 
@@ -391,7 +476,7 @@ sample_load_speex_data (sw_op_instance * inst)
     if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
       active = FALSE;
     } else {
-      n = MIN (remaining, READ_SIZE);
+      n = (size_t) MIN (remaining, (off_t)SPEEX_READ_SIZE);
 
       ogg_data = ogg_sync_buffer (&oy, n);
       nread = read (fd, ogg_data, n);
@@ -403,7 +488,7 @@ sample_load_speex_data (sw_op_instance * inst)
 	active = FALSE;
       } else {
 	ogg_sync_wrote (&oy, nread);
-	n = (size_t)nread;
+	remaining -= nread;
       }
 
       /* Loop for all complete pages we got */
@@ -417,7 +502,7 @@ sample_load_speex_data (sw_op_instance * inst)
 	ogg_stream_pagein (&os, &og);
 
 	/* Extract all available packets */
-	while (!eos && ogg_stream_packetout (&os, &op) == 1) {
+	while (active && !eos && ogg_stream_packetout (&os, &op) == 1) {
 	  if (packet_count == 0) {/* header */
 	    st = process_header (&op, enh_enabled, &frame_size, &rate,
 				 &nframes, forceMode, &channels, &stereo,
@@ -425,6 +510,7 @@ sample_load_speex_data (sw_op_instance * inst)
 	    if (st == NULL) {
 	      /*printf ("Not Speex!\n");*/
 	      active = FALSE;
+	      break;
 	    }
 
 	    sample->sounddata->format->rate = rate;
@@ -433,6 +519,13 @@ sample_load_speex_data (sw_op_instance * inst)
 	    if (nframes == 0)
 	      nframes = 1;
 
+	    /* Allocate the whole stream up front if its length is known */
+	    if (frames_expected > 0 &&
+		!speex_ensure_frames (sample->sounddata, frames_expected,
+				      &frames_allocated)) {
+	      frames_expected = -1;
+	    }
+
 	  } else if (packet_count <= 1+extra_headers) {
 	    /* XXX: metadata, extra_headers: ignore */
 	  } else {
@@ -442,58 +535,63 @@ sample_load_speex_data (sw_op_instance * inst)
 	    /* Copy Ogg packet to Speex bitstream */
 	    speex_bits_read_from (&bits, (char *)op.packet, op.bytes);
 
-	    frames_total += nframes * frame_size;
-
-	    if (sample->sounddata->nr_frames != frames_total) {
-	      sample->sounddata->data =
-		g_realloc (sample->sounddata->data,
-			   frames_total * channels * sizeof (float));
+	    if (!speex_ensure_frames (sample->sounddata,
+				      frames_decoded + nframes * frame_size,
+				      &frames_allocated)) {
+	      sweep_perror (ENOMEM, "speex: %s", sample->pathname);
+	      active = FALSE;
+	      break;
 	    }
 
-	    sample->sounddata->nr_frames = frames_total;
-
 	    d = &((float *)sample->sounddata->data)
 		  [frames_decoded * channels];
 
-	    if (d != NULL) {
-	      for (j = 0; j < nframes; j++) {
-		/* Decode frame */
-		speex_decode (st, &bits, d);
+	    for (j = 0; j < nframes; j++) {
+	      /* Decode frame */
+	      speex_decode (st, &bits, d);
 #ifdef DEBUG
-		if (speex_bits_remaining (&bits) < 0) {
-		  info_dialog_new ("Speex warning", NULL,
-				   "Speex: decoding overflow -- corrupted stream at frame %ld", frames_decoded + (j * frame_size));
-		}
+	      if (speex_bits_remaining (&bits) < 0) {
+		info_dialog_new ("Speex warning", NULL,
+				 "Speex: decoding overflow -- corrupted stream at frame %ld", frames_decoded + (j * frame_size));
+	      }
 #endif
-		if (channels == 2)
-		  speex_decode_stereo (d, frame_size, &stereo);
-
-		for (i = 0; i < frame_size * channels; i++) {
-		  d[i] /= 32767.0;
-		}
-		d += (frame_size * channels);
-		frames_decoded += frame_size;
+	      if (channels == 2)
+		speex_decode_stereo (d, frame_size, &stereo);
+
+	      for (i = 0; i < frame_size * channels; i++) {
+		d[i] /= 32767.0;
 	      }
+	      d += (frame_size * channels);
+	      frames_decoded += frame_size;
 	    }
+
+	    sample->sounddata->nr_frames = frames_decoded;
 	  }
 
 	  packet_count ++;
 	}
-
-	remaining -= n;
-
-	percent = (file_length - remaining) * 100 / file_length;
-	sample_set_progress_percent (sample, percent);
       }
+
+      percent = (gint)((file_length - remaining) * 100 / MAX (file_length, 1));
+      sample_set_progress_percent (sample, percent);
     }
 
     g_mutex_unlock (&sample->ops_mutex);
   }
 
+  /* Give back any overallocation */
+  if (frames_allocated > frames_decoded && frames_decoded > 0) {
+    g_mutex_lock (&sample->sounddata->data_mutex);
+    sample->sounddata->data =
+      g_realloc (sample->sounddata->data,
+		 frames_to_bytes (sample->sounddata->format, frames_decoded));
+    g_mutex_unlock (&sample->sounddata->data_mutex);
+  }
+
   if (st) speex_decoder_destroy (st);
   speex_bits_destroy (&bits);
   ogg_sync_clear (&oy);
-  ogg_stream_clear (&os);
+  if (stream_init) ogg_stream_clear (&os);
 
   close (fd);
 
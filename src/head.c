@@ -594,6 +594,7 @@ head_new (sw_sample * sample, sw_head_t head_type)
   head->sample = sample;
 
   g_mutex_init (&head->head_mutex);
+  g_mutex_init (&head->insert_mutex);
   head->type = head_type;
   head->stop_offset = 0;
   head->offset = 0;
@@ -604,6 +605,7 @@ head_new (sw_sample * sample, sw_head_t head_type)
   head->reverse = FALSE;
   head->mute = FALSE;
   head->gain = (head->type == SWEEP_HEAD_PLAY ? 0.7 : 1.0);
+  head->ramp_gain = head->gain;
   head->rate = 1.0;
   head->mix = 0.0;
 
@@ -743,6 +745,9 @@ head_set_offset (sw_head * h, sw_framecount_t offset)
 
   offset = CLAMP (offset, 0, h->sample->sounddata->nr_frames);
 
+  if (offset != h->offset)
+    g_atomic_int_set (&h->discontinuous, 1);
+
   h->offset = offset;
 
   for (gl = h->controllers; gl; gl = gl->next) {
@@ -784,6 +789,35 @@ head_set_rate (sw_head * h, gfloat rate)
   g_mutex_unlock (&h->head_mutex);
 }
 
+/*
+ * Route the head's channels to the device through the given matrix, or
+ * the default routing if NULL. The head takes ownership of the matrix.
+ * The routing can't be changed while the head is playing, as the mixer
+ * may be using it; returns FALSE (and frees routing) in that case.
+ */
+gboolean
+head_set_routing (sw_head * h, sw_mixmap * routing)
+{
+  sw_mixmap * old;
+
+  g_mutex_lock (&h->head_mutex);
+
+  if (h->going) {
+    g_mutex_unlock (&h->head_mutex);
+    mixmap_free (routing);
+    return FALSE;
+  }
+
+  old = h->routing;
+  g_atomic_pointer_set (&h->routing, routing);
+
+  g_mutex_unlock (&h->head_mutex);
+
+  mixmap_free (old);
+
+  return TRUE;
+}
+
 void
 head_set_monitor (sw_head * h, gboolean monitor)
 {
@@ -805,10 +839,9 @@ head_write_unrestricted (sw_head * head, float * buf,
   sw_format * f = sounddata->format;
   gpointer d;
   float * rd;
-  sw_framecount_t i, j, t, b;
+  sw_framecount_t i, j, t, b, start = head->offset;
 
-  d = sounddata->data +
-    (int)frames_to_bytes (f, head->offset);
+  d = sounddata->data + frames_to_bytes (f, head->offset);
   rd = (float *)d;
 
   if (head->reverse) {
@@ -835,6 +868,8 @@ head_write_unrestricted (sw_head * head, float * buf,
 
   }
 
+  sample_data_changed (sample, start, start + count);
+
   return count;
 }
 
@@ -889,7 +924,7 @@ head_write (sw_head * head, float * buf, sw_framecount_t count)
       }
     } else {
       written += head_write_unrestricted (head, buf, n);
-      buf += (int)frames_to_samples (f, n);
+      buf += frames_to_samples (f, n);
       remaining -= n;
     }
   }
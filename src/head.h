@@ -24,6 +24,7 @@
 #include <gtk/gtk.h>
 
 #include "sweep_app.h"
+#include "mixbus.h"
 
 #define HEAD_LOCK(h,e) \
   g_mutex_lock ((h)->head_mutex);    \
@@ -78,6 +79,14 @@ head_set_offset (sw_head * h, sw_framecount_t offset);
 void
 head_set_monitor (sw_head * h, gboolean monitor);
 
+gboolean
+head_set_routing (sw_head * h, sw_mixmap * routing);
+
+/*
+ * Read count frames of the head's sample, at the sample's own channel
+ * count. head->gain is not applied here: the mixer applies it, ramped,
+ * as it routes the frames to the device (see mixbus.h).
+ */
 sw_framecount_t
 head_read (sw_head * head, float * buf, sw_framecount_t count,
 	   int driver_rate);
@@ -0,0 +1,189 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+#include "insert.h"
+
+struct _sw_insert {
+  sw_procedure * proc;
+  sw_processor * processor;
+  sw_param_set pset;
+  gpointer state;
+  gint nr_channels;
+  gint rate;
+
+  /* planar buffers for one block, each aligned to SW_PROCESS_ALIGN */
+  gpointer block;
+  gfloat ** channels;
+
+  /* written by the mixer thread */
+  gint last_usec;
+  gint worst_usec;
+  gint load_percent;
+};
+
+sw_insert *
+insert_new (sw_procedure * proc, sw_format * format, sw_param_set pset)
+{
+  sw_insert * insert;
+  gint c;
+
+  if (proc->processor == NULL) return NULL;
+
+  insert = g_malloc0 (sizeof (sw_insert));
+
+  insert->proc = proc;
+  insert->processor = proc->processor;
+  insert->nr_channels = format->channels;
+  insert->rate = format->rate;
+
+  /* The processor may refer to pset for as long as it runs */
+  if (proc->nr_params > 0)
+    insert->pset = g_memdup (pset, proc->nr_params * sizeof (sw_param));
+
+  insert->state = insert->processor->init (format, insert->pset,
+					   proc->custom_data);
+  if (insert->state == NULL) {
+    g_free (insert->pset);
+    g_free (insert);
+    return NULL;
+  }
+
+  insert->block = g_malloc (insert->nr_channels * SW_PROCESS_BLOCK_FRAMES *
+			    sizeof (gfloat) + SW_PROCESS_ALIGN);
+  insert->channels = g_malloc (insert->nr_channels * sizeof (gfloat *));
+  insert->channels[0] =
+    (gfloat *)(((gsize)insert->block + SW_PROCESS_ALIGN - 1) &
+	       ~((gsize)SW_PROCESS_ALIGN - 1));
+  for (c = 1; c < insert->nr_channels; c++) {
+    insert->channels[c] = insert->channels[c-1] + SW_PROCESS_BLOCK_FRAMES;
+  }
+
+  return insert;
+}
+
+void
+insert_free (sw_insert * insert)
+{
+  if (insert == NULL) return;
+
+  insert->processor->cleanup (insert->state);
+
+  g_free (insert->channels);
+  g_free (insert->block);
+  g_free (insert->pset);
+  g_free (insert);
+}
+
+gint
+insert_get_rate (sw_insert * insert)
+{
+  return insert->rate;
+}
+
+void
+insert_process (sw_insert * insert, float * buf, gint nr_channels,
+		gint rate, sw_framecount_t count)
+{
+  sw_framecount_t offset, n, i;
+  gint64 t0, usec;
+  gint c, worst, load;
+  float * p;
+
+  if (nr_channels != insert->nr_channels || rate != insert->rate) return;
+
+  t0 = g_get_monotonic_time ();
+
+  for (offset = 0; offset < count; offset += n) {
+    n = MIN (count - offset, SW_PROCESS_BLOCK_FRAMES);
+    p = buf + offset * nr_channels;
+
+    for (c = 0; c < nr_channels; c++) {
+      for (i = 0; i < n; i++) {
+	insert->channels[c][i] = p[i * nr_channels + c];
+      }
+    }
+
+    insert->processor->process (insert->state, insert->channels,
+				nr_channels, (gint)n);
+
+    for (c = 0; c < nr_channels; c++) {
+      for (i = 0; i < n; i++) {
+	p[i * nr_channels + c] = insert->channels[c][i];
+      }
+    }
+  }
+
+  usec = g_get_monotonic_time () - t0;
+
+  worst = g_atomic_int_get (&insert->worst_usec);
+  if (usec > worst)
+    g_atomic_int_set (&insert->worst_usec, (gint)usec);
+
+  load = (count > 0) ? (gint)(usec * insert->rate / (count * 10000)) : 0;
+
+  g_atomic_int_set (&insert->last_usec, (gint)usec);
+  g_atomic_int_set (&insert->load_percent, load);
+}
+
+void
+insert_flush (sw_insert * insert)
+{
+  if (insert->processor->flush)
+    insert->processor->flush (insert->state);
+}
+
+void
+insert_get_stats (sw_insert * insert, gint * last_usec, gint * worst_usec,
+		  gint * load_percent)
+{
+  if (last_usec) *last_usec = g_atomic_int_get (&insert->last_usec);
+  if (worst_usec) *worst_usec = g_atomic_int_get (&insert->worst_usec);
+  if (load_percent) *load_percent = g_atomic_int_get (&insert->load_percent);
+}
+
+/*
+ * The mixer only ever trylocks insert_mutex (see head_read), so swapping
+ * inserts never makes it wait: it plays one block dry instead.
+ */
+void
+head_set_insert (sw_head * h, sw_insert * insert)
+{
+  sw_insert * old;
+
+  g_mutex_lock (&h->insert_mutex);
+
+  old = h->insert;
+  h->insert = insert;
+
+  g_mutex_unlock (&h->insert_mutex);
+
+  insert_free (old);
+}
@@ -0,0 +1,88 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __INSERT_H__
+#define __INSERT_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+
+/*
+ * Realtime inserts.
+ *
+ * An insert runs a procedure's processor (see sw_processor) over a
+ * head's output as it plays, so that an effect can be auditioned, and
+ * its parameters adjusted, before it is applied to the sample.
+ *
+ * Inserts are created and freed on the GUI thread, and swapped into a
+ * head with head_set_insert (). The mixer thread runs them from
+ * head_read (), timing each block.
+ */
+
+typedef struct _sw_insert sw_insert;
+
+/*
+ * GUI thread: returns NULL if proc has no processor, or it fails to start.
+ * format is that of the audio the insert will process, which is at the
+ * device's rate (see play_get_rate ()), not necessarily the sample's.
+ */
+sw_insert *
+insert_new (sw_procedure * proc, sw_format * format, sw_param_set pset);
+
+void
+insert_free (sw_insert * insert);
+
+/* The rate the insert was set up for */
+gint
+insert_get_rate (sw_insert * insert);
+
+/*
+ * Mixer thread: process count frames of buf, interleaved at nr_channels,
+ * in place. Does nothing if the insert was set up for a different number
+ * of channels or a different rate.
+ */
+void
+insert_process (sw_insert * insert, float * buf, gint nr_channels,
+		gint rate, sw_framecount_t count);
+
+/*
+ * Mixer thread: discard the processor's history, before processing
+ * frames that do not follow on from the last ones processed.
+ */
+void
+insert_flush (sw_insert * insert);
+
+/*
+ * Cost of the blocks processed so far: the time taken by the last block
+ * and by the slowest, in microseconds, and the last block's time as a
+ * percentage of the time it takes to play. Safe to call from any thread.
+ */
+void
+insert_get_stats (sw_insert * insert, gint * last_usec, gint * worst_usec,
+		  gint * load_percent);
+
+/* GUI thread: replace the insert of head h, freeing the old one */
+void
+head_set_insert (sw_head * h, sw_insert * insert);
+
+#endif /* __INSERT_H__ */
@@ -0,0 +1,365 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <glib.h>
+
+#include <sweep/sweep_i18n.h>
+
+#include "interp.h"
+
+/*
+ * Each head keeps the INTERP_MAX_TAPS input frames around its position
+ * in a small planar ring, with every frame stored twice (at slot and
+ * slot + INTERP_MAX_TAPS) so that any run of taps is contiguous. As the
+ * position moves by a frame or two only the new frames are fetched, in
+ * either direction; a jump refills the window.
+ *
+ * Lower qualities use the central taps of the same window, so the
+ * quality can change from one period to the next without reallocation.
+ */
+
+#define INTERP_PHASES 512
+#define INTERP_MAX_TAPS 32
+#define INTERP_HALF (INTERP_MAX_TAPS / 2)
+
+/* Tables for input steps of up to 1, 2, ... INTERP_CUTOFFS frames */
+#define INTERP_CUTOFFS 16
+
+/* Share of a period that mixing may use before quality is reduced */
+#define BUDGET_OVER_NUM 1
+#define BUDGET_OVER_DEN 2
+#define BUDGET_OVER_PERIODS 16
+
+/* ... and below which it is considered light enough to raise it again */
+#define BUDGET_UNDER_NUM 1
+#define BUDGET_UNDER_DEN 5
+#define BUDGET_UNDER_PERIODS 4096
+
+struct _sw_interp {
+  gint channels;
+  volatile gint quality;
+  gboolean valid;
+  sw_framecount_t base; /* input frame held in slot start */
+  gint start;
+  float * win; /* channels * 2 * INTERP_MAX_TAPS */
+  float * frame; /* scratch, one input frame */
+};
+
+static const gint interp_taps[INTERP_MAX] = { 2, 8, 16, 32 };
+
+/* Passband edge as a fraction of the input Nyquist frequency */
+static const gdouble interp_rolloff[INTERP_MAX] = { 1.0, 0.85, 0.91, 0.95 };
+
+static const char * interp_names[INTERP_MAX] = {
+  N_("Linear"), N_("Fast"), N_("Medium"), N_("Best")
+};
+
+static float * tables[INTERP_MAX][INTERP_CUTOFFS];
+static gboolean tables_built = FALSE;
+
+static volatile gint interp_ceiling = INTERP_MAX - 1;
+
+/* Times the budget has lowered interp_ceiling, for interp_get_limits () */
+static volatile gint interp_limits = 0;
+
+static gdouble
+sinc (gdouble x)
+{
+  if (fabs (x) < 1e-9) return 1.0;
+  return sin (M_PI * x) / (M_PI * x);
+}
+
+/* Blackman window over -half < x < half */
+static gdouble
+blackman (gdouble x, gdouble half)
+{
+  if (fabs (x) >= half) return 0.0;
+  return 0.42 + 0.5 * cos (M_PI * x / half) + 0.08 * cos (2.0 * M_PI * x / half);
+}
+
+/*
+ * Row p of a table holds the taps for input frames
+ * (frame - taps/2 + 1) ... (frame + taps/2) at fractional position
+ * p / INTERP_PHASES. Each row is normalised to unity gain at DC.
+ */
+static float *
+build_table (sw_interp_quality quality, gdouble cutoff)
+{
+  gint taps = interp_taps[quality];
+  gint p, k;
+  gdouble frac, x, h, sum;
+  float * table, * row;
+
+  table = g_malloc (INTERP_PHASES * taps * sizeof (float));
+
+  for (p = 0; p < INTERP_PHASES; p++) {
+    frac = (gdouble)p / INTERP_PHASES;
+    row = table + p * taps;
+    sum = 0.0;
+
+    for (k = 0; k < taps; k++) {
+      x = (k - taps/2 + 1) - frac;
+
+      if (quality == INTERP_LINEAR) {
+	h = MAX (0.0, 1.0 - fabs (x));
+      } else {
+	h = cutoff * sinc (cutoff * x) * blackman (x, taps / 2.0);
+      }
+
+      row[k] = (float)h;
+      sum += h;
+    }
+
+    for (k = 0; k < taps; k++)
+      row[k] = (float)(row[k] / sum);
+  }
+
+  return table;
+}
+
+static void
+build_tables (void)
+{
+  gint q, c;
+
+  if (tables_built) return;
+
+  tables[INTERP_LINEAR][0] = build_table (INTERP_LINEAR, 1.0);
+  for (c = 1; c < INTERP_CUTOFFS; c++)
+    tables[INTERP_LINEAR][c] = tables[INTERP_LINEAR][0];
+
+  for (q = INTERP_FAST; q < INTERP_MAX; q++) {
+    for (c = 0; c < INTERP_CUTOFFS; c++) {
+      tables[q][c] = build_table (q, interp_rolloff[q] / (c + 1));
+    }
+  }
+
+  tables_built = TRUE;
+}
+
+sw_interp *
+interp_new (gint channels, sw_interp_quality quality)
+{
+  sw_interp * ip;
+
+  build_tables ();
+
+  ip = g_malloc0 (sizeof (sw_interp));
+  ip->channels = channels;
+  ip->quality = CLAMP (quality, INTERP_LINEAR, INTERP_MAX - 1);
+  ip->valid = FALSE;
+  ip->win = g_malloc0 (channels * 2 * INTERP_MAX_TAPS * sizeof (float));
+  ip->frame = g_malloc0 (channels * sizeof (float));
+
+  return ip;
+}
+
+void
+interp_free (sw_interp * ip)
+{
+  if (ip == NULL) return;
+
+  g_free (ip->win);
+  g_free (ip->frame);
+  g_free (ip);
+}
+
+gint
+interp_channels (sw_interp * ip)
+{
+  return ip->channels;
+}
+
+void
+interp_set_quality (sw_interp * ip, sw_interp_quality quality)
+{
+  g_atomic_int_set (&ip->quality, CLAMP (quality, INTERP_LINEAR,
+					 INTERP_MAX - 1));
+}
+
+sw_interp_quality
+interp_get_quality (sw_interp * ip)
+{
+  return MIN (g_atomic_int_get (&ip->quality),
+	      g_atomic_int_get (&interp_ceiling));
+}
+
+void
+interp_reset (sw_interp * ip)
+{
+  ip->valid = FALSE;
+}
+
+void
+interp_get_limits (gint * limits, sw_interp_quality * ceiling)
+{
+  *limits = g_atomic_int_get (&interp_limits);
+  *ceiling = g_atomic_int_get (&interp_ceiling);
+}
+
+const char *
+interp_quality_name (sw_interp_quality quality)
+{
+  return interp_names[CLAMP (quality, INTERP_LINEAR, INTERP_MAX - 1)];
+}
+
+static void
+window_store (sw_interp * ip, gint slot, sw_framecount_t frame,
+	      sw_interp_fetch fetch, gpointer fetch_data)
+{
+  gint c;
+  float * w;
+
+  fetch (fetch_data, frame, ip->frame);
+
+  for (c = 0, w = ip->win; c < ip->channels; c++, w += 2 * INTERP_MAX_TAPS) {
+    w[slot] = w[slot + INTERP_MAX_TAPS] = ip->frame[c];
+  }
+}
+
+/* Make the window hold frames (frame - HALF + 1) ... (frame + HALF) */
+static void
+window_seek (sw_interp * ip, sw_framecount_t frame,
+	     sw_interp_fetch fetch, gpointer fetch_data)
+{
+  sw_framecount_t want = frame - INTERP_HALF + 1;
+  gint i;
+
+  if (!ip->valid || want - ip->base >= INTERP_MAX_TAPS ||
+      ip->base - want >= INTERP_MAX_TAPS) {
+    ip->base = want;
+    ip->start = 0;
+    for (i = 0; i < INTERP_MAX_TAPS; i++)
+      window_store (ip, i, want + i, fetch, fetch_data);
+    ip->valid = TRUE;
+    return;
+  }
+
+  while (ip->base < want) {
+    window_store (ip, ip->start, ip->base + INTERP_MAX_TAPS,
+		  fetch, fetch_data);
+    ip->start = (ip->start + 1) % INTERP_MAX_TAPS;
+    ip->base++;
+  }
+
+  while (ip->base > want) {
+    ip->start = (ip->start + INTERP_MAX_TAPS - 1) % INTERP_MAX_TAPS;
+    ip->base--;
+    window_store (ip, ip->start, ip->base, fetch, fetch_data);
+  }
+}
+
+static float
+interp_dot (const float * a, const float * b, gint n)
+{
+  gint i = 0;
+  float sum = 0.0;
+
+#ifdef __SSE__
+  if (n >= 4) {
+    __m128 acc = _mm_setzero_ps ();
+    float v[4];
+
+    for (; i + 4 <= n; i += 4)
+      acc = _mm_add_ps (acc, _mm_mul_ps (_mm_loadu_ps (a + i),
+					 _mm_loadu_ps (b + i)));
+
+    _mm_storeu_ps (v, acc);
+    sum = (v[0] + v[1]) + (v[2] + v[3]);
+  }
+#endif
+
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+
+  return sum;
+}
+
+void
+interp_frame (sw_interp * ip, sw_framecount_t frame, gdouble frac,
+	      gdouble step, sw_interp_fetch fetch, gpointer fetch_data,
+	      float * out)
+{
+  sw_interp_quality quality = interp_get_quality (ip);
+  gint taps = interp_taps[quality];
+  gint cutoff, phase, offset, c;
+  const float * row, * w;
+
+  window_seek (ip, frame, fetch, fetch_data);
+
+  step = fabs (step);
+  cutoff = (step <= 1.0) ? 0 : MIN ((gint)ceil (step) - 1, INTERP_CUTOFFS - 1);
+
+  phase = CLAMP ((gint)(frac * INTERP_PHASES), 0, INTERP_PHASES - 1);
+  row = tables[quality][cutoff] + phase * taps;
+
+  offset = ip->start + (INTERP_MAX_TAPS - taps) / 2;
+
+  for (c = 0, w = ip->win; c < ip->channels; c++, w += 2 * INTERP_MAX_TAPS) {
+    out[c] = interp_dot (w + offset, row, taps);
+  }
+}
+
+void
+interp_account_load (sw_interp_budget * budget, gint usec, gint period_usec)
+{
+  gint ceiling;
+
+  if (period_usec <= 0) return;
+
+  if (usec * BUDGET_OVER_DEN > period_usec * BUDGET_OVER_NUM) {
+    budget->under = 0;
+
+    if (++budget->over >= BUDGET_OVER_PERIODS) {
+      budget->over = 0;
+      ceiling = g_atomic_int_get (&interp_ceiling);
+
+      if (ceiling > INTERP_LINEAR &&
+	  g_atomic_int_compare_and_exchange (&interp_ceiling, ceiling,
+					     ceiling - 1))
+	g_atomic_int_inc (&interp_limits);
+    }
+  } else if (usec * BUDGET_UNDER_DEN < period_usec * BUDGET_UNDER_NUM) {
+    budget->over = 0;
+
+    if (++budget->under >= BUDGET_UNDER_PERIODS) {
+      budget->under = 0;
+      ceiling = g_atomic_int_get (&interp_ceiling);
+
+      if (ceiling < INTERP_MAX - 1)
+	g_atomic_int_compare_and_exchange (&interp_ceiling, ceiling,
+					   ceiling + 1);
+    }
+  } else {
+    budget->over = 0;
+    budget->under = 0;
+  }
+}
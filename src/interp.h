@@ -0,0 +1,111 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __INTERP_H__
+#define __INTERP_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+
+/*
+ * Band-limited interpolation for playback heads.
+ *
+ * Output frames are computed from a polyphase windowed-sinc table: the
+ * fractional position selects one of INTERP_PHASES rows of
+ * precomputed coefficients, whose length depends on the quality. When a
+ * head moves faster than one input frame per output frame, a table
+ * with a proportionally lower cutoff is used, so that fast varispeed
+ * and scrubbing do not alias.
+ */
+
+typedef enum {
+  INTERP_LINEAR = 0, /* 2-point, as sweep has always done */
+  INTERP_FAST,       /* 8 taps */
+  INTERP_MEDIUM,     /* 16 taps */
+  INTERP_BEST,       /* 32 taps */
+  INTERP_MAX
+} sw_interp_quality;
+
+#define INTERP_QUALITY_KEY "PlaybackInterpolation"
+#define DEFAULT_INTERP_QUALITY INTERP_MEDIUM
+
+/* Fill out with the channels of the given frame, or zeroes if none */
+typedef void (*sw_interp_fetch) (gpointer data, sw_framecount_t frame,
+				 float * out);
+
+/*
+ * Per-mixer CPU budget state. If mixing keeps taking too large a share
+ * of each period, the quality used by all heads is lowered a step; it
+ * is raised again after a long run of light periods.
+ */
+typedef struct {
+  gint over;
+  gint under;
+} sw_interp_budget;
+
+/* Builds the coefficient tables on first use; call from the GUI thread */
+sw_interp *
+interp_new (gint channels, sw_interp_quality quality);
+
+void
+interp_free (sw_interp * ip);
+
+gint
+interp_channels (sw_interp * ip);
+
+void
+interp_set_quality (sw_interp * ip, sw_interp_quality quality);
+
+/* The quality to use now: the head's own, limited by the CPU budget */
+sw_interp_quality
+interp_get_quality (sw_interp * ip);
+
+/* Forget the input history, eg. after the sound data has changed */
+void
+interp_reset (sw_interp * ip);
+
+/*
+ * Compute one output frame at input position (frame + frac), where
+ * 0 <= frac < 1 and step is the current input frames per output frame.
+ */
+void
+interp_frame (sw_interp * ip, sw_framecount_t frame, gdouble frac,
+	      gdouble step, sw_interp_fetch fetch, gpointer fetch_data,
+	      float * out);
+
+/* Called by a mixer after each period with its mixing time */
+void
+interp_account_load (sw_interp_budget * budget, gint usec, gint period_usec);
+
+/*
+ * Any thread: how many times the budget has lowered the quality, and
+ * the highest quality it allows now. The mixer only counts; these are
+ * reported from the GUI and at the end of a run.
+ */
+void
+interp_get_limits (gint * limits, sw_interp_quality * ceiling);
+
+const char *
+interp_quality_name (sw_interp_quality quality);
+
+#endif /* __INTERP_H__ */
@@ -45,6 +45,7 @@
 #include "callbacks.h"
 #include "question_dialogs.h"
 #include "play.h"
+#include "scheduler.h"
 
 extern void sweep_timeouts_init (void);
 extern gboolean ignore_failed_tdb_lock;
@@ -191,6 +192,9 @@ main (int argc, char *argv[])
   /* initialise preferences */
   prefs_init ();
 
+  /* start the operation worker pool */
+  init_scheduler ();
+
   /* initialise plugins */
   init_plugins ();
 
@@ -0,0 +1,280 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <glib.h>
+
+#include "mixbus.h"
+
+/*
+ * The common cases -- a head with the same number of channels as the
+ * device, or a mono head -- take vectorised paths: a scaled add for a
+ * steady gain, or a multiply-add against a per-sample ramp. Other
+ * layouts go through the matrix one output sample at a time.
+ *
+ * Blocks are at most MIXBUS_MAX_SAMPLES long per call; longer requests
+ * are split, continuing the ramp across the pieces.
+ */
+
+#define MIXBUS_MAX_SAMPLES 4096
+
+sw_mixmap *
+mixmap_new (gint src_channels, gint dest_channels)
+{
+  sw_mixmap * map;
+
+  map = g_malloc (sizeof (sw_mixmap));
+  map->src_channels = src_channels;
+  map->dest_channels = dest_channels;
+  map->gains = g_malloc0 (src_channels * dest_channels * sizeof (float));
+
+  return map;
+}
+
+sw_mixmap *
+mixmap_new_default (gint src_channels, gint dest_channels)
+{
+  sw_mixmap * map;
+  gint s, d;
+
+  map = mixmap_new (src_channels, dest_channels);
+
+  if (src_channels == 1) {
+    for (d = 0; d < dest_channels; d++)
+      mixmap_set_gain (map, 0, d, 1.0);
+  } else if (dest_channels == 1) {
+    for (s = 0; s < src_channels; s++)
+      mixmap_set_gain (map, s, 0, 1.0 / src_channels);
+  } else {
+    for (s = 0; s < MIN (src_channels, dest_channels); s++)
+      mixmap_set_gain (map, s, s, 1.0);
+  }
+
+  return map;
+}
+
+void
+mixmap_free (sw_mixmap * map)
+{
+  if (map == NULL) return;
+
+  g_free (map->gains);
+  g_free (map);
+}
+
+void
+mixmap_set_gain (sw_mixmap * map, gint src_channel, gint dest_channel,
+		 gfloat gain)
+{
+  g_return_if_fail (src_channel >= 0 && src_channel < map->src_channels);
+  g_return_if_fail (dest_channel >= 0 && dest_channel < map->dest_channels);
+
+  map->gains[dest_channel * map->src_channels + src_channel] = gain;
+}
+
+/* dest[i] += src[i] * gain */
+static void
+mix_scaled (float * dest, const float * src, gfloat gain, gint n)
+{
+  gint i = 0;
+
+#ifdef __SSE__
+  __m128 g = _mm_set1_ps (gain);
+
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps (dest + i,
+		   _mm_add_ps (_mm_loadu_ps (dest + i),
+			       _mm_mul_ps (_mm_loadu_ps (src + i), g)));
+  }
+#endif
+
+  for (; i < n; i++)
+    dest[i] += src[i] * gain;
+}
+
+/* dest[i] += src[i] * ramp[i] */
+static void
+mix_ramped (float * dest, const float * src, const float * ramp, gint n)
+{
+  gint i = 0;
+
+#ifdef __SSE__
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps (dest + i,
+		   _mm_add_ps (_mm_loadu_ps (dest + i),
+			       _mm_mul_ps (_mm_loadu_ps (src + i),
+					   _mm_loadu_ps (ramp + i))));
+  }
+#endif
+
+  for (; i < n; i++)
+    dest[i] += src[i] * ramp[i];
+}
+
+/* Fill ramp with one gain per frame, repeated for each of channels */
+static void
+build_ramp (float * ramp, gint channels, gfloat gain_from, gfloat step,
+	    gint nr_frames)
+{
+  gint i, j, b = 0;
+  gfloat g;
+
+  for (i = 0; i < nr_frames; i++) {
+    g = gain_from + step * i;
+    for (j = 0; j < channels; j++)
+      ramp[b++] = g;
+  }
+}
+
+static void
+mix_matrix (float * dest, gint dest_channels,
+	    const float * src, gint src_channels,
+	    const float * gains, gfloat gain_from, gfloat step,
+	    gint nr_frames)
+{
+  gint i, s, d;
+  const float * row;
+  float a, g;
+
+  for (i = 0; i < nr_frames; i++) {
+    g = gain_from + step * i;
+    row = gains;
+
+    for (d = 0; d < dest_channels; d++, row += src_channels) {
+      a = 0.0;
+      for (s = 0; s < src_channels; s++)
+	a += src[s] * row[s];
+      dest[d] += a * g;
+    }
+
+    src += src_channels;
+    dest += dest_channels;
+  }
+}
+
+/* Default routing other than mono-in or matching layouts */
+static void
+mix_default (float * dest, gint dest_channels,
+	     const float * src, gint src_channels,
+	     gfloat gain_from, gfloat step, gint nr_frames)
+{
+  gint i, j, n = MIN (src_channels, dest_channels);
+  float a, g;
+
+  for (i = 0; i < nr_frames; i++) {
+    g = gain_from + step * i;
+
+    if (dest_channels == 1) {
+      a = 0.0;
+      for (j = 0; j < src_channels; j++)
+	a += src[j];
+      dest[0] += a * g / src_channels;
+    } else {
+      for (j = 0; j < n; j++)
+	dest[j] += src[j] * g;
+    }
+
+    src += src_channels;
+    dest += dest_channels;
+  }
+}
+
+static void
+mixbus_add_block (float * dest, gint dest_channels,
+		  const float * src, gint src_channels,
+		  const sw_mixmap * map, gfloat gain_from, gfloat step,
+		  gint nr_frames)
+{
+  float ramp[MIXBUS_MAX_SAMPLES];
+  float up[MIXBUS_MAX_SAMPLES];
+  gint i, j, b;
+
+  if (map != NULL) {
+    mix_matrix (dest, dest_channels, src, src_channels, map->gains,
+		gain_from, step, nr_frames);
+
+  } else if (src_channels == dest_channels) {
+    if (step == 0.0) {
+      mix_scaled (dest, src, gain_from, nr_frames * src_channels);
+    } else {
+      build_ramp (ramp, src_channels, gain_from, step, nr_frames);
+      mix_ramped (dest, src, ramp, nr_frames * src_channels);
+    }
+
+  } else if (src_channels == 1) {
+    /* Spread the mono input across the outputs, then add it as above */
+    for (i = 0, b = 0; i < nr_frames; i++)
+      for (j = 0; j < dest_channels; j++)
+	up[b++] = src[i];
+
+    if (step == 0.0) {
+      mix_scaled (dest, up, gain_from, nr_frames * dest_channels);
+    } else {
+      build_ramp (ramp, dest_channels, gain_from, step, nr_frames);
+      mix_ramped (dest, up, ramp, nr_frames * dest_channels);
+    }
+
+  } else {
+    mix_default (dest, dest_channels, src, src_channels,
+		 gain_from, step, nr_frames);
+  }
+}
+
+void
+mixbus_add (float * dest, gint dest_channels,
+	    const float * src, gint src_channels,
+	    const sw_mixmap * map, gfloat gain_from, gfloat gain_to,
+	    gint nr_frames)
+{
+  gint block, channels;
+  gfloat step;
+
+  if (nr_frames <= 0) return;
+
+  if (map != NULL && (map->src_channels != src_channels ||
+		      map->dest_channels != dest_channels))
+    map = NULL;
+
+  step = (gain_to - gain_from) / nr_frames;
+
+  channels = MAX (src_channels, dest_channels);
+  block = MAX (MIXBUS_MAX_SAMPLES / channels, 1);
+
+  while (nr_frames > 0) {
+    block = MIN (block, nr_frames);
+
+    mixbus_add_block (dest, dest_channels, src, src_channels, map,
+		      gain_from, step, block);
+
+    dest += block * dest_channels;
+    src += block * src_channels;
+    gain_from += step * block;
+    nr_frames -= block;
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MIXBUS_H__
+#define __MIXBUS_H__
+
+#include <glib.h>
+
+/*
+ * Mixing of head output into a device buffer.
+ *
+ * A head's interleaved frames are added into the destination through a
+ * routing matrix, with its gain ramped linearly across the block so
+ * that gain changes do not zipper. Without an explicit matrix, channels
+ * are routed as sweep always has: mono is copied to every output, a
+ * mono output gets the average of all inputs, and otherwise channels
+ * map one to one, dropping or leaving silent any extras.
+ */
+
+typedef struct _sw_mixmap sw_mixmap;
+
+struct _sw_mixmap {
+  gint src_channels;
+  gint dest_channels;
+  float * gains; /* dest_channels rows of src_channels */
+};
+
+/* A routing matrix with all gains zero */
+sw_mixmap *
+mixmap_new (gint src_channels, gint dest_channels);
+
+/* The default routing, as described above */
+sw_mixmap *
+mixmap_new_default (gint src_channels, gint dest_channels);
+
+void
+mixmap_free (sw_mixmap * map);
+
+void
+mixmap_set_gain (sw_mixmap * map, gint src_channel, gint dest_channel,
+		 gfloat gain);
+
+/*
+ * Add nr_frames of src into dest, scaled by a gain ramping from
+ * gain_from at the first frame towards gain_to. If map is NULL, or does
+ * not match the channel counts, the default routing is used.
+ */
+void
+mixbus_add (float * dest, gint dest_channels,
+	    const float * src, gint src_channels,
+	    const sw_mixmap * map, gfloat gain_from, gfloat gain_to,
+	    gint nr_frames);
+
+#endif /* __MIXBUS_H__ */
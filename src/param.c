@@ -30,6 +30,9 @@
 #include <sweep/sweep_types.h>
 #include "sweep_app.h"
 #include "interface.h"
+#include "plugin.h"
+#include "insert.h"
+#include "play.h"
 
 #include "../pixmaps/ladlogo.xpm"
 
@@ -194,7 +197,8 @@ print_param_set (sw_procedure * proc, sw_param_set pset)
 typedef enum {
   SW_PS_TOGGLE_BUTTON,
   SW_PS_KNOWN_PARAM,
-  SW_PS_ADJUSTMENT
+  SW_PS_ADJUSTMENT,
+  SW_PS_ENTRY
 } sw_ps_widget_t;
 
 typedef struct _sw_ps_widget sw_ps_widget;
@@ -206,6 +210,7 @@ struct _sw_ps_widget {
     GtkWidget * toggle_button;
     sw_param * known_param;
     GtkObject * adjustment;
+    GtkWidget * entry;
   } w;
 };
 
@@ -218,8 +223,16 @@ struct _sw_ps_adjuster {
   GtkWidget * table;
   sw_ps_widget * widgets;
   GList * plsk_list;
+
+  /* Realtime preview through the play head's insert */
+  GtkWidget * preview_label;
+  sw_param_set preview_pset; /* parameters of the running insert */
+  gint preview_tag;
 };
 
+/* How often to pick up parameter changes and update the CPU readout */
+#define PREVIEW_INTERVAL 200
+
 static sw_ps_adjuster *
 ps_adjuster_new (sw_procedure * proc, sw_view * view, sw_param_set pset,
 		 GtkWidget * window)
@@ -239,6 +252,10 @@ ps_adjuster_new (sw_procedure * proc, sw_view * view, sw_param_set pset,
   ps->widgets = g_malloc (sizeof (sw_ps_widget) * proc->nr_params);
   ps->plsk_list = NULL;
 
+  ps->preview_label = NULL;
+  ps->preview_pset = NULL;
+  ps->preview_tag = 0;
+
   return ps;
 }
 
@@ -286,12 +303,130 @@ get_param_values (sw_procedure * proc, sw_param_set pset, sw_ps_widget * widgets
 	break;
       }
       break;
+    case SW_PS_ENTRY:
+      /* Copied, as the operation may outlive the dialog */
+      pset[i].s = g_strdup (gtk_entry_get_text (GTK_ENTRY(widgets[i].w.entry)));
+      break;
     default:
       break;
     }
   }
 }
 
+/*
+ * Free the strings get_param_values () copied into pset
+ */
+static void
+free_param_strings (sw_procedure * proc, sw_param_set pset,
+		    sw_ps_widget * widgets)
+{
+  gint i;
+
+  for (i = 0; i < proc->nr_params; i++) {
+    if (widgets[i].type == SW_PS_ENTRY) {
+      g_free (pset[i].s);
+      pset[i].s = NULL;
+    }
+  }
+}
+
+/*
+ * Realtime preview: while the Preview button is down, the procedure's
+ * processor runs on the sample's play head. The current parameter
+ * values are polled, and the insert is replaced whenever they change.
+ */
+static gboolean
+param_preview_update (gpointer data)
+{
+  sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
+  sw_procedure * proc = ps->proc;
+  sw_sample * sample = ps->view->sample;
+  sw_param_set pset;
+  sw_insert * insert;
+  sw_format format;
+  gint i, last_usec, worst_usec, load;
+  gchar buf[128];
+
+  pset = sw_param_set_new (proc);
+  get_param_values (proc, pset, ps->widgets);
+
+  for (i = 0; ps->preview_pset && i < proc->nr_params; i++) {
+    if (param_cmp (proc->param_specs[i].type, pset[i], ps->preview_pset[i]))
+      break;
+  }
+
+  /* The insert runs after resampling to the device's rate */
+  format = *sample->sounddata->format;
+  format.rate = play_get_rate (sample);
+
+  insert = sample->play_head->insert;
+
+  if (ps->preview_pset == NULL || i < proc->nr_params ||
+      (insert != NULL && insert_get_rate (insert) != format.rate)) {
+    insert = insert_new (proc, &format, pset);
+    head_set_insert (sample->play_head, insert);
+
+    if (ps->preview_pset)
+      free_param_strings (proc, ps->preview_pset, ps->widgets);
+    g_free (ps->preview_pset);
+    ps->preview_pset = pset;
+
+    if (insert == NULL) {
+      gtk_label_set_text (GTK_LABEL(ps->preview_label),
+			  _("Preview failed to start"));
+      return TRUE;
+    }
+  } else {
+    free_param_strings (proc, pset, ps->widgets);
+    g_free (pset);
+  }
+
+  if (sample->play_head->insert == NULL) return TRUE;
+
+  insert_get_stats (sample->play_head->insert, &last_usec, &worst_usec,
+		    &load);
+  g_snprintf (buf, sizeof (buf), _("%d%% CPU (%d us, worst %d us)"),
+	      load, last_usec, worst_usec);
+  gtk_label_set_text (GTK_LABEL(ps->preview_label), buf);
+
+  return TRUE;
+}
+
+static void
+param_preview_stop (sw_ps_adjuster * ps)
+{
+  if (ps->preview_tag == 0) return;
+
+  g_source_remove (ps->preview_tag);
+  ps->preview_tag = 0;
+
+  head_set_insert (ps->view->sample->play_head, NULL);
+
+  if (ps->preview_pset)
+    free_param_strings (ps->proc, ps->preview_pset, ps->widgets);
+  g_free (ps->preview_pset);
+  ps->preview_pset = NULL;
+
+  if (ps->preview_label)
+    gtk_label_set_text (GTK_LABEL(ps->preview_label), "");
+}
+
+static void
+param_preview_toggled_cb (GtkWidget * widget, gpointer data)
+{
+  sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
+
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(widget))) {
+    if (ps->preview_tag == 0) {
+      param_preview_update (ps);
+      ps->preview_tag = g_timeout_add (PREVIEW_INTERVAL,
+				       param_preview_update, ps);
+    }
+  } else {
+    param_preview_stop (ps);
+  }
+}
+
 /*
  * Callback for OK button of param_set_adjuster
  */
@@ -300,16 +435,15 @@ param_set_apply_cb (GtkWidget * widget, gpointer data)
 {
   sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
 
+  param_preview_stop (ps);
+
   get_param_values (ps->proc, ps->pset, ps->widgets);
 
 #ifdef DEBUG
   print_param_set (ps->proc, ps->pset);
 #endif
 
-  if (ps->proc->apply) {
-    ps->proc->apply (ps->view->sample,
-		     ps->pset, ps->proc->custom_data);
-  }
+  procedure_apply (ps->proc, ps->view->sample, ps->pset);
 
   gtk_widget_destroy (ps->window);
 
@@ -324,6 +458,10 @@ param_set_cancel_cb (GtkWidget * widget, gpointer data)
 {
   sw_ps_adjuster * ps = (sw_ps_adjuster *)data;
 
+  /* The label may already be going with the window */
+  ps->preview_label = NULL;
+  param_preview_stop (ps);
+
   gtk_widget_destroy (ps->window);
 
   ps_adjuster_destroy (ps);
@@ -347,6 +485,37 @@ param_list_set_known_cb (GtkWidget * widget, gpointer data)
   *(plsk->p1) = plsk->p2;
 }
 
+/*
+ * Callback for the Browse button of filename parameters
+ */
+static void
+param_entry_browse_cb (GtkWidget * widget, gpointer data)
+{
+  GtkWidget * entry = (GtkWidget *)data;
+  GtkWidget * dialog;
+  const gchar * text;
+  gchar * filename;
+
+  dialog = gtk_file_chooser_dialog_new (_("Sweep: Choose file"),
+				GTK_WINDOW(gtk_widget_get_toplevel (entry)),
+				GTK_FILE_CHOOSER_ACTION_OPEN,
+				GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+				GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
+				NULL);
+
+  text = gtk_entry_get_text (GTK_ENTRY(entry));
+  if (text[0] != '\0')
+    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER(dialog), text);
+
+  if (gtk_dialog_run (GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+    filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER(dialog));
+    gtk_entry_set_text (GTK_ENTRY(entry), filename);
+    g_free (filename);
+  }
+
+  gtk_widget_destroy (dialog);
+}
+
 static GtkWidget *
 create_param_set_table (sw_ps_adjuster * ps)
 {
@@ -369,6 +538,8 @@ create_param_set_table (sw_ps_adjuster * ps)
   GtkWidget * menu;
   GtkWidget * menuitem;
   GtkWidget * checkbutton;
+  GtkWidget * entry;
+  GtkWidget * button;
   GtkWidget * num_widget; /* numeric input widget: hscale or spinbutton */
 
   GtkObject * adj;
@@ -449,6 +620,30 @@ create_param_set_table (sw_ps_adjuster * ps)
 
 	ps->widgets[i].type = SW_PS_KNOWN_PARAM;
 
+      } else if (pspec->type == SWEEP_TYPE_STRING) {
+
+	hbox = gtk_hbox_new (FALSE, 4);
+	gtk_table_attach (GTK_TABLE (table), hbox, 1, 2, i, i+1,
+			  GTK_FILL|GTK_EXPAND, GTK_SHRINK, 0, 0);
+	gtk_widget_show (hbox);
+
+	entry = gtk_entry_new ();
+	if (pset[i].s != NULL)
+	  gtk_entry_set_text (GTK_ENTRY(entry), pset[i].s);
+	gtk_box_pack_start (GTK_BOX(hbox), entry, TRUE, TRUE, 0);
+	gtk_widget_show (entry);
+
+	if (pspec->hints & SW_PARAM_HINT_FILENAME) {
+	  button = gtk_button_new_with_label (_("Browse..."));
+	  gtk_box_pack_start (GTK_BOX(hbox), button, FALSE, FALSE, 0);
+	  gtk_widget_show (button);
+	  g_signal_connect (G_OBJECT(button), "clicked",
+			    G_CALLBACK(param_entry_browse_cb), entry);
+	}
+
+	ps->widgets[i].type = SW_PS_ENTRY;
+	ps->widgets[i].w.entry = entry;
+
 
 #define ADJUSTER_NUMERIC(T, DIGITS) \
                                                                            \
@@ -735,6 +930,20 @@ create_param_set_adjuster (sw_procedure * proc, sw_view * view,
   g_signal_connect (G_OBJECT(button), "clicked",
 		      G_CALLBACK (param_set_suggest_cb), ps);
 
+  if (proc->processor != NULL) {
+    button = gtk_toggle_button_new_with_label (_("Preview"));
+    gtk_box_pack_start (GTK_BOX(vbox), button, FALSE, FALSE, 0);
+    gtk_widget_show (button);
+    g_signal_connect (G_OBJECT(button), "toggled",
+		      G_CALLBACK (param_preview_toggled_cb), ps);
+
+    label = gtk_label_new ("");
+    gtk_box_pack_start (GTK_BOX(vbox), label, FALSE, FALSE, 0);
+    gtk_widget_show (label);
+
+    ps->preview_label = label;
+  }
+
   scrolled = gtk_scrolled_window_new (NULL, NULL);
   gtk_widget_set_size_request (scrolled, -1, 240);
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled),
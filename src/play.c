@@ -35,6 +35,8 @@
 #include <fcntl.h>
 #include <math.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include <pthread.h>
 
 #ifdef RECORD_DEMO_FILES
@@ -54,31 +56,223 @@
 #include "head.h"
 #include "driver.h"
 #include "preferences.h"
+#include "prefetch.h"
+#include "insert.h"
+#include "interp.h"
+#include "mixbus.h"
 #include "sample-display.h"
 
 /*#define DEBUG*/
 
 #define SCRUB_SLACKNESS 2.0
 
+/* Frames mixed per period */
+#define PSIZ 64
+
+/* Channels the mix buffers are sized for before the mixer starts */
+#define PLAY_BUFFER_CHANNELS 8
+
 #define USE_MONITOR_KEY "UseMonitor"
 
-static GMutex play_mutex;
+/*
+ * Each output device (main and, if enabled, monitor) is driven by its own
+ * mixer thread, so a blocking write or a different clock on one device
+ * cannot hold up the other.
+ *
+ * The heads a mixer plays are published to it as an immutable array.
+ * Adding or removing a head builds a new array and swaps it in with a
+ * single atomic store; the mixer loads the current array once per period
+ * and never takes a lock or walks a list to mix. Each array holds a
+ * reference on its heads' samples, so a sample closed mid-period stays
+ * alive until the mixer is done with it.
+ *
+ * Replaced arrays are retired, tagged with the mixer's period count at
+ * the time, and freed (from the main thread) once the mixer has finished
+ * a later period or has exited. publish_mutex serialises publishers only,
+ * and lifecycle_mutex starting and stopping the thread; the mixer takes
+ * neither while mixing.
+ */
 
-static sw_handle * main_handle = NULL;
-static sw_handle * monitor_handle = NULL;
+typedef enum {
+  MIXER_HEAD_ADD,
+  MIXER_HEAD_REMOVE,
+  MIXER_HEAD_CLEAR
+} sw_mixer_op;
+
+typedef struct {
+  gint nr_heads;
+  sw_head * heads[1]; /* nr_heads long */
+} sw_head_set;
+
+typedef struct {
+  sw_head_set * set;
+  gint period;
+} sw_retired_set;
+
+typedef struct {
+  const char * name;
+  int cueing; /* passed to device_open () */
+  gboolean realtime;
+
+  GMutex lifecycle_mutex;
+  pthread_t thread;
+  gboolean running;
+  volatile gint active; /* set until the mixer thread has finished */
+
+  sw_handle * handle;
+  volatile gint driver_rate; /* 0 until the device is set up */
+
+  GMutex publish_mutex;
+  gpointer heads; /* sw_head_set *, atomic */
+  volatile gint nr_heads;
+  volatile gint periods; /* periods completed by the mixer */
+  GList * retired; /* sw_retired_set *, protected by publish_mutex */
+  guint reap_tag;
+
+  float * pbuf, * devbuf;
+  int pbuf_chans, devbuf_chans;
+} sw_mixer;
+
+static sw_mixer main_mixer = { "main", 0 };
+static sw_mixer monitor_mixer = { "monitor", 1 };
 
-static GList * active_main_heads = NULL;
-static GList * active_monitor_heads = NULL;
+static void
+mixer_post (sw_mixer * m, sw_head * head, sw_mixer_op op);
+
+/*
+ * Realtime mode (opt-in): mixer threads ask for SCHED_FIFO, and their
+ * mix buffers and a window of the sample data around each playing head
+ * (see prefetch.c) are mlock()ed so that the mixer does not page-fault
+ * mid-period. Either may be refused, in which case playback carries on
+ * as normal, with a single warning for each.
+ *
+ * Whether or not realtime mode is on, every period's mix time is
+ * measured: a period that took longer to mix than it takes to play is
+ * counted as late. That is the mixer running out of CPU, not the device
+ * underrunning; the drivers count real xruns themselves (see driver.h).
+ */
+
+
+static volatile gint realtime_warned = 0;
+
+static volatile gint play_late_periods = 0;
+static volatile gint play_worst_usec = 0;
+static volatile gint play_period_usec = 0;
 
 /*static int realoffset = 0;*/
 static sw_sample * prev_sample = NULL;
-static pthread_t player_thread = (pthread_t)-1;
 
 static gboolean stop_all = FALSE;
 
-static float * pbuf = NULL, * devbuf = NULL;
-static int pbuf_chans = 0, devbuf_chans = 0;
 
+gboolean
+play_get_realtime (void)
+{
+  return (prefs_get_int (REALTIME_KEY, DEFAULT_REALTIME) != 0);
+}
+
+void
+play_set_realtime (gboolean realtime)
+{
+  prefs_set_int (REALTIME_KEY, realtime ? 1 : 0);
+}
+
+void
+play_get_stats (gint * late_periods, gint * worst_usec, gint * period_usec)
+{
+  if (late_periods) *late_periods = g_atomic_int_get (&play_late_periods);
+  if (worst_usec) *worst_usec = g_atomic_int_get (&play_worst_usec);
+  if (period_usec) *period_usec = g_atomic_int_get (&play_period_usec);
+}
+
+void
+play_reset_stats (void)
+{
+  g_atomic_int_set (&play_late_periods, 0);
+  g_atomic_int_set (&play_worst_usec, 0);
+}
+
+static void
+play_account_period (gint usec, gint period_usec)
+{
+  gint worst;
+
+  if (usec > period_usec)
+    g_atomic_int_inc (&play_late_periods);
+
+  do {
+    worst = g_atomic_int_get (&play_worst_usec);
+  } while (usec > worst &&
+	   !g_atomic_int_compare_and_exchange (&play_worst_usec, worst, usec));
+}
+
+/* Called on a mixer thread as it starts */
+static void
+play_enter_realtime (const char * name)
+{
+  struct sched_param param;
+  int priority, err;
+
+  priority = prefs_get_int (REALTIME_PRIORITY_KEY, DEFAULT_REALTIME_PRIORITY);
+  priority = CLAMP (priority, sched_get_priority_min (SCHED_FIFO),
+		    sched_get_priority_max (SCHED_FIFO));
+
+  param.sched_priority = priority;
+
+  /* Both mixers start a thread for each playback; warn only once */
+  if ((err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param))
+      != 0 && g_atomic_int_compare_and_exchange (&realtime_warned, 0, 1)) {
+    fprintf (stderr, "sweep: %s mixer: realtime scheduling refused (%s), "
+	     "using normal priority\n", name, strerror (err));
+  }
+}
+
+/*
+ * Reallocate a mix buffer of PSIZ frames from old_chans to chans
+ * channels, moving its lock with it in realtime mode.
+ */
+static float *
+play_buffer_realloc (float * buf, gint old_chans, gint chans,
+		     gboolean realtime)
+{
+  if (realtime && buf != NULL)
+    munlock (buf, PSIZ * old_chans * sizeof (float));
+
+  buf = g_realloc (buf, PSIZ * chans * sizeof (float));
+
+  if (realtime)
+    mlock (buf, PSIZ * chans * sizeof (float));
+
+  return buf;
+}
+
+/*
+ * Give a head an interpolator at the preferred quality. A head which is
+ * already going keeps its interpolator, as the mixer may be using it; if
+ * the channel count has since changed the mixer falls back to linear
+ * interpolation until playback is restarted.
+ */
+static void
+play_prepare_interp (sw_head * head)
+{
+  gint channels = head->sample->sounddata->format->channels;
+  gint quality;
+
+  quality = prefs_get_int (INTERP_QUALITY_KEY, DEFAULT_INTERP_QUALITY);
+
+  if (head->interp != NULL && !head->going &&
+      interp_channels (head->interp) != channels) {
+    interp_free (head->interp);
+    head->interp = NULL;
+  }
+
+  if (head->interp == NULL) {
+    head->interp = interp_new (channels, quality);
+  } else {
+    interp_set_quality (head->interp, quality);
+    if (!head->going) interp_reset (head->interp);
+  }
+}
 
 /*
  * update_playmarker ()
@@ -105,6 +299,11 @@ update_playmarker (gpointer data)
 #endif
     s->playmarker_tag = 0;
 
+    mixer_post (&main_mixer, head, MIXER_HEAD_REMOVE);
+    mixer_post (&monitor_mixer, head, MIXER_HEAD_REMOVE);
+
+    prefetch_stop (head);
+
     /* Set user offset to correct offset */
     if (head->previewing) {
       sample_set_playmarker (s, head->stop_offset, TRUE);
@@ -139,6 +338,52 @@ start_playmarker (sw_sample * s)
 		     (gpointer)s);
 }
 
+/*
+ * Fetch one frame for playback, from the prefetch stage if it is there
+ * and otherwise from sounddata directly.
+ */
+static void
+head_fetch_frame (sw_prefetch * pf, sw_sounddata * sounddata,
+		  sw_framecount_t frame, float * out,
+		  gint * hits, gint * misses)
+{
+  gint channels = sounddata->format->channels;
+
+  if (pf != NULL) {
+    if (prefetch_read (pf, sounddata, frame, out)) {
+      (*hits)++;
+      return;
+    }
+    (*misses)++;
+  }
+
+  g_mutex_lock (&sounddata->data_mutex);
+  memcpy (out, (float *)sounddata->data + frame * channels,
+	  channels * sizeof (float));
+  g_mutex_unlock (&sounddata->data_mutex);
+}
+
+typedef struct {
+  sw_prefetch * pf;
+  sw_sounddata * sounddata;
+  gint hits, misses;
+} sw_head_fetch;
+
+/* sw_interp_fetch for head_read_unrestricted () */
+static void
+head_interp_fetch (gpointer data, sw_framecount_t frame, float * out)
+{
+  sw_head_fetch * hf = (sw_head_fetch *)data;
+  sw_sounddata * sounddata = hf->sounddata;
+
+  if (frame < 0 || frame >= sounddata->nr_frames) {
+    memset (out, 0, sounddata->format->channels * sizeof (float));
+    return;
+  }
+
+  head_fetch_frame (hf->pf, sounddata, frame, out, &hf->hits, &hf->misses);
+}
+
 static sw_framecount_t
 head_read_unrestricted (sw_head * head, float * buf,
 			sw_framecount_t count, int driver_rate)
@@ -146,10 +391,14 @@ head_read_unrestricted (sw_head * head, float * buf,
   sw_sample * sample = head->sample;
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
+  sw_head_fetch hf = { head->prefetch, sounddata, 0, 0 };
+  sw_interp * ip = head->interp;
+  gboolean use_interp = FALSE;
+  float * fr = g_newa (float, 2 * f->channels);
   gdouble po = 0.0, p;
   gfloat relpitch;
   sw_framecount_t i, j, b;
-  gint si=0, si_next = 0;
+  sw_framecount_t si = 0;
   gboolean interpolate = FALSE;
   gboolean do_smoothing = FALSE;
   sw_framecount_t last_user_offset = -1;
@@ -163,6 +412,10 @@ head_read_unrestricted (sw_head * head, float * buf,
   /* compensate for sampling rate of driver */
   relpitch = (gfloat)((gdouble)f->rate / (gdouble)driver_rate);
 
+  if (ip != NULL && interp_channels (ip) == f->channels &&
+      interp_get_quality (ip) > INTERP_LINEAR)
+    use_interp = TRUE;
+
   for (i = 0; i < count; i++) {
     if (head->mute || sample->user_offset == last_user_offset) {
       for (j = 0; j < f->channels; j++) {
@@ -170,18 +423,26 @@ head_read_unrestricted (sw_head * head, float * buf,
 	b++;
       }
     } else {
-      si = (int)floor(po);
+      si = (sw_framecount_t)floor(po);
 
-      interpolate = (si < sounddata->nr_frames);
+      interpolate = (si + 1 < sounddata->nr_frames);
 
       p = po - (gdouble)si;
-      si *= f->channels;
-      g_mutex_lock(&head->sample->sounddata->data_mutex);
 
-      if (interpolate) {
-	si_next = si+f->channels;
+      if (use_interp) {
+	/* Band-limited; replaces both linear interpolation and smoothing */
+	interp_frame (ip, si, p, head->delta * relpitch,
+		      head_interp_fetch, &hf, fr);
+	for (j = 0; j < f->channels; j++) {
+	  buf[b] = fr[j];
+	  b++;
+	}
+      } else if (interpolate) {
+	head_fetch_frame (hf.pf, sounddata, si, fr, &hf.hits, &hf.misses);
+	head_fetch_frame (hf.pf, sounddata, si + 1, fr + f->channels,
+			  &hf.hits, &hf.misses);
 	for (j = 0; j < f->channels; j++) {
-         buf[b] = head->gain * (((float *)head->sample->sounddata->data)[si] * p + ((float *)head->sample->sounddata->data)[si_next] * (1 - p));
+	  buf[b] = fr[j] * p + fr[f->channels + j] * (1 - p);
 	  if (do_smoothing) {
 	    sw_framecount_t b1, b2;
 	    b1 = (b - f->channels + pbuf_size) % pbuf_size;
@@ -190,11 +451,12 @@ head_read_unrestricted (sw_head * head, float * buf,
 	    buf[b] += buf[b1] * 3.0 + buf[b2] * 4.0;
 	    buf[b] /= 10.0;
 	  }
-	  b++; si++; si_next++;
+	  b++;
 	}
       } else {
+	head_fetch_frame (hf.pf, sounddata, si, fr, &hf.hits, &hf.misses);
 	for (j = 0; j < f->channels; j++) {
-	 buf[b] = head->gain * ((float *)head->sample->sounddata->data)[si];
+	  buf[b] = fr[j];
 	  if (do_smoothing) {
 	    sw_framecount_t b1, b2;
 	    b1 = (b - f->channels + pbuf_size) % pbuf_size;
@@ -203,10 +465,9 @@ head_read_unrestricted (sw_head * head, float * buf,
 	    buf[b] += buf[b1] * 3.0 + buf[b2] * 4.0;
 	    buf[b] /= 10.0;
 	  }
-	  b++; si++;
+	  b++;
 	}
       }
-     g_mutex_unlock (&head->sample->sounddata->data_mutex);
     }
 
     if (head->scrubbing) {
@@ -221,7 +482,7 @@ head_read_unrestricted (sw_head * head, float * buf,
 
 	last_user_offset = sample->user_offset;
       } else  {
-	gfloat new_po, u_po = (gdouble)sample->user_offset;
+	gdouble new_po, u_po = (gdouble)sample->user_offset;
 
 	new_delta = (sample->user_offset - po) / scrub_rate;
 
@@ -245,6 +506,7 @@ head_read_unrestricted (sw_head * head, float * buf,
       if (sample->by_user) {
 	head->offset = (gdouble)sample->user_offset;
 	po = head->offset;
+	g_atomic_int_set (&head->discontinuous, 1);
 	head->delta = tdelta;
 
 	sample->by_user = FALSE;
@@ -271,6 +533,8 @@ head_read_unrestricted (sw_head * head, float * buf,
     {
       gdouble nr_frames = (gdouble)sample->sounddata->nr_frames;
       if (head->looping) {
+	if (po < 0.0 || po > nr_frames)
+	  g_atomic_int_set (&head->discontinuous, 1);
 	while (po < 0.0) po += nr_frames;
 	while (po > nr_frames) po -= nr_frames;
       } else {
@@ -283,9 +547,40 @@ head_read_unrestricted (sw_head * head, float * buf,
 
   }
 
+  prefetch_account (hf.hits, hf.misses);
+
   return count;
 }
 
+/* Move the head within head_read (), noting any jump for the insert */
+static void
+head_jump (sw_head * head, gdouble offset)
+{
+  if (offset != head->offset)
+    g_atomic_int_set (&head->discontinuous, 1);
+
+  head->offset = offset;
+}
+
+/*
+ * Run the head's insert, if any, over count frames of buf, flushing it
+ * first if they do not follow on from the frames it last processed. If
+ * the GUI is swapping the insert, the frames are played dry.
+ */
+static void
+head_run_insert (sw_head * head, float * buf, gint nr_channels,
+		 sw_framecount_t count, gboolean flush, int driver_rate)
+{
+  if (!g_mutex_trylock (&head->insert_mutex)) return;
+
+  if (head->insert != NULL) {
+    if (flush) insert_flush (head->insert);
+    insert_process (head->insert, buf, nr_channels, driver_rate, count);
+  }
+
+  g_mutex_unlock (&head->insert_mutex);
+}
+
 sw_framecount_t
 head_read (sw_head * head, float * buf, sw_framecount_t count,
 	   int driver_rate)
@@ -298,6 +593,11 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
   sw_framecount_t delta, bound;
   GList * gl;
   sw_sel * sel, * osel;
+  float * start = buf, * run = buf;
+  gboolean flush;
+
+  /* Jumps made since the last period, by seeking or restarting */
+  flush = g_atomic_int_compare_and_exchange (&head->discontinuous, 1, 0);
 
   while (head->going && remaining > 0) {
     n = 0;
@@ -329,7 +629,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	    sel = (sw_sel *)gl->data;
 
 	    if (osel && ((sw_framecount_t)head->offset > osel->sel_start))
-	      head->offset = osel->sel_start;
+	      head_jump (head, osel->sel_start);
 
 	    osel = sel;
 
@@ -344,7 +644,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	  /* If now at start of first selection region ... */
 	  if (gl == NULL && osel != NULL) {
 	    if ((sw_framecount_t)head->offset > osel->sel_start)
-	      head->offset = osel->sel_start;
+	      head_jump (head, osel->sel_start);
 
 	    head_offset = (sw_framecount_t)head->offset;
 
@@ -362,7 +662,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	    sel = (sw_sel *)gl->data;
 
 	    if (osel && ((sw_framecount_t)head->offset < osel->sel_end))
-	      head->offset = osel->sel_end;
+	      head_jump (head, osel->sel_end);
 
 	    osel = sel;
 
@@ -377,7 +677,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	  /* If now at end of last selection region ... */
 	  if (gl == NULL && osel != NULL) {
 	    if ((sw_framecount_t)head->offset < osel->sel_end)
-	      head->offset = osel->sel_end;
+	      head_jump (head, osel->sel_end);
 
 	    head_offset = head->offset;
 
@@ -396,7 +696,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	    sel = (sw_sel *)gl->data;
 
 	    if ((sw_framecount_t)head->offset > sel->sel_end)
-	      head->offset = sel->sel_end;
+	      head_jump (head, sel->sel_end);
 
 	    if ((sw_framecount_t)head->offset > sel->sel_start) {
 	      n = MIN (remaining, (sw_framecount_t)head->offset - sel->sel_start);
@@ -408,7 +708,7 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	    sel = (sw_sel *)gl->data;
 
 	    if ((sw_framecount_t)head->offset < sel->sel_start)
-	      head->offset = sel->sel_start;
+	      head_jump (head, sel->sel_start);
 
 	    if ((sw_framecount_t)head->offset < sel->sel_end) {
 	      n = MIN (remaining, sel->sel_end - (sw_framecount_t)head->offset);
@@ -440,19 +740,19 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 
     if (n == 0) {
       if (head->previewing) {
-	head->offset = head->stop_offset;
+	head_jump (head, head->stop_offset);
       } else if (!head->restricted || sounddata->sels == NULL) {
-	head->offset = head->reverse ? sounddata->nr_frames : 0;
+	head_jump (head, head->reverse ? sounddata->nr_frames : 0);
       } else {
 	g_mutex_lock (&sounddata->sels_mutex);
 	if (head->reverse) {
 	  gl = g_list_last (sounddata->sels);
 	  sel = (sw_sel *)gl->data;
-	  head->offset = sel->sel_end;
+	  head_jump (head, sel->sel_end);
 	} else {
 	  gl = sounddata->sels;
 	  sel = (sw_sel *)gl->data;
-	  head->offset = sel->sel_start;
+	  head_jump (head, sel->sel_start);
 	}
 	g_mutex_unlock (&sounddata->sels_mutex);
       }
@@ -471,8 +771,16 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
 	printf ("n = %d \t>\tcount = %d\n", n, count);
 #endif
       } else {
+      /* Run the insert up to a jump, and flush it before what follows */
+      if (g_atomic_int_compare_and_exchange (&head->discontinuous, 1, 0)) {
+	if (buf > run)
+	  head_run_insert (head, run, f->channels,
+			   (buf - run) / f->channels, flush, driver_rate);
+	run = buf;
+	flush = TRUE;
+      }
       written += head_read_unrestricted (head, buf, n, driver_rate);
-      buf += (int)frames_to_samples (f, n);
+      buf += frames_to_samples (f, n);
       remaining -= n;
       }
     }
@@ -486,6 +794,12 @@ head_read (sw_head * head, float * buf, sw_framecount_t count,
     written += remaining;
   }
 
+  /* Run the insert over the rest, including the padding so that its
+   * tail can ring out.
+   */
+  head_run_insert (head, run, f->channels,
+		   written - (run - start) / f->channels, flush, driver_rate);
+
   return written;
 }
 
@@ -573,199 +887,322 @@ head_init_playback (sw_sample * s)
   /*  g_mutex_unlock (&s->play_mutex);*/
 }
 
+static sw_head_set *
+head_set_new (gint nr_heads)
+{
+  sw_head_set * set;
+
+  set = g_malloc (sizeof (sw_head_set) + MAX (nr_heads - 1, 0) *
+		  sizeof (sw_head *));
+  set->nr_heads = nr_heads;
+
+  return set;
+}
+
 static void
-channel_convert_adding (float * src, int src_channels,
-			float * dest, int dest_channels,
-			sw_framecount_t n)
+head_set_free (sw_head_set * set)
 {
-  int j;
-  sw_framecount_t i, b = 0;
-  double a;
-
-  if (src_channels == 1) { /* mix mono data up */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < dest_channels; j++) {
-	dest[b] += src[i];
-	b++;
-      }
-    }
-  } else if (dest_channels == 1) { /* mix down to mono */
-    for (i = 0; i < n; i++) {
-      a = 0.0;
-      for (j = 0; j < src_channels; j++) {
-	a += src[b];
-	b++;
-      }
-      a /= (double)src_channels;
-      dest[i] += (float)a;
-    }
-  } else if (src_channels < dest_channels) { /* copy to first channels */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < src_channels; j++) {
-	dest[i * dest_channels + j] += src[b];
-	b++;
-      }
-    }
-  } else if (dest_channels < src_channels) { /* copy first channels only */
-    for (i = 0; i < n; i++) {
-      for (j = 0; j < dest_channels; j++) {
-	dest[b] += src[i * src_channels + j];
-	b++;
-      }
-    }
-  } else if (src_channels == dest_channels) { /* just add */
-    for (i = 0; i < n * src_channels; i ++) {
-      dest[i] += src[i];
+  gint i;
+
+  if (set == NULL) return;
+
+  for (i = 0; i < set->nr_heads; i++)
+    sample_unref (set->heads[i]->sample);
+
+  g_free (set);
+}
+
+/*
+ * Take the retired arrays the mixer can no longer be using. Call with
+ * publish_mutex held; the caller frees them after releasing it, as
+ * dropping the last reference to a sample may call back into here.
+ */
+static GList *
+mixer_collect_retired (sw_mixer * m)
+{
+  GList * gl, * gl_next, * done = NULL;
+  sw_retired_set * rs;
+  gboolean active = g_atomic_int_get (&m->active);
+  gint periods = g_atomic_int_get (&m->periods);
+
+  for (gl = m->retired; gl; gl = gl_next) {
+    gl_next = gl->next;
+    rs = (sw_retired_set *)gl->data;
+
+    if (!active || periods != rs->period) {
+      m->retired = g_list_delete_link (m->retired, gl);
+      done = g_list_prepend (done, rs);
     }
   }
+
+  return done;
 }
 
 static void
-play_head_update_device (sw_head * head)
+mixer_free_retired (GList * done)
 {
-  g_mutex_lock (&play_mutex);
-  g_mutex_lock (&head->head_mutex);
+  GList * gl;
+  sw_retired_set * rs;
 
-  if (head->monitor) {
-    if (g_list_find (active_monitor_heads, head) == 0) {
-      active_monitor_heads = g_list_append (active_monitor_heads, head);
-    }
-    active_main_heads = g_list_remove (active_main_heads, head);
-  } else {
-    if (g_list_find (active_main_heads, head) == 0) {
-      active_main_heads = g_list_append (active_main_heads, head);
-    }
-    active_monitor_heads = g_list_remove (active_monitor_heads, head);
+  for (gl = done; gl; gl = gl->next) {
+    rs = (sw_retired_set *)gl->data;
+    head_set_free (rs->set);
+    g_free (rs);
   }
 
-  g_mutex_unlock (&head->head_mutex);
-  g_mutex_unlock (&play_mutex);
+  g_list_free (done);
 }
 
-#ifdef RECORD_DEMO_FILES
-static gchar *
-generate_demo_filename (void)
+static gboolean
+mixer_reap (gpointer data)
 {
-  return erikd ("/tmp/sweep-demo-%d.au", getpid ());
-}
-#endif
+  sw_mixer * m = (sw_mixer *)data;
+  GList * done;
+  gboolean again;
 
-#define PSIZ 64
+  g_mutex_lock (&m->publish_mutex);
+  done = mixer_collect_retired (m);
+  again = (m->retired != NULL);
+  if (!again) m->reap_tag = 0;
+  g_mutex_unlock (&m->publish_mutex);
 
+  mixer_free_retired (done);
+
+  return again;
+}
+
+/*
+ * Publish a new head array for the mixer with the given head added or
+ * removed (or all heads removed, for MIXER_HEAD_CLEAR).
+ */
 static void
-prepare_to_play_heads (GList * heads, sw_handle * handle)
+mixer_post (sw_mixer * m, sw_head * head, sw_mixer_op op)
 {
-  sw_head * head;
-  sw_format * f;
+  sw_head_set * old, * set;
+  sw_retired_set * rs;
+  gint i, n = 0, nr_old;
+  gboolean found = FALSE;
+  GList * done;
 
-  GList * gl;
+  g_mutex_lock (&m->publish_mutex);
+
+  old = g_atomic_pointer_get (&m->heads);
+  nr_old = old ? old->nr_heads : 0;
+
+  for (i = 0; i < nr_old; i++)
+    if (old->heads[i] == head) found = TRUE;
 
-  if ((gl = heads) != NULL) {
-    head = (sw_head *)gl->data;
+  if ((op == MIXER_HEAD_ADD && found) ||
+      (op == MIXER_HEAD_REMOVE && !found) ||
+      (op == MIXER_HEAD_CLEAR && nr_old == 0)) {
+    g_mutex_unlock (&m->publish_mutex);
+    return;
+  }
 
-    f = head->sample->sounddata->format;
+  set = head_set_new (nr_old + 1);
 
-    if (f->channels > pbuf_chans) {
-      pbuf = g_realloc (pbuf, PSIZ * f->channels * sizeof (float));
-      pbuf_chans = f->channels;
+  if (op != MIXER_HEAD_CLEAR) {
+    for (i = 0; i < nr_old; i++) {
+      if (old->heads[i] != head) {
+	set->heads[n++] = old->heads[i];
+	sample_ref (old->heads[i]->sample);
+      }
     }
   }
 
-  device_wait (handle);
+  if (op == MIXER_HEAD_ADD) {
+    head->ramp_gain = head->gain;
+    set->heads[n++] = head;
+    sample_ref (head->sample);
+  }
+
+  set->nr_heads = n;
+
+  g_atomic_pointer_set (&m->heads, set);
+  g_atomic_int_set (&m->nr_heads, n);
+
+  if (old != NULL) {
+    rs = g_malloc (sizeof (sw_retired_set));
+    rs->set = old;
+    rs->period = g_atomic_int_get (&m->periods);
+    m->retired = g_list_prepend (m->retired, rs);
+  }
+
+  done = mixer_collect_retired (m);
+
+  if (m->retired != NULL && m->reap_tag == 0)
+    m->reap_tag = g_timeout_add (50, mixer_reap, m);
+
+  g_mutex_unlock (&m->publish_mutex);
 
-  return;
+  mixer_free_retired (done);
 }
 
-static void
-play_heads (GList ** heads, sw_handle * handle)
+static gboolean
+monitor_active (void)
+{
+  int use_monitor = prefs_get_int (USE_MONITOR_KEY, 0);
+
+  return (use_monitor != 0);
+}
+
+/*
+ * The rate the sample's play head is mixed at: that of the device it
+ * plays on, or, if that device is not set up yet, the sample's own rate,
+ * which is what the device will be set up from.
+ */
+gint
+play_get_rate (sw_sample * sample)
+{
+  sw_head * head = sample->play_head;
+  sw_mixer * m;
+  gint rate;
+
+  m = (head->monitor && monitor_active ()) ? &monitor_mixer : &main_mixer;
+  rate = g_atomic_int_get (&m->driver_rate);
+
+  return (rate > 0) ? rate : sample->sounddata->format->rate;
+}
+
+#ifdef RECORD_DEMO_FILES
+static gchar *
+generate_demo_filename (void)
+{
+  return erikd ("/tmp/sweep-demo-%d.au", getpid ());
+}
+#endif
+
+/*
+ * Mix one block into out, which is either m->devbuf or the device's own
+ * buffer. Returns the number of heads that were playing.
+ */
+static gint
+mixer_play_heads (sw_mixer * m, sw_head_set * set, float * out)
 {
   sw_sample * s;
   sw_head * head;
   sw_format * f;
+  sw_handle * handle = m->handle;
   sw_framecount_t n;
-
-  GList * gl, * gl_next;
-
-  if (*heads == NULL) return;
+  gfloat gain;
+  gint i, nr_going = 0;
 
   n = PSIZ;
 
-  for (gl = *heads; gl; gl = gl_next) {
+  for (i = 0; set && i < set->nr_heads; i++) {
+    head = set->heads[i];
 
-    g_mutex_lock (&play_mutex);
-    head = (sw_head *)gl->data;
-    gl_next = gl->next;
-    g_mutex_unlock (&play_mutex);
+    /* Stopped heads are withdrawn by the main thread */
+    if (!head->going) continue;
 
-    if (!head) {
-      /* XXX: wtf??? */
-      return;
-    } else if (!head->going || !sample_bank_contains (head->sample)) {
-      g_mutex_lock (&play_mutex);
-      *heads = g_list_remove (*heads, head);
-      g_mutex_unlock (&play_mutex);
-    } else {
-      s = head->sample;
-      f = s->sounddata->format;
+    nr_going++;
 
-      if (f->channels > pbuf_chans) {
-	pbuf = g_realloc (pbuf, n * f->channels * sizeof (float));
-	pbuf_chans = f->channels;
-      }
+    s = head->sample;
+    f = s->sounddata->format;
 
-      head_read (head, pbuf, n, handle->driver_rate);
-
-      channel_convert_adding (pbuf, f->channels, devbuf,
-			      handle->driver_channels, n);
+    if (f->channels > m->pbuf_chans) {
+      m->pbuf = play_buffer_realloc (m->pbuf, m->pbuf_chans, f->channels,
+				     m->realtime);
+      m->pbuf_chans = f->channels;
+    }
 
-      /* XXX: store the head->offset NOW for device_offset referencing */
+    head_read (head, m->pbuf, n, handle->driver_rate);
 
-      g_mutex_lock (&s->play_mutex);
+    /* Ramp from the gain used for the last block to the current one */
+    gain = head->gain;
+    mixbus_add (out, handle->driver_channels, m->pbuf, f->channels,
+		g_atomic_pointer_get (&head->routing), head->ramp_gain,
+		gain, n);
+    head->ramp_gain = gain;
 
-      head->realoffset = device_offset (handle);
-      if (head->realoffset == -1) {
-	head->realoffset = head->offset;
-      }
+    /* XXX: store the head->offset NOW for device_offset referencing */
 
-      head->offset = head->realoffset;
+    g_mutex_lock (&s->play_mutex);
 
-      if (s->by_user /* && s->play_scrubbing */) {
-	/*head->offset = s->user_offset;*/
-      } else {
-	if (!head->scrubbing) s->user_offset = head->realoffset;
-      }
+    head->realoffset = device_offset (handle);
+    if (head->realoffset == -1) {
+      head->realoffset = head->offset;
+    }
 
-      /*	if (!head->going) active = FALSE;*/
+    head->offset = head->realoffset;
 
-      g_mutex_unlock (&s->play_mutex);
+    if (s->by_user /* && s->play_scrubbing */) {
+      /*head->offset = s->user_offset;*/
+    } else {
+      if (!head->scrubbing) s->user_offset = head->realoffset;
     }
+
+    g_mutex_unlock (&s->play_mutex);
   }
 
-  return;
+  return nr_going;
 }
 
 /* how many inactive writes to do before closing */
 #define INACTIVE_TIMEOUT 256
 
 static gboolean
-monitor_active (void)
+head_set_any_going (sw_head_set * set)
 {
-  int use_monitor = prefs_get_int (USE_MONITOR_KEY, 0);
+  gint i;
 
-  return (use_monitor != 0);
+  for (i = 0; set && i < set->nr_heads; i++)
+    if (set->heads[i]->going) return TRUE;
+
+  return FALSE;
 }
 
-static void
-play_active_heads (void)
+/*
+ * Decide whether an idle mixer should exit. A head is set going before
+ * it is published and the mixer started, so any head published before
+ * running is cleared will be seen here; any published after will find
+ * the mixer stopped and start a new thread.
+ */
+static gboolean
+mixer_should_exit (sw_mixer * m)
+{
+  gboolean done;
+
+  g_mutex_lock (&m->lifecycle_mutex);
+
+  done = (stop_all || !head_set_any_going (g_atomic_pointer_get (&m->heads)));
+
+  if (done) {
+    g_atomic_int_set (&m->driver_rate, 0);
+    device_reset (m->handle);
+    device_close (m->handle);
+    m->handle = NULL;
+
+    m->running = FALSE;
+
+    /* This thread is finished with the head arrays */
+    g_atomic_int_set (&m->active, 0);
+  }
+
+  g_mutex_unlock (&m->lifecycle_mutex);
+
+  return done;
+}
+
+static void *
+mixer_thread (void * data)
 {
+  sw_mixer * m = (sw_mixer *)data;
+  sw_handle * handle = m->handle;
   sw_framecount_t count;
   int inactive_writes = 0;
-  GList * gl;
   sw_head * head;
   sw_format * f;
-  int max_driver_chans = 0;
-
-  gboolean use_monitor;
+  gboolean setup = FALSE;
+  gint64 t0;
+  gint period_usec = 0;
+  gint late_at_start = g_atomic_int_get (&play_late_periods);
+  gint limits, limits_at_start;
+  sw_interp_quality ceiling;
+  sw_interp_budget budget = {0, 0};
+  gint usec;
+  sw_head_set * set;
+  float * out;
 
 #ifdef RECORD_DEMO_FILES
   gchar * filename;
@@ -773,111 +1210,112 @@ play_active_heads (void)
   SF_INFO sfinfo;
 #endif
 
-  if (!active_main_heads && !active_monitor_heads) return;
+  interp_get_limits (&limits_at_start, &ceiling);
 
-  use_monitor = (monitor_handle != NULL);
+  /*
+   * Size the mix buffers for most samples and devices up front, so that
+   * the loop below only reallocates (and relocks) them for more channels
+   */
+  if (m->pbuf_chans < PLAY_BUFFER_CHANNELS) {
+    m->pbuf = play_buffer_realloc (m->pbuf, m->pbuf_chans,
+				   PLAY_BUFFER_CHANNELS, FALSE);
+    m->pbuf_chans = PLAY_BUFFER_CHANNELS;
+  }
+  if (m->devbuf_chans < PLAY_BUFFER_CHANNELS) {
+    m->devbuf = play_buffer_realloc (m->devbuf, m->devbuf_chans,
+				     PLAY_BUFFER_CHANNELS, FALSE);
+    m->devbuf_chans = PLAY_BUFFER_CHANNELS;
+  }
 
-  if (use_monitor) {
-    if ((gl = active_monitor_heads)) {
-      head = (sw_head *)gl->data;
-      f = head->sample->sounddata->format;
+  if (m->realtime) {
+    play_enter_realtime (m->name);
 
-      device_setup (monitor_handle, f);
-    } else if ((gl = active_main_heads)) {
-      head = (sw_head *)gl->data;
-      f = head->sample->sounddata->format;
+    if (m->pbuf) mlock (m->pbuf, PSIZ * m->pbuf_chans * sizeof (float));
+    if (m->devbuf) mlock (m->devbuf, PSIZ * m->devbuf_chans * sizeof (float));
+  }
 
-      device_setup (monitor_handle, f);
+  for (;;) {
+    if (stop_all || inactive_writes >= INACTIVE_TIMEOUT) {
+      if (mixer_should_exit (m)) break;
+      inactive_writes = 0;
     }
-  }
 
-  if ((gl = active_main_heads)) {
-    head = (sw_head *)gl->data;
-    f = head->sample->sounddata->format;
+    set = g_atomic_pointer_get (&m->heads);
+
+    if (!head_set_any_going (set)) {
+      inactive_writes++;
+
+      /* Nothing to set the device format from yet */
+      if (!setup) {
+	g_atomic_int_inc (&m->periods);
+	g_usleep (1000);
+	continue;
+      }
+    } else {
+      inactive_writes = 0;
+    }
+
+    if (!setup) {
+      head = set->heads[0];
+      f = head->sample->sounddata->format;
+
+      device_setup (handle, f);
+      g_atomic_int_set (&m->driver_rate, handle->driver_rate);
 
-    device_setup (main_handle, f);
+      if (handle->driver_channels > m->devbuf_chans) {
+	m->devbuf = play_buffer_realloc (m->devbuf, m->devbuf_chans,
+					 handle->driver_channels,
+					 m->realtime);
+	m->devbuf_chans = handle->driver_channels;
+      }
+
+      period_usec = (gint)((gint64)PSIZ * G_USEC_PER_SEC /
+			   MAX (handle->driver_rate, 1));
+      g_atomic_int_set (&play_period_usec, period_usec);
 
 #ifdef RECORD_DEMO_FILES
-    filename = generate_demo_filename ();
-    sfinfo.samplerate = f->rate;
-    sfinfo.channels = handle->driver_channels;
-    sfinfo.format = SF_FORMAT_AU | SF_FORMAT_FLOAT | SF_ENDIAN_CPU;
-    sndfile = sf_open (filename, SFM_WRITE, &sfinfo);
-    if (sndfile == NULL) sf_perror (NULL);
-    else printf ("Writing to %s\n", filename);
+      filename = generate_demo_filename ();
+      sfinfo.samplerate = f->rate;
+      sfinfo.channels = handle->driver_channels;
+      sfinfo.format = SF_FORMAT_AU | SF_FORMAT_FLOAT | SF_ENDIAN_CPU;
+      sndfile = sf_open (filename, SFM_WRITE, &sfinfo);
+      if (sndfile == NULL) sf_perror (NULL);
+      else printf ("Writing %s output to %s\n", m->name, filename);
 #endif
-  } else if ((gl = active_monitor_heads)) {
-    head = (sw_head *)gl->data;
-    f = head->sample->sounddata->format;
 
-    device_setup (main_handle, f);
-  } else {
-    return;
-  }
+      setup = TRUE;
+    }
 
-  if (use_monitor) {
-    max_driver_chans = MAX (main_handle->driver_channels,
-			    monitor_handle->driver_channels);
-  } else {
-    max_driver_chans = main_handle->driver_channels;
-  }
+    device_wait (handle);
 
-  if (max_driver_chans > devbuf_chans) {
-    devbuf = g_realloc (devbuf,
-			PSIZ * max_driver_chans * sizeof (float));
-    devbuf_chans = max_driver_chans;
-  }
+    t0 = g_get_monotonic_time ();
 
-  while (!stop_all && inactive_writes < INACTIVE_TIMEOUT) {
+    /* Render straight into the device's buffer if it can be mapped */
+    out = device_begin (handle, PSIZ);
+    if (out == NULL) out = m->devbuf;
 
-    if (active_main_heads == NULL && active_monitor_heads == NULL) {
-      inactive_writes++;
-    } else {
-      inactive_writes = 0;
-    }
+    count = PSIZ * handle->driver_channels;
+    memset (out, 0, count * sizeof (float));
+    mixer_play_heads (m, set, out);
 
-    g_mutex_lock (&play_mutex);
-    if (use_monitor) {
-      prepare_to_play_heads (active_monitor_heads, monitor_handle);
-      prepare_to_play_heads (active_main_heads, main_handle);
-    } else {
-      prepare_to_play_heads (active_monitor_heads, main_handle);
-      prepare_to_play_heads (active_main_heads, main_handle);
-    }
-    g_mutex_unlock (&play_mutex);
-
-    if (use_monitor) {
-      count = PSIZ * monitor_handle->driver_channels;
-      memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_monitor_heads, monitor_handle);
-      device_write (monitor_handle, devbuf, count);
-
-      count = PSIZ * main_handle->driver_channels;
-      memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_main_heads, main_handle);
-      device_write (main_handle, devbuf, count);
-    } else {
-      count = PSIZ * main_handle->driver_channels;
-      memset (devbuf, 0, count * sizeof (float));
-      play_heads (&active_monitor_heads, main_handle);
-      play_heads (&active_main_heads, main_handle);
-      device_write (main_handle, devbuf, count);
-    }
+    /* Done with set for this period */
+    g_atomic_int_inc (&m->periods);
+
+    usec = (gint)(g_get_monotonic_time () - t0);
+    play_account_period (usec, period_usec);
+    interp_account_load (&budget, usec, period_usec);
 
 #ifdef RECORD_DEMO_FILES
     if (sndfile)
-      sf_writef_float (sndfile, devbuf, count / main_handle->driver_channels);
+      sf_writef_float (sndfile, out, PSIZ);
 #endif
-  }
 
-  if (use_monitor) {
-    device_reset (monitor_handle);
-    device_close (monitor_handle);
+    if (out == m->devbuf)
+      device_write (handle, m->devbuf, count);
+    else
+      device_commit (handle, PSIZ);
   }
 
-  device_reset (main_handle);
-  device_close (main_handle);
-
 #ifdef RECORD_DEMO_FILES
   if (sndfile) {
     printf ("Closing %s\n", filename);
@@ -885,31 +1323,98 @@ play_active_heads (void)
   }
 #endif
 
-  player_thread = (pthread_t) -1;
+  if (m->realtime || g_atomic_int_get (&play_late_periods) > late_at_start) {
+    gint hits, misses;
+
+    prefetch_get_stats (&hits, &misses);
+
+    fprintf (stderr, "sweep: %s mixer: %d late periods, worst period %d us "
+	     "of %d us, %d of %d frames prefetched\n", m->name,
+	     g_atomic_int_get (&play_late_periods) - late_at_start,
+	     g_atomic_int_get (&play_worst_usec), period_usec,
+	     hits, hits + misses);
+  }
+
+  interp_get_limits (&limits, &ceiling);
+  if (limits > limits_at_start) {
+    fprintf (stderr, "sweep: %s mixer: over its CPU budget %d times, "
+	     "interpolation limited to %s\n", m->name,
+	     limits - limits_at_start, interp_quality_name (ceiling));
+  }
+
+  return NULL;
 }
 
+/*
+ * Make sure the mixer's device is open and its thread running. Returns
+ * FALSE if the device could not be opened.
+ */
 static gboolean
-ensure_playing (void)
+mixer_ensure_running (sw_mixer * m)
 {
-  sw_handle * h;
+  gboolean ok = TRUE;
+
+  g_mutex_lock (&m->lifecycle_mutex);
 
-  if (player_thread == (pthread_t) -1) {
-    if ((h = device_open (0, O_WRONLY)) != NULL) {
-      main_handle = h;
-      if (monitor_active()) {
-	monitor_handle = device_open (1, O_WRONLY);
+  if (!m->running) {
+    m->realtime = play_get_realtime ();
+
+    if ((m->handle = device_open (m->cueing, O_WRONLY)) == NULL) {
+      ok = FALSE;
+    } else {
+      g_atomic_int_set (&m->active, 1);
+
+      if (pthread_create (&m->thread, NULL, mixer_thread, m) != 0) {
+	g_atomic_int_set (&m->active, 0);
+	device_close (m->handle);
+	m->handle = NULL;
+	ok = FALSE;
       } else {
-	monitor_handle = NULL;
+	pthread_detach (m->thread);
+	m->running = TRUE;
       }
+    }
+  }
+
+  g_mutex_unlock (&m->lifecycle_mutex);
+
+  return ok;
+}
+
+/*
+ * Hand the head to the mixer for the device it should play on, starting
+ * that mixer if necessary, and withdraw it from the other one. Monitor
+ * heads fall back to the main device if there is no monitor device.
+ */
+static gboolean
+play_head_update_device (sw_head * head)
+{
+  sw_mixer * target = NULL, * other;
+
+  stop_all = FALSE;
 
-      pthread_create (&player_thread, NULL, (void *) (*play_active_heads),
-		      NULL);
-      return TRUE;
+  if (head->monitor && monitor_active ()) {
+    mixer_post (&monitor_mixer, head, MIXER_HEAD_ADD);
+    if (mixer_ensure_running (&monitor_mixer)) {
+      target = &monitor_mixer;
     } else {
+      mixer_post (&monitor_mixer, head, MIXER_HEAD_REMOVE);
+    }
+  }
+
+  if (target == NULL) {
+    mixer_post (&main_mixer, head, MIXER_HEAD_ADD);
+    if (mixer_ensure_running (&main_mixer)) {
+      target = &main_mixer;
+    } else {
+      mixer_post (&main_mixer, head, MIXER_HEAD_REMOVE);
       return FALSE;
     }
   }
 
+  other = (target == &main_mixer) ? &monitor_mixer : &main_mixer;
+  mixer_post (other, head, MIXER_HEAD_REMOVE);
+
   return TRUE;
 }
 
@@ -918,14 +1423,16 @@ sample_play (sw_sample * sample)
 {
   sw_head * head = sample->play_head;
 
-  play_head_update_device (head);
   head_init_playback (sample);
+  g_atomic_int_set (&head->discontinuous, 1);
+  prefetch_start (head);
+  play_prepare_interp (head);
 
   head_set_going (head, TRUE);
 
   sample_refresh_playmode (sample);
 
-  if (ensure_playing()) {
+  if (play_head_update_device (head)) {
     start_playmarker (sample);
   } else {
     head_set_going (head, FALSE);
@@ -1047,8 +1554,8 @@ void
 stop_all_playback (void)
 {
   stop_all = TRUE;
-  g_list_free (active_main_heads);
-  active_main_heads = NULL;
+  mixer_post (&main_mixer, NULL, MIXER_HEAD_CLEAR);
+  mixer_post (&monitor_mixer, NULL, MIXER_HEAD_CLEAR);
 }
 
 void
@@ -1080,20 +1587,27 @@ stop_playback (sw_sample * s)
     head_set_going (head, FALSE);
     sample_set_playmarker (s, head->stop_offset, TRUE);
 
-    g_mutex_lock (&play_mutex);
-    active_main_heads = g_list_remove (active_main_heads, head);
-    g_mutex_unlock (&play_mutex);
+    mixer_post (&main_mixer, head, MIXER_HEAD_REMOVE);
+    mixer_post (&monitor_mixer, head, MIXER_HEAD_REMOVE);
   }
+
+  /* Even if the head has already stopped by itself, as the sample may
+   * be about to be destroyed */
+  prefetch_stop (head);
 }
 
 gboolean
 any_playing (void)
 {
-  return ((player_thread != (pthread_t) -1) && (active_main_heads != NULL));
+  return ((g_atomic_int_get (&main_mixer.nr_heads) > 0) ||
+	  (g_atomic_int_get (&monitor_mixer.nr_heads) > 0));
 }
 
 void
 init_playback (void)
 {
-  g_mutex_init (&play_mutex);
+  g_mutex_init (&main_mixer.lifecycle_mutex);
+  g_mutex_init (&monitor_mixer.lifecycle_mutex);
+  g_mutex_init (&main_mixer.publish_mutex);
+  g_mutex_init (&monitor_mixer.publish_mutex);
 }
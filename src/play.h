@@ -23,6 +23,12 @@
 
 #include "sweep_app.h"
 
+#define REALTIME_KEY "RealtimePlayback"
+#define REALTIME_PRIORITY_KEY "RealtimePriority"
+
+#define DEFAULT_REALTIME 0
+#define DEFAULT_REALTIME_PRIORITY 40
+
 void
 init_playback (void);
 
@@ -59,4 +65,23 @@ stop_playback (sw_sample * sample);
 gboolean
 any_playing (void);
 
+gboolean
+play_get_realtime (void);
+
+void
+play_set_realtime (gboolean realtime);
+
+/*
+ * Playback timing: the number of periods that took longer to mix than
+ * to play, the worst mix time seen, and the current period length.
+ */
+gint
+play_get_rate (sw_sample * sample);
+
+void
+play_get_stats (gint * late_periods, gint * worst_usec, gint * period_usec);
+
+void
+play_reset_stats (void);
+
 #endif /* __PLAY_H__ */
@@ -36,6 +36,7 @@
 #include <sweep/sweep_i18n.h>
 #include <sweep/sweep_version.h>
 #include <sweep/sweep_types.h>
+#include <sweep/sweep_filter.h>
 
 #include "sweep_compat.h"
 
@@ -134,3 +135,16 @@ release_plugins (void)
   g_list_free (plugins);
   plugins = NULL;
 }
+
+sw_op_instance *
+procedure_apply (sw_procedure * proc, sw_sample * sample, sw_param_set pset)
+{
+  if (proc->apply)
+    return proc->apply (sample, pset, proc->custom_data);
+
+  if (proc->processor)
+    return perform_process_op (sample, _(proc->name), proc->processor,
+			       pset, proc->custom_data);
+
+  return NULL;
+}
@@ -22,10 +22,19 @@
 #ifndef __PLUGIN_H__
 #define __PLUGIN_H__
 
+#include <sweep/sweep_types.h>
+
 void
 init_plugins (void);
 
 void
 release_plugins (void);
 
+/*
+ * Apply proc to sample with parameters pset, either through its own
+ * apply function or by running its processor over the selection.
+ */
+sw_op_instance *
+procedure_apply (sw_procedure * proc, sw_sample * sample, sw_param_set pset);
+
 #endif /* __PLUGIN_H__ */
@@ -0,0 +1,641 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_typeconvert.h>
+
+#include "prefetch.h"
+#include "play.h"
+#include "preferences.h"
+
+/*
+ * Each followed head owns a stage: a ring of PREFETCH_SLOTS frames in
+ * which frame f always lives in slot (f & PREFETCH_MASK), plus a tag per
+ * slot recording which frame (modulo 2^32) it holds. Staging a frame
+ * empties the tag, copies the frame and then publishes the new tag; the
+ * mixer checks the tag before and after copying a frame out, so it
+ * either gets a consistent frame or a miss and never waits.
+ *
+ * The prefetch thread stages up to PREFETCH_AHEAD frames along the
+ * head's path, leaving the remaining quarter of the ring holding frames
+ * just behind the head for small backward jumps and interpolation.
+ *
+ * A stage is only valid for the sounddata and edit generation it was
+ * filled from. When those change, or the channel count changes, it is
+ * refilled or replaced. Replaced stages are freed only after
+ * PREFETCH_GRACE_USEC, long after any mixer period that could have
+ * loaded the old pointer has finished.
+ *
+ * In realtime mode the thread also keeps a window of PREFETCH_LOCK_FRAMES
+ * of the sample data around each head locked in memory, moving it as the
+ * head moves away from its middle, and relocking it after an edit. This
+ * happens even if staging is turned off, so that the mixer's own reads
+ * of the sample data do not fault.
+ */
+
+#define PREFETCH_SLOTS (1<<17)
+#define PREFETCH_MASK (PREFETCH_SLOTS - 1)
+#define PREFETCH_AHEAD (PREFETCH_SLOTS / 4 * 3)
+
+/* Frames copied per hold of data_mutex */
+#define PREFETCH_CHUNK 1024
+
+#define PREFETCH_LOCK_FRAMES PREFETCH_SLOTS
+
+#define PREFETCH_INTERVAL_USEC 5000
+#define PREFETCH_GRACE_USEC 1000000
+
+#define TAG_EMPTY (-1)
+#define FRAME_TAG(f) ((gint)(guint32)(f))
+
+typedef struct {
+  gpointer sounddata; /* sw_sounddata * staged from, atomic */
+  volatile gint generation;
+  gint channels;
+  float * data;
+  volatile gint * tags;
+  gint64 retired_at;
+} sw_prefetch_stage;
+
+struct _sw_prefetch {
+  sw_head * head;
+  gpointer stage; /* sw_prefetch_stage *, atomic */
+  volatile gint generation; /* bumped by prefetch_invalidate () */
+  gboolean following; /* protected by prefetch_mutex */
+  gboolean busy; /* in prefetch_follow (), protected by prefetch_mutex */
+  gboolean staging; /* whether to fill the stage, or only lock */
+  gboolean realtime;
+
+  /* The locked window, used only by whichever thread has pf busy */
+  gpointer lock_data; /* sounddata->data the window was locked in */
+  gint lock_generation;
+  sw_framecount_t lock_start, lock_end;
+  gchar * lock_addr;
+  size_t lock_len;
+};
+
+typedef struct {
+  sw_framecount_t start, end;
+} sw_prefetch_range;
+
+static GMutex prefetch_mutex;
+static GCond prefetch_cond;
+static GCond prefetch_idle_cond; /* signalled when a follow finishes */
+static GList * followed = NULL;
+static GList * retired = NULL;
+static gboolean prefetch_thread_running = FALSE;
+
+static gboolean mlock_warned = FALSE;
+
+static volatile gint total_hits = 0;
+static volatile gint total_misses = 0;
+
+static sw_prefetch_stage *
+stage_new (sw_sounddata * sounddata, gint generation)
+{
+  sw_prefetch_stage * stage;
+  gint i;
+
+  stage = g_malloc0 (sizeof (sw_prefetch_stage));
+  stage->sounddata = sounddata;
+  stage->generation = generation;
+  stage->channels = sounddata->format->channels;
+  stage->data = g_malloc (PREFETCH_SLOTS * stage->channels * sizeof (float));
+  stage->tags = g_malloc (PREFETCH_SLOTS * sizeof (gint));
+
+  for (i = 0; i < PREFETCH_SLOTS; i++)
+    stage->tags[i] = TAG_EMPTY;
+
+  if (play_get_realtime ())
+    mlock (stage->data, PREFETCH_SLOTS * stage->channels * sizeof (float));
+
+  return stage;
+}
+
+static void
+stage_free (sw_prefetch_stage * stage)
+{
+  munlock (stage->data, PREFETCH_SLOTS * stage->channels * sizeof (float));
+
+  g_free (stage->data);
+  g_free ((gpointer)stage->tags);
+  g_free (stage);
+}
+
+/* Call with prefetch_mutex held */
+static void
+stage_retire (sw_prefetch_stage * stage)
+{
+  if (stage == NULL) return;
+
+  stage->retired_at = g_get_monotonic_time ();
+  retired = g_list_prepend (retired, stage);
+}
+
+static void
+reap_retired (void)
+{
+  GList * gl, * gl_next;
+  sw_prefetch_stage * stage;
+  gint64 now = g_get_monotonic_time ();
+
+  g_mutex_lock (&prefetch_mutex);
+
+  for (gl = retired; gl; gl = gl_next) {
+    gl_next = gl->next;
+    stage = (sw_prefetch_stage *)gl->data;
+
+    if (now - stage->retired_at > PREFETCH_GRACE_USEC) {
+      retired = g_list_delete_link (retired, gl);
+      stage_free (stage);
+    }
+  }
+
+  g_mutex_unlock (&prefetch_mutex);
+}
+
+/* Copy frames [start, end) of sounddata into the stage */
+static void
+stage_run (sw_prefetch_stage * stage, sw_sounddata * sounddata,
+	   sw_framecount_t start, sw_framecount_t end)
+{
+  sw_framecount_t f, chunk_end;
+  gint channels = stage->channels;
+  size_t frame_bytes = channels * sizeof (float);
+  float * src;
+  gint slot;
+
+  end = MIN (end, sounddata->nr_frames);
+
+  for (; start < end; start = chunk_end) {
+    chunk_end = MIN (start + PREFETCH_CHUNK, end);
+
+    /* Skip chunks which are already fully staged */
+    for (f = start; f < chunk_end; f++) {
+      if (g_atomic_int_get (&stage->tags[f & PREFETCH_MASK]) != FRAME_TAG(f))
+	break;
+    }
+    if (f == chunk_end) continue;
+
+    g_mutex_lock (&sounddata->data_mutex);
+
+    /* An edit may have shortened the data since end was clamped */
+    if (chunk_end > sounddata->nr_frames)
+      end = chunk_end = sounddata->nr_frames;
+
+    src = (float *)sounddata->data + f * channels;
+
+    for (; f < chunk_end; f++, src += channels) {
+      slot = f & PREFETCH_MASK;
+
+      if (g_atomic_int_get (&stage->tags[slot]) == FRAME_TAG(f))
+	continue;
+
+      g_atomic_int_set (&stage->tags[slot], TAG_EMPTY);
+      memcpy (stage->data + slot * channels, src, frame_bytes);
+      g_atomic_int_set (&stage->tags[slot], FRAME_TAG(f));
+    }
+
+    g_mutex_unlock (&sounddata->data_mutex);
+  }
+}
+
+/*
+ * The regions a head may play through, in order: the selection regions
+ * for a restricted head, otherwise the whole sample.
+ */
+static GArray *
+head_ranges (sw_head * head, sw_sounddata * sounddata)
+{
+  GArray * ranges;
+  sw_prefetch_range r;
+  GList * gl;
+  sw_sel * sel;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (sw_prefetch_range));
+
+  if (head->restricted) {
+    g_mutex_lock (&sounddata->sels_mutex);
+    for (gl = sounddata->sels; gl; gl = gl->next) {
+      sel = (sw_sel *)gl->data;
+      r.start = MAX (sel->sel_start, 0);
+      r.end = MIN (sel->sel_end, sounddata->nr_frames);
+      if (r.end > r.start)
+	g_array_append_val (ranges, r);
+    }
+    g_mutex_unlock (&sounddata->sels_mutex);
+  }
+
+  if (ranges->len == 0) {
+    r.start = 0;
+    r.end = sounddata->nr_frames;
+    g_array_append_val (ranges, r);
+  }
+
+  return ranges;
+}
+
+static void
+stage_forwards (sw_prefetch_stage * stage, sw_sounddata * sounddata,
+		GArray * ranges, sw_framecount_t pos, gboolean looping)
+{
+  sw_prefetch_range * r;
+  sw_framecount_t budget = PREFETCH_AHEAD, end;
+  guint i, passes;
+
+  for (i = 0; i < ranges->len; i++) {
+    r = &g_array_index (ranges, sw_prefetch_range, i);
+    if (r->end > pos) break;
+  }
+
+  for (passes = 0; budget > 0 && passes <= ranges->len; passes++, i++) {
+    if (i == ranges->len) {
+      if (!looping) break;
+      i = 0;
+    }
+
+    r = &g_array_index (ranges, sw_prefetch_range, i);
+    if (passes > 0 || pos < r->start) pos = r->start;
+
+    end = MIN (r->end, pos + budget);
+    stage_run (stage, sounddata, pos, end);
+    budget -= (end - pos);
+  }
+}
+
+static void
+stage_backwards (sw_prefetch_stage * stage, sw_sounddata * sounddata,
+		 GArray * ranges, sw_framecount_t pos, gboolean looping)
+{
+  sw_prefetch_range * r;
+  sw_framecount_t budget = PREFETCH_AHEAD, start;
+  gint i;
+  guint passes;
+
+  for (i = ranges->len - 1; i >= 0; i--) {
+    r = &g_array_index (ranges, sw_prefetch_range, i);
+    if (r->start < pos) break;
+  }
+
+  for (passes = 0; budget > 0 && passes <= ranges->len; passes++, i--) {
+    if (i < 0) {
+      if (!looping) break;
+      i = ranges->len - 1;
+    }
+
+    r = &g_array_index (ranges, sw_prefetch_range, i);
+
+    /* Include the frame at pos, which is read for interpolation */
+    if (passes > 0 || pos >= r->end) pos = r->end;
+    else pos = pos + 1;
+
+    start = MAX (r->start, pos - budget);
+    stage_run (stage, sounddata, start, pos);
+    budget -= (pos - start);
+  }
+}
+
+static void
+prefetch_unlock_window (sw_prefetch * pf)
+{
+  if (pf->lock_len > 0)
+    munlock (pf->lock_addr, pf->lock_len);
+
+  pf->lock_data = NULL;
+  pf->lock_len = 0;
+}
+
+/* Keep the frames of sounddata around pos locked in memory */
+static void
+prefetch_lock_window (sw_prefetch * pf, sw_sounddata * sounddata,
+		      sw_framecount_t pos, gint generation)
+{
+  sw_framecount_t start, end;
+  size_t len;
+
+  g_mutex_lock (&sounddata->data_mutex);
+
+  if (sounddata->data != pf->lock_data) {
+    /*
+     * The data has been reallocated since, or this is a new sample. A
+     * moved block keeps its locks and a freed one drops them, so the
+     * old window is simply forgotten.
+     */
+    pf->lock_len = 0;
+  } else if (generation == pf->lock_generation &&
+	     pos >= pf->lock_start + PREFETCH_LOCK_FRAMES / 4 &&
+	     pos < pf->lock_end - PREFETCH_LOCK_FRAMES / 4) {
+    g_mutex_unlock (&sounddata->data_mutex);
+    return;
+  }
+
+  prefetch_unlock_window (pf);
+
+  start = CLAMP (pos - PREFETCH_LOCK_FRAMES / 2, 0, sounddata->nr_frames);
+  end = CLAMP (pos + PREFETCH_LOCK_FRAMES / 2, start, sounddata->nr_frames);
+
+  /* Remember the window even if it cannot be locked, to not retry */
+  pf->lock_data = sounddata->data;
+  pf->lock_generation = generation;
+  pf->lock_start = start;
+  pf->lock_end = end;
+
+  if (end > start && sounddata->data != NULL) {
+    pf->lock_addr = (gchar *)sounddata->data +
+      frames_to_bytes (sounddata->format, start);
+    len = (size_t)frames_to_bytes (sounddata->format, end - start);
+
+    if (mlock (pf->lock_addr, len) == 0) {
+      pf->lock_len = len;
+    } else if (!mlock_warned) {
+      fprintf (stderr, "sweep: unable to lock %lu bytes of sample data "
+	       "(%s); playing without locked memory\n",
+	       (unsigned long)len, strerror (errno));
+      mlock_warned = TRUE;
+    }
+  }
+
+  g_mutex_unlock (&sounddata->data_mutex);
+}
+
+static void
+prefetch_follow (sw_prefetch * pf)
+{
+  sw_head * head = pf->head;
+  sw_sounddata * sounddata;
+  sw_prefetch_stage * stage, * old;
+  gint generation, i;
+  gboolean backwards;
+  GArray * ranges;
+
+  if (!head->going) return;
+
+  sounddata = head->sample->sounddata;
+  if (sounddata == NULL || sounddata->data == NULL) return;
+
+  generation = g_atomic_int_get (&pf->generation);
+
+  if (pf->realtime)
+    prefetch_lock_window (pf, sounddata, (sw_framecount_t)head->offset,
+			  generation);
+
+  if (!pf->staging) return;
+
+  stage = g_atomic_pointer_get (&pf->stage);
+
+  if (stage == NULL || stage->channels != sounddata->format->channels) {
+    old = stage;
+    stage = stage_new (sounddata, generation);
+
+    g_mutex_lock (&prefetch_mutex);
+    if (pf->following) {
+      g_atomic_pointer_set (&pf->stage, stage);
+      stage_retire (old);
+      stage = NULL;
+    }
+    g_mutex_unlock (&prefetch_mutex);
+
+    /* Stopped while we were allocating */
+    if (stage != NULL) {
+      stage_free (stage);
+      return;
+    }
+
+    stage = g_atomic_pointer_get (&pf->stage);
+
+  } else if (g_atomic_pointer_get (&stage->sounddata) != sounddata ||
+	     g_atomic_int_get (&stage->generation) != generation) {
+    /*
+     * The mixer already treats this stage as invalid (its sounddata or
+     * generation no longer match), so the tags can be cleared before
+     * it is republished.
+     */
+    for (i = 0; i < PREFETCH_SLOTS; i++)
+      g_atomic_int_set (&stage->tags[i], TAG_EMPTY);
+
+    g_atomic_pointer_set (&stage->sounddata, sounddata);
+    g_atomic_int_set (&stage->generation, generation);
+  }
+
+  backwards = head->scrubbing ? (head->delta < 0) : head->reverse;
+
+  ranges = head_ranges (head, sounddata);
+
+  if (backwards) {
+    stage_backwards (stage, sounddata, ranges, (sw_framecount_t)head->offset,
+		     head->looping);
+  } else {
+    stage_forwards (stage, sounddata, ranges, (sw_framecount_t)head->offset,
+		    head->looping);
+  }
+
+  g_array_free (ranges, TRUE);
+}
+
+static void *
+prefetch_thread (void * unused)
+{
+  GList * heads, * gl;
+  sw_prefetch * pf;
+
+  for (;;) {
+    g_mutex_lock (&prefetch_mutex);
+    while (followed == NULL && retired == NULL)
+      g_cond_wait (&prefetch_cond, &prefetch_mutex);
+    heads = g_list_copy (followed);
+    g_mutex_unlock (&prefetch_mutex);
+
+    /*
+     * Heads and their sw_prefetch are never freed, but the sample and
+     * sounddata behind a head are: prefetch_stop () waits for a busy
+     * follow to finish, and a stopped head is not followed again.
+     */
+    for (gl = heads; gl; gl = gl->next) {
+      pf = (sw_prefetch *)gl->data;
+
+      g_mutex_lock (&prefetch_mutex);
+      pf->busy = pf->following;
+      g_mutex_unlock (&prefetch_mutex);
+
+      if (!pf->busy) continue;
+
+      prefetch_follow (pf);
+
+      g_mutex_lock (&prefetch_mutex);
+      pf->busy = FALSE;
+      g_cond_broadcast (&prefetch_idle_cond);
+      g_mutex_unlock (&prefetch_mutex);
+    }
+
+    g_list_free (heads);
+
+    reap_retired ();
+
+    g_usleep (PREFETCH_INTERVAL_USEC);
+  }
+
+  return NULL;
+}
+
+void
+prefetch_start (sw_head * head)
+{
+  sw_prefetch * pf;
+  pthread_t thread;
+  pthread_attr_t attr;
+  gboolean staging, realtime;
+
+  staging = (prefs_get_int (PREFETCH_KEY, DEFAULT_PREFETCH) != 0);
+  realtime = play_get_realtime ();
+
+  if (!staging && !realtime) return;
+
+  if (head->prefetch == NULL) {
+    pf = g_malloc0 (sizeof (sw_prefetch));
+    pf->head = head;
+    head->prefetch = pf;
+  }
+
+  pf = head->prefetch;
+
+  g_mutex_lock (&prefetch_mutex);
+
+  if (!pf->following) {
+    /* Not busy, as it is not followed */
+    pf->staging = staging;
+    pf->realtime = realtime;
+
+    followed = g_list_prepend (followed, pf);
+    pf->following = TRUE;
+  }
+
+  if (!prefetch_thread_running) {
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create (&thread, &attr, prefetch_thread, NULL) == 0) {
+      prefetch_thread_running = TRUE;
+    } else {
+      fprintf (stderr, "sweep: unable to start prefetch thread\n");
+    }
+
+    pthread_attr_destroy (&attr);
+  }
+
+  g_cond_signal (&prefetch_cond);
+
+  g_mutex_unlock (&prefetch_mutex);
+}
+
+void
+prefetch_stop (sw_head * head)
+{
+  sw_prefetch * pf = head->prefetch;
+  sw_sounddata * sounddata;
+
+  if (pf == NULL) return;
+
+  g_mutex_lock (&prefetch_mutex);
+
+  if (pf->following) {
+    followed = g_list_remove (followed, pf);
+    pf->following = FALSE;
+
+    stage_retire (g_atomic_pointer_get (&pf->stage));
+    g_atomic_pointer_set (&pf->stage, NULL);
+
+    g_cond_signal (&prefetch_cond);
+  }
+
+  /* The caller may be about to free the sample */
+  while (pf->busy)
+    g_cond_wait (&prefetch_idle_cond, &prefetch_mutex);
+
+  g_mutex_unlock (&prefetch_mutex);
+
+  /* As in prefetch_lock_window (), a window in data since reallocated
+   * is already gone */
+  sounddata = head->sample->sounddata;
+  if (sounddata == NULL || sounddata->data != pf->lock_data)
+    pf->lock_len = 0;
+
+  prefetch_unlock_window (pf);
+}
+
+void
+prefetch_invalidate (sw_sample * sample)
+{
+  sw_prefetch * pf = sample->play_head->prefetch;
+
+  if (pf != NULL)
+    g_atomic_int_inc (&pf->generation);
+}
+
+gboolean
+prefetch_read (sw_prefetch * pf, sw_sounddata * sounddata,
+	       sw_framecount_t frame, float * out)
+{
+  sw_prefetch_stage * stage = g_atomic_pointer_get (&pf->stage);
+  gint slot, tag = FRAME_TAG(frame);
+
+  if (stage == NULL ||
+      g_atomic_pointer_get (&stage->sounddata) != sounddata ||
+      g_atomic_int_get (&stage->generation) !=
+      g_atomic_int_get (&pf->generation))
+    return FALSE;
+
+  slot = frame & PREFETCH_MASK;
+
+  if (g_atomic_int_get (&stage->tags[slot]) != tag)
+    return FALSE;
+
+  memcpy (out, stage->data + slot * stage->channels,
+	  stage->channels * sizeof (float));
+
+  /* Restaged while we were copying? */
+  return (g_atomic_int_get (&stage->tags[slot]) == tag);
+}
+
+void
+prefetch_account (gint hits, gint misses)
+{
+  if (hits) g_atomic_int_add (&total_hits, hits);
+  if (misses) g_atomic_int_add (&total_misses, misses);
+}
+
+void
+prefetch_get_stats (gint * hits, gint * misses)
+{
+  if (hits) *hits = g_atomic_int_get (&total_hits);
+  if (misses) *misses = g_atomic_int_get (&total_misses);
+}
@@ -0,0 +1,76 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+
+/*
+ * Read-ahead for playback.
+ *
+ * A prefetch thread follows each playing head along the path it will
+ * take (forwards or in reverse, within the selection if restricted,
+ * wrapping if looping) and copies the upcoming frames into a per-head
+ * staging ring. The mixer reads frames from the ring without locking,
+ * and only touches sounddata itself on a miss, so any page faults or
+ * waits on data_mutex happen on the prefetch thread instead. In realtime
+ * mode the same thread keeps the sample data around each head locked.
+ */
+
+#define PREFETCH_KEY "PlaybackPrefetch"
+#define DEFAULT_PREFETCH 1
+
+/*
+ * GUI thread: begin and end following a head. prefetch_stop () returns
+ * only once the head is no longer being staged from, so the sample may
+ * then be freed.
+ */
+void
+prefetch_start (sw_head * head);
+
+void
+prefetch_stop (sw_head * head);
+
+/* Discard staged frames for a sample whose data has been edited */
+void
+prefetch_invalidate (sw_sample * sample);
+
+/*
+ * Mixer thread: copy one frame of sounddata from the staging ring into
+ * out. Returns FALSE if the frame is not staged, in which case the
+ * caller must read it from sounddata itself.
+ */
+gboolean
+prefetch_read (sw_prefetch * pf, sw_sounddata * sounddata,
+	       sw_framecount_t frame, float * out);
+
+/* Mixer thread: record the outcome of a block of prefetch_read()s */
+void
+prefetch_account (gint hits, gint misses);
+
+void
+prefetch_get_stats (gint * hits, gint * misses);
+
+#endif /* __PREFETCH_H__ */
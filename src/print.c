@@ -33,21 +33,21 @@
  * using standard abbreviations (GB, MB, kB, byte[s])
  */
 int
-snprint_bytes (gchar * s, gint n, glong nr_bytes)
+snprint_bytes (gchar * s, gint n, gint64 nr_bytes)
 {
-  if (nr_bytes > (1L<<30)) {
+  if (nr_bytes > ((gint64)1<<30)) {
     return snprintf (s, n, "%0.3f GB",
 		     (gfloat)nr_bytes / (1024.0 * 1024.0 * 1024.0));
-  } else if (nr_bytes > (1L<<20)) {
+  } else if (nr_bytes > ((gint64)1<<20)) {
     return snprintf (s, n, "%0.3f MB",
 		     (gfloat)nr_bytes / (1024.0 * 1024.0));
-  } else if (nr_bytes > (1L<<10)) {
+  } else if (nr_bytes > ((gint64)1<<10)) {
     return snprintf (s, n, "%0.3f kB",
 		     (gfloat)nr_bytes / (1024.0));
   } else if (nr_bytes == 1) {
     return snprintf (s, n, "1 byte");
   } else {
-    return snprintf (s, n, "%ld bytes", nr_bytes);
+    return snprintf (s, n, "%" G_GINT64_FORMAT " bytes", nr_bytes);
   }
 }
 
@@ -28,7 +28,7 @@
  * using standard abbreviations (GB, MB, kB, byte[s])
  */
 int
-snprint_bytes (gchar * s, gint n, glong nr_bytes);
+snprint_bytes (gchar * s, gint n, gint64 nr_bytes);
 
 /*
  * Print a time in the format HH:MM:SS.sss
@@ -29,12 +29,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <glib.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtk.h>
 
+#include <sndfile.h>
+
 #include "callbacks.h"
 
 #include <sweep/sweep_i18n.h>
@@ -55,6 +61,12 @@
 #include "driver.h"
 #include "undo_dialog.h"
 #include "db_slider.h"
+#include "ringbuffer.h"
+#include "question_dialogs.h"
+#include "record.h"
+#include "file_dialogs.h"
+#include "preferences.h"
+#include "print.h"
 
 #define DEBUG
 
@@ -75,6 +87,7 @@ static gint update_tag = -1;
 
 static GtkWidget * rec_ind_ebox;
 static GtkWidget * rec_ind_label;
+static GtkWidget * rec_overrun_label;
 static gboolean rec_ind_state = FALSE;
 
 static GtkWidget * combo;
@@ -83,11 +96,31 @@ static sw_head_controller * head_controller;
 
 static sw_head * rec_head = NULL;
 
+static void
+update_rec_overruns (void)
+{
+  gchar buf[64];
+  gint overruns, dropped;
+
+  overruns = record_get_overruns (&dropped);
+
+  if (overruns == 0) {
+    gtk_label_set_text (GTK_LABEL(rec_overrun_label), "");
+  } else {
+    g_snprintf (buf, sizeof (buf), _("Overruns: %d (%d frames dropped)"),
+		overruns, dropped);
+    gtk_label_set_text (GTK_LABEL(rec_overrun_label), buf);
+  }
+}
+
 static gint
 update_rec_ind (gpointer data)
 {
   sw_head * h = (sw_head *)data;
 
+  if (rec_dialog != NULL)
+    update_rec_overruns ();
+
   if (rec_dialog == NULL) {
     return FALSE;
   } else if (!h->going) {
@@ -180,7 +213,83 @@ prepare_recording (sw_format * format)
   rec_prepared = TRUE;
 }
 
-static struct timeval tv_instant = {0, 0};
+/*
+ * Capture runs on its own thread, which does nothing but read blocks
+ * from the device into a lock-free ring. The op thread consumes the ring
+ * and does the head_write() mixing, so a stall in the edit path (eg.
+ * waiting for ops_mutex) only costs ring space, not input. If the ring
+ * fills the captured block is dropped and counted as an overrun.
+ */
+
+/* Frames per device read */
+#define REC_BLOCK_FRAMES 1024
+
+/* Seconds of audio the capture ring can hold */
+#define REC_RING_SECONDS 2
+
+/* How long the consumer sleeps when the ring is empty */
+#define REC_POLL_USEC 2000
+
+typedef struct {
+  sw_handle * handle;
+  sw_ringbuffer * ring;
+  gint channels;
+  volatile gint stop;
+  volatile gint finished;
+} sw_rec_capture;
+
+static volatile gint rec_overruns = 0;
+static volatile gint rec_overrun_frames = 0;
+
+gint
+record_get_overruns (gint * nr_frames_dropped)
+{
+  if (nr_frames_dropped)
+    *nr_frames_dropped = g_atomic_int_get (&rec_overrun_frames);
+
+  return g_atomic_int_get (&rec_overruns);
+}
+
+static void
+record_raise_priority (void)
+{
+  struct sched_param param;
+
+  /* Best effort: without privileges this fails and we carry on */
+  param.sched_priority = sched_get_priority_min (SCHED_RR);
+  pthread_setschedparam (pthread_self (), SCHED_RR, &param);
+}
+
+static void *
+record_capture_thread (void * data)
+{
+  sw_rec_capture * cap = (sw_rec_capture *)data;
+  size_t count = REC_BLOCK_FRAMES * cap->channels;
+  float * buf;
+
+  buf = g_malloc (count * sizeof (float));
+
+  record_raise_priority ();
+
+  while (!g_atomic_int_get (&cap->stop)) {
+    if (device_read (cap->handle, buf, count) == -1)
+      break;
+
+    if (ringbuffer_write_space (cap->ring) < count) {
+      g_atomic_int_inc (&rec_overruns);
+      g_atomic_int_add (&rec_overrun_frames, REC_BLOCK_FRAMES);
+      continue;
+    }
+
+    ringbuffer_write (cap->ring, buf, count);
+  }
+
+  g_free (buf);
+
+  g_atomic_int_set (&cap->finished, 1);
+
+  return NULL;
+}
 
 static void
 do_record_regions (sw_sample * sample)
@@ -188,10 +297,13 @@ do_record_regions (sw_sample * sample)
   sw_head * head = sample->rec_head;
   sw_sounddata * sounddata = sample->sounddata;
   sw_format * f = sounddata->format;
-  fd_set fds;
   sw_framecount_t sel_total, run_total;
-  sw_framecount_t offset, remaining, n, count;
+  sw_framecount_t n;
   gint percent;
+  guint avail;
+
+  sw_rec_capture cap;
+  pthread_t capture_thread;
 
   float * rbuf;
 
@@ -208,41 +320,72 @@ do_record_regions (sw_sample * sample)
   if (sel_total == 0) sel_total = 1;
   run_total = 0;
 
-  rbuf = alloca (1024 * f->channels * sizeof (float));
+  rbuf = g_malloc (REC_BLOCK_FRAMES * f->channels * sizeof (float));
 
-  while (active) {
+  cap.handle = rec_handle;
+  cap.channels = f->channels;
+  cap.ring = ringbuffer_new (REC_RING_SECONDS * f->rate * f->channels);
+  cap.stop = 0;
+  cap.finished = 0;
 
-    FD_ZERO (&fds);
-    FD_SET (rec_handle->driver_fd, &fds);
+  g_atomic_int_set (&rec_overruns, 0);
+  g_atomic_int_set (&rec_overrun_frames, 0);
 
-    if (select (rec_handle->driver_fd+1, &fds, NULL, NULL, &tv_instant) == 0);
+  if (pthread_create (&capture_thread, NULL, record_capture_thread,
+		      &cap) != 0) {
+    sweep_perror (errno, "Unable to start capture thread");
+    g_free (rbuf);
+    ringbuffer_destroy (cap.ring);
+    goto done;
+  }
 
-    n = 1024;
-    count = n * f->channels;
+  while (active) {
+    avail = ringbuffer_read_space (cap.ring) / f->channels;
+
+    if (avail == 0) {
+      if (g_atomic_int_get (&cap.finished)) {
+	/* device error or end of input */
+	active = FALSE;
+      } else if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL ||
+		 !head->going) {
+	active = FALSE;
+      } else {
+	g_usleep (REC_POLL_USEC);
+      }
+      continue;
+    }
 
-    count = device_read (rec_handle, rbuf, count);
+    n = MIN (avail, REC_BLOCK_FRAMES);
+    ringbuffer_read (cap.ring, rbuf, n * f->channels);
 
     g_mutex_lock (&sample->ops_mutex);
 
-    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL || count == -1 ||
-	!head->going) {
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL || !head->going) {
       active = FALSE;
     } else {
       head_write (head, rbuf, n);
 
-      remaining -= n;
-      offset += n;
-
       run_total += n;
       percent = run_total / sel_total;
       percent = MIN (100, percent);
       sample_set_progress_percent (sample, percent);
-
     }
 
     g_mutex_unlock (&sample->ops_mutex);
   }
 
+  g_atomic_int_set (&cap.stop, 1);
+  pthread_join (capture_thread, NULL);
+
+  if (g_atomic_int_get (&rec_overruns) > 0) {
+    fprintf (stderr, "sweep: record: %d overruns, %d frames dropped\n",
+	     g_atomic_int_get (&rec_overruns),
+	     g_atomic_int_get (&rec_overrun_frames));
+  }
+
+  g_free (rbuf);
+  ringbuffer_destroy (cap.ring);
+
  done:
   if (rec_handle != NULL) {
     device_close (rec_handle);
@@ -253,6 +396,379 @@ do_record_regions (sw_sample * sample)
   rec_prepared = FALSE;
 }
 
+/*
+ * Record to disk.
+ *
+ * Rather than filling the selection of an existing sample, a disk take
+ * streams input straight to a new soundfile, so its length is bounded
+ * only by disk space. The capture thread is the same as above; a writer
+ * thread drains the ring in large blocks through libsndfile and keeps a
+ * coarse peak overview for the dialog to draw as the take grows. When
+ * the take stops the file is loaded as a new sample.
+ */
+
+#define RECORD_DIR_KEY "RecordDirectory"
+#define RECORD_FORMAT_KEY "RecordFileFormat"
+
+/* W64 by default: float WAV reaches its 4 GB limit after a few hours */
+#define DEFAULT_RECORD_FORMAT "w64"
+
+/* Frames per sequential write, and the minimum worth waking up for */
+#define DISK_WRITE_FRAMES 65536
+#define DISK_WRITE_MIN_FRAMES (DISK_WRITE_FRAMES / 4)
+
+/* Frames summarised by each entry of the peak overview */
+#define DISK_PEAK_FRAMES 1024
+
+typedef struct {
+  sw_rec_capture cap;
+  pthread_t capture_thread;
+  pthread_t writer_thread;
+
+  SNDFILE * sndfile;
+  gchar * pathname;
+  gint rate;
+
+  volatile gint write_error;
+
+  /* Shared with the GUI thread */
+  GMutex peaks_mutex;
+  GArray * peaks; /* max, min pairs */
+  sw_framecount_t nr_frames;
+
+  /* Private to the writer thread */
+  float peak_max, peak_min;
+  sw_framecount_t peak_fill;
+} sw_disk_take;
+
+static sw_disk_take * disk_take = NULL;
+
+static GtkWidget * disk_button;
+static GtkWidget * disk_label;
+static GtkWidget * disk_peaks_area;
+
+static gint disk_update_tag = 0;
+
+static void
+record_disk_peaks (sw_disk_take * take, float * buf, sw_framecount_t n)
+{
+  sw_framecount_t i;
+  gint j, channels = take->cap.channels;
+  float v;
+
+  g_mutex_lock (&take->peaks_mutex);
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < channels; j++) {
+      v = *buf++;
+      if (v > take->peak_max) take->peak_max = v;
+      if (v < take->peak_min) take->peak_min = v;
+    }
+
+    if (++take->peak_fill == DISK_PEAK_FRAMES) {
+      g_array_append_val (take->peaks, take->peak_max);
+      g_array_append_val (take->peaks, take->peak_min);
+      take->peak_max = take->peak_min = 0.0;
+      take->peak_fill = 0;
+    }
+  }
+
+  take->nr_frames += n;
+
+  g_mutex_unlock (&take->peaks_mutex);
+}
+
+static void *
+record_disk_writer_thread (void * data)
+{
+  sw_disk_take * take = (sw_disk_take *)data;
+  gint channels = take->cap.channels;
+  guint avail;
+  sw_framecount_t n;
+  float * buf;
+
+  buf = g_malloc (DISK_WRITE_FRAMES * channels * sizeof (float));
+
+  for (;;) {
+    avail = ringbuffer_read_space (take->cap.ring) / channels;
+
+    if (!g_atomic_int_get (&take->cap.finished) &&
+	avail < DISK_WRITE_MIN_FRAMES) {
+      g_usleep (REC_POLL_USEC * 5);
+      continue;
+    }
+
+    /* Capture has finished and the ring is drained */
+    if (avail == 0) break;
+
+    n = MIN (avail, DISK_WRITE_FRAMES);
+    ringbuffer_read (take->cap.ring, buf, n * channels);
+
+    if (sf_writef_float (take->sndfile, buf, n) != n) {
+      g_atomic_int_set (&take->write_error, 1);
+      g_atomic_int_set (&take->cap.stop, 1);
+      break;
+    }
+
+    record_disk_peaks (take, buf, n);
+  }
+
+  g_free (buf);
+
+  return NULL;
+}
+
+static gchar *
+record_disk_pathname (const char * ext)
+{
+  char dir[512];
+  char name[64];
+  time_t now;
+
+  prefs_get_string (RECORD_DIR_KEY, dir, sizeof (dir), g_get_home_dir ());
+
+  now = time (NULL);
+  strftime (name, sizeof (name) - 8, "sweep-take-%Y%m%d-%H%M%S",
+	    localtime (&now));
+  strcat (name, ".");
+  strcat (name, ext);
+
+  return g_build_filename (dir, name, NULL);
+}
+
+static gboolean
+record_disk_start (sw_format * format)
+{
+  sw_disk_take * take;
+  sw_handle * handle;
+  SF_INFO sfinfo;
+  char ext[8];
+  int err;
+
+  if (disk_take != NULL) return TRUE;
+
+  if ((handle = device_open (0, O_RDONLY)) == NULL)
+    return FALSE;
+
+  device_setup (handle, format);
+
+  take = g_malloc0 (sizeof (sw_disk_take));
+
+  prefs_get_string (RECORD_FORMAT_KEY, ext, sizeof (ext),
+		    DEFAULT_RECORD_FORMAT);
+  take->pathname = record_disk_pathname (ext);
+  take->rate = format->rate;
+
+  memset (&sfinfo, 0, sizeof (sfinfo));
+  sfinfo.samplerate = format->rate;
+  sfinfo.channels = format->channels;
+  sfinfo.format = (g_ascii_strcasecmp (ext, "wav") == 0 ?
+		   SF_FORMAT_WAV : SF_FORMAT_W64) | SF_FORMAT_FLOAT;
+
+  if ((take->sndfile = sf_open (take->pathname, SFM_WRITE, &sfinfo))
+      == NULL) {
+    sweep_perror (errno, "Unable to create %s:\n%s", take->pathname,
+		  sf_strerror (NULL));
+    device_close (handle);
+    g_free (take->pathname);
+    g_free (take);
+    return FALSE;
+  }
+
+  g_mutex_init (&take->peaks_mutex);
+  take->peaks = g_array_new (FALSE, FALSE, sizeof (float));
+
+  take->cap.handle = handle;
+  take->cap.channels = format->channels;
+  take->cap.ring = ringbuffer_new (REC_RING_SECONDS * format->rate *
+				   format->channels);
+
+  g_atomic_int_set (&rec_overruns, 0);
+  g_atomic_int_set (&rec_overrun_frames, 0);
+
+  if ((err = pthread_create (&take->writer_thread, NULL,
+			     record_disk_writer_thread, take)) != 0) {
+    sweep_perror (err, "Unable to start disk writer thread");
+    goto fail;
+  }
+
+  if ((err = pthread_create (&take->capture_thread, NULL,
+			     record_capture_thread, &take->cap)) != 0) {
+    sweep_perror (err, "Unable to start capture thread");
+    /* Nothing was captured; let the writer see an empty, finished ring */
+    g_atomic_int_set (&take->cap.finished, 1);
+    pthread_join (take->writer_thread, NULL);
+    goto fail;
+  }
+
+  disk_take = take;
+
+  return TRUE;
+
+ fail:
+  device_close (handle);
+  sf_close (take->sndfile);
+  unlink (take->pathname);
+  ringbuffer_destroy (take->cap.ring);
+  g_array_free (take->peaks, TRUE);
+  g_mutex_clear (&take->peaks_mutex);
+  g_free (take->pathname);
+  g_free (take);
+
+  return FALSE;
+}
+
+static void
+record_disk_stop (void)
+{
+  sw_disk_take * take = disk_take;
+  gboolean ok;
+
+  if (take == NULL) return;
+
+  disk_take = NULL;
+
+  g_atomic_int_set (&take->cap.stop, 1);
+  pthread_join (take->capture_thread, NULL);
+  pthread_join (take->writer_thread, NULL);
+
+  device_close (take->cap.handle);
+
+  ok = (sf_close (take->sndfile) == 0) &&
+    !g_atomic_int_get (&take->write_error);
+
+  if (!ok) {
+    sweep_perror (errno, "Error writing %s", take->pathname);
+  } else if (take->nr_frames > 0) {
+    sample_load (take->pathname);
+  }
+
+  ringbuffer_destroy (take->cap.ring);
+  g_array_free (take->peaks, TRUE);
+  g_mutex_clear (&take->peaks_mutex);
+  g_free (take->pathname);
+  g_free (take);
+}
+
+static gboolean
+disk_peaks_expose (GtkWidget * widget, GdkEventExpose * event, gpointer data)
+{
+  sw_disk_take * take = disk_take;
+  GdkGC * gc = widget->style->fg_gc[GTK_WIDGET_STATE (widget)];
+  gint width = widget->allocation.width;
+  gint height = widget->allocation.height;
+  gint mid = height / 2;
+  guint nr_peaks, first, last, i;
+  gint x;
+  float max, min, * peaks;
+
+  gdk_draw_rectangle (widget->window,
+		      widget->style->bg_gc[GTK_WIDGET_STATE (widget)],
+		      TRUE, 0, 0, width, height);
+
+  gdk_draw_line (widget->window, gc, 0, mid, width, mid);
+
+  if (take == NULL) return TRUE;
+
+  g_mutex_lock (&take->peaks_mutex);
+
+  peaks = (float *)take->peaks->data;
+  nr_peaks = take->peaks->len / 2;
+
+  /* Draw at one peak per pixel until the take is wider than the widget */
+  for (x = 0; x < width && nr_peaks > 0; x++) {
+    if (nr_peaks <= (guint)width) {
+      if ((guint)x >= nr_peaks) break;
+      first = x;
+      last = x + 1;
+    } else {
+      first = (guint)((gint64)x * nr_peaks / width);
+      last = (guint)((gint64)(x + 1) * nr_peaks / width);
+      if (last == first) last++;
+    }
+
+    max = min = 0.0;
+    for (i = first; i < last; i++) {
+      if (peaks[2*i] > max) max = peaks[2*i];
+      if (peaks[2*i+1] < min) min = peaks[2*i+1];
+    }
+
+    gdk_draw_line (widget->window, gc,
+		   x, mid - (gint)(max * mid), x, mid - (gint)(min * mid));
+  }
+
+  g_mutex_unlock (&take->peaks_mutex);
+
+  return TRUE;
+}
+
+static gint
+update_disk_take (gpointer data)
+{
+  sw_disk_take * take = disk_take;
+  gchar time_buf[32], buf[512];
+  sw_framecount_t nr_frames;
+
+  if (take == NULL || rec_dialog == NULL) {
+    disk_update_tag = 0;
+    return FALSE;
+  }
+
+  /* Capture stopped by itself, eg. device or write error */
+  if (g_atomic_int_get (&take->cap.finished)) {
+    disk_update_tag = 0;
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(disk_button), FALSE);
+    return FALSE;
+  }
+
+  g_mutex_lock (&take->peaks_mutex);
+  nr_frames = take->nr_frames;
+  g_mutex_unlock (&take->peaks_mutex);
+
+  snprint_time (time_buf, sizeof (time_buf),
+		(sw_time_t)nr_frames / (sw_time_t)take->rate);
+  g_snprintf (buf, sizeof (buf), _("Recording to %s: %s"),
+	      take->pathname, time_buf);
+  gtk_label_set_text (GTK_LABEL(disk_label), buf);
+
+  update_rec_overruns ();
+
+  gtk_widget_queue_draw (disk_peaks_area);
+
+  return TRUE;
+}
+
+static void
+disk_button_toggled_cb (GtkWidget * widget, gpointer data)
+{
+  gboolean active;
+
+  active = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(widget));
+
+  if (active && disk_take == NULL) {
+    if (rec_head == NULL || rec_head->going ||
+	!record_disk_start (rec_head->sample->sounddata->format)) {
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(widget), FALSE);
+      return;
+    }
+
+    gtk_widget_set_sensitive (combo, FALSE);
+    disk_update_tag = g_timeout_add ((guint32)100,
+				     (GSourceFunc)update_disk_take, NULL);
+  } else if (!active && disk_take != NULL) {
+    if (disk_update_tag > 0) {
+      g_source_remove (disk_update_tag);
+      disk_update_tag = 0;
+    }
+
+    record_disk_stop ();
+
+    gtk_label_set_text (GTK_LABEL(disk_label), "");
+    gtk_widget_queue_draw (disk_peaks_area);
+    gtk_widget_set_sensitive (combo, TRUE);
+  }
+}
+
 static void
 do_record_regions_thread (sw_op_instance * inst)
 {
@@ -294,6 +810,9 @@ record_cb (GtkWidget * widget, gpointer data)
 
   if (head->going) {
     stop_recording (sample);
+  } else if (disk_take != NULL) {
+    head_set_going (head, FALSE);
+    sample_set_tmp_message (sample, _("Already recording to disk"));
   } else {
     if (sounddata_selection_nr_frames (sample->sounddata) > 0) {
       head->going = TRUE;
@@ -315,6 +834,8 @@ rec_dialog_destroy (GtkWidget * widget, gpointer data)
   rec_dialog = NULL;
   rec_head = NULL;
 
+  record_disk_stop ();
+
   stop_recording (head->sample);
 }
 
@@ -543,6 +1064,49 @@ rec_dialog_create (sw_sample * sample)
     gtk_widget_show (label);
 
     rec_ind_label = label;
+
+    label = gtk_label_new ("");
+    gtk_box_pack_start (GTK_BOX(main_vbox), label, FALSE, TRUE, 0);
+    gtk_widget_show (label);
+
+    rec_overrun_label = label;
+
+    /* Record to disk */
+
+    separator = gtk_hseparator_new ();
+    gtk_box_pack_start (GTK_BOX(main_vbox), separator, FALSE, FALSE, 0);
+    gtk_widget_show (separator);
+
+    hbox = gtk_hbox_new (FALSE, 8);
+    gtk_box_pack_start (GTK_BOX(main_vbox), hbox, FALSE, TRUE, 4);
+    gtk_container_set_border_width (GTK_CONTAINER(hbox), 4);
+    gtk_widget_show (hbox);
+
+    disk_button = gtk_toggle_button_new_with_label (_("Record to disk"));
+    gtk_box_pack_start (GTK_BOX(hbox), disk_button, FALSE, FALSE, 0);
+    gtk_widget_show (disk_button);
+
+    g_signal_connect (G_OBJECT(disk_button), "toggled",
+		      G_CALLBACK(disk_button_toggled_cb), NULL);
+
+    gtk_tooltips_set_tip (tooltips, disk_button,
+			  _("Record a new take straight to a file, without "
+			    "a selection to record into. The take is opened "
+			    "as a new sample when recording stops."), NULL);
+
+    label = gtk_label_new ("");
+    gtk_box_pack_start (GTK_BOX(hbox), label, TRUE, TRUE, 0);
+    gtk_widget_show (label);
+
+    disk_label = label;
+
+    disk_peaks_area = gtk_drawing_area_new ();
+    gtk_widget_set_size_request (disk_peaks_area, -1, 48);
+    gtk_box_pack_start (GTK_BOX(main_vbox), disk_peaks_area, FALSE, TRUE, 4);
+    gtk_widget_show (disk_peaks_area);
+
+    g_signal_connect (G_OBJECT(disk_peaks_area), "expose_event",
+		      G_CALLBACK(disk_peaks_expose), NULL);
   }
 
   rec_dialog_refresh_sample_list ();
@@ -34,4 +34,12 @@ rec_dialog_refresh_sample_list (void);
 void
 rec_dialog_create (sw_sample * sample);
 
+/*
+ * Number of capture blocks dropped because the ring was full during the
+ * current (or last) take; the number of frames lost is returned in
+ * nr_frames_dropped if non-NULL.
+ */
+gint
+record_get_overruns (gint * nr_frames_dropped);
+
 #endif /* __RECORD_H__ */
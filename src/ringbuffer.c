@@ -0,0 +1,139 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "ringbuffer.h"
+
+/*
+ * The read and write counters only ever increase (modulo 2^32), each
+ * being stored by one side and loaded by the other. g_atomic_int_get()
+ * and g_atomic_int_set() are full barriers, so the data copied before a
+ * counter is published is visible to the other side once it sees the
+ * new count.
+ */
+
+sw_ringbuffer *
+ringbuffer_new (guint min_size)
+{
+  sw_ringbuffer * rb;
+  guint size = 1;
+
+  while (size < min_size && size < (1U << 30))
+    size <<= 1;
+
+  rb = g_malloc0 (sizeof (sw_ringbuffer));
+  rb->data = g_malloc0 (size * sizeof (float));
+  rb->size = size;
+  rb->mask = size - 1;
+
+  return rb;
+}
+
+void
+ringbuffer_destroy (sw_ringbuffer * rb)
+{
+  if (rb == NULL) return;
+
+  g_free (rb->data);
+  g_free (rb);
+}
+
+void
+ringbuffer_reset (sw_ringbuffer * rb)
+{
+  g_atomic_int_set (&rb->write_count, 0);
+  g_atomic_int_set (&rb->read_count, 0);
+}
+
+guint
+ringbuffer_read_space (sw_ringbuffer * rb)
+{
+  return (guint)g_atomic_int_get (&rb->write_count) -
+    (guint)g_atomic_int_get (&rb->read_count);
+}
+
+guint
+ringbuffer_write_space (sw_ringbuffer * rb)
+{
+  return rb->size - ringbuffer_read_space (rb);
+}
+
+guint
+ringbuffer_write (sw_ringbuffer * rb, const float * buf, guint count)
+{
+  guint w, start, n1;
+
+  count = MIN (count, ringbuffer_write_space (rb));
+  if (count == 0) return 0;
+
+  w = (guint)g_atomic_int_get (&rb->write_count);
+  start = w & rb->mask;
+  n1 = MIN (count, rb->size - start);
+
+  memcpy (rb->data + start, buf, n1 * sizeof (float));
+  if (count > n1)
+    memcpy (rb->data, buf + n1, (count - n1) * sizeof (float));
+
+  g_atomic_int_set (&rb->write_count, (gint)(w + count));
+
+  return count;
+}
+
+guint
+ringbuffer_read (sw_ringbuffer * rb, float * buf, guint count)
+{
+  guint r, start, n1;
+
+  count = MIN (count, ringbuffer_read_space (rb));
+  if (count == 0) return 0;
+
+  r = (guint)g_atomic_int_get (&rb->read_count);
+  start = r & rb->mask;
+  n1 = MIN (count, rb->size - start);
+
+  memcpy (buf, rb->data + start, n1 * sizeof (float));
+  if (count > n1)
+    memcpy (buf + n1, rb->data, (count - n1) * sizeof (float));
+
+  g_atomic_int_set (&rb->read_count, (gint)(r + count));
+
+  return count;
+}
+
+guint
+ringbuffer_skip (sw_ringbuffer * rb, guint count)
+{
+  guint r;
+
+  count = MIN (count, ringbuffer_read_space (rb));
+  if (count == 0) return 0;
+
+  r = (guint)g_atomic_int_get (&rb->read_count);
+  g_atomic_int_set (&rb->read_count, (gint)(r + count));
+
+  return count;
+}
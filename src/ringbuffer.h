@@ -0,0 +1,72 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <glib.h>
+
+/*
+ * A single-producer, single-consumer ring of floats.
+ *
+ * One thread may write and one other thread may read concurrently
+ * without locking; neither side ever blocks. Sizes and counts are in
+ * samples (not frames), and the capacity is rounded up to a power of two.
+ */
+
+typedef struct _sw_ringbuffer sw_ringbuffer;
+
+struct _sw_ringbuffer {
+  float * data;
+  guint size;  /* power of two */
+  guint mask;
+  volatile gint write_count; /* total samples written, wraps */
+  volatile gint read_count;  /* total samples read, wraps */
+};
+
+sw_ringbuffer *
+ringbuffer_new (guint min_size);
+
+void
+ringbuffer_destroy (sw_ringbuffer * rb);
+
+/* Discard all data. Only safe while neither side is running. */
+void
+ringbuffer_reset (sw_ringbuffer * rb);
+
+guint
+ringbuffer_read_space (sw_ringbuffer * rb);
+
+guint
+ringbuffer_write_space (sw_ringbuffer * rb);
+
+/* Producer side: copy up to count samples in, returns the number written */
+guint
+ringbuffer_write (sw_ringbuffer * rb, const float * buf, guint count);
+
+/* Consumer side: copy up to count samples out, returns the number read */
+guint
+ringbuffer_read (sw_ringbuffer * rb, float * buf, guint count);
+
+/* Consumer side: drop up to count samples, returns the number dropped */
+guint
+ringbuffer_skip (sw_ringbuffer * rb, guint count);
+
+#endif /* __RINGBUFFER_H__ */
@@ -44,6 +44,7 @@
 #include "callbacks.h"
 #include "edit.h"
 #include "undo_dialog.h"
+#include "spectrogram.h"
 
 /*#define DEBUG*/
 
@@ -57,8 +58,7 @@
 
 extern GdkCursor * sweep_cursors[];
 
-/* Maximum number of samples to consider per pixel */
-#define STEP_MAX 32
+#define STEP_MAX SAMPLE_DISPLAY_STEP_MAX
 
 
 /* Whether or not to compile in support for
@@ -723,6 +723,106 @@ sample_display_realize (GtkWidget *widget)
 }
 
 
+/*
+ * Summarise frames [start, end) of one channel, looking at every step'th
+ * frame: the positive and negative peaks and the mean positive and negative
+ * values. This is the data pass of waveform drawing, kept separate from the
+ * GDK calls so that it can be timed on its own.
+ */
+void
+sample_display_scan_column (const float * data, int channels, int channel,
+			    sw_framecount_t start, sw_framecount_t end,
+			    sw_framecount_t step, sw_column_peaks * peaks)
+{
+  sw_framecount_t i, nr_pos = 0, nr_neg = 0;
+  double totpos = 0.0, totneg = 0.0;
+  float d, maxpos = 0.0, minneg = 0.0;
+
+  for (i = start; i < end; i += step) {
+    d = data[i*channels + channel];
+    if (d >= 0) {
+      if (d > maxpos) maxpos = d;
+      totpos += d;
+      nr_pos++;
+    } else {
+      if (d < minneg) minneg = d;
+      totneg += d;
+      nr_neg++;
+    }
+  }
+
+  peaks->maxpos = maxpos;
+  peaks->minneg = minneg;
+  peaks->avgpos = (nr_pos > 0) ? totpos / nr_pos : 0;
+  peaks->avgneg = (nr_neg > 0) ? totneg / nr_neg : 0;
+}
+
+/*
+ * Spectrogram mode: frequency runs up the channel and the loudness of
+ * each band is shown as colour; see spectrogram.c. Selections are
+ * XORed over the top, as the background is no longer a flat colour.
+ */
+static void
+sample_display_draw_spectrogram_channel (GdkDrawable * win,
+					 const SampleDisplay * s,
+					 int x,
+					 int y,
+					 int width,
+					 int height,
+					 int channel)
+{
+  GList * gl;
+  sw_sel * sel;
+  sw_sample * sample;
+  guchar * rgb;
+  gdouble fpp;
+  int x1, x2;
+
+  if (width <= 0 || height <= 0)
+    return;
+
+  sample = s->view->sample;
+
+  fpp = (gdouble)(s->view->end - s->view->start) / (gdouble)s->width;
+
+  rgb = g_malloc (width * height * 3);
+  spectrogram_render (sample, channel, s->view->start + x * fpp, fpp,
+		      width, height, rgb, width * 3);
+  gdk_draw_rgb_image (win, s->fg_gcs[sample->color], x, y, width, height,
+		      GDK_RGB_DITHER_NONE, rgb, width * 3);
+  g_free (rgb);
+
+  for (gl = sample->sounddata->sels; gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+
+    x1 = OFFSET_TO_XPOS(sel->sel_start);
+    x1 = CLAMP(x1, x, x+width);
+
+    x2 = OFFSET_TO_XPOS(sel->sel_end);
+    x2 = CLAMP(x2, x, x+width);
+
+    if (x2 - x1 > 1) {
+      gdk_draw_rectangle (win, s->tmp_sel_gc, TRUE,
+			  x1, y, x2 - x1, height);
+    }
+  }
+
+  sel = sample->tmp_sel;
+
+  if (sel && sel->sel_start != sel->sel_end) {
+    x1 = OFFSET_TO_XPOS(sel->sel_start);
+    x1 = CLAMP(x1, x, x+width);
+
+    x2 = OFFSET_TO_XPOS(sel->sel_end);
+    x2 = CLAMP(x2, x, x+width);
+
+    if (x2 - x1 > 1) {
+      gdk_draw_rectangle (win, s->tmp_sel_gc, FALSE,
+			  x1, y, x2 - x1 - 1, height - 1);
+    }
+  }
+}
+
 static void
 sample_display_draw_data_channel (GdkDrawable * win,
 				  const SampleDisplay * s,
@@ -737,15 +837,21 @@ sample_display_draw_data_channel (GdkDrawable * win,
   sw_sel * sel;
   int x1, x2, y1;
   float vhigh, vlow;
-  double totpos, totneg;
   float d, maxpos, avgpos, minneg, avgneg;
   float prev_maxpos, prev_minneg;
-  sw_framecount_t i, step, nr_frames, nr_pos, nr_neg;
+  sw_framecount_t i, step, nr_frames;
+  sw_column_peaks peaks;
   sw_sample * sample;
   const int channels = s->view->sample->sounddata->format->channels;
 
   sample = s->view->sample;
 
+  if (s->view->spectrogram) {
+    sample_display_draw_spectrogram_channel (win, s, x, y, width, height,
+					     channel);
+    return;
+  }
+
   fg_gc = s->fg_gcs[sample->color];
 
   gdk_draw_rectangle(win, s->bg_gcs[sample->color],
@@ -804,7 +910,6 @@ sample_display_draw_data_channel (GdkDrawable * win,
   gdk_draw_line(win, s->zeroline_gc,
 		x, y1, x + width - 1, y1);
 
-  totpos = totneg = 0.0;
   maxpos = minneg = prev_maxpos = prev_minneg = 0.0;
 
   nr_frames = sample->sounddata->nr_frames;
@@ -854,43 +959,22 @@ sample_display_draw_data_channel (GdkDrawable * win,
   }
 
   while(width >= 0) {
-    nr_pos = nr_neg = 0;
-    totpos = totneg = 0;
-
-    maxpos = minneg = 0;
-
     /* lock the sounddata against destructive ops to make sure
      * sounddata->data doesn't change under us */
     g_mutex_lock (&sample->ops_mutex);
 
-    for (i = OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x));
-	 i < OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1));
-	 i+=step) {
-      d = ((float *)sample->sounddata->data)[i*channels + channel];
-      if (d >= 0) {
-	if (d > maxpos) maxpos = d;
-	totpos += d;
-	nr_pos++;
-      } else {
-	if (d < minneg) minneg = d;
-	totneg += d;
-	nr_neg++;
-      }
-    }
+    sample_display_scan_column ((float *)sample->sounddata->data,
+				channels, channel,
+				OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x)),
+				OFFSET_RANGE(nr_frames, XPOS_TO_OFFSET(x+1)),
+				step, &peaks);
 
     g_mutex_unlock (&sample->ops_mutex);
 
-    if (nr_pos > 0) {
-      avgpos = totpos / nr_pos;
-    } else {
-      avgpos = 0;
-    }
-
-    if (nr_neg > 0) {
-      avgneg = totneg / nr_neg;
-    } else {
-      avgneg = 0;
-    }
+    maxpos = peaks.maxpos;
+    minneg = peaks.minneg;
+    avgpos = peaks.avgpos;
+    avgneg = peaks.avgneg;
 
     gdk_draw_line(win, s->minmax_gc,
 		  x, YPOS(maxpos),
@@ -35,6 +35,15 @@
 typedef struct _SampleDisplay       SampleDisplay;
 typedef struct _SampleDisplayClass  SampleDisplayClass;
 
+/* Maximum number of samples to consider per pixel */
+#define SAMPLE_DISPLAY_STEP_MAX 32
+
+/* Summary of the data under one pixel column of one channel */
+typedef struct {
+  float maxpos, minneg;
+  float avgpos, avgneg;
+} sw_column_peaks;
+
 enum {
   SAMPLE_DISPLAYCOL_BG,
   SAMPLE_DISPLAYCOL_FG,
@@ -160,4 +169,9 @@ sample_display_start_marching_ants (SampleDisplay * s);
 void
 sample_display_stop_marching_ants (SampleDisplay * s);
 
+void
+sample_display_scan_column (const float * data, int channels, int channel,
+			    sw_framecount_t start, sw_framecount_t end,
+			    sw_framecount_t step, sw_column_peaks * peaks);
+
 #endif /* _SAMPLE_DISPLAY_H */
@@ -0,0 +1,370 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "scheduler.h"
+#include "preferences.h"
+
+/*#define DEBUG*/
+
+#define MAX_WORKERS 64
+
+typedef struct {
+  SweepFunction func;
+  gpointer data;
+  gint64 queued_at;
+} sw_sched_job;
+
+static GMutex sched_mutex;
+static GCond sched_cond;
+
+static GQueue sched_queues[SCHED_PRIORITY_MAX];
+
+static sw_sched_stats sched_stats;
+
+static gboolean sched_initialised = FALSE;
+
+/* Parallel helper pool; see scheduler_parallel () */
+
+typedef struct {
+  SweepParallelFunction func;
+  gpointer data;
+  gint nr_tasks;
+  gint next;      /* next index to hand out */
+  gint remaining; /* calls not yet finished */
+} sw_parallel_job;
+
+static GMutex par_mutex;
+static GCond par_cond;      /* a job was queued */
+static GCond par_done_cond; /* a call finished */
+
+static GQueue par_queue;
+
+static gint par_nr_helpers = 0;
+
+static sw_sched_job *
+scheduler_next_job (void)
+{
+  int i;
+
+  for (i = 0; i < SCHED_PRIORITY_MAX; i++) {
+    if (!g_queue_is_empty (&sched_queues[i])) {
+      sched_stats.queue_depth[i]--;
+      return (sw_sched_job *) g_queue_pop_head (&sched_queues[i]);
+    }
+  }
+
+  return NULL;
+}
+
+static void *
+scheduler_worker (void * unused)
+{
+  sw_sched_job * job;
+  gint64 wait;
+
+  g_mutex_lock (&sched_mutex);
+
+  while (1) {
+    while ((job = scheduler_next_job ()) == NULL) {
+      g_cond_wait (&sched_cond, &sched_mutex);
+    }
+
+    wait = g_get_monotonic_time () - job->queued_at;
+
+    sched_stats.nr_busy++;
+    sched_stats.nr_dispatched++;
+    sched_stats.total_wait_usec += wait;
+    sched_stats.last_wait_usec = wait;
+    if (wait > sched_stats.max_wait_usec)
+      sched_stats.max_wait_usec = wait;
+
+    g_mutex_unlock (&sched_mutex);
+
+#ifdef DEBUG
+    g_print ("scheduler: dispatching job %p after %ld us\n", job->data,
+	     (long)wait);
+#endif
+
+    job->func (job->data);
+    g_free (job);
+
+    g_mutex_lock (&sched_mutex);
+    sched_stats.nr_busy--;
+  }
+
+  /* not reached */
+  g_mutex_unlock (&sched_mutex);
+
+  return NULL;
+}
+
+/*
+ * Claim the next index of the job at the head of par_queue, unqueueing
+ * the job once all its indices are handed out. Call with par_mutex held.
+ * Returns -1 if there is nothing to do.
+ */
+static gint
+scheduler_parallel_claim (sw_parallel_job ** job_ret)
+{
+  sw_parallel_job * job;
+  gint i;
+
+  job = (sw_parallel_job *) g_queue_peek_head (&par_queue);
+  if (job == NULL) return -1;
+
+  i = job->next++;
+  if (job->next >= job->nr_tasks)
+    g_queue_pop_head (&par_queue);
+
+  *job_ret = job;
+
+  return i;
+}
+
+/* Run one claimed call and account for it. Call with par_mutex held. */
+static void
+scheduler_parallel_run (sw_parallel_job * job, gint i)
+{
+  g_mutex_unlock (&par_mutex);
+  job->func (job->data, i);
+  g_mutex_lock (&par_mutex);
+
+  if (--job->remaining == 0)
+    g_cond_broadcast (&par_done_cond);
+}
+
+static void *
+scheduler_parallel_helper (void * unused)
+{
+  sw_parallel_job * job;
+  gint i;
+
+  g_mutex_lock (&par_mutex);
+
+  while (1) {
+    while ((i = scheduler_parallel_claim (&job)) < 0) {
+      g_cond_wait (&par_cond, &par_mutex);
+    }
+
+    scheduler_parallel_run (job, i);
+  }
+
+  /* not reached */
+  g_mutex_unlock (&par_mutex);
+
+  return NULL;
+}
+
+static gint
+scheduler_nr_cpus (void)
+{
+  long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  if (n < 1) n = 1;
+
+  return (gint)n;
+}
+
+void
+init_scheduler (void)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int i, nr_workers;
+
+  if (sched_initialised) return;
+
+  g_mutex_init (&sched_mutex);
+  g_cond_init (&sched_cond);
+
+  g_mutex_init (&par_mutex);
+  g_cond_init (&par_cond);
+  g_cond_init (&par_done_cond);
+  g_queue_init (&par_queue);
+
+  for (i = 0; i < SCHED_PRIORITY_MAX; i++)
+    g_queue_init (&sched_queues[i]);
+
+  /* A preference of 0 (the default) means one worker per online CPU */
+  nr_workers = prefs_get_int (OPS_WORKERS_KEY, 0);
+  if (nr_workers <= 0) nr_workers = scheduler_nr_cpus ();
+  if (nr_workers > MAX_WORKERS) nr_workers = MAX_WORKERS;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  for (i = 0; i < nr_workers; i++) {
+    if (pthread_create (&thread, &attr, scheduler_worker, NULL) != 0) {
+      perror ("Unable to create operation worker thread");
+      break;
+    }
+    sched_stats.nr_workers++;
+  }
+
+  /* The thread calling scheduler_parallel () makes up the last CPU */
+  nr_workers = MIN (scheduler_nr_cpus (), MAX_WORKERS) - 1;
+
+  for (i = 0; i < nr_workers; i++) {
+    if (pthread_create (&thread, &attr, scheduler_parallel_helper,
+			NULL) != 0) {
+      perror ("Unable to create parallel helper thread");
+      break;
+    }
+    par_nr_helpers++;
+  }
+
+  pthread_attr_destroy (&attr);
+
+  if (sched_stats.nr_workers == 0) {
+    fprintf (stderr, "sweep: no operation worker threads available\n");
+    exit (1);
+  }
+
+#ifdef DEBUG
+  g_print ("scheduler: started %d workers\n", sched_stats.nr_workers);
+#endif
+
+  sched_initialised = TRUE;
+}
+
+sw_sched_priority
+scheduler_priority_for_mode (sw_edit_mode edit_mode)
+{
+  switch (edit_mode) {
+  case SWEEP_EDIT_MODE_META:
+    return SCHED_PRIORITY_INTERACTIVE;
+  case SWEEP_EDIT_MODE_ALLOC:
+    return SCHED_PRIORITY_EDIT;
+  case SWEEP_EDIT_MODE_FILTER:
+  default:
+    return SCHED_PRIORITY_BATCH;
+  }
+}
+
+void
+scheduler_submit (SweepFunction func, gpointer data,
+		  sw_sched_priority priority)
+{
+  sw_sched_job * job;
+
+  g_assert (sched_initialised);
+  g_return_if_fail (priority >= 0 && priority < SCHED_PRIORITY_MAX);
+
+  job = g_malloc (sizeof (sw_sched_job));
+  job->func = func;
+  job->data = data;
+  job->queued_at = g_get_monotonic_time ();
+
+  g_mutex_lock (&sched_mutex);
+  g_queue_push_tail (&sched_queues[priority], job);
+  sched_stats.queue_depth[priority]++;
+  g_cond_signal (&sched_cond);
+  g_mutex_unlock (&sched_mutex);
+}
+
+gint
+scheduler_queue_depth (void)
+{
+  gint i, depth = 0;
+
+  g_mutex_lock (&sched_mutex);
+  for (i = 0; i < SCHED_PRIORITY_MAX; i++)
+    depth += sched_stats.queue_depth[i];
+  g_mutex_unlock (&sched_mutex);
+
+  return depth;
+}
+
+void
+scheduler_get_stats (sw_sched_stats * stats)
+{
+  if (stats == NULL) return;
+
+  g_mutex_lock (&sched_mutex);
+  *stats = sched_stats;
+  g_mutex_unlock (&sched_mutex);
+}
+
+void
+scheduler_parallel (SweepParallelFunction func, gpointer data, gint n)
+{
+  sw_parallel_job job;
+  gint i;
+
+  g_return_if_fail (func != NULL);
+
+  if (n <= 0) return;
+
+  /* Nothing to share, or nobody to share it with */
+  if (n == 1 || par_nr_helpers == 0) {
+    for (i = 0; i < n; i++)
+      func (data, i);
+    return;
+  }
+
+  job.func = func;
+  job.data = data;
+  job.nr_tasks = n;
+  job.next = 0;
+  job.remaining = n;
+
+  g_mutex_lock (&par_mutex);
+
+  g_queue_push_tail (&par_queue, &job);
+  if (n - 1 < par_nr_helpers) {
+    for (i = 0; i < n - 1; i++)
+      g_cond_signal (&par_cond);
+  } else {
+    g_cond_broadcast (&par_cond);
+  }
+
+  /*
+   * Help out until this job's indices are all handed out. Only work on
+   * this job, even if another op's job is ahead of it in the queue.
+   */
+  while (job.next < job.nr_tasks) {
+    i = job.next++;
+    if (job.next >= job.nr_tasks)
+      g_queue_remove (&par_queue, &job);
+
+    scheduler_parallel_run (&job, i);
+  }
+
+  while (job.remaining > 0)
+    g_cond_wait (&par_done_cond, &par_mutex);
+
+  g_mutex_unlock (&par_mutex);
+}
@@ -0,0 +1,89 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+/*
+ * Process-wide operation scheduler.
+ *
+ * Rather than each sample spawning its own ops thread, work is handed to a
+ * fixed pool of worker threads sized to the number of online CPUs. Each
+ * sample still keeps its own FIFO of pending ops (sample->pending_ops) to
+ * preserve ordering; the scheduler only decides which sample's next op gets
+ * a worker, picking higher priorities first and FIFO within a priority.
+ */
+
+typedef enum {
+  SCHED_PRIORITY_INTERACTIVE = 0, /* META ops: selections, cursors etc. */
+  SCHED_PRIORITY_EDIT,            /* ALLOC ops: cut, paste, undo etc. */
+  SCHED_PRIORITY_BATCH,           /* FILTER ops: plugins, whole-file processing */
+  SCHED_PRIORITY_BACKGROUND,      /* caches: spectrogram tiles */
+  SCHED_PRIORITY_MAX
+} sw_sched_priority;
+
+typedef struct {
+  gint nr_workers;
+  gint nr_busy;
+  gint queue_depth[SCHED_PRIORITY_MAX];
+  guint64 nr_dispatched;
+  gint64 total_wait_usec; /* sum of time spent queued before dispatch */
+  gint64 max_wait_usec;
+  gint64 last_wait_usec;
+} sw_sched_stats;
+
+#define OPS_WORKERS_KEY "OpsWorkers"
+
+/*
+ * Data-parallel helper for use from within an op.
+ *
+ * scheduler_parallel (func, data, n) calls func (data, i) once for each
+ * i in [0, n), spread across a second pool of threads, and returns when
+ * all n calls have finished. The calling thread takes a share of the
+ * calls itself. The helper threads are separate from the op workers
+ * above, so an op that blocks in here never waits on a worker that is
+ * itself waiting for an op.
+ */
+typedef void (*SweepParallelFunction) (gpointer data, gint index);
+
+void
+init_scheduler (void);
+
+sw_sched_priority
+scheduler_priority_for_mode (sw_edit_mode edit_mode);
+
+void
+scheduler_submit (SweepFunction func, gpointer data,
+		  sw_sched_priority priority);
+
+gint
+scheduler_queue_depth (void);
+
+void
+scheduler_get_stats (sw_sched_stats * stats);
+
+void
+scheduler_parallel (SweepParallelFunction func, gpointer data, gint n);
+
+#endif /* __SCHEDULER_H__ */
@@ -0,0 +1,787 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include <sweep/sweep_i18n.h>
+#include <sweep/sweep_types.h>
+#include <sweep/sweep_fft.h>
+#include <sweep/sweep_sample.h>
+
+#include "sweep_app.h"
+#include "spectrogram.h"
+#include "sample-display.h"
+#include "scheduler.h"
+
+/*#define DEBUG*/
+
+/* FFT lengths, chosen per level from four times the column width */
+#define SPECTROGRAM_MIN_FFT 128
+#define SPECTROGRAM_MAX_FFT 2048
+
+/* Tiles kept per sample; about 64kB each */
+#define SPECTROGRAM_CACHE_TILES 512
+
+/* Requests beyond this many are dropped, oldest first */
+#define SPECTROGRAM_MAX_QUEUED 256
+
+/* Frames of one channel copied out per hold of ops_mutex */
+#define SPECTROGRAM_COPY_FRAMES 65536
+
+/* How often the GUI looks for finished tiles while jobs are running */
+#define SPECTROGRAM_POLL_INTERVAL 100
+
+#define TILE_BYTES (SPECTROGRAM_TILE_COLUMNS * SPECTROGRAM_ROWS)
+
+#define TILE_KEY(level,channel,index) \
+  (((gint64)(index) << 13) | ((level) << 8) | (channel))
+
+typedef enum {
+  TILE_QUEUED,
+  TILE_BUSY,
+  TILE_READY
+} sw_spec_tile_state;
+
+typedef struct {
+  gint64 key;
+  gint level;
+  gint channel;
+  sw_framecount_t index;
+
+  sw_spec_tile_state state;
+  gboolean stale;  /* data (if any) predates an edit under the tile */
+  guint last_used; /* render pass which last looked at the tile */
+
+  guint8 * data;   /* SPECTROGRAM_ROWS per column, lowest frequency first */
+} sw_spec_tile;
+
+typedef struct _sw_spectrogram sw_spectrogram;
+
+struct _sw_spectrogram {
+  sw_sample * sample;
+
+  GMutex mutex;
+  GCond idle_cond;
+
+  GHashTable * tiles; /* by key */
+  GQueue queue;       /* TILE_QUEUED tiles, most recently wanted first */
+
+  gint nr_jobs;       /* submitted to the scheduler and not yet returned */
+  gint nr_running;    /* of those, running with the sample in hand */
+  gboolean closing;
+
+  sw_sounddata * sounddata; /* what the tiles were made from */
+  gboolean hold;      /* don't queue anything: an edit is running */
+  gboolean warned;    /* told the user there is no worker to spare */
+
+  guint serial;       /* render passes */
+  gint nr_done, last_done;
+  guint poll_tag;
+};
+
+typedef struct {
+  gfloat * frames;
+  sw_framecount_t frames_start;
+  gint frames_len;
+  gfloat * window, * x, * re, * im, * work;
+  gfloat power[SPECTROGRAM_ROWS];
+} sw_spec_work;
+
+/* Jobs running or waiting for a worker, over all samples */
+static volatile gint spectrogram_nr_jobs = 0;
+
+static guchar palette[256][3];
+static gboolean palette_ready = FALSE;
+
+static void
+spectrogram_init_palette (void)
+{
+  static const struct { gdouble at; gint r, g, b; } stops[] = {
+    { 0.0,    0,   0,   0 },
+    { 0.25,  20,  10,  90 },
+    { 0.45, 120,  20, 130 },
+    { 0.65, 220,  60,  40 },
+    { 0.85, 250, 190,  30 },
+    { 1.0,  255, 255, 230 },
+  };
+  gint i, j;
+  gdouble v, t;
+
+  for (i = 0; i < 256; i++) {
+    v = i / 255.0;
+    for (j = 1; j < G_N_ELEMENTS (stops) - 1 && v > stops[j].at; j++);
+    t = (v - stops[j-1].at) / (stops[j].at - stops[j-1].at);
+    palette[i][0] = stops[j-1].r + t * (stops[j].r - stops[j-1].r);
+    palette[i][1] = stops[j-1].g + t * (stops[j].g - stops[j-1].g);
+    palette[i][2] = stops[j-1].b + t * (stops[j].b - stops[j-1].b);
+  }
+
+  palette_ready = TRUE;
+}
+
+static gint
+spectrogram_fft_size (gint level)
+{
+  gint n = SPECTROGRAM_MIN_FFT;
+
+  while (n < SPECTROGRAM_MAX_FFT && n < 4 * (SPECTROGRAM_MIN_HOP << level))
+    n *= 2;
+
+  return n;
+}
+
+/* Whether an edit that changes the data is under way */
+static gboolean
+spectrogram_sample_busy (sw_sample * sample)
+{
+  return (sample->edit_state == SWEEP_EDIT_STATE_BUSY ||
+	  sample->edit_state == SWEEP_EDIT_STATE_CANCEL) &&
+    sample->edit_mode != SWEEP_EDIT_MODE_READY &&
+    sample->edit_mode != SWEEP_EDIT_MODE_META;
+}
+
+static void
+spectrogram_destroy (sw_spectrogram * sg)
+{
+  GHashTableIter iter;
+  sw_spec_tile * tile;
+
+  g_hash_table_iter_init (&iter, sg->tiles);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tile)) {
+    g_free (tile->data);
+    g_free (tile);
+  }
+  g_hash_table_destroy (sg->tiles);
+
+  g_queue_clear (&sg->queue);
+  g_cond_clear (&sg->idle_cond);
+  g_mutex_clear (&sg->mutex);
+
+  g_free (sg);
+}
+
+/*
+ * Workers
+ */
+
+/*
+ * Copy len frames of channel from start into buf, zero outside the
+ * data. Fails if the sample no longer holds sounddata.
+ */
+static gboolean
+spectrogram_fill (sw_spectrogram * sg, sw_sounddata * sounddata,
+		  gint channel, sw_framecount_t start, gfloat * buf, gint len)
+{
+  sw_sample * sample = sg->sample;
+  sw_framecount_t nr_frames, f;
+  const float * d;
+  gint channels, i;
+  gboolean ok = FALSE;
+
+  /*
+   * Edits hold ops_mutex while they move or resize the data, and file
+   * loaders hold data_mutex while they grow it.
+   */
+  g_mutex_lock (&sample->ops_mutex);
+
+  if (sample->sounddata == sounddata &&
+      channel < sounddata->format->channels) {
+    g_mutex_lock (&sounddata->data_mutex);
+
+    channels = sounddata->format->channels;
+    nr_frames = sounddata->nr_frames;
+    d = (const float *)sounddata->data;
+
+    for (i = 0, f = start; i < len; i++, f++) {
+      buf[i] = (f >= 0 && f < nr_frames) ? d[f * channels + channel] : 0.0;
+    }
+
+    g_mutex_unlock (&sounddata->data_mutex);
+
+    ok = TRUE;
+  }
+
+  g_mutex_unlock (&sample->ops_mutex);
+
+  return ok;
+}
+
+static gboolean
+spectrogram_compute (sw_spectrogram * sg, sw_sounddata * sounddata,
+		     sw_spec_tile * tile, guint8 * out, sw_spec_work * w)
+{
+  sw_framecount_t hop = (sw_framecount_t)SPECTROGRAM_MIN_HOP << tile->level;
+  sw_framecount_t col0 = tile->index * SPECTROGRAM_TILE_COLUMNS;
+  sw_framecount_t tile_end, wstart, step;
+  gint n, nr_bins, nr_windows, len, c, i, j, k, r, r0, r1;
+  sw_fft_plan * plan;
+  const gfloat * src;
+  gdouble sum = 0.0, norm, db;
+  gfloat p;
+
+  n = spectrogram_fft_size (tile->level);
+  nr_bins = n / 2;
+  step = MIN (hop, n / 2);
+  nr_windows = hop / step;
+  plan = sw_fft_plan_get (SW_FFT_REAL, n);
+
+  for (i = 0; i < n; i++) {
+    w->window[i] = 0.5 - 0.5 * cos (2.0 * M_PI * (i + 0.5) / n);
+    sum += w->window[i];
+  }
+
+  /* The power of a full scale sine's bin is (sum / 2)^2 */
+  norm = 4.0 / (sum * sum);
+
+  tile_end = (col0 + SPECTROGRAM_TILE_COLUMNS) * hop + n / 2;
+  w->frames_len = 0;
+
+  for (c = 0; c < SPECTROGRAM_TILE_COLUMNS; c++) {
+    if (g_atomic_int_get (&sg->closing)) return FALSE;
+
+    memset (w->power, 0, sizeof (w->power));
+
+    for (j = 0; j < nr_windows; j++) {
+      wstart = (col0 + c) * hop + j * step + step / 2 - n / 2;
+
+      if (wstart < w->frames_start ||
+	  wstart + n > w->frames_start + w->frames_len) {
+	len = CLAMP (tile_end - wstart, n, SPECTROGRAM_COPY_FRAMES);
+	if (!spectrogram_fill (sg, sounddata, tile->channel, wstart,
+			       w->frames, len))
+	  return FALSE;
+	w->frames_start = wstart;
+	w->frames_len = len;
+      }
+
+      src = w->frames + (wstart - w->frames_start);
+      for (i = 0; i < n; i++)
+	w->x[i] = src[i] * w->window[i];
+
+      sw_fft_real_forward (plan, w->x, w->re, w->im, w->work);
+
+      /* Keep the loudest bin under each row */
+      for (k = 0; k < nr_bins; k++) {
+	p = w->re[k] * w->re[k] + w->im[k] * w->im[k];
+	r0 = k * SPECTROGRAM_ROWS / nr_bins;
+	r1 = MAX (r0 + 1, (k + 1) * SPECTROGRAM_ROWS / nr_bins);
+	for (r = r0; r < r1; r++)
+	  if (p > w->power[r]) w->power[r] = p;
+      }
+    }
+
+    for (r = 0; r < SPECTROGRAM_ROWS; r++) {
+      db = 10.0 * log10 (w->power[r] * norm + 1e-30);
+      db = (db + SPECTROGRAM_DB_RANGE) * 255.0 / SPECTROGRAM_DB_RANGE;
+      out[c * SPECTROGRAM_ROWS + r] = (guint8)CLAMP (db, 0.0, 255.0);
+    }
+  }
+
+  return TRUE;
+}
+
+/* Take back a request for tile, popped from the queue. Call with mutex held */
+static void
+spectrogram_unqueue (sw_spectrogram * sg, sw_spec_tile * tile)
+{
+  if (tile->data != NULL) {
+    tile->state = TILE_READY;
+  } else {
+    g_hash_table_remove (sg->tiles, &tile->key);
+    g_free (tile);
+  }
+}
+
+static void
+spectrogram_drop_queue (sw_spectrogram * sg)
+{
+  sw_spec_tile * tile;
+
+  while ((tile = g_queue_pop_head (&sg->queue)) != NULL)
+    spectrogram_unqueue (sg, tile);
+}
+
+/* Drop the least recently drawn tiles over the limit. Call with mutex held */
+static void
+spectrogram_evict (sw_spectrogram * sg)
+{
+  GHashTableIter iter;
+  sw_spec_tile * tile, * oldest;
+
+  while (g_hash_table_size (sg->tiles) > SPECTROGRAM_CACHE_TILES) {
+    oldest = NULL;
+
+    g_hash_table_iter_init (&iter, sg->tiles);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tile)) {
+      if (tile->state != TILE_READY || tile->last_used == sg->serial)
+	continue;
+      if (oldest == NULL || tile->last_used < oldest->last_used)
+	oldest = tile;
+    }
+
+    if (oldest == NULL) break;
+
+    g_hash_table_remove (sg->tiles, &oldest->key);
+    g_free (oldest->data);
+    g_free (oldest);
+  }
+}
+
+/*
+ * One tile per job, so that an edit queued meanwhile gets the worker
+ * next. The job resubmits itself while there is more to do, keeping its
+ * slot in spectrogram_nr_jobs.
+ */
+static void
+spectrogram_job (gpointer data)
+{
+  sw_spectrogram * sg = (sw_spectrogram *)data;
+  sw_sounddata * sounddata;
+  sw_spec_tile * tile;
+  sw_spec_work w;
+  guint8 * out;
+  gboolean ok, last;
+
+  g_mutex_lock (&sg->mutex);
+
+  tile = sg->closing ? NULL : g_queue_pop_head (&sg->queue);
+
+  /*
+   * Tiles computed during an edit would only be stale when it is done,
+   * so leave the sample alone until then; the views are redrawn then,
+   * which queues whatever is still wanted. spectrogram_fill () keeps a
+   * tile that is already running safe from the edit itself.
+   */
+  if (tile != NULL && spectrogram_sample_busy (sg->sample)) {
+    g_queue_push_head (&sg->queue, tile);
+    spectrogram_drop_queue (sg);
+    tile = NULL;
+  }
+
+  if (tile != NULL) {
+    tile->state = TILE_BUSY;
+    tile->stale = FALSE;
+    sounddata = sg->sounddata;
+    sg->nr_running++;
+
+    g_mutex_unlock (&sg->mutex);
+
+    memset (&w, 0, sizeof (w));
+    w.frames = g_malloc (SPECTROGRAM_COPY_FRAMES * sizeof (gfloat));
+    w.window = g_malloc (SPECTROGRAM_MAX_FFT * sizeof (gfloat));
+    w.x = g_malloc (SPECTROGRAM_MAX_FFT * sizeof (gfloat));
+    w.re = g_malloc ((SPECTROGRAM_MAX_FFT/2 + 1) * sizeof (gfloat));
+    w.im = g_malloc ((SPECTROGRAM_MAX_FFT/2 + 1) * sizeof (gfloat));
+    w.work = g_malloc (4 * SPECTROGRAM_MAX_FFT * sizeof (gfloat));
+
+    out = g_malloc (TILE_BYTES);
+    ok = spectrogram_compute (sg, sounddata, tile, out, &w);
+
+    g_free (w.work);
+    g_free (w.im);
+    g_free (w.re);
+    g_free (w.x);
+    g_free (w.window);
+    g_free (w.frames);
+
+    g_mutex_lock (&sg->mutex);
+
+    if (ok && sounddata == sg->sounddata) {
+      g_free (tile->data);
+      tile->data = out;
+      tile->state = TILE_READY;
+      sg->nr_done++;
+      spectrogram_evict (sg);
+    } else {
+      g_free (out);
+      if (tile->data != NULL && sounddata == sg->sounddata) {
+	tile->state = TILE_READY;
+	tile->stale = TRUE;
+      } else {
+	g_hash_table_remove (sg->tiles, &tile->key);
+	g_free (tile->data);
+	g_free (tile);
+      }
+    }
+
+    sg->nr_running--;
+    g_cond_broadcast (&sg->idle_cond);
+
+    if (!sg->closing && !g_queue_is_empty (&sg->queue)) {
+      scheduler_submit ((SweepFunction)spectrogram_job, sg,
+			SCHED_PRIORITY_BACKGROUND);
+      g_mutex_unlock (&sg->mutex);
+      return;
+    }
+  }
+
+  sg->nr_jobs--;
+  g_atomic_int_add (&spectrogram_nr_jobs, -1);
+  last = sg->closing && sg->nr_jobs == 0;
+
+  g_mutex_unlock (&sg->mutex);
+
+  if (last) spectrogram_destroy (sg);
+}
+
+/*
+ * GUI side
+ */
+
+static gboolean
+spectrogram_poll (gpointer data)
+{
+  sw_spectrogram * sg = (sw_spectrogram *)data;
+  gboolean changed, running;
+  GList * gl;
+  sw_view * v;
+
+  g_mutex_lock (&sg->mutex);
+
+  changed = (sg->nr_done != sg->last_done);
+  sg->last_done = sg->nr_done;
+
+  running = (sg->nr_jobs > 0);
+  if (!running) sg->poll_tag = 0;
+
+  g_mutex_unlock (&sg->mutex);
+
+  if (changed) {
+    for (gl = sg->sample->views; gl; gl = gl->next) {
+      v = (sw_view *)gl->data;
+      if (v->spectrogram)
+	sample_display_refresh (SAMPLE_DISPLAY(v->display));
+    }
+  }
+
+  return running;
+}
+
+/* Start enough jobs for the queue. Call with mutex held */
+static void
+spectrogram_kick (sw_spectrogram * sg)
+{
+  sw_sched_stats stats;
+  gint max_jobs, nr_jobs;
+
+  if (g_queue_is_empty (&sg->queue)) return;
+
+  /* Leave a worker free for edits, counting every sample's jobs */
+  scheduler_get_stats (&stats);
+  max_jobs = stats.nr_workers - 1;
+
+  if (max_jobs < 1) {
+    if (!sg->warned) {
+      sample_set_tmp_message (sg->sample,
+			      _("Spectrogram needs more than one "
+				"operation worker"));
+      sg->warned = TRUE;
+    }
+    spectrogram_drop_queue (sg);
+    return;
+  }
+
+  while (sg->nr_jobs < (gint)g_queue_get_length (&sg->queue)) {
+    nr_jobs = g_atomic_int_get (&spectrogram_nr_jobs);
+    if (nr_jobs >= max_jobs) break;
+    if (!g_atomic_int_compare_and_exchange (&spectrogram_nr_jobs,
+					    nr_jobs, nr_jobs + 1))
+      continue;
+
+    sg->nr_jobs++;
+    scheduler_submit ((SweepFunction)spectrogram_job, sg,
+		      SCHED_PRIORITY_BACKGROUND);
+  }
+
+  if (sg->nr_jobs > 0 && sg->poll_tag == 0) {
+    sg->poll_tag = g_timeout_add (SPECTROGRAM_POLL_INTERVAL,
+				  spectrogram_poll, sg);
+  }
+}
+
+/* Forget all tiles, for new sounddata. Call with mutex held */
+static void
+spectrogram_flush (sw_spectrogram * sg, sw_sounddata * sounddata)
+{
+  GHashTableIter iter;
+  sw_spec_tile * tile;
+
+  g_hash_table_iter_init (&iter, sg->tiles);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tile)) {
+    /* Busy tiles are dropped by their job when it finishes */
+    if (tile->state == TILE_BUSY) continue;
+
+    g_hash_table_iter_remove (&iter);
+    g_free (tile->data);
+    g_free (tile);
+  }
+
+  g_queue_clear (&sg->queue);
+
+  sg->sounddata = sounddata;
+}
+
+/*
+ * Find a tile, if request is set queueing it to be computed if it is
+ * missing or stale. Call with mutex held.
+ */
+static sw_spec_tile *
+spectrogram_lookup (sw_spectrogram * sg, gint level, gint channel,
+		    sw_framecount_t index, gboolean request)
+{
+  sw_spec_tile * tile;
+  gint64 key = TILE_KEY (level, channel, index);
+
+  tile = g_hash_table_lookup (sg->tiles, &key);
+
+  if (request && !sg->hold) {
+    if (tile == NULL) {
+      tile = g_malloc0 (sizeof (sw_spec_tile));
+      tile->key = key;
+      tile->level = level;
+      tile->channel = channel;
+      tile->index = index;
+      tile->state = TILE_QUEUED;
+      g_hash_table_insert (sg->tiles, &tile->key, tile);
+      g_queue_push_head (&sg->queue, tile);
+    } else if (tile->last_used != sg->serial) {
+      if (tile->state == TILE_QUEUED) {
+	g_queue_remove (&sg->queue, tile);
+	g_queue_push_head (&sg->queue, tile);
+      } else if (tile->state == TILE_READY && tile->stale) {
+	tile->state = TILE_QUEUED;
+	g_queue_push_head (&sg->queue, tile);
+      }
+    }
+
+    while (g_queue_get_length (&sg->queue) > SPECTROGRAM_MAX_QUEUED)
+      spectrogram_unqueue (sg, g_queue_pop_tail (&sg->queue));
+  }
+
+  if (tile != NULL) tile->last_used = sg->serial;
+
+  return tile;
+}
+
+static const guint8 *
+spectrogram_column (sw_spectrogram * sg, gint level, gint channel,
+		    sw_framecount_t column, gboolean request)
+{
+  sw_spec_tile * tile;
+
+  if (column < 0) return NULL;
+
+  tile = spectrogram_lookup (sg, level, channel,
+			     column / SPECTROGRAM_TILE_COLUMNS, request);
+  if (tile == NULL || tile->data == NULL) return NULL;
+
+  return tile->data + (column % SPECTROGRAM_TILE_COLUMNS) * SPECTROGRAM_ROWS;
+}
+
+/* The column over frame at the nearest level that has one ready */
+static const guint8 *
+spectrogram_fallback (sw_spectrogram * sg, gint level, gint channel,
+		      gdouble frame)
+{
+  const guint8 * d;
+  gint i, l;
+
+  for (i = 1; i < SPECTROGRAM_LEVELS; i++) {
+    l = level + i;
+    if (l < SPECTROGRAM_LEVELS) {
+      d = spectrogram_column (sg, l, channel,
+			      (sw_framecount_t)(frame / (SPECTROGRAM_MIN_HOP << l)),
+			      FALSE);
+      if (d != NULL) return d;
+    }
+
+    l = level - i;
+    if (l >= 0) {
+      d = spectrogram_column (sg, l, channel,
+			      (sw_framecount_t)(frame / (SPECTROGRAM_MIN_HOP << l)),
+			      FALSE);
+      if (d != NULL) return d;
+    }
+  }
+
+  return NULL;
+}
+
+static sw_spectrogram *
+spectrogram_get (sw_sample * sample)
+{
+  sw_spectrogram * sg = sample->spectrogram;
+
+  if (sg != NULL) return sg;
+
+  sg = g_malloc0 (sizeof (sw_spectrogram));
+  sg->sample = sample;
+  g_mutex_init (&sg->mutex);
+  g_cond_init (&sg->idle_cond);
+  sg->tiles = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_queue_init (&sg->queue);
+  sg->sounddata = sample->sounddata;
+
+  g_atomic_pointer_set (&sample->spectrogram, sg);
+
+  return sg;
+}
+
+void
+spectrogram_render (sw_sample * sample, gint channel, gdouble start,
+		    gdouble frames_per_pixel, gint width, gint height,
+		    guchar * rgb, gint rowstride)
+{
+  sw_spectrogram * sg;
+  sw_framecount_t hop, c, c0, c1;
+  guint8 col[SPECTROGRAM_ROWS];
+  const guint8 * d;
+  guchar * p;
+  gdouble f0, f1;
+  gint level = 0, x, y, r, r0, r1;
+  guint8 v;
+
+  if (!palette_ready) spectrogram_init_palette ();
+
+  sg = spectrogram_get (sample);
+
+  g_mutex_lock (&sg->mutex);
+
+  if (sg->sounddata != sample->sounddata)
+    spectrogram_flush (sg, sample->sounddata);
+
+  sg->serial++;
+  sg->hold = spectrogram_sample_busy (sample);
+
+  /* The widest columns that are still no wider than a pixel */
+  while (level + 1 < SPECTROGRAM_LEVELS &&
+	 (SPECTROGRAM_MIN_HOP << (level + 1)) <= frames_per_pixel)
+    level++;
+  hop = (sw_framecount_t)SPECTROGRAM_MIN_HOP << level;
+
+  for (x = 0; x < width; x++) {
+    f0 = start + x * frames_per_pixel;
+    f1 = f0 + frames_per_pixel;
+    c0 = (sw_framecount_t)floor (f0 / hop);
+    c1 = MAX (c0, (sw_framecount_t)ceil (f1 / hop) - 1);
+
+    memset (col, 0, sizeof (col));
+
+    for (c = c0; c <= c1 && channel < 256; c++) {
+      d = spectrogram_column (sg, level, channel, c, TRUE);
+      if (d == NULL)
+	d = spectrogram_fallback (sg, level, channel, (gdouble)c * hop);
+      if (d == NULL) continue;
+
+      for (r = 0; r < SPECTROGRAM_ROWS; r++)
+	if (d[r] > col[r]) col[r] = d[r];
+    }
+
+    for (y = 0; y < height; y++) {
+      r0 = (height - 1 - y) * SPECTROGRAM_ROWS / height;
+      r1 = MAX (r0 + 1, (height - y) * SPECTROGRAM_ROWS / height);
+
+      for (v = 0, r = r0; r < r1; r++)
+	if (col[r] > v) v = col[r];
+
+      p = rgb + y * rowstride + x * 3;
+      p[0] = palette[v][0];
+      p[1] = palette[v][1];
+      p[2] = palette[v][2];
+    }
+  }
+
+  spectrogram_kick (sg);
+
+  g_mutex_unlock (&sg->mutex);
+}
+
+void
+spectrogram_invalidate (sw_sample * sample, sw_framecount_t start,
+			sw_framecount_t end)
+{
+  sw_spectrogram * sg = g_atomic_pointer_get (&sample->spectrogram);
+  GHashTableIter iter;
+  sw_spec_tile * tile;
+  sw_framecount_t hop, span, t0, t1;
+  gint n;
+
+  if (sg == NULL || end <= start) return;
+
+  g_mutex_lock (&sg->mutex);
+
+  g_hash_table_iter_init (&iter, sg->tiles);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tile)) {
+    hop = (sw_framecount_t)SPECTROGRAM_MIN_HOP << tile->level;
+    span = hop * SPECTROGRAM_TILE_COLUMNS;
+    n = spectrogram_fft_size (tile->level);
+
+    t0 = tile->index * span - n/2;
+    t1 = (tile->index + 1) * span + n/2;
+
+    if (t0 < end && t1 > start)
+      tile->stale = TRUE;
+  }
+
+  g_mutex_unlock (&sg->mutex);
+
+#ifdef DEBUG
+  g_print ("spectrogram: invalidated %" G_GINT64_FORMAT " to %"
+	   G_GINT64_FORMAT "\n", (gint64)start, (gint64)end);
+#endif
+}
+
+void
+spectrogram_free (sw_sample * sample)
+{
+  sw_spectrogram * sg = sample->spectrogram;
+  gboolean last;
+
+  if (sg == NULL) return;
+
+  g_atomic_pointer_set (&sample->spectrogram, NULL);
+
+  if (sg->poll_tag != 0) g_source_remove (sg->poll_tag);
+
+  g_mutex_lock (&sg->mutex);
+
+  sg->closing = TRUE;
+  g_queue_clear (&sg->queue);
+
+  /*
+   * Jobs still waiting for a worker will find the cache closing and let
+   * it go themselves, but running jobs are reading the sample.
+   */
+  while (sg->nr_running > 0)
+    g_cond_wait (&sg->idle_cond, &sg->mutex);
+
+  last = (sg->nr_jobs == 0);
+
+  g_mutex_unlock (&sg->mutex);
+
+  if (last) spectrogram_destroy (sg);
+}
@@ -0,0 +1,83 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SPECTROGRAM_H__
+#define __SPECTROGRAM_H__
+
+#include <glib.h>
+
+#include <sweep/sweep_types.h>
+
+#include "sweep_app.h"
+
+/*
+ * Spectrogram tiles.
+ *
+ * Each sample with a view in spectrogram mode keeps a cache of STFT
+ * magnitudes, cut into tiles of SPECTROGRAM_TILE_COLUMNS columns by
+ * SPECTROGRAM_ROWS rows of one channel. Tiles come in levels: a column
+ * at level L summarises SPECTROGRAM_MIN_HOP << L frames, and the FFT
+ * gets longer as the columns get wider, trading time resolution for
+ * frequency resolution as the view zooms out. Where a column is wider
+ * than the FFT, each row holds the loudest of the transforms across
+ * it, so that a single click still shows when zoomed all the way out.
+ *
+ * Tiles are computed one at a time by background jobs on the scheduler,
+ * which between all samples never take the last free worker; with a
+ * single worker there is no spectrogram at all. Drawing uses
+ * whatever tiles are ready, falling back to neighbouring levels while
+ * the right ones are made, and redraws the sample's views as they
+ * arrive. Edits mark the tiles over the frames they change as stale;
+ * stale tiles are still drawn until they have been recomputed.
+ */
+
+#define SPECTROGRAM_ROWS 256
+#define SPECTROGRAM_TILE_COLUMNS 256
+#define SPECTROGRAM_MIN_HOP 16
+#define SPECTROGRAM_LEVELS 20
+
+/* Range of magnitudes shown, in dB below a full scale sine */
+#define SPECTROGRAM_DB_RANGE 120.0
+
+/*
+ * GUI thread: draw width columns of channel, the first starting at
+ * frame start and each frames_per_pixel long, into rgb (3 bytes per
+ * pixel, rows rowstride bytes apart, highest frequency first). Columns
+ * with no tile ready at any level are left black. Queues computation of
+ * any tiles that are missing or stale, unless an edit is running.
+ */
+void
+spectrogram_render (sw_sample * sample, gint channel, gdouble start,
+		    gdouble frames_per_pixel, gint width, gint height,
+		    guchar * rgb, gint rowstride);
+
+/*
+ * Any thread: mark tiles over frames [start, end) of sample as stale.
+ * Edits that change the length of the data invalidate up to G_MAXINT64.
+ */
+void
+spectrogram_invalidate (sw_sample * sample, sw_framecount_t start,
+			sw_framecount_t end);
+
+/* GUI thread: drop the sample's tiles, waiting for any running jobs */
+void
+spectrogram_free (sw_sample * sample);
+
+#endif /* __SPECTROGRAM_H__ */
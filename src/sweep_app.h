@@ -32,6 +32,7 @@ struct _sw_perform_data {
   SweepFunction func;
   sw_param_set pset;
   gpointer custom_data;
+  SweepFunction destroy; /* frees custom_data, or NULL */
 };
 
 /* Tools */
@@ -86,6 +87,7 @@ struct _sw_view {
   gint repeater_tag;
 
   gboolean following; /* whether or not to follow playmarker */
+  gboolean spectrogram; /* draw spectrograms instead of waveforms */
 
   gint hand_offset;
 
@@ -116,6 +118,7 @@ struct _sw_view {
   GList * channelops_widgets;
 
   GtkWidget * follow_checkmenu;
+  GtkWidget * spectrogram_checkmenu;
   GtkWidget * color_menuitems[VIEW_COLOR_MAX];
   GtkWidget * loop_checkmenu;
   GtkWidget * playrev_checkmenu;
@@ -157,6 +160,9 @@ struct _sw_head_controller {
   GtkObject * gain_adj;
 };
 
+typedef struct _sw_prefetch sw_prefetch;
+typedef struct _sw_interp sw_interp;
+
 struct _sw_head {
   sw_sample * sample;
 
@@ -175,6 +181,7 @@ struct _sw_head {
   gboolean monitor;
   gfloat delta; /* current motion delta */
   gfloat gain;
+  gfloat ramp_gain; /* gain the mixer applied at the end of its last block */
   gfloat rate;
   gfloat mix; /* record mixing level */
 
@@ -183,6 +190,14 @@ struct _sw_head {
 
   gint repeater_tag;
   GList * controllers;
+
+  sw_prefetch * prefetch; /* read-ahead for playback, see prefetch.c */
+  sw_interp * interp; /* playback interpolator, see interp.c */
+  struct _sw_mixmap * routing; /* channel routing, or NULL for default */
+
+  GMutex insert_mutex;
+  struct _sw_insert * insert; /* realtime effect, or NULL; see insert.c */
+  volatile gint discontinuous; /* offset jumped; the insert is flushed */
 };
 
 typedef enum {
@@ -197,6 +212,8 @@ typedef enum {
  * sw_sample
  */
 struct _sw_sample {
+  volatile gint refcount;
+
   sw_sounddata * sounddata;
   GList * views;
 
@@ -215,7 +232,8 @@ struct _sw_sample {
 
   /* Operations; lock on scheduling */
 
-  pthread_t ops_thread;
+  pthread_t ops_thread; /* worker currently running an op, or -1 */
+  gboolean ops_queued; /* waiting in the scheduler for a worker */
 
   GMutex ops_mutex;
   GList * registered_ops;
@@ -258,6 +276,8 @@ struct _sw_sample {
   gchar last_tmp_message [512];
   gint tmp_message_tag;
   gint progress_ready_tag;
+
+  struct _sw_spectrogram * spectrogram; /* STFT tile cache, see spectrogram.c */
 };
 
 void
@@ -0,0 +1,563 @@
+/*
+ * Sweep, a sound wave editor.
+ *
+ * Copyright (C) 2000 Conrad Parker
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Mixed radix Stockham FFT.
+ *
+ * Each stage reads one buffer and writes the other, so no bit reversal
+ * pass is needed, and the innermost loop of every kernel runs over
+ * contiguous floats in both buffers, which the compiler can vectorize.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include <sweep/sweep_fft.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct _sw_fft_stage sw_fft_stage;
+
+struct _sw_fft_stage {
+  gint radix;
+  gint m;          /* length of the sub-transforms, ie. n_stage / radix */
+  gint s;          /* stride: number of sub-transforms done side by side */
+  gfloat * tw_re;  /* m * (radix - 1) forward twiddles */
+  gfloat * tw_im;
+  gfloat * root_re; /* radix forward roots, for the direct kernel */
+  gfloat * root_im;
+};
+
+struct _sw_fft_plan {
+  sw_fft_type type;
+  gint n;
+
+  /* Complex plans */
+  gint nr_stages;
+  sw_fft_stage * stages;
+
+  /* Real plans: a complex plan of n/2 and n/2+1 forward twiddles */
+  sw_fft_plan * half;
+  gfloat * split_re;
+  gfloat * split_im;
+};
+
+static GMutex fft_mutex;
+static GHashTable * fft_plans = NULL;
+
+static void
+fft_radix2 (sw_fft_stage * st, gint sign,
+	    const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	    gfloat * __restrict__ yr, gfloat * __restrict__ yi)
+{
+  gint m = st->m, s = st->s, p, q;
+  gfloat conj = (gfloat)-sign;
+
+  for (p = 0; p < m; p++) {
+    const gfloat wr = st->tw_re[p], wi = conj * st->tw_im[p];
+    const gfloat * x0r = xr + s*p, * x0i = xi + s*p;
+    const gfloat * x1r = xr + s*(p+m), * x1i = xi + s*(p+m);
+    gfloat * y0r = yr + s*2*p, * y0i = yi + s*2*p;
+    gfloat * y1r = y0r + s, * y1i = y0i + s;
+
+    for (q = 0; q < s; q++) {
+      gfloat dr = x0r[q] - x1r[q], di = x0i[q] - x1i[q];
+      y0r[q] = x0r[q] + x1r[q];
+      y0i[q] = x0i[q] + x1i[q];
+      y1r[q] = dr*wr - di*wi;
+      y1i[q] = dr*wi + di*wr;
+    }
+  }
+}
+
+static void
+fft_radix3 (sw_fft_stage * st, gint sign,
+	    const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	    gfloat * __restrict__ yr, gfloat * __restrict__ yi)
+{
+  gint m = st->m, s = st->s, p, q;
+  gfloat conj = (gfloat)-sign;
+  const gfloat c = -0.5f, sn = (gfloat)sign * 0.86602540378443865f;
+
+  for (p = 0; p < m; p++) {
+    const gfloat w1r = st->tw_re[2*p], w1i = conj * st->tw_im[2*p];
+    const gfloat w2r = st->tw_re[2*p+1], w2i = conj * st->tw_im[2*p+1];
+    const gfloat * x0r = xr + s*p, * x0i = xi + s*p;
+    const gfloat * x1r = xr + s*(p+m), * x1i = xi + s*(p+m);
+    const gfloat * x2r = xr + s*(p+2*m), * x2i = xi + s*(p+2*m);
+    gfloat * y0r = yr + s*3*p, * y0i = yi + s*3*p;
+
+    for (q = 0; q < s; q++) {
+      gfloat br = x1r[q] + x2r[q], bi = x1i[q] + x2i[q];
+      gfloat tr = x0r[q] + c*br, ti = x0i[q] + c*bi;
+      gfloat ur = sn * (x1r[q] - x2r[q]), ui = sn * (x1i[q] - x2i[q]);
+      gfloat ar, ai;
+
+      y0r[q] = x0r[q] + br;
+      y0i[q] = x0i[q] + bi;
+
+      /* X1 = t + iu, X2 = t - iu */
+      ar = tr - ui; ai = ti + ur;
+      y0r[s+q] = ar*w1r - ai*w1i;
+      y0i[s+q] = ar*w1i + ai*w1r;
+
+      ar = tr + ui; ai = ti - ur;
+      y0r[2*s+q] = ar*w2r - ai*w2i;
+      y0i[2*s+q] = ar*w2i + ai*w2r;
+    }
+  }
+}
+
+static void
+fft_radix4 (sw_fft_stage * st, gint sign,
+	    const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	    gfloat * __restrict__ yr, gfloat * __restrict__ yi)
+{
+  gint m = st->m, s = st->s, p, q;
+  gfloat conj = (gfloat)-sign;
+  const gfloat sg = (gfloat)sign;
+
+  for (p = 0; p < m; p++) {
+    const gfloat w1r = st->tw_re[3*p], w1i = conj * st->tw_im[3*p];
+    const gfloat w2r = st->tw_re[3*p+1], w2i = conj * st->tw_im[3*p+1];
+    const gfloat w3r = st->tw_re[3*p+2], w3i = conj * st->tw_im[3*p+2];
+    const gfloat * x0r = xr + s*p, * x0i = xi + s*p;
+    const gfloat * x1r = xr + s*(p+m), * x1i = xi + s*(p+m);
+    const gfloat * x2r = xr + s*(p+2*m), * x2i = xi + s*(p+2*m);
+    const gfloat * x3r = xr + s*(p+3*m), * x3i = xi + s*(p+3*m);
+    gfloat * y0r = yr + s*4*p, * y0i = yi + s*4*p;
+
+    for (q = 0; q < s; q++) {
+      gfloat t0r = x0r[q] + x2r[q], t0i = x0i[q] + x2i[q];
+      gfloat t1r = x0r[q] - x2r[q], t1i = x0i[q] - x2i[q];
+      gfloat t2r = x1r[q] + x3r[q], t2i = x1i[q] + x3i[q];
+      /* t3 = i * sign * (x1 - x3) */
+      gfloat t3r = -sg * (x1i[q] - x3i[q]), t3i = sg * (x1r[q] - x3r[q]);
+      gfloat ar, ai;
+
+      y0r[q] = t0r + t2r;
+      y0i[q] = t0i + t2i;
+
+      ar = t1r + t3r; ai = t1i + t3i;
+      y0r[s+q] = ar*w1r - ai*w1i;
+      y0i[s+q] = ar*w1i + ai*w1r;
+
+      ar = t0r - t2r; ai = t0i - t2i;
+      y0r[2*s+q] = ar*w2r - ai*w2i;
+      y0i[2*s+q] = ar*w2i + ai*w2r;
+
+      ar = t1r - t3r; ai = t1i - t3i;
+      y0r[3*s+q] = ar*w3r - ai*w3i;
+      y0i[3*s+q] = ar*w3i + ai*w3r;
+    }
+  }
+}
+
+static void
+fft_radix5 (sw_fft_stage * st, gint sign,
+	    const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	    gfloat * __restrict__ yr, gfloat * __restrict__ yi)
+{
+  gint m = st->m, s = st->s, p, q, k;
+  gfloat conj = (gfloat)-sign;
+  const gfloat c1 = 0.30901699437494742f, c2 = -0.80901699437494742f;
+  const gfloat s1 = (gfloat)sign * 0.95105651629515357f;
+  const gfloat s2 = (gfloat)sign * 0.58778525229247313f;
+
+  for (p = 0; p < m; p++) {
+    gfloat wr[4], wi[4];
+    const gfloat * x0r = xr + s*p, * x0i = xi + s*p;
+    const gfloat * x1r = xr + s*(p+m), * x1i = xi + s*(p+m);
+    const gfloat * x2r = xr + s*(p+2*m), * x2i = xi + s*(p+2*m);
+    const gfloat * x3r = xr + s*(p+3*m), * x3i = xi + s*(p+3*m);
+    const gfloat * x4r = xr + s*(p+4*m), * x4i = xi + s*(p+4*m);
+    gfloat * y0r = yr + s*5*p, * y0i = yi + s*5*p;
+
+    for (k = 0; k < 4; k++) {
+      wr[k] = st->tw_re[4*p+k];
+      wi[k] = conj * st->tw_im[4*p+k];
+    }
+
+    for (q = 0; q < s; q++) {
+      gfloat b1r = x1r[q] + x4r[q], b1i = x1i[q] + x4i[q];
+      gfloat b2r = x2r[q] + x3r[q], b2i = x2i[q] + x3i[q];
+      gfloat d1r = x1r[q] - x4r[q], d1i = x1i[q] - x4i[q];
+      gfloat d2r = x2r[q] - x3r[q], d2i = x2i[q] - x3i[q];
+      gfloat t1r = x0r[q] + c1*b1r + c2*b2r, t1i = x0i[q] + c1*b1i + c2*b2i;
+      gfloat t2r = x0r[q] + c2*b1r + c1*b2r, t2i = x0i[q] + c2*b1i + c1*b2i;
+      gfloat u1r = s1*d1r + s2*d2r, u1i = s1*d1i + s2*d2i;
+      gfloat u2r = s2*d1r - s1*d2r, u2i = s2*d1i - s1*d2i;
+      gfloat ar, ai;
+
+      y0r[q] = x0r[q] + b1r + b2r;
+      y0i[q] = x0i[q] + b1i + b2i;
+
+      /* X1 = t1 + iu1, X4 = t1 - iu1, X2 = t2 + iu2, X3 = t2 - iu2 */
+      ar = t1r - u1i; ai = t1i + u1r;
+      y0r[s+q] = ar*wr[0] - ai*wi[0];
+      y0i[s+q] = ar*wi[0] + ai*wr[0];
+
+      ar = t2r - u2i; ai = t2i + u2r;
+      y0r[2*s+q] = ar*wr[1] - ai*wi[1];
+      y0i[2*s+q] = ar*wi[1] + ai*wr[1];
+
+      ar = t2r + u2i; ai = t2i - u2r;
+      y0r[3*s+q] = ar*wr[2] - ai*wi[2];
+      y0i[3*s+q] = ar*wi[2] + ai*wr[2];
+
+      ar = t1r + u1i; ai = t1i - u1r;
+      y0r[4*s+q] = ar*wr[3] - ai*wi[3];
+      y0i[4*s+q] = ar*wi[3] + ai*wr[3];
+    }
+  }
+}
+
+/* Direct DFT of any radix, for the prime factors left over */
+static void
+fft_radix_any (sw_fft_stage * st, gint sign,
+	       const gfloat * __restrict__ xr, const gfloat * __restrict__ xi,
+	       gfloat * __restrict__ yr, gfloat * __restrict__ yi)
+{
+  gint r = st->radix, m = st->m, s = st->s, p, q, j, k;
+  gfloat conj = (gfloat)-sign;
+
+  for (p = 0; p < m; p++) {
+    for (k = 0; k < r; k++) {
+      gfloat wr = 1.0f, wi = 0.0f;
+      gfloat * ykr = yr + s*(r*p + k), * yki = yi + s*(r*p + k);
+
+      if (k > 0) {
+	wr = st->tw_re[(r-1)*p + k-1];
+	wi = conj * st->tw_im[(r-1)*p + k-1];
+      }
+
+      for (q = 0; q < s; q++) {
+	ykr[q] = xr[s*p + q];
+	yki[q] = xi[s*p + q];
+      }
+
+      for (j = 1; j < r; j++) {
+	gint jk = (gint)(((gint64)j * k) % r);
+	gfloat rr = st->root_re[jk], ri = conj * st->root_im[jk];
+	const gfloat * xjr = xr + s*(p + j*m), * xji = xi + s*(p + j*m);
+
+	for (q = 0; q < s; q++) {
+	  ykr[q] += xjr[q]*rr - xji[q]*ri;
+	  yki[q] += xjr[q]*ri + xji[q]*rr;
+	}
+      }
+
+      if (k > 0) {
+	for (q = 0; q < s; q++) {
+	  gfloat ar = ykr[q], ai = yki[q];
+	  ykr[q] = ar*wr - ai*wi;
+	  yki[q] = ar*wi + ai*wr;
+	}
+      }
+    }
+  }
+}
+
+static void
+fft_stage_run (sw_fft_stage * st, gint sign,
+	       const gfloat * xr, const gfloat * xi, gfloat * yr, gfloat * yi)
+{
+  switch (st->radix) {
+  case 2: fft_radix2 (st, sign, xr, xi, yr, yi); break;
+  case 3: fft_radix3 (st, sign, xr, xi, yr, yi); break;
+  case 4: fft_radix4 (st, sign, xr, xi, yr, yi); break;
+  case 5: fft_radix5 (st, sign, xr, xi, yr, yi); break;
+  default: fft_radix_any (st, sign, xr, xi, yr, yi); break;
+  }
+}
+
+static gint
+fft_next_radix (gint n)
+{
+  gint r;
+
+  if (n % 4 == 0) return 4;
+  if (n % 2 == 0) return 2;
+  if (n % 3 == 0) return 3;
+  if (n % 5 == 0) return 5;
+
+  for (r = 7; (gint64)r * r <= n; r += 2)
+    if (n % r == 0) return r;
+
+  return n;
+}
+
+static sw_fft_plan *
+fft_plan_lookup (sw_fft_type type, gint n);
+
+static sw_fft_plan *
+fft_complex_plan_new (gint n)
+{
+  sw_fft_plan * plan;
+  sw_fft_stage * st;
+  gint nr_stages = 0, len, s, r, p, k;
+
+  for (len = n; len > 1; len /= fft_next_radix (len))
+    nr_stages++;
+
+  plan = g_malloc0 (sizeof (sw_fft_plan));
+  plan->type = SW_FFT_COMPLEX;
+  plan->n = n;
+  plan->nr_stages = nr_stages;
+  plan->stages = g_malloc0 (MAX (nr_stages, 1) * sizeof (sw_fft_stage));
+
+  for (len = n, s = 1, st = plan->stages; len > 1; len /= r, s *= r, st++) {
+    r = fft_next_radix (len);
+    st->radix = r;
+    st->m = len / r;
+    st->s = s;
+
+    st->tw_re = g_malloc (st->m * (r-1) * sizeof (gfloat));
+    st->tw_im = g_malloc (st->m * (r-1) * sizeof (gfloat));
+    for (p = 0; p < st->m; p++) {
+      for (k = 1; k < r; k++) {
+	gdouble a = -2.0 * M_PI * (gdouble)p * k / len;
+	st->tw_re[(r-1)*p + k-1] = (gfloat)cos (a);
+	st->tw_im[(r-1)*p + k-1] = (gfloat)sin (a);
+      }
+    }
+
+    if (r > 5) {
+      st->root_re = g_malloc (r * sizeof (gfloat));
+      st->root_im = g_malloc (r * sizeof (gfloat));
+      for (k = 0; k < r; k++) {
+	st->root_re[k] = (gfloat)cos (-2.0 * M_PI * k / r);
+	st->root_im[k] = (gfloat)sin (-2.0 * M_PI * k / r);
+      }
+    }
+  }
+
+  return plan;
+}
+
+static sw_fft_plan *
+fft_real_plan_new (gint n)
+{
+  sw_fft_plan * plan;
+  gint h = n / 2, k;
+
+  plan = g_malloc0 (sizeof (sw_fft_plan));
+  plan->type = SW_FFT_REAL;
+  plan->n = n;
+  plan->half = fft_plan_lookup (SW_FFT_COMPLEX, h);
+
+  plan->split_re = g_malloc ((h + 1) * sizeof (gfloat));
+  plan->split_im = g_malloc ((h + 1) * sizeof (gfloat));
+  for (k = 0; k <= h; k++) {
+    plan->split_re[k] = (gfloat)cos (-2.0 * M_PI * k / n);
+    plan->split_im[k] = (gfloat)sin (-2.0 * M_PI * k / n);
+  }
+
+  return plan;
+}
+
+/* Called with fft_mutex held */
+static sw_fft_plan *
+fft_plan_lookup (sw_fft_type type, gint n)
+{
+  sw_fft_plan * plan;
+  gpointer key = GINT_TO_POINTER (n * 2 + (type == SW_FFT_REAL));
+
+  if (fft_plans == NULL)
+    fft_plans = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  plan = g_hash_table_lookup (fft_plans, key);
+  if (plan == NULL) {
+    plan = (type == SW_FFT_REAL) ? fft_real_plan_new (n) :
+      fft_complex_plan_new (n);
+    g_hash_table_insert (fft_plans, key, plan);
+  }
+
+  return plan;
+}
+
+sw_fft_plan *
+sw_fft_plan_get (sw_fft_type type, gint n)
+{
+  sw_fft_plan * plan;
+
+  if (n < 1 || n > G_MAXINT / 8) return NULL;
+  if (type == SW_FFT_REAL && n % 2 != 0) return NULL;
+
+  g_mutex_lock (&fft_mutex);
+  plan = fft_plan_lookup (type, n);
+  g_mutex_unlock (&fft_mutex);
+
+  return plan;
+}
+
+gint
+sw_fft_length (sw_fft_plan * plan)
+{
+  return plan->n;
+}
+
+gint
+sw_fft_work_size (sw_fft_plan * plan)
+{
+  return 4 * plan->n;
+}
+
+static void
+fft_complex_run (sw_fft_plan * plan, gint sign,
+		 const gfloat * in_re, const gfloat * in_im,
+		 gfloat * out_re, gfloat * out_im, gfloat * work)
+{
+  gint n = plan->n, i;
+  const gfloat * xr = in_re, * xi = in_im;
+  gfloat * yr, * yi;
+
+  if (plan->nr_stages == 0) {
+    if (out_re != in_re) memmove (out_re, in_re, n * sizeof (gfloat));
+    if (out_im != in_im) memmove (out_im, in_im, n * sizeof (gfloat));
+    return;
+  }
+
+  /*
+   * Stages alternate between the output and work, arranged so that the
+   * last one lands in the output. If the first would also write to the
+   * output, and that is the input, run it from a copy instead.
+   */
+  if (plan->nr_stages % 2 == 1 && (in_re == out_re || in_im == out_im)) {
+    memcpy (work + 2*n, in_re, n * sizeof (gfloat));
+    memcpy (work + 3*n, in_im, n * sizeof (gfloat));
+    xr = work + 2*n;
+    xi = work + 3*n;
+  }
+
+  for (i = 0; i < plan->nr_stages; i++) {
+    if ((plan->nr_stages - 1 - i) % 2 == 0) {
+      yr = out_re; yi = out_im;
+    } else {
+      yr = work; yi = work + n;
+    }
+    fft_stage_run (&plan->stages[i], sign, xr, xi, yr, yi);
+    xr = yr; xi = yi;
+  }
+}
+
+void
+sw_fft_complex (sw_fft_plan * plan, gint sign,
+		const gfloat * in_re, const gfloat * in_im,
+		gfloat * out_re, gfloat * out_im, gfloat * work)
+{
+  gfloat * w = work;
+
+  g_return_if_fail (plan != NULL && plan->type == SW_FFT_COMPLEX);
+
+  if (w == NULL) w = g_malloc (sw_fft_work_size (plan) * sizeof (gfloat));
+
+  fft_complex_run (plan, sign, in_re, in_im, out_re, out_im, w);
+
+  if (work == NULL) g_free (w);
+}
+
+/*
+ * Real transforms of length n run as a complex transform of length n/2
+ * over the even and odd samples packed as z = x[2k] + i x[2k+1], then
+ * split into the spectra of the two halves and recombined.
+ *
+ * Work layout: z (n floats), Z (n floats), then the complex work.
+ */
+void
+sw_fft_real_forward (sw_fft_plan * plan, const gfloat * in,
+		     gfloat * out_re, gfloat * out_im, gfloat * work)
+{
+  gint h, k;
+  gfloat * w = work, * zr, * zi, * Zr, * Zi;
+
+  g_return_if_fail (plan != NULL && plan->type == SW_FFT_REAL);
+
+  if (w == NULL) w = g_malloc (sw_fft_work_size (plan) * sizeof (gfloat));
+
+  h = plan->n / 2;
+  zr = w; zi = w + h; Zr = w + 2*h; Zi = w + 3*h;
+
+  for (k = 0; k < h; k++) {
+    zr[k] = in[2*k];
+    zi[k] = in[2*k+1];
+  }
+
+  fft_complex_run (plan->half, SW_FFT_FORWARD, zr, zi, Zr, Zi, w + 4*h);
+
+  out_re[0] = Zr[0] + Zi[0];
+  out_im[0] = 0.0f;
+  out_re[h] = Zr[0] - Zi[0];
+  out_im[h] = 0.0f;
+
+  for (k = 1; k < h; k++) {
+    gfloat er = 0.5f * (Zr[k] + Zr[h-k]), ei = 0.5f * (Zi[k] - Zi[h-k]);
+    gfloat odr = 0.5f * (Zi[k] + Zi[h-k]), oi = -0.5f * (Zr[k] - Zr[h-k]);
+    gfloat wr = plan->split_re[k], wi = plan->split_im[k];
+
+    out_re[k] = er + odr*wr - oi*wi;
+    out_im[k] = ei + odr*wi + oi*wr;
+  }
+
+  if (work == NULL) g_free (w);
+}
+
+void
+sw_fft_real_inverse (sw_fft_plan * plan,
+		     const gfloat * in_re, const gfloat * in_im,
+		     gfloat * out, gfloat * work)
+{
+  gint h, k;
+  gfloat * w = work, * zr, * zi, * Zr, * Zi;
+
+  g_return_if_fail (plan != NULL && plan->type == SW_FFT_REAL);
+
+  if (w == NULL) w = g_malloc (sw_fft_work_size (plan) * sizeof (gfloat));
+
+  h = plan->n / 2;
+  zr = w; zi = w + h; Zr = w + 2*h; Zi = w + 3*h;
+
+  /* Recombine without the halving, which makes the result n * x */
+  for (k = 0; k < h; k++) {
+    gfloat er = in_re[k] + in_re[h-k], ei = in_im[k] - in_im[h-k];
+    gfloat dr = in_re[k] - in_re[h-k], di = in_im[k] + in_im[h-k];
+    gfloat wr = plan->split_re[k], wi = plan->split_im[k];
+    gfloat odr = dr*wr + di*wi, oi = di*wr - dr*wi;
+
+    zr[k] = er - oi;
+    zi[k] = ei + odr;
+  }
+
+  fft_complex_run (plan->half, SW_FFT_INVERSE, zr, zi, Zr, Zi, w + 4*h);
+
+  for (k = 0; k < h; k++) {
+    out[2*k] = Zr[k];
+    out[2*k+1] = Zi[k];
+  }
+
+  if (work == NULL) g_free (w);
+}
@@ -68,7 +68,7 @@ do_filter_regions (sw_sample * sample, SweepFilterRegion func,
       if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
 	active = FALSE;
       } else {
-	d = sounddata->data + (int)frames_to_bytes (f, sel->sel_start + offset);
+	d = sounddata->data + frames_to_bytes (f, sel->sel_start + offset);
 
 	n = MIN(remaining, 1024);
 
@@ -82,13 +82,16 @@ do_filter_regions (sw_sample * sample, SweepFilterRegion func,
 	sample_set_progress_percent (sample, percent);
 
 #ifdef DEBUG
-	g_print ("completed %d / %d frames, %d%%\n", run_total, sel_total,
+	g_print ("completed %" G_GINT64_FORMAT " / %" G_GINT64_FORMAT
+		 " frames, %d%%\n", (gint64)run_total, (gint64)sel_total,
 		 percent);
 #endif
       }
 
       g_mutex_unlock (&sample->ops_mutex);
     }
+
+    sample_data_changed (sample, sel->sel_start, sel->sel_start + offset);
   }
 }
 
@@ -145,6 +148,7 @@ perform_filter_region_op (sw_sample * sample, char * desc,
   pd->func = (SweepFunction)func;
   pd->pset = pset;
   pd->custom_data = custom_data;
+  pd->destroy = NULL;
 
   schedule_operation (sample, desc, &filter_regions_op, pd);
 
@@ -164,6 +168,8 @@ do_filter_thread (sw_op_instance * inst)
   sw_edit_buffer * old_eb;
   paste_over_data * p;
   sw_sample * out;
+  GList * gl;
+  sw_sel * sel;
 
   old_eb = edit_buffer_from_sample (sample);
 
@@ -173,6 +179,11 @@ do_filter_thread (sw_op_instance * inst)
 
   out = func (sample, pset, custom_data);
 
+  for (gl = sample->sounddata->sels; gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+    sample_data_changed (sample, sel->sel_start, sel->sel_end);
+  }
+
   /* XXX: this is all kinda assuming out == sample if out != NULL */
   if (out != NULL && sample->edit_state == SWEEP_EDIT_STATE_BUSY) {
     p->new_eb = edit_buffer_from_sample (sample);
@@ -181,10 +192,17 @@ do_filter_thread (sw_op_instance * inst)
   }
 }
 
+static void
+perform_data_free (sw_perform_data * pd)
+{
+  if (pd->destroy) pd->destroy (pd->custom_data);
+  g_free (pd);
+}
+
 static sw_operation filter_op = {
   SWEEP_EDIT_MODE_FILTER,
   (SweepCallback)do_filter_thread,
-  (SweepFunction)g_free,
+  (SweepFunction)perform_data_free,
   (SweepCallback)undo_by_paste_over,
   (SweepFunction)paste_over_data_destroy,
   (SweepCallback)redo_by_paste_over,
@@ -195,14 +213,232 @@ static sw_operation filter_op = {
 sw_op_instance *
 perform_filter_op (sw_sample * sample, char * desc, SweepFilter func,
 		   sw_param_set pset, gpointer custom_data)
+{
+  return perform_filter_op_full (sample, desc, func, pset, custom_data, NULL);
+}
+
+sw_op_instance *
+perform_filter_op_full (sw_sample * sample, char * desc, SweepFilter func,
+			sw_param_set pset, gpointer custom_data,
+			SweepFunction destroy)
 {
   sw_perform_data * pd = (sw_perform_data *)g_malloc (sizeof(*pd));
 
   pd->func = (SweepFunction)func;
   pd->pset = pset;
   pd->custom_data = custom_data;
+  pd->destroy = destroy;
 
   schedule_operation (sample, desc, &filter_op, pd);
 
   return NULL;
 }
+
+/*
+ * Processors (plugin API v2)
+ */
+
+typedef struct _sw_process_data sw_process_data;
+
+struct _sw_process_data {
+  sw_processor * processor;
+  sw_param_set pset;
+  gpointer custom_data;
+};
+
+/*
+ * Run one selected region of frames starting at data through processor.
+ * Input is read SW_PROCESS_BLOCK_FRAMES at a time into the planar
+ * buffers, followed by latency frames of silence; output is written back
+ * latency frames behind the input, so it only ever overwrites frames that
+ * have already been read.
+ */
+static gboolean
+do_process_region (sw_sample * sample, sw_processor * processor,
+		   gpointer state, sw_framecount_t latency,
+		   gfloat ** channels, gfloat * data,
+		   sw_framecount_t nr_frames, sw_framecount_t * run_total,
+		   sw_framecount_t op_total)
+{
+  sw_format * f = sample->sounddata->format;
+  gint nr_channels = f->channels;
+  sw_framecount_t in_pos, out_pos, end, n, i, skip, m;
+  gint c;
+  gboolean active = TRUE;
+
+  end = nr_frames + latency;
+
+  for (in_pos = 0; active && in_pos < end; in_pos += n) {
+    g_mutex_lock (&sample->ops_mutex);
+
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      active = FALSE;
+      n = 0;
+    } else {
+      n = MIN (end - in_pos, SW_PROCESS_BLOCK_FRAMES);
+
+      /* Deinterleave the input, padding with silence past the region */
+      m = CLAMP (nr_frames - in_pos, 0, n);
+      for (c = 0; c < nr_channels; c++) {
+	gfloat * s = data + in_pos * nr_channels + c;
+	gfloat * d = channels[c];
+
+	for (i = 0; i < m; i++) {
+	  d[i] = *s;
+	  s += nr_channels;
+	}
+	for (; i < n; i++) {
+	  d[i] = 0.0;
+	}
+      }
+
+      processor->process (state, channels, nr_channels, (gint)n);
+
+      /* Interleave the output, skipping the first latency frames */
+      out_pos = in_pos - latency;
+      skip = MAX (-out_pos, 0);
+      if (skip < n) {
+	m = MIN (n, nr_frames - out_pos);
+	for (c = 0; c < nr_channels; c++) {
+	  gfloat * s = channels[c];
+	  gfloat * d = data + (out_pos + skip) * nr_channels + c;
+
+	  for (i = skip; i < m; i++) {
+	    *d = s[i];
+	    d += nr_channels;
+	  }
+	}
+      }
+
+      *run_total += n;
+      sample_set_progress_percent (sample, *run_total / op_total);
+    }
+
+    g_mutex_unlock (&sample->ops_mutex);
+  }
+
+  return active;
+}
+
+static void
+do_process_regions (sw_sample * sample, sw_processor * processor,
+		    gpointer state)
+{
+  sw_sounddata * sounddata = sample->sounddata;
+  sw_format * f = sounddata->format;
+  GList * gl;
+  sw_sel * sel;
+  sw_framecount_t op_total, run_total, latency;
+  gfloat ** channels;
+  gpointer block;
+  gint c, nr_regions;
+  gboolean active = TRUE;
+
+  /* Planar buffers, each aligned to SW_PROCESS_ALIGN bytes */
+  block = g_malloc (f->channels * SW_PROCESS_BLOCK_FRAMES * sizeof (gfloat)
+		    + SW_PROCESS_ALIGN);
+  channels = g_malloc (f->channels * sizeof (gfloat *));
+  channels[0] = (gfloat *)(((gsize)block + SW_PROCESS_ALIGN - 1) &
+			   ~((gsize)SW_PROCESS_ALIGN - 1));
+  for (c = 1; c < f->channels; c++) {
+    channels[c] = channels[c-1] + SW_PROCESS_BLOCK_FRAMES;
+  }
+
+  latency = processor->latency ? processor->latency (state) : 0;
+  if (latency < 0) latency = 0;
+
+  nr_regions = g_list_length (sounddata->sels);
+
+  op_total = (sounddata_selection_nr_frames (sounddata) +
+	      nr_regions * latency) / 100;
+  if (op_total == 0) op_total = 1;
+  run_total = 0;
+
+  for (gl = sounddata->sels; active && gl; gl = gl->next) {
+    sel = (sw_sel *)gl->data;
+
+    if (gl != sounddata->sels && processor->flush)
+      processor->flush (state);
+
+    active = do_process_region (sample, processor, state, latency, channels,
+				(gfloat *)sounddata->data +
+				sel->sel_start * f->channels,
+				sel->sel_end - sel->sel_start,
+				&run_total, op_total);
+
+    sample_data_changed (sample, sel->sel_start, sel->sel_end);
+  }
+
+  g_free (channels);
+  g_free (block);
+}
+
+static void
+do_process_thread (sw_op_instance * inst)
+{
+  sw_sample * sample = inst->sample;
+  sw_process_data * pd = (sw_process_data *)inst->do_data;
+  sw_processor * processor = pd->processor;
+
+  sw_edit_buffer * old_eb;
+  paste_over_data * p;
+  gpointer state;
+
+  if (sample == NULL || sample->sounddata == NULL ||
+      sample->sounddata->sels == NULL) goto noop;
+
+  state = processor->init (sample->sounddata->format, pd->pset,
+			   pd->custom_data);
+  if (state == NULL) {
+    sample_set_tmp_message (sample, _("%s failed to start"),
+			    inst->description);
+    return;
+  }
+
+  old_eb = edit_buffer_from_sample (sample);
+
+  p = paste_over_data_new (old_eb, old_eb);
+  inst->redo_data = inst->undo_data = p;
+  set_active_op (sample, inst);
+
+  do_process_regions (sample, processor, state);
+
+  processor->cleanup (state);
+
+  if (sample->edit_state == SWEEP_EDIT_STATE_BUSY) {
+    p->new_eb = edit_buffer_from_sample (sample);
+
+    register_operation (sample, inst);
+  }
+
+  return;
+
+ noop:
+  sample_set_tmp_message (sample, _("No selection to process"));
+}
+
+static sw_operation process_op = {
+  SWEEP_EDIT_MODE_FILTER,
+  (SweepCallback)do_process_thread,
+  (SweepFunction)g_free,
+  (SweepCallback)undo_by_paste_over,
+  (SweepFunction)paste_over_data_destroy,
+  (SweepCallback)redo_by_paste_over,
+  (SweepFunction)paste_over_data_destroy
+};
+
+sw_op_instance *
+perform_process_op (sw_sample * sample, char * desc,
+		    sw_processor * processor, sw_param_set pset,
+		    gpointer custom_data)
+{
+  sw_process_data * pd = (sw_process_data *)g_malloc (sizeof(*pd));
+
+  pd->processor = processor;
+  pd->pset = pset;
+  pd->custom_data = custom_data;
+
+  schedule_operation (sample, desc, &process_op, pd);
+
+  return NULL;
+}
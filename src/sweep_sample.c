@@ -49,8 +49,10 @@
 #include "interface.h"
 #include "preferences.h"
 #include "record.h"
+#include "prefetch.h"
 #include "question_dialogs.h"
 #include "sw_chooser.h"
+#include "spectrogram.h"
 
 #include "../pixmaps/new.xpm"
 
@@ -67,7 +69,12 @@
 
 extern sw_view * last_tmp_view;
 
+/*
+ * The sample bank: a list in the order samples were added, for menus,
+ * and a hash set of the same samples for membership tests.
+ */
 static GList * sample_bank = NULL;
+static GHashTable * sample_bank_set = NULL;
 
 static int untitled_count = 0;
 
@@ -130,6 +137,8 @@ sample_new_empty(gchar * pathname,
   if (!s)
     return NULL;
 
+  s->refcount = 1;
+
   s->sounddata = sounddata_new_empty (nr_channels, sample_rate, sample_length);
 
   s->views = NULL;
@@ -140,6 +149,7 @@ sample_new_empty(gchar * pathname,
     filename_generate (s->pathname, sizeof (s->pathname));
 
   s->ops_thread = (pthread_t) -1;
+  s->ops_queued = FALSE;
 
   g_mutex_init (&s->ops_mutex);
   s->registered_ops = NULL;
@@ -634,6 +644,8 @@ sample_destroy (sw_sample * s)
 
   stop_playback (s);
 
+  spectrogram_free (s);
+
   sounddata_destroy (s->sounddata);
 
   /* XXX: Should do this: */
@@ -664,6 +676,20 @@ sample_destroy (sw_sample * s)
   g_free (s);
 }
 
+sw_sample *
+sample_ref (sw_sample * s)
+{
+  g_atomic_int_inc (&s->refcount);
+  return s;
+}
+
+void
+sample_unref (sw_sample * s)
+{
+  if (g_atomic_int_dec_and_test (&s->refcount))
+    sample_destroy (s);
+}
+
 sw_sounddata *
 sample_get_sounddata (sw_sample * s)
 {
@@ -728,15 +754,21 @@ sample_bank_find_byname (const gchar * name)
 gboolean
 sample_bank_contains (sw_sample *s)
 {
-  return (g_list_find (sample_bank, s) != 0);
+  if (sample_bank_set == NULL) return FALSE;
+
+  return (g_hash_table_lookup (sample_bank_set, s) != NULL);
 }
 
 void
 sample_bank_add (sw_sample * s)
 {
+  if (sample_bank_set == NULL)
+    sample_bank_set = g_hash_table_new (g_direct_hash, g_direct_equal);
+
   /* Check that sample is not already in sample_bank */
-  if (g_list_find (sample_bank, s)) return;
+  if (sample_bank_contains (s)) return;
 
+  g_hash_table_insert (sample_bank_set, s, s);
   sample_bank = g_list_append (sample_bank, s);
 
   undo_dialog_refresh_sample_list ();
@@ -746,17 +778,22 @@ sample_bank_add (sw_sample * s)
 /*
  * sample_bank_remove (s)
  *
- * Takes a sample out of the sample list.
+ * Takes a sample out of the sample list and drops the bank's reference
+ * to it. If a mixer still holds a reference, the sample is destroyed
+ * once the mixer lets go.
  */
 void
 sample_bank_remove (sw_sample * s)
 {
-  if (s) {
+  if (s && sample_bank_contains (s)) {
+    g_hash_table_remove (sample_bank_set, s);
     sample_bank = g_list_remove(sample_bank, s);
 
     undo_dialog_refresh_sample_list ();
     rec_dialog_refresh_sample_list ();
-    sample_destroy(s);
+
+    stop_playback (s);
+    sample_unref (s);
     s = NULL;
   }
 
@@ -825,6 +862,14 @@ sweep_quit (void)
 /* info dialog */
 
 
+void
+sample_data_changed (sw_sample * s, sw_framecount_t start,
+		     sw_framecount_t end)
+{
+  prefetch_invalidate (s);
+  spectrogram_invalidate (s, start, end);
+}
+
 void
 sample_refresh_views (sw_sample * s)
 {
@@ -833,6 +878,8 @@ sample_refresh_views (sw_sample * s)
 
   g_mutex_lock (&s->ops_mutex);
 
+  prefetch_invalidate (s);
+
   sample_info_update (s);
 
   for(gl = s->views; gl; gl = gl->next) {
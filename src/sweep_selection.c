@@ -266,6 +266,7 @@ perform_selection_op (sw_sample * sample, char * desc, SweepFilter func,
   pd->func = (SweepFunction)func;
   pd->pset = pset;
   pd->custom_data = custom_data;
+  pd->destroy = NULL;
 
   schedule_operation (sample, desc, &selection_op, pd);
 
@@ -29,6 +29,7 @@
 
 #include <sweep/sweep_types.h>
 #include <sweep/sweep_typeconvert.h>
+#include <sweep/sweep_sounddata.h>
 #include <sweep/sweep_selection.h>
 #include <sweep/sweep_undo.h>
 
@@ -39,7 +40,8 @@
 #include "driver.h"
 
 sw_sounddata *
-sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length)
+sounddata_new_empty(gint nr_channels, gint sample_rate,
+		    sw_framecount_t sample_length)
 {
   sw_sounddata *s;
   sw_framecount_t len;
@@ -52,12 +54,12 @@ sounddata_new_empty(gint nr_channels, gint sample_rate, gint sample_length)
 
   s->format = format_new (nr_channels, sample_rate);
 
-  s->nr_frames = (sw_framecount_t) sample_length;
+  s->nr_frames = sample_length;
 
   if (sample_length > 0) {
     len = frames_to_bytes (s->format, sample_length);
 
-    s->data = g_malloc0 ((size_t)len);
+    s->data = g_try_malloc0 ((size_t)len);
 
     if (!(s->data)) {
       fprintf(stderr, "Unable to allocate %" PRId64 " bytes for sample data.\n", len);
@@ -263,10 +265,10 @@ sounddata_set_selection_1 (sw_sounddata * sounddata, sw_framecount_t start, sw_f
   return sounddata_add_selection_1 (sounddata, start, end);
 }
 
-gint
+sw_framecount_t
 sounddata_selection_nr_frames (sw_sounddata * sounddata)
 {
-  gint nr_frames = 0;
+  sw_framecount_t nr_frames = 0;
   GList * gl;
   sw_sel * sel;
 
@@ -298,7 +300,8 @@ sounddata_selection_width (sw_sounddata * sounddata)
 }
 
 void
-sounddata_selection_translate (sw_sounddata * sounddata, gint delta)
+sounddata_selection_translate (sw_sounddata * sounddata,
+			       sw_framecount_t delta)
 {
   GList * gl;
   sw_sel * sel;
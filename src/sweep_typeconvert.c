@@ -32,19 +32,19 @@
  * Determine the number of samples occupied by a number of frames
  * in a given format.
  */
-glong
+gint64
 frames_to_samples (sw_format * format, sw_framecount_t nr_frames)
 {
-  return (nr_frames * (glong)format->channels);
+  return (nr_frames * (gint64)format->channels);
 }
 
 /*
  * Determine the size in bytes of a number of frames of a given format.
  */
-glong
+gint64
 frames_to_bytes (sw_format * format, sw_framecount_t nr_frames)
 {
-  return (nr_frames * (glong)format->channels * sizeof(float));
+  return (nr_frames * (gint64)format->channels * (gint64)sizeof(float));
 }
 
 /*
@@ -25,7 +25,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <glib.h>
 #include <pthread.h>
 
@@ -34,6 +36,7 @@
 #include <sweep/sweep_sample.h>
 #include <sweep/sweep_sounddata.h>
 #include <sweep/sweep_selection.h>
+#include <sweep/sweep_typeconvert.h>
 
 #include "sweep_app.h"
 #include "edit.h"
@@ -42,6 +45,8 @@
 #include "play.h"
 #include "file_dialogs.h"
 #include "question_dialogs.h"
+#include "scheduler.h"
+#include "preferences.h"
 
 #ifdef LIMITED_UNDO
 /* Nr. of undo operations remembered */
@@ -55,101 +60,274 @@
 
 /*#define DEBUG*/
 
+/*
+ * Operation telemetry.
+ *
+ * op_main() times each operation and the standard undo data constructors
+ * below account the frames and bytes they retain against the operation
+ * running in the current thread. Completed records can optionally be
+ * appended to a log file, named by the OpLogFile preference or the
+ * SWEEP_OP_LOG environment variable; a name ending in ".json" or ".jsonl"
+ * selects JSON lines, anything else CSV.
+ */
+
+#define OP_LOG_KEY "OpLogFile"
+
+static GPrivate op_stats_private; /* sw_op_stats * of this thread's op */
+
+static GMutex op_log_mutex;
+static FILE * op_log = NULL;
+static gboolean op_log_json = FALSE;
+
 static void
-op_main (sw_sample * sample)
+op_stats_account (sw_framecount_t nr_frames, gsize nr_bytes)
 {
-  GList * gl;
-  sw_op_instance * inst;
+  sw_op_stats * stats = (sw_op_stats *)g_private_get (&op_stats_private);
 
-#ifdef DEBUG
-  g_print ("%d: Hello from op_main %d!\n", getpid(), getpid());
-#endif
+  if (stats == NULL) return;
 
-  while (sample->edit_state != SWEEP_EDIT_STATE_CANCEL &&
-	 (gl = sample->pending_ops) != NULL) {
+  if (nr_frames > stats->nr_frames) stats->nr_frames = nr_frames;
+  stats->undo_bytes += nr_bytes;
+}
 
-    g_mutex_lock (&sample->edit_mutex);
-    while (sample->edit_state != SWEEP_EDIT_STATE_PENDING &&
-	   sample->edit_state != SWEEP_EDIT_STATE_CANCEL) {
-      g_cond_wait (&sample->pending_cond, &sample->edit_mutex);
-    }
+static void
+op_stats_account_eb (sw_edit_buffer * eb)
+{
+  sw_framecount_t nr_frames;
 
-    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
-#ifdef DEBUG
-      g_print ("Caught an early cancelmoose; pending is %p\n",
-	       sample->pending_ops);
-      fflush (stdout);
+  if (eb == NULL) return;
+
+  nr_frames = edit_buffer_length (eb);
+  op_stats_account (nr_frames, frames_to_bytes (eb->format, nr_frames));
+}
+
+static gint64
+op_thread_cpu_time (void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
 #endif
-    } else {
-      gboolean was_going = FALSE;
 
-      inst = (sw_op_instance *)gl->data;
+  return -1;
+}
 
-      g_assert (sample->edit_state == SWEEP_EDIT_STATE_PENDING);
+gdouble
+op_stats_frames_per_second (sw_op_stats * stats)
+{
+  if (stats->wall_usec <= 0) return 0.0;
 
-      sample->edit_state = SWEEP_EDIT_STATE_BUSY;
-      sample->pending_ops = g_list_remove_link (sample->pending_ops, gl);
+  return (gdouble)stats->nr_frames * G_USEC_PER_SEC / stats->wall_usec;
+}
 
-      g_mutex_unlock (&sample->edit_mutex);
+/*
+ * Called from the main thread before the first operation is scheduled.
+ */
+static void
+op_log_init (void)
+{
+  static gboolean initialised = FALSE;
+  char path[512];
+  const char * env;
 
-      if (inst->op->edit_mode == SWEEP_EDIT_MODE_ALLOC) {
-	g_mutex_lock (&sample->play_mutex);
-	if ((was_going = sample->play_head->going)) {
-	  head_set_stop_offset (sample->play_head, sample->user_offset);
-	  head_set_going (sample->play_head, FALSE);
-	}
-	g_mutex_unlock (&sample->play_mutex);
-      }
+  if (initialised) return;
+  initialised = TRUE;
 
-      /* XXX: this is fubar -- change to SweepFunction ?? or change all to
-       * have sample as first arg ... */
-      inst->op->_do_ ((sw_sample *)inst, (void *)inst);
+  g_mutex_init (&op_log_mutex);
 
-      g_mutex_lock (&sample->edit_mutex);
+  prefs_get_string (OP_LOG_KEY, path, sizeof (path) - 1, "");
 
-#ifdef DEBUG
-      if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
-	g_print ("Caught a late cancelmoose; pending is %p\n",
-		 sample->pending_ops);
-	fflush (stdout);
-      }  else {
-	g_print ("%d: post-op edit state is %d\n", getpid(),
-		 sample->edit_state);
-      }
-#endif
+  if (path[0] == '\0' && (env = getenv ("SWEEP_OP_LOG")) != NULL)
+    g_snprintf (path, sizeof (path), "%s", env);
 
-    }
+  if (path[0] == '\0') return;
 
-    sample->edit_state = SWEEP_EDIT_STATE_DONE;
+  if ((op_log = fopen (path, "a")) == NULL) {
+    perror (_("Error opening operation log"));
+    return;
+  }
 
-    g_mutex_unlock (&sample->edit_mutex);
+  op_log_json = (g_str_has_suffix (path, ".json") ||
+		 g_str_has_suffix (path, ".jsonl"));
+
+  if (!op_log_json && ftell (op_log) == 0) {
+    fprintf (op_log, "time,file,operation,mode,state,wall_ms,cpu_ms,"
+	     "frames,frames_per_sec,undo_bytes\n");
+    fflush (op_log);
   }
+}
 
+static void
+op_log_string (FILE * f, const char * str, gboolean json)
+{
+  const char * c;
+
+  fputc ('"', f);
+  for (c = str; *c; c++) {
+    if (*c == '"') {
+      fputs (json ? "\\\"" : "\"\"", f);
+    } else if (json && *c == '\\') {
+      fputs ("\\\\", f);
+    } else if (json && (unsigned char)*c < 0x20) {
+      fprintf (f, "\\u%04x", *c);
+    } else {
+      fputc (*c, f);
+    }
+  }
+  fputc ('"', f);
+}
+
+static void
+op_log_write (sw_sample * sample, sw_op_instance * inst, gboolean cancelled)
+{
+  static const char * mode_names[] = { "ready", "meta", "filter", "alloc" };
+  sw_op_stats * stats = &inst->stats;
+  const char * mode = mode_names[inst->op->edit_mode];
+  const char * state = cancelled ? "cancelled" : "done";
+  gdouble wall_ms, cpu_ms;
+  time_t now;
+
+  if (op_log == NULL) return;
+
+  now = time (NULL);
+  wall_ms = stats->wall_usec / 1000.0;
+  cpu_ms = stats->cpu_usec < 0 ? -1.0 : stats->cpu_usec / 1000.0;
+
+  g_mutex_lock (&op_log_mutex);
+
+  if (op_log_json) {
+    fprintf (op_log, "{\"time\": %ld, \"file\": ", (long)now);
+    op_log_string (op_log, sample->pathname, TRUE);
+    fprintf (op_log, ", \"operation\": ");
+    op_log_string (op_log, inst->description, TRUE);
+    fprintf (op_log, ", \"mode\": \"%s\", \"state\": \"%s\", "
+	     "\"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+	     "\"frames\": %" G_GINT64_FORMAT ", \"frames_per_sec\": %.1f, "
+	     "\"undo_bytes\": %lu}\n",
+	     mode, state, wall_ms, cpu_ms, (gint64)stats->nr_frames,
+	     op_stats_frames_per_second (stats),
+	     (unsigned long)stats->undo_bytes);
+  } else {
+    fprintf (op_log, "%ld,", (long)now);
+    op_log_string (op_log, sample->pathname, FALSE);
+    fputc (',', op_log);
+    op_log_string (op_log, inst->description, FALSE);
+    fprintf (op_log, ",%s,%s,%.3f,%.3f,%" G_GINT64_FORMAT ",%.1f,%lu\n",
+	     mode, state, wall_ms, cpu_ms, (gint64)stats->nr_frames,
+	     op_stats_frames_per_second (stats),
+	     (unsigned long)stats->undo_bytes);
+  }
+
+  fflush (op_log);
+
+  g_mutex_unlock (&op_log_mutex);
+}
+
+/*
+ * Run the next pending op of a sample. This is called from a scheduler
+ * worker thread; each dispatch runs a single op so that the pool can be
+ * shared fairly between samples, and the next op in this sample's FIFO is
+ * resubmitted by update_edit_progress() once this one is DONE.
+ */
+static void
+op_main (sw_sample * sample)
+{
+  GList * gl;
+  sw_op_instance * inst, * done_inst = NULL;
+  gboolean cancelled = FALSE;
 
   g_mutex_lock (&sample->edit_mutex);
 
+  sample->ops_queued = FALSE;
+  sample->ops_thread = pthread_self ();
+
 #ifdef DEBUG
-  if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
-    g_print ("%d: Let me save you from scrubby!.\n", getpid());
-    sample->edit_state = SWEEP_EDIT_STATE_DONE;
-  } else {
-    g_print ("%d: exit edit state is %d\n", getpid(), sample->edit_state);
+  g_print ("%d: Hello from op_main %p!\n", getpid(), (void *)sample);
+#endif
+
+  while (sample->edit_state != SWEEP_EDIT_STATE_PENDING &&
+	 sample->edit_state != SWEEP_EDIT_STATE_CANCEL) {
+    g_cond_wait (&sample->pending_cond, &sample->edit_mutex);
   }
 
-  g_print ("%d: yada yada that's all!\n", getpid());
+  if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+#ifdef DEBUG
+    g_print ("Caught an early cancelmoose; pending is %p\n",
+	     sample->pending_ops);
+    fflush (stdout);
+#endif
+  } else if ((gl = sample->pending_ops) != NULL) {
+    gboolean was_going = FALSE;
+    gint64 t0, cpu0;
+
+    inst = (sw_op_instance *)gl->data;
 
+    g_assert (sample->edit_state == SWEEP_EDIT_STATE_PENDING);
+
+    sample->edit_state = SWEEP_EDIT_STATE_BUSY;
+    sample->pending_ops = g_list_remove_link (sample->pending_ops, gl);
+
+    g_mutex_unlock (&sample->edit_mutex);
+
+    if (inst->op->edit_mode == SWEEP_EDIT_MODE_ALLOC) {
+      g_mutex_lock (&sample->play_mutex);
+      if ((was_going = sample->play_head->going)) {
+	head_set_stop_offset (sample->play_head, sample->user_offset);
+	head_set_going (sample->play_head, FALSE);
+      }
+      g_mutex_unlock (&sample->play_mutex);
+    }
+
+    memset (&inst->stats, 0, sizeof (sw_op_stats));
+    g_private_set (&op_stats_private, &inst->stats);
+
+    t0 = g_get_monotonic_time ();
+    cpu0 = op_thread_cpu_time ();
+
+    /* XXX: this is fubar -- change to SweepFunction ?? or change all to
+     * have sample as first arg ... */
+    inst->op->_do_ ((sw_sample *)inst, (void *)inst);
+
+    inst->stats.wall_usec = g_get_monotonic_time () - t0;
+    inst->stats.cpu_usec = (cpu0 < 0) ? -1 : op_thread_cpu_time () - cpu0;
+
+    g_private_set (&op_stats_private, NULL);
+
+    g_mutex_lock (&sample->edit_mutex);
+
+    done_inst = inst;
+    cancelled = (sample->edit_state == SWEEP_EDIT_STATE_CANCEL);
+
+#ifdef DEBUG
+    if (sample->edit_state == SWEEP_EDIT_STATE_CANCEL) {
+      g_print ("Caught a late cancelmoose; pending is %p\n",
+	       sample->pending_ops);
+      fflush (stdout);
+    }  else {
+      g_print ("%d: post-op edit state is %d\n", getpid(),
+	       sample->edit_state);
+    }
 #endif
 
+  }
+
+  sample->edit_state = SWEEP_EDIT_STATE_DONE;
+
   sample->ops_thread = (pthread_t) -1;
 
   g_mutex_unlock (&sample->edit_mutex);
 
+  if (done_inst != NULL)
+    op_log_write (sample, done_inst, cancelled);
 }
 
 static void
 prepare_op (sw_op_instance * inst)
 {
   sw_sample * sample = inst->sample;
+  gboolean submit = FALSE;
 
   gchar buf[128];
 
@@ -159,8 +337,16 @@ prepare_op (sw_op_instance * inst)
   sample_set_edit_mode (sample, inst->op->edit_mode);
   sample_set_progress_percent (sample, 0);
 
-  if (sample->ops_thread == (pthread_t) -1) {
-    pthread_create (&sample->ops_thread, NULL, (void *) (*op_main), sample);
+  g_mutex_lock (&sample->edit_mutex);
+  if (sample->ops_thread == (pthread_t) -1 && !sample->ops_queued) {
+    sample->ops_queued = TRUE;
+    submit = TRUE;
+  }
+  g_mutex_unlock (&sample->edit_mutex);
+
+  if (submit) {
+    scheduler_submit ((SweepFunction)op_main, sample,
+		      scheduler_priority_for_mode (inst->op->edit_mode));
   }
 }
 
@@ -170,6 +356,8 @@ update_edit_progress (gpointer data)
   sw_sample * sample = (sw_sample *)data;
   sw_op_instance * inst;
 
+  undo_dialog_refresh_queue_stats ();
+
   if (sample->edit_state == SWEEP_EDIT_STATE_BUSY) {
     sample_refresh_progress_percent (sample);
     if (sample->edit_mode == SWEEP_EDIT_MODE_META ||
@@ -240,7 +428,7 @@ sw_op_instance_new (sw_sample * sample, const char * desc, sw_operation * op)
 {
   sw_op_instance * inst;
 
-  inst = g_malloc (sizeof(sw_op_instance));
+  inst = g_malloc0 (sizeof(sw_op_instance));
   inst->sample = sample;
   inst->description = strdup (desc);
   inst->op = op;
@@ -273,6 +461,8 @@ schedule_operation_do (sw_op_instance * inst)
 {
   sw_sample * sample = inst->sample;
 
+  op_log_init ();
+
   g_mutex_lock (&sample->edit_mutex);
   sample->pending_ops = g_list_append (sample->pending_ops, inst);
   g_mutex_unlock (&sample->edit_mutex);
@@ -651,8 +841,10 @@ cancel_active_op (sw_sample * s)
    * It is possible that the ops thread has already exited, in which case
    * s->ops_thread will have been set to -1 on its departure, also within
    * s->edit_mutex, in which case the signalled CANCEL would never be cleared.
+   * An op still waiting in the scheduler for a worker will see the CANCEL
+   * as soon as it is dispatched.
    */
-  if (s->ops_thread != (pthread_t) -1) {
+  if (s->ops_thread != (pthread_t) -1 || s->ops_queued) {
     s->edit_state = SWEEP_EDIT_STATE_CANCEL;
   }
 
@@ -692,6 +884,10 @@ sounddata_replace_data_new (sw_sample * sample,
   old_sounddata->refcount++;
   new_sounddata->refcount++;
 
+  op_stats_account (old_sounddata->nr_frames,
+		    frames_to_bytes (old_sounddata->format,
+				     old_sounddata->nr_frames));
+
   return sr;
 }
 
@@ -731,6 +927,10 @@ paste_over_data_new (sw_edit_buffer * old_eb, sw_edit_buffer * new_eb)
   p->old_eb = old_eb;
   p->new_eb = new_eb;
 
+  op_stats_account_eb (old_eb);
+  if (new_eb != old_eb)
+    op_stats_account_eb (new_eb);
+
   return p;
 };
 
@@ -765,6 +965,8 @@ splice_data_new (sw_edit_buffer * eb, GList * sels)
   s->eb = eb;
   s->sels = sels_copy (sels);
 
+  op_stats_account_eb (eb);
+
   return s;
 }
 
@@ -38,6 +38,7 @@
 #include "edit.h"
 #include "interface.h"
 #include "callbacks.h"
+#include "scheduler.h"
 
 #include "../pixmaps/undo.xpm"
 #include "../pixmaps/redo.xpm"
@@ -49,6 +50,7 @@ static GtkWidget * undo_dialog = NULL;
 static GtkWidget * undo_clist = NULL;
 static GtkWidget * combo;
 static GtkWidget * undo_button, * redo_button, * revert_button;
+static GtkWidget * queue_label = NULL;
 static sw_sample * ud_sample = NULL;
 
 static void
@@ -101,6 +103,63 @@ undo_dialog_refresh_edit_mode (sw_sample * sample)
   }
 }
 
+#define UD_COL_ICON 0
+#define UD_COL_ACTION 1
+#define UD_COL_TIME 2
+#define UD_COL_CPU 3
+#define UD_COL_RATE 4
+#define UD_COL_UNDO 5
+#define UD_NR_COLS 6
+
+static void
+ud_format_usec (gchar * buf, gsize len, gint64 usec)
+{
+  if (usec < 0)
+    g_snprintf (buf, len, "-");
+  else if (usec < 1000000)
+    g_snprintf (buf, len, "%.1f ms", usec / 1000.0);
+  else
+    g_snprintf (buf, len, "%.2f s", usec / 1000000.0);
+}
+
+static void
+ud_format_bytes (gchar * buf, gsize len, gsize bytes)
+{
+  if (bytes < 1024)
+    g_snprintf (buf, len, "%lu B", (unsigned long)bytes);
+  else if (bytes < 1024 * 1024)
+    g_snprintf (buf, len, "%.1f KB", bytes / 1024.0);
+  else if (bytes < 1024 * 1024 * 1024)
+    g_snprintf (buf, len, "%.1f MB", bytes / (1024.0 * 1024.0));
+  else
+    g_snprintf (buf, len, "%.2f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+}
+
+static void
+ud_set_stats_text (GtkCList * clist, gint row, sw_op_stats * stats)
+{
+  gchar buf[64];
+  gdouble fps;
+
+  ud_format_usec (buf, sizeof (buf), stats->wall_usec);
+  gtk_clist_set_text (clist, row, UD_COL_TIME, buf);
+
+  ud_format_usec (buf, sizeof (buf), stats->cpu_usec);
+  gtk_clist_set_text (clist, row, UD_COL_CPU, buf);
+
+  fps = op_stats_frames_per_second (stats);
+  if (fps <= 0.0)
+    g_snprintf (buf, sizeof (buf), "-");
+  else if (fps < 1e6)
+    g_snprintf (buf, sizeof (buf), "%.0f", fps);
+  else
+    g_snprintf (buf, sizeof (buf), "%.1f M", fps / 1e6);
+  gtk_clist_set_text (clist, row, UD_COL_RATE, buf);
+
+  ud_format_bytes (buf, sizeof (buf), stats->undo_bytes);
+  gtk_clist_set_text (clist, row, UD_COL_UNDO, buf);
+}
+
 static void
 _undo_dialog_set_sample (sw_sample * sample, gboolean select_current)
 {
@@ -108,7 +167,7 @@ _undo_dialog_set_sample (sw_sample * sample, gboolean select_current)
   GList * gl;
   sw_op_instance * inst;
   gint i = 0;
-  gchar * list_item[] = { "" };
+  gchar * list_item[] = { "", "", "", "", "", "" };
   GdkColormap * colormap;
   GdkPixmap * pixmap_data;
   GdkBitmap * mask;
@@ -130,7 +189,8 @@ _undo_dialog_set_sample (sw_sample * sample, gboolean select_current)
     inst = (sw_op_instance *)gl->data;
 
     gtk_clist_append (clist, list_item);
-    gtk_clist_set_text (clist, i, 1, _(inst->description));
+    gtk_clist_set_text (clist, i, UD_COL_ACTION, _(inst->description));
+    ud_set_stats_text (clist, i, &inst->stats);
 
     if (gl == sample->current_undo) {
       done = TRUE;
@@ -145,7 +205,7 @@ _undo_dialog_set_sample (sw_sample * sample, gboolean select_current)
   }
 
   gtk_clist_append (clist, list_item);
-  gtk_clist_set_text (clist, i, 1, _("Original data"));
+  gtk_clist_set_text (clist, i, UD_COL_ACTION, _("Original data"));
   gtk_clist_set_pixmap (clist, i, 0, pixmap_data, mask);
 
   if (sample->current_undo == NULL) {
@@ -189,6 +249,35 @@ undo_dialog_refresh_history (sw_sample * sample)
   _undo_dialog_set_sample (sample, FALSE);
 }
 
+void
+undo_dialog_refresh_queue_stats (void)
+{
+  sw_sched_stats stats;
+  gint i, depth = 0;
+  gdouble avg_ms = 0.0;
+  gchar buf[256];
+
+  if (undo_dialog == NULL || !GTK_WIDGET_VISIBLE(undo_dialog))
+    return;
+
+  scheduler_get_stats (&stats);
+
+  for (i = 0; i < SCHED_PRIORITY_BACKGROUND; i++)
+    depth += stats.queue_depth[i];
+
+  if (stats.nr_dispatched > 0)
+    avg_ms = (gdouble)stats.total_wait_usec / stats.nr_dispatched / 1000.0;
+
+  g_snprintf (buf, sizeof (buf),
+	      _("Operations: %d of %d workers busy, %d queued\n"
+		"Wait: last %.1f ms, mean %.1f ms, max %.1f ms"),
+	      stats.nr_busy, stats.nr_workers, depth,
+	      stats.last_wait_usec / 1000.0, avg_ms,
+	      stats.max_wait_usec / 1000.0);
+
+  gtk_label_set_text (GTK_LABEL(queue_label), buf);
+}
+
 void
 undo_dialog_refresh_sample_list (void)
 {
@@ -312,7 +401,9 @@ undo_dialog_create (sw_sample * sample)
   /*  GtkWidget * ok_button;*/
   GtkWidget * button;
   GtkWidget * scrolled;
-  gchar * titles[] = { "", N_("Action") };
+  gchar * titles[] = { "", N_("Action"), N_("Time"), N_("CPU"),
+		       N_("Frames/s"), N_("Undo data") };
+  gint i;
   GClosure *gclosure;
   GtkAccelGroup * accel_group;
 
@@ -382,18 +473,29 @@ undo_dialog_create (sw_sample * sample)
 				    GTK_POLICY_AUTOMATIC, GTK_POLICY_ALWAYS);
     gtk_box_pack_start (GTK_BOX(GTK_DIALOG(undo_dialog)->vbox), scrolled,
 			FALSE, FALSE, 0);
-    gtk_widget_set_usize (scrolled, 360, 240);
+    gtk_widget_set_usize (scrolled, 560, 240);
     gtk_widget_show (scrolled);
 
-    undo_clist = gtk_clist_new_with_titles (2, titles);
-    gtk_clist_set_column_width (GTK_CLIST(undo_clist), 0, 20);
+    undo_clist = gtk_clist_new_with_titles (UD_NR_COLS, titles);
+    gtk_clist_set_column_width (GTK_CLIST(undo_clist), UD_COL_ICON, 20);
+    gtk_clist_set_column_width (GTK_CLIST(undo_clist), UD_COL_ACTION, 180);
     gtk_clist_set_selection_mode (GTK_CLIST(undo_clist), GTK_SELECTION_BROWSE);
     gtk_clist_column_titles_passive (GTK_CLIST(undo_clist));
     /* set title actively for i18n */
-    gtk_clist_set_column_title(GTK_CLIST(undo_clist), 1, _(titles[1]));
+    for (i = UD_COL_ACTION; i < UD_NR_COLS; i++)
+      gtk_clist_set_column_title(GTK_CLIST(undo_clist), i, _(titles[i]));
+    for (i = UD_COL_TIME; i < UD_NR_COLS; i++)
+      gtk_clist_set_column_justification (GTK_CLIST(undo_clist), i,
+					  GTK_JUSTIFY_RIGHT);
     gtk_container_add (GTK_CONTAINER(scrolled), undo_clist);
     gtk_widget_show (undo_clist);
 
+    queue_label = gtk_label_new ("");
+    gtk_misc_set_alignment (GTK_MISC(queue_label), 0.0, 0.5);
+    gtk_box_pack_start (GTK_BOX(GTK_DIALOG(undo_dialog)->vbox), queue_label,
+			FALSE, FALSE, 4);
+    gtk_widget_show (queue_label);
+
     button = gtk_button_new_with_label (_("Revert to selected state"));
     GTK_WIDGET_SET_FLAGS (GTK_WIDGET (button), GTK_CAN_DEFAULT);
     gtk_box_pack_start (GTK_BOX (GTK_DIALOG(undo_dialog)->action_area),
@@ -426,4 +528,6 @@ undo_dialog_create (sw_sample * sample)
   } else {
     gdk_window_raise (undo_dialog->window);
   }
+
+  undo_dialog_refresh_queue_stats ();
 }
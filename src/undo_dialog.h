@@ -35,6 +35,9 @@ undo_dialog_refresh_history (sw_sample * sample);
 void
 undo_dialog_refresh_sample_list (void);
 
+void
+undo_dialog_refresh_queue_stats (void);
+
 void
 undo_dialog_refresh_edit_mode (sw_sample * sample);
 
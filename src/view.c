@@ -60,6 +60,7 @@
 #include "cursors.h"
 #include "head.h"
 #include "view_pixmaps.h"
+#include "plugin.h"
 
 /*#define DEBUG*/
 
@@ -135,7 +136,6 @@ sw_proc_instance_new (sw_procedure * proc, sw_view * view)
 {
   sw_proc_instance * pi;
 
-  /* XXX: where to clean this up? */
   pi = g_malloc (sizeof (sw_proc_instance));
   pi->proc = proc;
   pi->view = view;
@@ -153,7 +153,7 @@ apply_procedure_cb (GtkWidget * widget, gpointer data)
 
   if (proc->nr_params == 0) {
     pset = NULL;
-    proc->apply (sample, pset, proc->custom_data);
+    procedure_apply (proc, sample, pset);
   } else {
     pset = sw_param_set_new (proc);
     if (proc->suggest)
@@ -165,7 +165,7 @@ apply_procedure_cb (GtkWidget * widget, gpointer data)
 
 static void
 create_proc_menuitem (sw_procedure * proc, sw_view * view,
-		      GtkWidget * submenu, GtkAccelGroup * accel_group)
+		      GtkWidget * submenu)
 {
   sw_proc_instance * pi;
   GtkWidget * menuitem;
@@ -174,8 +174,9 @@ create_proc_menuitem (sw_procedure * proc, sw_view * view,
 
   menuitem = gtk_menu_item_new_with_label(_(proc->name));
   gtk_menu_append(GTK_MENU(submenu), menuitem);
-  g_signal_connect (G_OBJECT(menuitem), "activate",
-		     G_CALLBACK(apply_procedure_cb), pi);
+  g_signal_connect_data (G_OBJECT(menuitem), "activate",
+			 G_CALLBACK(apply_procedure_cb), pi,
+			 (GClosureNotify)g_free, 0);
   gtk_widget_show(menuitem);
 /* these accels are not editable */
  /*   gtk_widget_add_accelerator (menuitem, "activate", accel_group,
@@ -183,76 +184,127 @@ create_proc_menuitem (sw_procedure * proc, sw_view * view,
 				GTK_ACCEL_VISIBLE); */
 }
 
-static GtkWidget *
-create_proc_menu (sw_view * view, GtkAccelGroup * accel_group)
+/*
+ * Process menus
+ *
+ * The list of plugins is fixed once they are loaded, so how it is split
+ * into submenus is worked out once and shared by every view. Each
+ * view's menus start out empty and are filled in when first opened, so
+ * that opening a view costs the same however many plugins there are.
+ */
+
+#define PROCS_PER_GROUP 10
+
+typedef struct {
+  gchar * label; /* "first ... last", or NULL if plugins are not grouped */
+  GList * first; /* first procedure of this group in plugins */
+  gint nr_procs;
+} sw_proc_group;
+
+static sw_proc_group * proc_groups = NULL;
+static gint nr_proc_groups = 0;
+
+static void
+proc_groups_init (void)
 {
-  GtkWidget * menu, * submenu, * menuitem = NULL, * label, * hbox;
   GList * gl;
-  sw_procedure * proc;
-  gboolean use_submenus = FALSE;
-  gint i = 0;
+  sw_proc_group * group;
+  gint i, nr_procs;
   gchar first_name[32], last_name[32];
-  gchar title [256];
 
-  menu = gtk_menu_new ();
+  if (proc_groups != NULL) return;
+
+  nr_procs = g_list_length (plugins);
 
-  if (g_list_length (plugins) > 10) {
-    use_submenus = TRUE;
+  if (nr_procs <= PROCS_PER_GROUP) {
+    nr_proc_groups = 1;
+    proc_groups = g_malloc0 (sizeof (sw_proc_group));
+    proc_groups[0].label = NULL;
+    proc_groups[0].first = plugins;
+    proc_groups[0].nr_procs = nr_procs;
+    return;
   }
 
-  submenu = menu;
+  nr_proc_groups = (nr_procs + PROCS_PER_GROUP - 1) / PROCS_PER_GROUP;
+  proc_groups = g_malloc0 (nr_proc_groups * sizeof (sw_proc_group));
 
-  if (plugins)
-    /*strncpy (first_name, ((sw_procedure *)plugins->data)->name, 4);*/
-    sscanf (_(((sw_procedure *)plugins->data)->name), "%s", first_name);
+  for (gl = plugins, i = 0; gl; gl = gl->next, i++) {
+    group = &proc_groups[i / PROCS_PER_GROUP];
 
-  /* Filter plugins */
-  for (gl = plugins; gl; gl = gl->next) {
-    proc = (sw_procedure *)gl->data;
+    if (group->nr_procs == 0) {
+      group->first = gl;
+      first_name[0] = '\0';
+      sscanf (_(((sw_procedure *)gl->data)->name), "%31s", first_name);
+    }
 
-    if (use_submenus && ((i % 10) == 0)) {
-      if (menuitem) {
-	hbox = gtk_hbox_new (FALSE, 0);
-	gtk_container_add (GTK_CONTAINER(menuitem), hbox);
-	gtk_widget_show (hbox);
+    group->nr_procs++;
 
-	snprintf (title, sizeof (title), "%s  ...  %s", first_name, last_name);
-	label = gtk_label_new (title);
-	gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 0);
-	/*menuitem = gtk_menu_item_new_with_label (title);*/
-	gtk_widget_show (label);
+    if (group->nr_procs == PROCS_PER_GROUP || gl->next == NULL) {
+      last_name[0] = '\0';
+      sscanf (_(((sw_procedure *)gl->data)->name), "%31s", last_name);
+      group->label = g_strdup_printf ("%s  ...  %s", first_name, last_name);
+    }
+  }
+}
 
-	/*strncpy (first_name, proc->name, 4);*/
-	sscanf (_(proc->name), "%s", first_name);
-      }
+static void proc_menu_attach (GtkWidget * menuitem, sw_view * view,
+			      sw_proc_group * group);
 
-      menuitem = gtk_menu_item_new ();
-      gtk_menu_append (GTK_MENU(menu), menuitem);
-      gtk_widget_show (menuitem);
-      submenu = gtk_menu_new ();
-      gtk_menu_item_set_submenu (GTK_MENU_ITEM(menuitem), submenu);
-    }
+/*
+ * Fill in the submenu of menuitem the first time it is about to be
+ * opened: with the procedures of group, or if group is NULL, with the
+ * top level of the Process menu.
+ */
+static void
+proc_menu_populate_cb (GtkWidget * menuitem, gpointer data)
+{
+  sw_proc_group * group = (sw_proc_group *)data;
+  GtkWidget * menu, * item;
+  sw_view * view;
+  GList * gl;
+  gint i;
 
-    create_proc_menuitem (proc, view, submenu, accel_group);
-    /*strncpy (last_name, proc->name, 4);*/
-    sscanf (_(proc->name), "%s", last_name);
-    i++;
-  }
+  menu = gtk_menu_item_get_submenu (GTK_MENU_ITEM(menuitem));
+  if (menu == NULL || g_object_get_data (G_OBJECT(menu), "populated"))
+    return;
+
+  g_object_set_data (G_OBJECT(menu), "populated", GINT_TO_POINTER(1));
 
-  if (menuitem) {
-    char temp [256];
+  view = (sw_view *)g_object_get_data (G_OBJECT(menuitem), "view");
 
-    hbox = gtk_hbox_new (FALSE, 0);
-    gtk_container_add (GTK_CONTAINER(menuitem), hbox);
-    gtk_widget_show (hbox);
+  if (group == NULL) {
+    proc_groups_init ();
 
-    snprintf (temp, sizeof (temp), "%s ... %s", first_name, last_name);
-    label = gtk_label_new (temp);
-    gtk_box_pack_start (GTK_BOX(hbox), label, FALSE, FALSE, 0);
-    gtk_widget_show (label);
+    if (proc_groups[0].label == NULL) {
+      group = &proc_groups[0];
+    } else {
+      for (i = 0; i < nr_proc_groups; i++) {
+	item = gtk_menu_item_new_with_label (proc_groups[i].label);
+	gtk_menu_append (GTK_MENU(menu), item);
+	proc_menu_attach (item, view, &proc_groups[i]);
+	gtk_widget_show (item);
+      }
+      return;
+    }
   }
 
-  return menu;
+  for (gl = group->first, i = 0; gl && i < group->nr_procs;
+       gl = gl->next, i++) {
+    create_proc_menuitem ((sw_procedure *)gl->data, view, menu);
+  }
+}
+
+static void
+proc_menu_attach (GtkWidget * menuitem, sw_view * view, sw_proc_group * group)
+{
+  gtk_menu_item_set_submenu (GTK_MENU_ITEM(menuitem), gtk_menu_new ());
+
+  g_object_set_data (G_OBJECT(menuitem), "view", view);
+
+  g_signal_connect (G_OBJECT(menuitem), "select",
+		    G_CALLBACK(proc_menu_populate_cb), group);
+  g_signal_connect (G_OBJECT(menuitem), "activate",
+		    G_CALLBACK(proc_menu_populate_cb), group);
 }
 
 static void view_store_cb (GtkWidget * widget, gpointer data);
@@ -660,6 +712,16 @@ create_view_menu (sw_view * view, GtkWidget * m)
 				  view->following);
   view->follow_checkmenu = menuitem;
 
+  menuitem = gtk_check_menu_item_new_with_label(_("Spectrogram"));
+  gtk_menu_item_set_accel_path(GTK_MENU_ITEM(menuitem), "<Sweep-View>/View/Spectrogram");
+  gtk_menu_append(GTK_MENU(submenu), menuitem);
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM(menuitem),
+				  view->spectrogram);
+  g_signal_connect (G_OBJECT(menuitem), "activate",
+                    G_CALLBACK(spectrogram_toggle_cb), view);
+  gtk_widget_show(menuitem);
+  view->spectrogram_checkmenu = menuitem;
+
   menuitem = gtk_menu_item_new(); /* Separator */
   gtk_menu_append(GTK_MENU(submenu), menuitem);
   gtk_widget_show(menuitem);
@@ -881,8 +943,7 @@ create_view_menu (sw_view * view, GtkWidget * m)
   menuitem = gtk_menu_item_new_with_label(_("Process"));
   MENU_APPEND(m, menuitem);
   gtk_widget_show(menuitem);
-  submenu = create_proc_menu (view, accel_group);
-  gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem), submenu);
+  proc_menu_attach (menuitem, view, NULL);
 
   NOMODIFY(menuitem);
 
@@ -1165,8 +1226,7 @@ create_context_menu_sel (sw_view * view)
   menuitem = gtk_menu_item_new_with_label(_("Process"));
   gtk_menu_append (GTK_MENU(menu), menuitem);
   gtk_widget_show(menuitem);
-  submenu = create_proc_menu (view, NULL);
-  gtk_menu_item_set_submenu(GTK_MENU_ITEM(menuitem), submenu);
+  proc_menu_attach (menuitem, view, NULL);
 
   NOMODIFY(menuitem);
 
@@ -1558,6 +1618,7 @@ view_new(sw_sample * sample, sw_framecount_t start, sw_framecount_t end,
   view->repeater_tag = 0;
 
   view->following = TRUE;
+  view->spectrogram = FALSE;
 
   view->noready_widgets = NULL;
   view->nomodify_widgets = NULL;
@@ -3188,6 +3249,19 @@ view_set_following (sw_view * view, gboolean following)
   }
 }
 
+void
+view_set_spectrogram (sw_view * view, gboolean spectrogram)
+{
+  view->spectrogram = spectrogram;
+
+  g_signal_handlers_block_matched (GTK_OBJECT(view->spectrogram_checkmenu), G_SIGNAL_MATCH_DATA, 0, 0, 0, 0, view);
+  gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM(view->spectrogram_checkmenu),
+				  view->spectrogram);
+  g_signal_handlers_unblock_matched (GTK_OBJECT(view->spectrogram_checkmenu), G_SIGNAL_MATCH_DATA, 0, 0, 0, 0, view);
+
+  sample_display_refresh (SAMPLE_DISPLAY(view->display));
+}
+
 static void
 view_close_ok_cb (GtkWidget * widget, gpointer data)
 {
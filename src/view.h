@@ -89,6 +89,9 @@ view_refresh_playmode (sw_view * view);
 void
 view_set_following (sw_view * view, gboolean following);
 
+void
+view_set_spectrogram (sw_view * view, gboolean spectrogram);
+
 void
 view_close(sw_view * view);
 